@@ -1,7 +1,7 @@
 #ifndef _COMPIZ_ANIMATIONADDON_H
 #define _COMPIZ_ANIMATIONADDON_H
 
-#define ANIMATIONADDON_ABIVERSION 20081023
+#define ANIMATIONADDON_ABIVERSION 20261017
 
 
 // Polygon tesselation type: Rectangular, Hexagonal
@@ -104,6 +104,8 @@ typedef struct _PolygonSet	// Polygon objects with same thickness
     void (*extraPolygonTransformFunc) (PolygonObject *);
 } PolygonSet;
 
+// A single particle, as read and written by getParticle and setParticle.
+// Particle systems do not store particles this way, see ParticleSystem.
 typedef struct _Particle
 {
     float life;			// particle life
@@ -130,10 +132,49 @@ typedef struct _Particle
     float zo;			// orginal Z position
 } Particle;
 
+// Particle systems keep their particles as a structure of arrays, one
+// array per Particle member, so that updating them runs over contiguous
+// floats. The arrays are allocated by initParticles as one block that
+// starts at part.life, with room for numParticles rounded up to a multiple of
+// PARTICLE_BLOCK. Live particles are kept at the start of the arrays,
+// the numAlive first ones are alive and all others dead: a new particle
+// goes at numAlive, and updateParticles shifts the live particles down
+// over the ones that died, keeping the order they are drawn in.
+#define PARTICLE_BLOCK 8
+#define PARTICLE_BLOCK_COUNT(n) \
+    (((n) + PARTICLE_BLOCK - 1) & ~(PARTICLE_BLOCK - 1))
+
+typedef struct _ParticleArrays
+{
+    float *life;		// particle life
+    float *fade;		// fade speed
+    float *width;		// particle width
+    float *height;		// particle height
+    float *w_mod;		// particle size modification during life
+    float *h_mod;		// particle size modification during life
+    float *r;			// red value
+    float *g;			// green value
+    float *b;			// blue value
+    float *a;			// alpha value
+    float *x;			// X position
+    float *y;			// Y position
+    float *z;			// Z position
+    float *xi;			// X direction
+    float *yi;			// Y direction
+    float *zi;			// Z direction
+    float *xg;			// X gravity
+    float *yg;			// Y gravity
+    float *zg;			// Z gravity
+    float *xo;			// orginal X position
+    float *yo;			// orginal Y position
+    float *zo;			// orginal Z position
+} ParticleArrays;
+
 typedef struct _ParticleSystem
 {
     int numParticles;
-    Particle *particles;
+    int numAlive;
+    ParticleArrays part;
     float slowdown;
     GLuint tex;
     Bool active;
@@ -185,6 +226,12 @@ typedef struct _AnimAddonFunctions {
     void (*particlesCleanup) (CompWindow * w);
     Bool (*particlesPrePrepPaintScreen) (CompWindow * w,
 					 int msSinceLastPaint);
+    void (*getParticle) (ParticleSystem * ps,
+			 int i,
+			 Particle * part);
+    void (*setParticle) (ParticleSystem * ps,
+			 int i,
+			 const Particle * part);
 
     // Polygon engine functions
     Bool (*polygonsAnimInit) (CompWindow * w);
@@ -0,0 +1,37 @@
+#ifndef _COMPIZ_BENCH_H
+#define _COMPIZ_BENCH_H
+
+#define BENCH_ABIVERSION 20261017
+
+/* Plugins report the textures they keep around to bench, which keeps
+ * a total per screen and per plugin. A texture is known by a key of
+ * the caller's choosing, usually the address of its CompTexture or
+ * texture name, and reporting the same key again replaces its size.
+ *
+ * Bench is optional, look it up with checkPluginABI and
+ * getPluginDisplayIndex when reporting, not only when starting, as it
+ * may be loaded after the plugin.
+ *
+ * Textures allocated while bench is not loaded are not known to it.
+ * When bench starts on a screen it sends the compiz event "bench"
+ * "start" with the screen's "root" window, and plugins answer by
+ * reporting every texture they hold on that screen. */
+
+#define BENCH_TEXTURE_BYTES(width, height) \
+    ((unsigned long) (width) * (height) * 4)
+
+typedef void (*BenchAddTextureProc) (CompScreen    *s,
+				     const void    *key,
+				     const char    *owner,
+				     const char    *label,
+				     unsigned long bytes);
+
+typedef void (*BenchRemoveTextureProc) (CompScreen *s,
+					const void *key);
+
+typedef struct _BenchFunc {
+    BenchAddTextureProc    addTexture;
+    BenchRemoveTextureProc removeTexture;
+} BenchFunc;
+
+#endif
@@ -179,6 +179,18 @@ getIntenseTimeStep (CompScreen *s)
     return as->opt[ANIMADDON_SCREEN_OPTION_TIME_STEP_INTENSE].value.i;
 }
 
+BenchFunc *
+getBenchFunc (CompDisplay *d)
+{
+    int index;
+
+    if (!checkPluginABI ("bench", BENCH_ABIVERSION) ||
+	!getPluginDisplayIndex (d, "bench", &index))
+	return NULL;
+
+    return d->base.privates[index].ptr;
+}
+
 AnimAddonFunctions animAddonFunctions =
 {
     .getAnimWindowEngineData		= getAnimWindowEngineData,
@@ -190,6 +202,8 @@ AnimAddonFunctions animAddonFunctions =
     .particlesUpdateBB			= particlesUpdateBB,
     .particlesCleanup			= particlesCleanup,
     .particlesPrePrepPaintScreen	= particlesPrePrepPaintScreen,
+    .getParticle			= getParticle,
+    .setParticle			= setParticle,
 
     .polygonsAnimInit			= polygonsAnimInit,
     .polygonsAnimStep			= polygonsAnimStep,
@@ -450,6 +464,47 @@ initEffectProperties (AnimAddonDisplay *ad)
 	    NUM_EFFECTS * sizeof (AnimEffect));
 }
 
+/* Particle textures of animations that started before bench did are
+ * reported when it asks */
+static void
+animAddonHandleCompizEvent (CompDisplay *d,
+			    const char  *pluginName,
+			    const char  *eventName,
+			    CompOption  *option,
+			    int         nOption)
+{
+    CompScreen *s;
+    CompWindow *w;
+
+    ANIMADDON_DISPLAY (d);
+
+    UNWRAP (ad, d, handleCompizEvent);
+    (*d->handleCompizEvent) (d, pluginName, eventName, option, nOption);
+    WRAP (ad, d, handleCompizEvent, animAddonHandleCompizEvent);
+
+    if (strcmp (pluginName, "bench") != 0 ||
+	strcmp (eventName, "start") != 0)
+	return;
+
+    s = findScreenAtDisplay (d, getIntOptionNamed (option, nOption,
+						   "root", 0));
+    if (!s)
+	return;
+
+    for (w = s->windows; w; w = w->next)
+    {
+	ANIMADDON_WINDOW (w);
+
+	if (!aw || aw->com->animRemainingTime <= 0)
+	    continue;
+
+	if (aw->com->curAnimEffect == AnimEffectBurn)
+	    fxBurnReportTextures (w);
+	else if (aw->com->curAnimEffect == AnimEffectBeamUp)
+	    fxBeamUpReportTextures (w);
+    }
+}
+
 static Bool animInitDisplay(CompPlugin * p, CompDisplay * d)
 {
     AnimAddonDisplay *ad;
@@ -493,6 +548,8 @@ static Bool animInitDisplay(CompPlugin * p, CompDisplay * d)
     d->base.privates[animDisplayPrivateIndex].ptr = ad;
     d->base.privates[animAddonFunctionsPrivateIndex].ptr = &animAddonFunctions;
 
+    WRAP (ad, d, handleCompizEvent, animAddonHandleCompizEvent);
+
     return TRUE;
 }
 
@@ -500,6 +557,8 @@ static void animFiniDisplay(CompPlugin * p, CompDisplay * d)
 {
     ANIMADDON_DISPLAY (d);
 
+    UNWRAP (ad, d, handleCompizEvent);
+
     freeScreenPrivateIndex(d, ad->screenPrivateIndex);
 
     compFiniDisplayOptions (d, ad->opt, ANIMADDON_DISPLAY_OPTION_NUM);
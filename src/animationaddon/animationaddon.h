@@ -6,6 +6,7 @@
 #include <compiz-core.h>
 #include <compiz-animation.h>
 #include "compiz-animationaddon.h"
+#include <compiz-bench.h>
 
 extern int animDisplayPrivateIndex;
 extern CompMetadata animMetadata;
@@ -127,6 +128,8 @@ typedef struct _AnimAddonDisplay
     int screenPrivateIndex;
     AnimBaseFunctions *animBaseFunctions;
 
+    HandleCompizEventProc handleCompizEvent;
+
     CompOption opt[ANIMADDON_DISPLAY_OPTION_NUM];
 } AnimAddonDisplay;
 
@@ -194,6 +197,9 @@ OPTION_GETTERS_HDR
 int
 getIntenseTimeStep (CompScreen *s);
 
+BenchFunc *
+getBenchFunc (CompDisplay *d);
+
 
 /* airplane3d.c */
 
@@ -229,6 +235,9 @@ fxBeamUpAnimStep (CompWindow *w,
 Bool
 fxBeamUpInit (CompWindow *w);
 
+void
+fxBeamUpReportTextures (CompWindow *w);
+
 
 /* burn.c */
 
@@ -239,6 +248,9 @@ fxBurnAnimStep (CompWindow *w,
 Bool
 fxBurnInit (CompWindow *w);
 
+void
+fxBurnReportTextures (CompWindow *w);
+
 /* domino.c */
 
 Bool
@@ -301,6 +313,16 @@ Bool
 particlesPrePrepPaintScreen (CompWindow * w,
 			     int msSinceLastPaint);
 
+void
+getParticle (ParticleSystem * ps,
+	     int i,
+	     Particle * part);
+
+void
+setParticle (ParticleSystem * ps,
+	     int i,
+	     const Particle * part);
+
 /* polygon.c */
 
 Bool
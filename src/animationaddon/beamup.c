@@ -39,6 +39,18 @@
 
 // =====================  Effect: Beam Up  =========================
 
+void
+fxBeamUpReportTextures (CompWindow *w)
+{
+    BenchFunc *bench = getBenchFunc (w->screen->display);
+
+    ANIMADDON_WINDOW (w);
+
+    if (bench && aw->eng.numPs && aw->eng.ps[0].tex)
+	(*bench->addTexture) (w->screen, &aw->eng.ps[0].tex, "animationaddon",
+			      "beam", BENCH_TEXTURE_BYTES (32, 32));
+}
+
 Bool
 fxBeamUpInit (CompWindow * w)
 {
@@ -77,6 +89,8 @@ fxBeamUpInit (CompWindow * w)
 		 GL_RGBA, GL_UNSIGNED_BYTE, fireTex);
     glBindTexture(GL_TEXTURE_2D, 0);
 
+    fxBeamUpReportTextures (w);
+
     return TRUE;
 }
 
@@ -116,55 +130,49 @@ fxBeamUpGenNewBeam(CompWindow * w,
     if (max_new > ps->numParticles)
 	max_new = ps->numParticles;
 
-    Particle *part = ps->particles;
+    ParticleArrays *part = &ps->part;
     int i;
-    for (i = 0; i < ps->numParticles && max_new > 0; i++, part++)
+    for (i = ps->numAlive; i < ps->numParticles && max_new > 0; i++)
     {
-	if (part->life <= 0.0f)
-	{
-	    // give gt new life
-	    rVal = (float)(random() & 0xff) / 255.0;
-	    part->life = 1.0f;
-	    part->fade = rVal * beaumUpLifeNeg + fadeExtra; // Random Fade Value
-
-	    // set size
-	    part->width = partw;
-	    part->height = height;
-	    part->w_mod = size * 0.2;
-	    part->h_mod = size * 0.02;
-
-	    // choose random x position
-	    rVal = (float)(random() & 0xff) / 255.0;
-	    part->x = x + ((width > 1) ? (rVal * width) : 0);
-	    part->y = y;
-	    part->z = 0.0;
-	    part->xo = part->x;
-	    part->yo = part->y;
-	    part->zo = part->z;
-
-	    // set speed and direction
-	    part->xi = 0.0f;
-	    part->yi = 0.0f;
-	    part->zi = 0.0f;
-
-	    part->r = colr1 - rVal * colr2;
-	    part->g = colg1 - rVal * colg2;
-	    part->b = colb1 - rVal * colb2;
-	    part->a = cola;
-
-	    // set gravity
-	    part->xg = 0.0f;
-	    part->yg = 0.0f;
-	    part->zg = 0.0f;
-
-	    ps->active = TRUE;
-	    max_new -= 1;
-	}
-	else
-	{
-	    part->xg = (part->x < part->xo) ? 1.0 : -1.0;
-	}
+	// give gt new life
+	rVal = (float)(random() & 0xff) / 255.0;
+	part->life[i] = 1.0f;
+	part->fade[i] = rVal * beaumUpLifeNeg + fadeExtra; // Random Fade Value
+
+	// set size
+	part->width[i] = partw;
+	part->height[i] = height;
+	part->w_mod[i] = size * 0.2;
+	part->h_mod[i] = size * 0.02;
+
+	// choose random x position
+	rVal = (float)(random() & 0xff) / 255.0;
+	part->x[i] = x + ((width > 1) ? (rVal * width) : 0);
+	part->y[i] = y;
+	part->z[i] = 0.0;
+	part->xo[i] = part->x[i];
+	part->yo[i] = part->y[i];
+	part->zo[i] = part->z[i];
+
+	// set speed and direction
+	part->xi[i] = 0.0f;
+	part->yi[i] = 0.0f;
+	part->zi[i] = 0.0f;
+
+	part->r[i] = colr1 - rVal * colr2;
+	part->g[i] = colg1 - rVal * colg2;
+	part->b[i] = colb1 - rVal * colb2;
+	part->a[i] = cola;
+
+	// set gravity
+	part->xg[i] = 0.0f;
+	part->yg[i] = 0.0f;
+	part->zg[i] = 0.0f;
+
+	ps->active = TRUE;
+	max_new -= 1;
     }
+    ps->numAlive = i;
 
 }
 
@@ -232,6 +240,10 @@ fxBeamUpAnimStep (CompWindow *w, float time)
     {
 	if (aw->eng.ps)
 	{
+	    BenchFunc *bench = getBenchFunc (w->screen->display);
+
+	    if (bench)
+		(*bench->removeTexture) (w->screen, &aw->eng.ps[0].tex);
 	    finiParticles(aw->eng.ps);
 	    free(aw->eng.ps);
 	    aw->eng.ps = NULL;
@@ -243,11 +255,11 @@ fxBeamUpAnimStep (CompWindow *w, float time)
 
     if (aw->com->animRemainingTime > 0)
     {
-	int nParticles = aw->eng.ps[0].numParticles;
-	Particle *part = aw->eng.ps[0].particles;
+	int nParticles = aw->eng.ps[0].numAlive;
+	ParticleArrays *part = &aw->eng.ps[0].part;
 	int i;
-	for (i = 0; i < nParticles; i++, part++)
-	    part->xg = (part->x < part->xo) ? 1.0 : -1.0;
+	for (i = 0; i < nParticles; i++)
+	    part->xg[i] = (part->x[i] < part->xo[i]) ? 1.0 : -1.0;
     }
     aw->eng.ps[0].x = WIN_X(w);
     aw->eng.ps[0].y = WIN_Y(w);
@@ -39,6 +39,24 @@
 
 // =====================  Effect: Burn  =========================
 
+void
+fxBurnReportTextures (CompWindow *w)
+{
+    BenchFunc *bench = getBenchFunc (w->screen->display);
+
+    ANIMADDON_WINDOW (w);
+
+    if (!bench || aw->eng.numPs < 2)
+	return;
+
+    if (aw->eng.ps[0].tex)
+	(*bench->addTexture) (w->screen, &aw->eng.ps[0].tex, "animationaddon",
+			      "smoke", BENCH_TEXTURE_BYTES (32, 32));
+    if (aw->eng.ps[1].tex)
+	(*bench->addTexture) (w->screen, &aw->eng.ps[1].tex, "animationaddon",
+			      "fire", BENCH_TEXTURE_BYTES (32, 32));
+}
+
 Bool
 fxBurnInit (CompWindow * w)
 {
@@ -91,6 +109,8 @@ fxBurnInit (CompWindow * w)
 		 GL_RGBA, GL_UNSIGNED_BYTE, fireTex);
     glBindTexture(GL_TEXTURE_2D, 0);
 
+    fxBurnReportTextures (w);
+
     aw->animFireDirection = ad->animBaseFunctions->getActualAnimDirection
 	(w, animGetI (w, ANIMADDON_SCREEN_OPTION_FIRE_DIRECTION), FALSE);
 
@@ -138,73 +158,67 @@ fxBurnGenNewFire(CompWindow * w,
     if (max_new > ps->numParticles / 5)
 	max_new = ps->numParticles / 5;
 
-    Particle *part = ps->particles;
+    ParticleArrays *part = &ps->part;
     int i;
-    for (i = 0; i < ps->numParticles && max_new > 0; i++, part++)
+    for (i = ps->numAlive; i < ps->numParticles && max_new > 0; i++)
     {
-	if (part->life <= 0.0f)
+	// give gt new life
+	rVal = (float)(random() & 0xff) / 255.0;
+	part->life[i] = 1.0f;
+	part->fade[i] = rVal * fireLifeNeg + fadeExtra; // Random Fade Value
+
+	// set size
+	part->width[i] = partw;
+	part->height[i] = parth;
+	rVal = (float)(random() & 0xff) / 255.0;
+	part->w_mod[i] = part->h_mod[i] = size * rVal;
+
+	// choose random position
+	rVal = (float)(random() & 0xff) / 255.0;
+	part->x[i] = x + ((width > 1) ? (rVal * width) : 0);
+	rVal = (float)(random() & 0xff) / 255.0;
+	part->y[i] = y + ((height > 1) ? (rVal * height) : 0);
+	part->z[i] = 0.0;
+	part->xo[i] = part->x[i];
+	part->yo[i] = part->y[i];
+	part->zo[i] = part->z[i];
+
+	// set speed and direction
+	rVal = (float)(random() & 0xff) / 255.0;
+	part->xi[i] = ((rVal * 20.0) - 10.0f);
+	rVal = (float)(random() & 0xff) / 255.0;
+	part->yi[i] = ((rVal * 20.0) - 15.0f);
+	part->zi[i] = 0.0f;
+
+	if (mysticalFire)
 	{
-	    // give gt new life
-	    rVal = (float)(random() & 0xff) / 255.0;
-	    part->life = 1.0f;
-	    part->fade = rVal * fireLifeNeg + fadeExtra; // Random Fade Value
-
-	    // set size
-	    part->width = partw;
-	    part->height = parth;
+	    // Random colors! (aka Mystical Fire)
 	    rVal = (float)(random() & 0xff) / 255.0;
-	    part->w_mod = part->h_mod = size * rVal;
-
-	    // choose random position
-	    rVal = (float)(random() & 0xff) / 255.0;
-	    part->x = x + ((width > 1) ? (rVal * width) : 0);
-	    rVal = (float)(random() & 0xff) / 255.0;
-	    part->y = y + ((height > 1) ? (rVal * height) : 0);
-	    part->z = 0.0;
-	    part->xo = part->x;
-	    part->yo = part->y;
-	    part->zo = part->z;
-
-	    // set speed and direction
+	    part->r[i] = rVal;
 	    rVal = (float)(random() & 0xff) / 255.0;
-	    part->xi = ((rVal * 20.0) - 10.0f);
+	    part->g[i] = rVal;
 	    rVal = (float)(random() & 0xff) / 255.0;
-	    part->yi = ((rVal * 20.0) - 15.0f);
-	    part->zi = 0.0f;
-
-	    if (mysticalFire)
-	    {
-		// Random colors! (aka Mystical Fire)
-		rVal = (float)(random() & 0xff) / 255.0;
-		part->r = rVal;
-		rVal = (float)(random() & 0xff) / 255.0;
-		part->g = rVal;
-		rVal = (float)(random() & 0xff) / 255.0;
-		part->b = rVal;
-	    }
-	    else
-	    {
-		rVal = (float)(random() & 0xff) / 255.0;
-		part->r = colr1 - rVal * colr2;
-		part->g = colg1 - rVal * colg2;
-		part->b = colb1 - rVal * colb2;
-	    }
-	    // set transparancy
-	    part->a = cola;
-
-	    // set gravity
-	    part->xg = (part->x < part->xo) ? 1.0 : -1.0;
-	    part->yg = -3.0f;
-	    part->zg = 0.0f;
-
-	    ps->active = TRUE;
-	    max_new -= 1;
+	    part->b[i] = rVal;
 	}
 	else
 	{
-	    part->xg = (part->x < part->xo) ? 1.0 : -1.0;
+	    rVal = (float)(random() & 0xff) / 255.0;
+	    part->r[i] = colr1 - rVal * colr2;
+	    part->g[i] = colg1 - rVal * colg2;
+	    part->b[i] = colb1 - rVal * colb2;
 	}
+	// set transparancy
+	part->a[i] = cola;
+
+	// set gravity
+	part->xg[i] = (part->x[i] < part->xo[i]) ? 1.0 : -1.0;
+	part->yg[i] = -3.0f;
+	part->zg[i] = 0.0f;
+
+	ps->active = TRUE;
+	max_new -= 1;
     }
+    ps->numAlive = i;
 
 }
 
@@ -234,61 +248,55 @@ fxBurnGenNewSmoke(CompWindow * w,
     if (max_new > ps->numParticles)
 	max_new = ps->numParticles;
 
-    Particle *part = ps->particles;
+    ParticleArrays *part = &ps->part;
     int i;
-    for (i = 0; i < ps->numParticles && max_new > 0; i++, part++)
+    for (i = ps->numAlive; i < ps->numParticles && max_new > 0; i++)
     {
-	if (part->life <= 0.0f)
-	{
-	    // give gt new life
-	    rVal = (float)(random() & 0xff) / 255.0;
-	    part->life = 1.0f;
-	    part->fade = rVal * fireLifeNeg + fadeExtra; // Random Fade Value
-
-	    // set size
-	    part->width = partSize;
-	    part->height = partSize;
-	    part->w_mod = -0.8;
-	    part->h_mod = -0.8;
-
-	    // choose random position
-	    rVal = (float)(random() & 0xff) / 255.0;
-	    part->x = x + ((width > 1) ? (rVal * width) : 0);
-	    rVal = (float)(random() & 0xff) / 255.0;
-	    part->y = y + ((height > 1) ? (rVal * height) : 0);
-	    part->z = 0.0;
-	    part->xo = part->x;
-	    part->yo = part->y;
-	    part->zo = part->z;
-
-	    // set speed and direction
-	    rVal = (float)(random() & 0xff) / 255.0;
-	    part->xi = ((rVal * 20.0) - 10.0f);
-	    rVal = (float)(random() & 0xff) / 255.0;
-	    part->yi = (rVal + 0.2) * -size;
-	    part->zi = 0.0f;
-
-	    // set color
-	    rVal = (float)(random() & 0xff) / 255.0;
-	    part->r = rVal / 4.0;
-	    part->g = rVal / 4.0;
-	    part->b = rVal / 4.0;
-	    rVal = (float)(random() & 0xff) / 255.0;
-	    part->a = 0.5 + (rVal / 2.0);
-
-	    // set gravity
-	    part->xg = (part->x < part->xo) ? size : sizeNeg;
-	    part->yg = sizeNeg;
-	    part->zg = 0.0f;
-
-	    ps->active = TRUE;
-	    max_new -= 1;
-	}
-	else
-	{
-	    part->xg = (part->x < part->xo) ? size : sizeNeg;
-	}
+	// give gt new life
+	rVal = (float)(random() & 0xff) / 255.0;
+	part->life[i] = 1.0f;
+	part->fade[i] = rVal * fireLifeNeg + fadeExtra; // Random Fade Value
+
+	// set size
+	part->width[i] = partSize;
+	part->height[i] = partSize;
+	part->w_mod[i] = -0.8;
+	part->h_mod[i] = -0.8;
+
+	// choose random position
+	rVal = (float)(random() & 0xff) / 255.0;
+	part->x[i] = x + ((width > 1) ? (rVal * width) : 0);
+	rVal = (float)(random() & 0xff) / 255.0;
+	part->y[i] = y + ((height > 1) ? (rVal * height) : 0);
+	part->z[i] = 0.0;
+	part->xo[i] = part->x[i];
+	part->yo[i] = part->y[i];
+	part->zo[i] = part->z[i];
+
+	// set speed and direction
+	rVal = (float)(random() & 0xff) / 255.0;
+	part->xi[i] = ((rVal * 20.0) - 10.0f);
+	rVal = (float)(random() & 0xff) / 255.0;
+	part->yi[i] = (rVal + 0.2) * -size;
+	part->zi[i] = 0.0f;
+
+	// set color
+	rVal = (float)(random() & 0xff) / 255.0;
+	part->r[i] = rVal / 4.0;
+	part->g[i] = rVal / 4.0;
+	part->b[i] = rVal / 4.0;
+	rVal = (float)(random() & 0xff) / 255.0;
+	part->a[i] = 0.5 + (rVal / 2.0);
+
+	// set gravity
+	part->xg[i] = (part->x[i] < part->xo[i]) ? size : sizeNeg;
+	part->yg[i] = sizeNeg;
+	part->zg[i] = 0.0f;
+
+	ps->active = TRUE;
+	max_new -= 1;
     }
+    ps->numAlive = i;
 
 }
 
@@ -423,6 +431,13 @@ fxBurnAnimStep (CompWindow *w, float time)
     {
 	if (aw->eng.ps)
 	{
+	    BenchFunc *bench = getBenchFunc (w->screen->display);
+
+	    if (bench)
+	    {
+		(*bench->removeTexture) (w->screen, &aw->eng.ps[0].tex);
+		(*bench->removeTexture) (w->screen, &aw->eng.ps[1].tex);
+	    }
 	    finiParticles(aw->eng.ps);
 	    free(aw->eng.ps);
 	    aw->eng.ps = NULL;
@@ -434,29 +449,29 @@ fxBurnAnimStep (CompWindow *w, float time)
 
     int i;
     int nParticles;
-    Particle *part;
+    ParticleArrays *part;
 
     if (aw->com->animRemainingTime > 0 && smoke)
     {
 	float partxg = WIN_W(w) / 40.0;
 	float partxgNeg = -partxg;
 
-	nParticles = aw->eng.ps[0].numParticles;
-	part = aw->eng.ps[0].particles;
+	nParticles = aw->eng.ps[0].numAlive;
+	part = &aw->eng.ps[0].part;
 
-	for (i = 0; i < nParticles; i++, part++)
-	    part->xg = (part->x < part->xo) ? partxg : partxgNeg;
+	for (i = 0; i < nParticles; i++)
+	    part->xg[i] = (part->x[i] < part->xo[i]) ? partxg : partxgNeg;
     }
     aw->eng.ps[0].x = WIN_X(w);
     aw->eng.ps[0].y = WIN_Y(w);
 
     if (aw->com->animRemainingTime > 0)
     {
-	nParticles = aw->eng.ps[1].numParticles;
-	part = aw->eng.ps[1].particles;
+	nParticles = aw->eng.ps[1].numAlive;
+	part = &aw->eng.ps[1].part;
 
-	for (i = 0; i < nParticles; i++, part++)
-	    part->xg = (part->x < part->xo) ? 1.0 : -1.0;
+	for (i = 0; i < nParticles; i++)
+	    part->xg[i] = (part->x[i] < part->xo[i]) ? 1.0 : -1.0;
     }
     aw->eng.ps[1].x = WIN_X(w);
     aw->eng.ps[1].y = WIN_Y(w);
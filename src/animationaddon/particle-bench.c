@@ -0,0 +1,317 @@
+/*
+ * Animation plugin for compiz/beryl
+ *
+ * particle-bench.c
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Times the particle update loop as it was with one struct per particle
+ * against updateParticleArrays, after checking that both give the same
+ * particles. Prints ns per particle, best of RUNS runs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "particle-update.h"
+
+#define RUNS    5
+#define UPDATES 10000000	// particle updates per run
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define BLOCK_COUNT(n) \
+    (((n) + PARTICLE_UPDATE_BLOCK - 1) & ~(PARTICLE_UPDATE_BLOCK - 1))
+
+// Particle as it was stored before the structure of arrays
+typedef struct _Particle
+{
+    float life, fade;
+    float width, height, w_mod, h_mod;
+    float r, g, b, a;
+    float x, y, z;
+    float xi, yi, zi;
+    float xg, yg, zg;
+    float xo, yo, zo;
+} Particle;
+
+typedef struct _Arrays
+{
+    float *block;
+    float *life, *fade;
+    float *x, *y, *z;
+    float *xi, *yi, *zi;
+    float *xg, *yg, *zg;
+} Arrays;
+
+static double
+now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// The update loop of updateParticles before the structure of arrays
+static __attribute__ ((noinline)) int
+updateParticlesOld (Particle *part,
+		    int      numParticles,
+		    float    slowdown,
+		    float    speed)
+{
+    int i, active = 0;
+
+    for (i = 0; i < numParticles; i++, part++)
+    {
+	if (part->life > 0.0f)
+	{
+	    // move particle
+	    part->x += part->xi / slowdown;
+	    part->y += part->yi / slowdown;
+	    part->z += part->zi / slowdown;
+
+	    // modify speed
+	    part->xi += part->xg * speed;
+	    part->yi += part->yg * speed;
+	    part->zi += part->zg * speed;
+
+	    // modify life
+	    part->life -= part->fade * speed;
+	    active = 1;
+	}
+    }
+
+    return active;
+}
+
+static float
+randf (float min, float max)
+{
+    return min + (max - min) * rand () / (float) RAND_MAX;
+}
+
+// n particles, a share of them alive spread over all of them
+static Particle *
+makeParticles (int n, float share)
+{
+    Particle *part = calloc (n, sizeof (Particle));
+    int      i;
+
+    if (!part)
+	return NULL;
+
+    for (i = 0; i < n; i++)
+    {
+	part[i].life = (rand () < share * RAND_MAX) ? randf (0.5, 1) : 0;
+	part[i].fade = randf (1e-7, 1e-6);
+	part[i].x = randf (0, 1000);
+	part[i].y = randf (0, 1000);
+	part[i].z = randf (-1, 1);
+	part[i].xi = randf (-10, 10);
+	part[i].yi = randf (-10, 10);
+	part[i].zi = randf (-1, 1);
+	part[i].xg = randf (-1, 1);
+	part[i].yg = randf (-3, 0);
+	part[i].zg = randf (-0.1, 0.1);
+    }
+
+    return part;
+}
+
+static int
+makeArrays (Arrays *a, int n)
+{
+    int size = BLOCK_COUNT (n);
+
+    a->block = calloc (size * 11, sizeof (float));
+    if (!a->block)
+	return 0;
+
+    a->life = a->block;
+    a->fade = a->life + size;
+    a->x = a->fade + size;
+    a->y = a->x + size;
+    a->z = a->y + size;
+    a->xi = a->z + size;
+    a->yi = a->xi + size;
+    a->zi = a->yi + size;
+    a->xg = a->zi + size;
+    a->yg = a->xg + size;
+    a->zg = a->yg + size;
+
+    return 1;
+}
+
+// Copies particles into the arrays, only the live ones, packed at the
+// start, if packed is set. Returns the number copied.
+static int
+loadArrays (Arrays *a, const Particle *part, int n, int packed)
+{
+    int i, j;
+
+    memset (a->block, 0, BLOCK_COUNT (n) * 11 * sizeof (float));
+
+    for (i = j = 0; i < n; i++)
+    {
+	if (packed && part[i].life <= 0.0f)
+	    continue;
+
+	a->life[j] = part[i].life;
+	a->fade[j] = part[i].fade;
+	a->x[j] = part[i].x;
+	a->y[j] = part[i].y;
+	a->z[j] = part[i].z;
+	a->xi[j] = part[i].xi;
+	a->yi[j] = part[i].yi;
+	a->zi[j] = part[i].zi;
+	a->xg[j] = part[i].xg;
+	a->yg[j] = part[i].yg;
+	a->zg[j] = part[i].zg;
+	j++;
+    }
+
+    return j;
+}
+
+static int
+updateArrays (Arrays *a, int n, float slowdown, float speed)
+{
+    return updateParticleArrays (a->life, a->fade, a->x, a->y, a->z,
+				 a->xi, a->yi, a->zi, a->xg, a->yg, a->zg,
+				 BLOCK_COUNT (n), 1.0f / slowdown, speed);
+}
+
+static int
+near (float a, float b)
+{
+    return fabsf (a - b) <= 1e-5f * MAX (fabsf (a), fabsf (b)) + 1e-6f;
+}
+
+// One update of both, from the same particles, gives the same particles
+static int
+check (const Particle *orig, int n, Arrays *a, float slowdown, float speed)
+{
+    Particle *part = malloc (n * sizeof (Particle));
+    int      i, activeOld, activeNew, ok = 1;
+
+    if (!part)
+	return 0;
+
+    memcpy (part, orig, n * sizeof (Particle));
+    loadArrays (a, orig, n, 0);
+
+    activeOld = updateParticlesOld (part, n, slowdown, speed);
+    activeNew = updateArrays (a, n, slowdown, speed);
+
+    if (activeOld != activeNew)
+    {
+	fprintf (stderr, "active differs from the old update\n");
+	ok = 0;
+    }
+
+    for (i = 0; i < n && ok; i++)
+    {
+	ok = near (part[i].life, a->life[i]) &&
+	     near (part[i].x, a->x[i]) &&
+	     near (part[i].y, a->y[i]) &&
+	     near (part[i].z, a->z[i]) &&
+	     near (part[i].xi, a->xi[i]) &&
+	     near (part[i].yi, a->yi[i]) &&
+	     near (part[i].zi, a->zi[i]);
+	if (!ok)
+	    fprintf (stderr, "particle %d differs from the old update\n", i);
+    }
+
+    free (part);
+
+    return ok;
+}
+
+static int
+bench (int n, float share, float slowdown, float speed)
+{
+    Particle *orig, *part;
+    Arrays   a;
+    double   t, best[3] = { 1e9, 1e9, 1e9 };
+    int      i, r, alive, iters = UPDATES / n;
+
+    orig = makeParticles (n, share);
+    part = malloc (n * sizeof (Particle));
+    if (!orig || !part || !makeArrays (&a, n))
+	return 0;
+
+    if (!check (orig, n, &a, slowdown, speed))
+	return 0;
+
+    for (r = 0; r < RUNS; r++)
+    {
+	memcpy (part, orig, n * sizeof (Particle));
+	t = now ();
+	for (i = 0; i < iters; i++)
+	    updateParticlesOld (part, n, slowdown, speed);
+	best[0] = MIN (best[0], now () - t);
+
+	loadArrays (&a, orig, n, 0);
+	t = now ();
+	for (i = 0; i < iters; i++)
+	    updateArrays (&a, n, slowdown, speed);
+	best[1] = MIN (best[1], now () - t);
+
+	alive = loadArrays (&a, orig, n, 1);
+	t = now ();
+	for (i = 0; i < iters; i++)
+	    updateArrays (&a, alive, slowdown, speed);
+	best[2] = MIN (best[2], now () - t);
+    }
+
+    printf ("%6d %5.0f%% %8.2f %8.2f %8.2f\n", n, share * 100,
+	    best[0] * 1e9 / iters / n,
+	    best[1] * 1e9 / iters / n,
+	    best[2] * 1e9 / iters / n);
+
+    free (a.block);
+    free (part);
+    free (orig);
+
+    return 1;
+}
+
+int
+main (void)
+{
+    static const int   sizes[] = { 100, 1000, 10000 };
+    static const float shares[] = { 1.0, 0.25 };
+    float              time = 16; // ms between frames
+    float              speed = time / 50.0;
+    float              slowdown = 1 * (1 - MAX (0.99, time / 1000.0)) * 1000;
+    unsigned int       i, j;
+
+    srand (1);
+
+    // ns per particle, live or dead; "packed" walks only the live
+    // particles, as updateParticles keeps them at the start
+    printf ("%6s %6s %8s %8s %8s\n", "count", "alive", "old", "arrays",
+	    "packed");
+
+    for (i = 0; i < sizeof (sizes) / sizeof (sizes[0]); i++)
+	for (j = 0; j < sizeof (shares) / sizeof (shares[0]); j++)
+	    if (!bench (sizes[i], shares[j], slowdown, speed))
+		return 1;
+
+    return 0;
+}
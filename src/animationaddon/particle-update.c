@@ -0,0 +1,70 @@
+/*
+ * Animation plugin for compiz/beryl
+ *
+ * particle-update.c
+ *
+ * Particle system added by : (C) 2006 Dennis Kasprzyk
+ * E-mail                   : onestone@compiz.org
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "particle-update.h"
+
+/*
+ * Runs over whole blocks of PARTICLE_UPDATE_BLOCK particles and
+ * multiplies by 0 instead of skipping dead particles, so the compiler
+ * turns the inner loop into SIMD code without a scalar remainder. The
+ * arrays are passed one by one, as restrict is what tells it they do
+ * not overlap.
+ */
+int
+updateParticleArrays (float * restrict life,
+		      const float * restrict fade,
+		      float * restrict x,
+		      float * restrict y,
+		      float * restrict z,
+		      float * restrict xi,
+		      float * restrict yi,
+		      float * restrict zi,
+		      const float * restrict xg,
+		      const float * restrict yg,
+		      const float * restrict zg,
+		      int n,
+		      float move,
+		      float speed)
+{
+    int i, j, active = 0;
+
+    for (i = 0; i < n; i += PARTICLE_UPDATE_BLOCK)
+    {
+	for (j = i; j < i + PARTICLE_UPDATE_BLOCK; j++)
+	{
+	    float alive = (life[j] > 0.0f) ? 1.0f : 0.0f;
+
+	    // move particle
+	    x[j] += alive * xi[j] * move;
+	    y[j] += alive * yi[j] * move;
+	    z[j] += alive * zi[j] * move;
+
+	    // modify speed
+	    xi[j] += alive * xg[j] * speed;
+	    yi[j] += alive * yg[j] * speed;
+	    zi[j] += alive * zg[j] * speed;
+
+	    // modify life
+	    active |= (life[j] > 0.0f);
+	    life[j] -= alive * fade[j] * speed;
+	}
+    }
+
+    return active;
+}
@@ -0,0 +1,45 @@
+/*
+ * Animation plugin for compiz/beryl
+ *
+ * particle-update.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef _ANIMATIONADDON_PARTICLE_UPDATE_H
+#define _ANIMATIONADDON_PARTICLE_UPDATE_H
+
+// The particle update loop, kept free of compiz headers so that
+// particle-bench builds it on its own.
+
+// Same as PARTICLE_BLOCK, particle.c checks that they match
+#define PARTICLE_UPDATE_BLOCK 8
+
+// Moves, accelerates and fades the n first particles, n being a
+// multiple of PARTICLE_UPDATE_BLOCK. Returns whether any of them was
+// alive.
+int
+updateParticleArrays (float * restrict life,
+		      const float * restrict fade,
+		      float * restrict x,
+		      float * restrict y,
+		      float * restrict z,
+		      float * restrict xi,
+		      float * restrict yi,
+		      float * restrict zi,
+		      const float * restrict xg,
+		      const float * restrict yg,
+		      const float * restrict zg,
+		      int n,
+		      float move,
+		      float speed);
+
+#endif
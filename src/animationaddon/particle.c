@@ -35,14 +35,50 @@
  */
 
 #include "animationaddon.h"
+#include "particle-update.h"
+
+#if PARTICLE_UPDATE_BLOCK != PARTICLE_BLOCK
+#error "PARTICLE_UPDATE_BLOCK and PARTICLE_BLOCK differ"
+#endif
+
+// Number of arrays a particle system keeps, one per Particle member
+#define PARTICLE_ARRAYS (sizeof (Particle) / sizeof (float))
 
 void initParticles(int numParticles, ParticleSystem * ps)
 {
-    if (ps->particles)
-	free(ps->particles);
-    ps->particles = (Particle *) malloc (numParticles * sizeof (Particle));
+    ParticleArrays *part = &ps->part;
+    int size = PARTICLE_BLOCK_COUNT (numParticles);
+
+    if (part->life)
+	free(part->life);
+
+    // All particles start out dead, with every member zeroed
+    part->life = calloc (size * PARTICLE_ARRAYS, sizeof (float));
+    part->fade = part->life + size;
+    part->width = part->fade + size;
+    part->height = part->width + size;
+    part->w_mod = part->height + size;
+    part->h_mod = part->w_mod + size;
+    part->r = part->h_mod + size;
+    part->g = part->r + size;
+    part->b = part->g + size;
+    part->a = part->b + size;
+    part->x = part->a + size;
+    part->y = part->x + size;
+    part->z = part->y + size;
+    part->xi = part->z + size;
+    part->yi = part->xi + size;
+    part->zi = part->yi + size;
+    part->xg = part->zi + size;
+    part->yg = part->xg + size;
+    part->zg = part->yg + size;
+    part->xo = part->zg + size;
+    part->yo = part->xo + size;
+    part->zo = part->yo + size;
+
     ps->tex = 0;
     ps->numParticles = numParticles;
+    ps->numAlive = 0;
     ps->slowdown = 1;
     ps->active = FALSE;
 
@@ -55,11 +91,58 @@ void initParticles(int numParticles, ParticleSystem * ps)
     ps->color_cache_count = 0;
     ps->coords_cache_count = 0;
     ps->dcolors_cache_count = 0;
+}
 
-    Particle *part = ps->particles;
-    int i;
-    for (i = 0; i < numParticles; i++, part++)
-	part->life = 0.0f;
+void getParticle (ParticleSystem * ps, int i, Particle * part)
+{
+    part->life = ps->part.life[i];
+    part->fade = ps->part.fade[i];
+    part->width = ps->part.width[i];
+    part->height = ps->part.height[i];
+    part->w_mod = ps->part.w_mod[i];
+    part->h_mod = ps->part.h_mod[i];
+    part->r = ps->part.r[i];
+    part->g = ps->part.g[i];
+    part->b = ps->part.b[i];
+    part->a = ps->part.a[i];
+    part->x = ps->part.x[i];
+    part->y = ps->part.y[i];
+    part->z = ps->part.z[i];
+    part->xi = ps->part.xi[i];
+    part->yi = ps->part.yi[i];
+    part->zi = ps->part.zi[i];
+    part->xg = ps->part.xg[i];
+    part->yg = ps->part.yg[i];
+    part->zg = ps->part.zg[i];
+    part->xo = ps->part.xo[i];
+    part->yo = ps->part.yo[i];
+    part->zo = ps->part.zo[i];
+}
+
+void setParticle (ParticleSystem * ps, int i, const Particle * part)
+{
+    ps->part.life[i] = part->life;
+    ps->part.fade[i] = part->fade;
+    ps->part.width[i] = part->width;
+    ps->part.height[i] = part->height;
+    ps->part.w_mod[i] = part->w_mod;
+    ps->part.h_mod[i] = part->h_mod;
+    ps->part.r[i] = part->r;
+    ps->part.g[i] = part->g;
+    ps->part.b[i] = part->b;
+    ps->part.a[i] = part->a;
+    ps->part.x[i] = part->x;
+    ps->part.y[i] = part->y;
+    ps->part.z[i] = part->z;
+    ps->part.xi[i] = part->xi;
+    ps->part.yi[i] = part->yi;
+    ps->part.zi[i] = part->zi;
+    ps->part.xg[i] = part->xg;
+    ps->part.yg[i] = part->yg;
+    ps->part.zg[i] = part->zg;
+    ps->part.xo[i] = part->xo;
+    ps->part.yo[i] = part->yo;
+    ps->part.zo[i] = part->zo;
 }
 
 void drawParticles (CompWindow * w, ParticleSystem * ps)
@@ -79,38 +162,38 @@ void drawParticles (CompWindow * w, ParticleSystem * ps)
     glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
 
     /* Check that the cache is big enough */
-    if (ps->numParticles > ps->vertex_cache_count)
+    if (ps->numAlive > ps->vertex_cache_count)
     {
 	ps->vertices_cache =
 	    realloc(ps->vertices_cache,
-		    ps->numParticles * 4 * 3 * sizeof(GLfloat));
-	ps->vertex_cache_count = ps->numParticles;
+		    ps->numAlive * 4 * 3 * sizeof(GLfloat));
+	ps->vertex_cache_count = ps->numAlive;
     }
 
-    if (ps->numParticles > ps->coords_cache_count)
+    if (ps->numAlive > ps->coords_cache_count)
     {
 	ps->coords_cache =
 	    realloc(ps->coords_cache,
-		    ps->numParticles * 4 * 2 * sizeof(GLfloat));
-	ps->coords_cache_count = ps->numParticles;
+		    ps->numAlive * 4 * 2 * sizeof(GLfloat));
+	ps->coords_cache_count = ps->numAlive;
     }
 
-    if (ps->numParticles > ps->color_cache_count)
+    if (ps->numAlive > ps->color_cache_count)
     {
 	ps->colors_cache =
 	    realloc(ps->colors_cache,
-		    ps->numParticles * 4 * 4 * sizeof(GLfloat));
-	ps->color_cache_count = ps->numParticles;
+		    ps->numAlive * 4 * 4 * sizeof(GLfloat));
+	ps->color_cache_count = ps->numAlive;
     }
 
     if (ps->darken > 0)
     {
-	if (ps->dcolors_cache_count < ps->numParticles)
+	if (ps->dcolors_cache_count < ps->numAlive)
 	{
 	    ps->dcolors_cache =
 		realloc(ps->dcolors_cache,
-			ps->numParticles * 4 * 4 * sizeof(GLfloat));
-	    ps->dcolors_cache_count = ps->numParticles;
+			ps->numAlive * 4 * 4 * sizeof(GLfloat));
+	    ps->dcolors_cache_count = ps->numAlive;
 	}
     }
 
@@ -127,66 +210,61 @@ void drawParticles (CompWindow * w, ParticleSystem * ps)
 			       1.0, 1.0,
 			       1.0, 0.0};
 
-    int numActive = 0;
+    int numActive = ps->numAlive * 4;
 
-    Particle *part = ps->particles;
+    ParticleArrays *part = &ps->part;
     int i;
-    for (i = 0; i < ps->numParticles; i++, part++)
+    for (i = 0; i < ps->numAlive; i++)
     {
-	if (part->life > 0.0f)
-	{
-	    numActive += 4;
-
-	    float w = part->width / 2;
-	    float h = part->height / 2;
+	float w = part->width[i] / 2;
+	float h = part->height[i] / 2;
 
-	    w += (w * part->w_mod) * part->life;
-	    h += (h * part->h_mod) * part->life;
+	w += (w * part->w_mod[i]) * part->life[i];
+	h += (h * part->h_mod[i]) * part->life[i];
 
-	    vertices[0] = part->x - w;
-	    vertices[1] = part->y - h;
-	    vertices[2] = part->z;
+	vertices[0] = part->x[i] - w;
+	vertices[1] = part->y[i] - h;
+	vertices[2] = part->z[i];
 
-	    vertices[3] = part->x - w;
-	    vertices[4] = part->y + h;
-	    vertices[5] = part->z;
+	vertices[3] = part->x[i] - w;
+	vertices[4] = part->y[i] + h;
+	vertices[5] = part->z[i];
 
-	    vertices[6] = part->x + w;
-	    vertices[7] = part->y + h;
-	    vertices[8] = part->z;
+	vertices[6] = part->x[i] + w;
+	vertices[7] = part->y[i] + h;
+	vertices[8] = part->z[i];
 
-	    vertices[9] = part->x + w;
-	    vertices[10] = part->y - h;
-	    vertices[11] = part->z;
+	vertices[9] = part->x[i] + w;
+	vertices[10] = part->y[i] - h;
+	vertices[11] = part->z[i];
 
-	    vertices += 12;
+	vertices += 12;
 
-	    memcpy (coords, cornerCoords, cornersSize);
+	memcpy (coords, cornerCoords, cornersSize);
 
-	    coords += 8;
+	coords += 8;
 
-	    colors[0] = part->r;
-	    colors[1] = part->g;
-	    colors[2] = part->b;
-	    colors[3] = part->life * part->a;
-	    memcpy (colors + 4, colors, colorSize);
-	    memcpy (colors + 8, colors, colorSize);
-	    memcpy (colors + 12, colors, colorSize);
+	colors[0] = part->r[i];
+	colors[1] = part->g[i];
+	colors[2] = part->b[i];
+	colors[3] = part->life[i] * part->a[i];
+	memcpy (colors + 4, colors, colorSize);
+	memcpy (colors + 8, colors, colorSize);
+	memcpy (colors + 12, colors, colorSize);
 
-	    colors += 16;
+	colors += 16;
 
-	    if (ps->darken > 0)
-	    {
-		dcolors[0] = part->r;
-		dcolors[1] = part->g;
-		dcolors[2] = part->b;
-		dcolors[3] = part->life * part->a * ps->darken;
-		memcpy (dcolors + 4, dcolors, colorSize);
-		memcpy (dcolors + 8, dcolors, colorSize);
-		memcpy (dcolors + 12, dcolors, colorSize);
-
-		dcolors += 16;
-	    }
+	if (ps->darken > 0)
+	{
+	    dcolors[0] = part->r[i];
+	    dcolors[1] = part->g[i];
+	    dcolors[2] = part->b[i];
+	    dcolors[3] = part->life[i] * part->a[i] * ps->darken;
+	    memcpy (dcolors + 4, dcolors, colorSize);
+	    memcpy (dcolors + 8, dcolors, colorSize);
+	    memcpy (dcolors + 12, dcolors, colorSize);
+
+	    dcolors += 16;
 	}
     }
 
@@ -237,39 +315,44 @@ void drawParticleSystems (CompWindow * w)
 
 void updateParticles(ParticleSystem * ps, float time)
 {
-    int i;
-    Particle *part;
+    ParticleArrays *part = &ps->part;
     float speed = (time / 50.0);
     float slowdown = ps->slowdown * (1 - MAX(0.99, time / 1000.0)) * 1000;
 
-    ps->active = FALSE;
+    Particle p;
+    int i, j;
 
-    part = ps->particles;
+    ps->active = updateParticleArrays (part->life, part->fade,
+				       part->x, part->y, part->z,
+				       part->xi, part->yi, part->zi,
+				       part->xg, part->yg, part->zg,
+				       PARTICLE_BLOCK_COUNT (ps->numAlive),
+				       1.0f / slowdown, speed);
 
-    for (i = 0; i < ps->numParticles; i++, part++)
+    // keep live particles at the start in the order they were emitted,
+    // shifting them down over the ones that died, so that blended
+    // particles are drawn in the same order from frame to frame
+    for (i = j = 0; i < ps->numAlive; i++)
     {
-	if (part->life > 0.0f)
+	if (part->life[i] <= 0.0f)
+	    continue;
+
+	if (i != j)
 	{
-	    // move particle
-	    part->x += part->xi / slowdown;
-	    part->y += part->yi / slowdown;
-	    part->z += part->zi / slowdown;
-
-	    // modify speed
-	    part->xi += part->xg * speed;
-	    part->yi += part->yg * speed;
-	    part->zi += part->zg * speed;
-
-	    // modify life
-	    part->life -= part->fade * speed;
-	    ps->active = TRUE;
+	    getParticle (ps, i, &p);
+	    setParticle (ps, j, &p);
 	}
+	j++;
     }
+
+    for (i = j; i < ps->numAlive; i++)
+	part->life[i] = 0.0f;
+    ps->numAlive = j;
 }
 
 void finiParticles(ParticleSystem * ps)
 {
-    free(ps->particles);
+    free(ps->part.life);
     if (ps->tex)
 	glDeleteTextures(1, &ps->tex);
 
@@ -297,22 +380,19 @@ particlesUpdateBB (CompOutput *output,
 	ParticleSystem * ps = &aw->eng.ps[i];
 	if (ps->active)
 	{
-	    Particle *part = ps->particles;
+	    ParticleArrays *part = &ps->part;
 	    int j;
-	    for (j = 0; j < ps->numParticles; j++, part++)
+	    for (j = 0; j < ps->numAlive; j++)
 	    {
-		if (part->life <= 0.0f)	     // Ignore dead particles
-		    continue;
-
-		float w = part->width / 2;
-		float h = part->height / 2;
+		float w = part->width[j] / 2;
+		float h = part->height[j] / 2;
 
-		w += (w * part->w_mod) * part->life;
-		h += (h * part->h_mod) * part->life;
+		w += (w * part->w_mod[j]) * part->life[j];
+		h += (h * part->h_mod[j]) * part->life[j];
 
 		Box particleBox =
-		    {part->x - w, part->x + w,
-		     part->y - h, part->y + h};
+		    {part->x[j] - w, part->x[j] + w,
+		     part->y[j] - h, part->y[j] + h};
 
 		ad->animBaseFunctions->expandBoxWithBox (BB, &particleBox);
 	    }
@@ -340,10 +420,15 @@ particlesCleanup (CompWindow * w)
 
     if (aw->eng.numPs)
     {
+	BenchFunc *bench = getBenchFunc (w->screen->display);
 	int i = 0;
 
 	for (i = 0; i < aw->eng.numPs; i++)
+	{
+	    if (bench)
+		(*bench->removeTexture) (w->screen, &aw->eng.ps[i].tex);
 	    finiParticles (aw->eng.ps + i);
+	}
 	free (aw->eng.ps);
 	aw->eng.ps = NULL;
 	aw->eng.numPs = 0;
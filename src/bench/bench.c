@@ -21,7 +21,15 @@
  **/
 
 #include <compiz-core.h>
+#include <compiz-bench.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
 
 #include "bench_tex.h"
 #include "bench_options.h"
@@ -38,6 +46,12 @@
 #define BENCH_SCREEN(s)                                                      \
     BenchScreen *bs = GET_BENCH_SCREEN (s, GET_BENCH_DISPLAY (s->display))
 
+#define GET_BENCH_CORE(c)                                \
+    ((BenchCore *) (c)->base.privates[corePrivateIndex].ptr)
+
+#define BENCH_CORE(c)                 \
+    BenchCore *bc = GET_BENCH_CORE (c)
+
 #define TIMEVALDIFF(tv1, tv2)                                              \
     (((tv1)->tv_sec == (tv2)->tv_sec || (tv1)->tv_usec >= (tv2)->tv_usec) ? \
      ((((tv1)->tv_sec - (tv2)->tv_sec) * 1000000) +                         \
@@ -61,18 +75,276 @@ static GLenum gl_error;
 #define GLERR
 #endif
 
+/* Frame intervals are kept in a ring for the overlay, and counted in
+ * histograms of 0.1 ms buckets, the last one taking everything from
+ * 100 ms up. A frame is over budget when it took more than one and a
+ * half times the optimal redraw time, i.e. it missed a refresh. */
+#define BENCH_RING_SIZE    512
+#define BENCH_BUCKET_US    100
+#define BENCH_HIST_BUCKETS 1000
+
+#define BENCH_OVER_BUDGET(us, s) ((us) * 2 > (s)->optimalRedrawTime * 3000)
+
+typedef struct _BenchHistogram
+{
+    unsigned int bucket[BENCH_HIST_BUCKETS];
+    unsigned int count;
+    unsigned int over;
+    int          max;
+}
+BenchHistogram;
+
+typedef struct _BenchFrameSummary
+{
+    float        p50, p90, p99, max;
+    unsigned int over;
+    unsigned int count;
+}
+BenchFrameSummary;
+
+/* Paint hooks timed per plugin when profiling */
+#define BENCH_HOOK_PREPARE_PAINT_SCREEN 0
+#define BENCH_HOOK_PAINT_OUTPUT         1
+#define BENCH_HOOK_PAINT_WINDOW         2
+#define BENCH_HOOK_DRAW_WINDOW          3
+#define BENCH_HOOK_DONE_PAINT_SCREEN    4
+#define BENCH_HOOK_NUM                  5
+
+#define BENCH_MAX_LEVELS 64
+
+/* GPU timestamps go into one of two sets of queries per frame, read
+ * back a frame later if they are ready by then, so that reading them
+ * never waits for the GPU */
+#define BENCH_GPU_SLOTS   2
+#define BENCH_MAX_OUTPUTS 16
+
+/* Trace records wait in a ring for the writer thread, which is woken
+ * when the ring is half full and once a second otherwise. When the
+ * writer falls behind, records are dropped rather than making the
+ * paint thread wait. */
+#define BENCH_TRACE_RECORDS 4096
+
+#define BENCH_TRACE_CSV  0
+#define BENCH_TRACE_JSON 1
+
+/* The overlay is queued as quads into one vertex array and drawn in
+ * one go from an atlas holding the background, the digits, and a
+ * white block for the quads that are only colored */
+#define BENCH_ATLAS_SIZE        512
+#define BENCH_ATLAS_DIGIT_Y     264
+#define BENCH_ATLAS_DIGIT_PITCH 32
+#define BENCH_ATLAS_WHITE_X     352
+#define BENCH_MAX_QUADS         1024
+
+#define BENCH_GRAPH_Y      388
+#define BENCH_GRAPH_HEIGHT 96
+
+/* Scenario steps are driven from a fixed tick. What the test windows
+ * do is worked out from how far into its step the scenario is rather
+ * than from the number of ticks, so that a slow machine goes through
+ * the same motions in the same time, only in fewer frames. */
+#define BENCH_SCENARIO_TICK      20
+#define BENCH_SCENARIO_DELAY     3000
+#define BENCH_MAX_STEPS          32
+#define BENCH_MAX_TEST_WINDOWS   32
+
+#define BENCH_STEP_IDLE     0
+#define BENCH_STEP_OPEN     1
+#define BENCH_STEP_MOVE     2
+#define BENCH_STEP_RESIZE   3
+#define BENCH_STEP_MINIMIZE 4
+#define BENCH_STEP_VIEWPORT 5
+#define BENCH_STEP_CLOSE    6
+#define BENCH_STEP_NUM      7
+
+static const char *benchStepName[BENCH_STEP_NUM] = {
+    "idle", "open", "move", "resize", "minimize", "viewport", "close"
+};
+
+static int corePrivateIndex;
 static int displayPrivateIndex = 0;
+static int functionsPrivateIndex;
+
+typedef struct _BenchCore
+{
+    InitPluginForObjectProc initPluginForObject;
+    FiniPluginForObjectProc finiPluginForObject;
+}
+BenchCore;
+
+typedef struct _BenchTraceRecord
+{
+    double       time;
+    int          screen;
+    float        interval;
+    float        cpu;
+    unsigned int damage;
+    float        damagePct;
+    int          outputs;
+    int          windows;
+    float        overdraw;
+    float        outputPct[BENCH_MAX_OUTPUTS];
+    int          nOutput;
+}
+BenchTraceRecord;
+
+typedef struct _BenchTrace
+{
+    FILE             *f;
+    int              format;
+    long long        start;
+    pthread_t        thread;
+    pthread_mutex_t  mutex;
+    pthread_cond_t   cond;
+    BenchTraceRecord ring[BENCH_TRACE_RECORDS];
+    int              head, count;
+    unsigned int     dropped;
+    Bool             stop;
+}
+BenchTrace;
+
+/* One plugin's function in the wrap chain of a hook. Level 0 is what
+ * was there when bench was loaded: core, the plugins loaded before
+ * bench, and bench itself. Plugins loaded without plugin profiling
+ * join the level below them. */
+typedef struct _BenchLevel
+{
+    CompPlugin *plugin;
+    FuncPtr    real;
+    long long  selfNs;
+    long long  calls;
+}
+BenchLevel;
+
+/* Every plugin loaded after bench with plugin profiling on finds the
+ * trampoline of the hook in the screen when it wraps it, and bench
+ * puts the trampoline back on top when it is done. A trampoline entered while none of its own are
+ * running was called from the top of the chain, otherwise by the level
+ * above the innermost running one, after it unwrapped itself. */
+typedef struct _BenchHook
+{
+    BenchLevel level[BENCH_MAX_LEVELS];
+    int        nLevel;
+    int        active;
+    long long  childNs;
+}
+BenchHook;
+
+typedef struct _BenchGpuFrame
+{
+    GLuint query[BENCH_MAX_OUTPUTS * 2];
+    int    output[BENCH_MAX_OUTPUTS];
+    int    nOutput;
+}
+BenchGpuFrame;
+
+/* CPU and GPU time, damage and windows painted per frame, over a
+ * console period */
+typedef struct _BenchFrameCost
+{
+    long long    cpuNs, cpuMaxNs;
+    long long    gpuNs, gpuMaxNs;
+    long long    outputNs[BENCH_MAX_OUTPUTS];
+    unsigned int cpuFrames, gpuFrames;
+
+    long long    damagePx, outputDamagePx[BENCH_MAX_OUTPUTS];
+    long long    windows, overdrawPx;
+    unsigned int damageFrames;
+}
+BenchFrameCost;
+
+typedef struct _BenchStep
+{
+    int               type;
+    int               ms;
+
+    Bool              done;
+    float             seconds;
+    BenchFrameSummary frames;
+    float             cpuMs, gpuMs;
+    float             damagePct;
+}
+BenchStep;
+
+typedef struct _BenchTestWindow
+{
+    Window id;
+    int    x, y, width, height;
+    Bool   iconic;
+}
+BenchTestWindow;
+
+/* The test windows belong to a connection of their own, so that they
+ * are mapped, configured and minimized through the window manager
+ * like those of any other client */
+typedef struct _BenchScenario
+{
+    CompScreen        *screen;
+    Display           *dpy;
+    Atom              viewportAtom;
+    CompTimeoutHandle timer;
+    Bool              wasActive;
+
+    BenchTestWindow   window[BENCH_MAX_TEST_WINDOWS];
+    int               nWindow;
+    int               radius;
+    int               viewportX;
+
+    BenchStep         step[BENCH_MAX_STEPS];
+    int               nStep;
+    int               current;
+    long long         stepStart;
+    int               actions;
+
+    BenchHistogram    total;
+    BenchFrameCost    totalCost;
+    float             seconds;
+}
+BenchScenario;
 
 typedef struct _BenchDisplay
 {
     int  screenPrivateIndex;
     Bool active;
+
+    BenchTrace    *trace;
+    BenchScenario *scenario;
+
+    CompTimeoutHandle autostartHandle;
 }
 BenchDisplay;
 
+/* A texture a plugin has reported, see compiz-bench.h */
+typedef struct _BenchTexture
+{
+    const void    *key;
+    char          owner[32];
+    char          label[64];
+    unsigned long bytes;
+}
+BenchTexture;
+
+/* Laid out for GL_T2F_C4UB_V3F */
+typedef struct _BenchVertex
+{
+    GLfloat s, t;
+    GLubyte color[4];
+    GLfloat x, y, z;
+}
+BenchVertex;
+
+typedef struct _BenchProfileCall
+{
+    int       level;
+    int       prevActive;
+    Bool      timed;
+    long long start;
+    long long childNs;
+}
+BenchProfileCall;
+
 typedef struct _BenchScreen
 {
-    GLuint dList;
     float  rrVal;
     float  fps;
     float  alpha;
@@ -83,8 +355,51 @@ typedef struct _BenchScreen
     float ctime;
     float frames;
 
-    GLuint numTex[10];
-    GLuint backTex;
+    GLuint      atlasTex;
+    BenchVertex vertices[BENCH_MAX_QUADS * 4];
+    int         nVertex;
+
+    BenchHook hooks[BENCH_HOOK_NUM];
+
+    long long      frameStart;
+    float          frameInterval;
+    unsigned int   frameDamage;
+    int            frameOutputs;
+    int            frameWindows;
+    unsigned int   frameOverdraw;
+    unsigned int   outputDamage[BENCH_MAX_OUTPUTS];
+    int            outputWindows[BENCH_MAX_OUTPUTS];
+    int            paintingOutput;
+    float          cpuMs, gpuMs;
+    float          damagePct, windows, overdraw;
+
+    Region damageRegion;
+    Region tmpRegion;
+    Region overlayRegion;
+
+    BenchTexture  *textures;
+    int           nTexture;
+    int           textureSize;
+    unsigned long textureBytes;
+    BenchFrameCost cost;
+    BenchFrameCost stepCost;
+
+    Bool          timerQuery;
+    BenchGpuFrame gpuFrame[BENCH_GPU_SLOTS];
+    int           gpuSlot;
+
+    PFNGLGENQUERIESPROC           genQueries;
+    PFNGLDELETEQUERIESPROC        deleteQueries;
+    PFNGLQUERYCOUNTERPROC         queryCounter;
+    PFNGLGETQUERYOBJECTIVPROC     getQueryObjectiv;
+    PFNGLGETQUERYOBJECTUI64VPROC  getQueryObjectui64v;
+
+    int            ring[BENCH_RING_SIZE];
+    int            ringPos;
+    Bool           skipFrame;
+    BenchHistogram recent;
+    BenchHistogram period;
+    BenchHistogram step;
 
     PreparePaintScreenProc preparePaintScreen;
     DonePaintScreenProc    donePaintScreen;
@@ -92,370 +407,2378 @@ typedef struct _BenchScreen
 }
 BenchScreen;
 
+static int
+benchBucket (int us)
+{
+    return MIN (us / BENCH_BUCKET_US, BENCH_HIST_BUCKETS - 1);
+}
+
 static void
-benchPreparePaintScreen (CompScreen *s,
-			 int        ms)
+benchHistogramAdd (BenchHistogram *h,
+		   int            us,
+		   Bool           over)
+{
+    h->bucket[benchBucket (us)]++;
+    h->count++;
+    h->max = MAX (h->max, us);
+    if (over)
+	h->over++;
+}
+
+/* The recent histogram always describes the frames in the ring, its
+ * over budget count and maximum are only worked out when needed */
+static void
+benchAddFrame (CompScreen *s,
+	       int        us)
+{
+    Bool over = BENCH_OVER_BUDGET (us, s);
+
+    BENCH_SCREEN (s);
+
+    if (bs->recent.count == BENCH_RING_SIZE)
+	bs->recent.bucket[benchBucket (bs->ring[bs->ringPos])]--;
+    else
+	bs->recent.count++;
+
+    bs->ring[bs->ringPos] = us;
+    bs->ringPos = (bs->ringPos + 1) % BENCH_RING_SIZE;
+    bs->recent.bucket[benchBucket (us)]++;
+
+    benchHistogramAdd (&bs->period, us, over);
+    benchHistogramAdd (&bs->step, us, over);
+}
+
+static void
+benchResetFrames (BenchScreen *bs)
+{
+    memset (&bs->recent, 0, sizeof (BenchHistogram));
+    memset (&bs->period, 0, sizeof (BenchHistogram));
+    memset (&bs->step, 0, sizeof (BenchHistogram));
+    bs->ringPos = 0;
+
+    /* The first interval reaches back to before bench was started */
+    bs->skipFrame = TRUE;
+}
+
+/* In ms, the middle of the bucket holding the frame that is slower
+ * than the given fraction of all frames */
+static float
+benchPercentile (BenchHistogram *h,
+		 float          p)
+{
+    unsigned int n, rank = MAX (1, ceilf (h->count * p));
+    int          i;
+
+    for (i = 0, n = 0; i < BENCH_HIST_BUCKETS - 1; i++)
+    {
+	n += h->bucket[i];
+	if (n >= rank)
+	    return MIN ((i + 0.5f) * BENCH_BUCKET_US, h->max) / 1000.0f;
+    }
+
+    return h->max / 1000.0f;
+}
+
+static void
+benchSummarize (BenchHistogram    *h,
+		BenchFrameSummary *sum)
+{
+    sum->count = h->count;
+    sum->over  = h->over;
+    sum->max   = h->max / 1000.0f;
+    sum->p50   = h->count ? benchPercentile (h, 0.50f) : 0.0f;
+    sum->p90   = h->count ? benchPercentile (h, 0.90f) : 0.0f;
+    sum->p99   = h->count ? benchPercentile (h, 0.99f) : 0.0f;
+}
+
+static void
+benchSummarizeRecent (CompScreen        *s,
+		      BenchFrameSummary *sum)
+{
+    unsigned int i;
+
+    BENCH_SCREEN (s);
+
+    bs->recent.max = 0;
+    bs->recent.over = 0;
+
+    for (i = 0; i < bs->recent.count; i++)
+    {
+	bs->recent.max = MAX (bs->recent.max, bs->ring[i]);
+	if (BENCH_OVER_BUDGET (bs->ring[i], s))
+	    bs->recent.over++;
+    }
+
+    benchSummarize (&bs->recent, sum);
+}
+
+static long long
+benchNowNs (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* The damaged share of each output goes last, as an array in JSON
+ * and separated by semicolons in CSV */
+static void
+benchTraceWriteRecord (BenchTrace       *t,
+		       BenchTraceRecord *r)
+{
+    int i;
+
+    if (t->format == BENCH_TRACE_JSON)
+	fprintf (t->f, "{\"time_ms\":%.3f,\"screen\":%d,"
+		 "\"interval_ms\":%.3f,\"cpu_ms\":%.3f,"
+		 "\"damage_px\":%u,\"damage_pct\":%.2f,\"outputs\":%d,"
+		 "\"windows\":%d,\"overdraw\":%.2f,\"output_damage_pct\":[",
+		 r->time, r->screen, r->interval, r->cpu,
+		 r->damage, r->damagePct, r->outputs, r->windows, r->overdraw);
+    else
+	fprintf (t->f, "%.3f,%d,%.3f,%.3f,%u,%.2f,%d,%d,%.2f,",
+		 r->time, r->screen, r->interval, r->cpu,
+		 r->damage, r->damagePct, r->outputs, r->windows, r->overdraw);
+
+    for (i = 0; i < r->nOutput; i++)
+    {
+	if (i)
+	    fputc (t->format == BENCH_TRACE_JSON ? ',' : ';', t->f);
+	fprintf (t->f, "%.2f", r->outputPct[i]);
+    }
+
+    fprintf (t->f, t->format == BENCH_TRACE_JSON ? "]}\n" : "\n");
+}
+
+static void *
+benchTraceThread (void *data)
+{
+    BenchTrace       *t = data;
+    BenchTraceRecord *batch;
+    struct timespec  ts;
+    int              i, n;
+    Bool             stop = FALSE;
+
+    batch = malloc (BENCH_TRACE_RECORDS * sizeof (BenchTraceRecord));
+    if (!batch)
+	return NULL;
+
+    while (!stop)
+    {
+	pthread_mutex_lock (&t->mutex);
+
+	clock_gettime (CLOCK_REALTIME, &ts);
+	ts.tv_sec++;
+	while (!t->count && !t->stop)
+	    if (pthread_cond_timedwait (&t->cond, &t->mutex, &ts) == ETIMEDOUT)
+		break;
+
+	for (n = 0; n < t->count; n++)
+	    batch[n] = t->ring[(t->head + n) % BENCH_TRACE_RECORDS];
+	t->head = (t->head + n) % BENCH_TRACE_RECORDS;
+	t->count = 0;
+	stop = t->stop;
+
+	pthread_mutex_unlock (&t->mutex);
+
+	for (i = 0; i < n; i++)
+	    benchTraceWriteRecord (t, &batch[i]);
+
+	if (n)
+	    fflush (t->f);
+    }
+
+    free (batch);
+
+    return NULL;
+}
+
+static void
+benchTraceStart (CompDisplay *d)
+{
+    BenchTrace *t;
+    const char *path = benchGetTraceFile (d);
+
+    BENCH_DISPLAY (d);
+
+    if (bd->trace || !*path)
+	return;
+
+    t = calloc (1, sizeof (BenchTrace));
+    if (!t)
+	return;
+
+    t->f = fopen (path, "w");
+    if (!t->f)
+    {
+	compLogMessage ("bench", CompLogLevelWarn,
+			"Could not open trace file %s", path);
+	free (t);
+	return;
+    }
+
+    t->format = benchGetTraceFormat (d);
+    t->start = benchNowNs ();
+
+    if (t->format == BENCH_TRACE_CSV)
+	fprintf (t->f, "time_ms,screen,interval_ms,cpu_ms,damage_px,"
+		 "damage_pct,outputs,windows,overdraw,output_damage_pct\n");
+
+    pthread_mutex_init (&t->mutex, NULL);
+    pthread_cond_init (&t->cond, NULL);
+
+    if (pthread_create (&t->thread, NULL, benchTraceThread, t))
+    {
+	pthread_mutex_destroy (&t->mutex);
+	pthread_cond_destroy (&t->cond);
+	fclose (t->f);
+	free (t);
+	return;
+    }
+
+    bd->trace = t;
+}
+
+static void
+benchTraceStop (CompDisplay *d)
+{
+    BenchTrace *t;
+
+    BENCH_DISPLAY (d);
+
+    t = bd->trace;
+    if (!t)
+	return;
+
+    pthread_mutex_lock (&t->mutex);
+    t->stop = TRUE;
+    pthread_cond_signal (&t->cond);
+    pthread_mutex_unlock (&t->mutex);
+
+    pthread_join (t->thread, NULL);
+
+    if (t->dropped)
+	compLogMessage ("bench", CompLogLevelWarn,
+			"%u trace records dropped, the trace file could "
+			"not be written fast enough", t->dropped);
+
+    pthread_mutex_destroy (&t->mutex);
+    pthread_cond_destroy (&t->cond);
+    fclose (t->f);
+    free (t);
+
+    bd->trace = NULL;
+}
+
+static unsigned int
+benchRegionArea (Region region)
+{
+    unsigned int area = 0;
+    int          i;
+
+    for (i = 0; i < region->numRects; i++)
+	area += (region->rects[i].x2 - region->rects[i].x1) *
+		(region->rects[i].y2 - region->rects[i].y1);
+
+    return area;
+}
+
+static unsigned int
+benchOutputArea (CompScreen *s,
+		 int        output)
+{
+    return s->outputDev[output].width * s->outputDev[output].height;
+}
+
+/* Of all outputs together */
+static unsigned int
+benchScreenArea (CompScreen *s)
+{
+    unsigned int area = 0;
+    int          i;
+
+    for (i = 0; i < MIN (s->nOutputDev, BENCH_MAX_OUTPUTS); i++)
+	area += benchOutputArea (s, i);
+
+    return area;
+}
+
+static float
+benchDamagePct (CompScreen *s)
+{
+    unsigned int area = benchScreenArea (s);
+
+    BENCH_SCREEN (s);
+
+    return area ? bs->frameDamage * 100.0f / area : 0.0f;
+}
+
+/* Window pixels painted for every damaged pixel */
+static float
+benchOverdraw (BenchScreen *bs)
+{
+    return bs->frameDamage ? (float) bs->frameOverdraw / bs->frameDamage :
+			     0.0f;
+}
+
+static void
+benchTraceFrame (CompScreen *s,
+		 long long  cpuNs)
 {
+    BenchTrace       *t;
+    BenchTraceRecord *r;
+    int              i;
+
     BENCH_SCREEN (s);
     BENCH_DISPLAY (s->display);
 
-    float nRrVal;
-    float ratio = 0.05;
-    int   timediff;
+    t = bd->trace;
+    if (!t)
+	return;
 
-    struct timeval now;
+    pthread_mutex_lock (&t->mutex);
+
+    if (t->count == BENCH_TRACE_RECORDS)
+    {
+	t->dropped++;
+    }
+    else
+    {
+	r = &t->ring[(t->head + t->count) % BENCH_TRACE_RECORDS];
+	r->time = (bs->frameStart - t->start) / 1e6;
+	r->screen = s->screenNum;
+	r->interval = bs->frameInterval;
+	r->cpu = cpuNs / 1e6;
+	r->damage = bs->frameDamage;
+	r->damagePct = benchDamagePct (s);
+	r->outputs = bs->frameOutputs;
+	r->windows = bs->frameWindows;
+	r->overdraw = benchOverdraw (bs);
+
+	r->nOutput = MIN (s->nOutputDev, BENCH_MAX_OUTPUTS);
+	for (i = 0; i < r->nOutput; i++)
+	    r->outputPct[i] = bs->outputDamage[i] * 100.0f /
+			      MAX (1, benchOutputArea (s, i));
+
+	if (++t->count == BENCH_TRACE_RECORDS / 2)
+	    pthread_cond_signal (&t->cond);
+    }
+
+    pthread_mutex_unlock (&t->mutex);
+}
+
+static void
+benchCostAddCpu (BenchFrameCost *c,
+		 long long      ns)
+{
+    c->cpuNs += ns;
+    c->cpuMaxNs = MAX (c->cpuMaxNs, ns);
+    c->cpuFrames++;
+}
+
+static void
+benchCostAddGpu (BenchFrameCost *c,
+		 long long      ns)
+{
+    c->gpuNs += ns;
+    c->gpuMaxNs = MAX (c->gpuMaxNs, ns);
+    c->gpuFrames++;
+}
+
+static void
+benchCostAddDamage (BenchFrameCost *c,
+		    BenchScreen    *bs)
+{
+    int i;
+
+    c->damagePx += bs->frameDamage;
+    for (i = 0; i < BENCH_MAX_OUTPUTS; i++)
+	c->outputDamagePx[i] += bs->outputDamage[i];
+
+    c->windows += bs->frameWindows;
+    c->overdrawPx += bs->frameOverdraw;
+    c->damageFrames++;
+}
+
+/* CPU time is taken from the start of preparePaintScreen to the start
+ * of donePaintScreen, before bench waits for the X server */
+static void
+benchFrameBegin (CompScreen *s)
+{
+    BENCH_SCREEN (s);
+
+    bs->frameStart = benchNowNs ();
+    bs->frameDamage = 0;
+    bs->frameOutputs = 0;
+    bs->frameWindows = 0;
+    bs->frameOverdraw = 0;
+
+    memset (bs->outputDamage, 0, sizeof (bs->outputDamage));
+    memset (bs->outputWindows, 0, sizeof (bs->outputWindows));
+}
+
+/* Damaged area of each output, as painted from the top of the chain.
+ * Painting them all at once counts for each of them. The overlay is
+ * left out when bench damages only that. */
+static void
+benchFrameOutput (CompScreen *s,
+		  CompOutput *output,
+		  Region     region)
+{
+    unsigned int area;
+    int          i, first, last;
+
+    BENCH_SCREEN (s);
+    BENCH_DISPLAY (s->display);
+
+    bs->frameOutputs++;
+
+    if (output == &s->fullscreenOutput)
+    {
+	first = 0;
+	last = MIN (s->nOutputDev, BENCH_MAX_OUTPUTS);
+	bs->paintingOutput = -1;
+    }
+    else
+    {
+	first = output - s->outputDev;
+	last = MIN (first + 1, BENCH_MAX_OUTPUTS);
+	bs->paintingOutput = first < last ? first : -1;
+    }
+
+    if (!bd->active)
+	return;
+
+    if (XEmptyRegion (bs->overlayRegion))
+	XUnionRegion (region, bs->overlayRegion, bs->damageRegion);
+    else
+	XSubtractRegion (region, bs->overlayRegion, bs->damageRegion);
+
+    for (i = first; i < last; i++)
+    {
+	XIntersectRegion (bs->damageRegion, &s->outputDev[i].region,
+			  bs->tmpRegion);
+	area = benchRegionArea (bs->tmpRegion);
+
+	bs->outputDamage[i] += area;
+	bs->frameDamage += area;
+    }
+}
+
+/* A window drawn from the top of the chain, counted for the output
+ * being painted or every output it is on. The overdraw estimate adds
+ * up the part of each window inside the region it is drawn in. */
+static void
+benchFrameWindow (CompWindow *w,
+		  Region     region)
+{
+    CompScreen *s = w->screen;
+    BOX        *box, *out;
+    int        i;
+
+    BENCH_SCREEN (s);
+    BENCH_DISPLAY (s->display);
+
+    if (!bd->active)
+	return;
+
+    bs->frameWindows++;
+
+    if (bs->paintingOutput >= 0)
+    {
+	bs->outputWindows[bs->paintingOutput]++;
+    }
+    else
+    {
+	box = &w->region->extents;
+
+	for (i = 0; i < MIN (s->nOutputDev, BENCH_MAX_OUTPUTS); i++)
+	{
+	    out = &s->outputDev[i].region.extents;
+	    if (box->x1 < out->x2 && box->x2 > out->x1 &&
+		box->y1 < out->y2 && box->y2 > out->y1)
+		bs->outputWindows[i]++;
+	}
+    }
+
+    if (benchGetOverdrawEstimate (s->display))
+    {
+	XIntersectRegion (w->region, region, bs->tmpRegion);
+	bs->frameOverdraw += benchRegionArea (bs->tmpRegion);
+    }
+}
+
+static void
+benchFrameEnd (CompScreen *s)
+{
+    long long ns;
+    float     ratio = 0.05;
+
+    BENCH_SCREEN (s);
+    BENCH_DISPLAY (s->display);
+
+    if (!bd->active || !bs->frameStart)
+	return;
+
+    ns = benchNowNs () - bs->frameStart;
+    benchTraceFrame (s, ns);
+    bs->frameStart = 0;
+
+    bs->cpuMs = bs->cpuMs * (1.0 - ratio) + ns / 1e6 * ratio;
+    benchCostAddCpu (&bs->cost, ns);
+    benchCostAddCpu (&bs->stepCost, ns);
+
+    bs->damagePct = bs->damagePct * (1.0 - ratio) +
+		    benchDamagePct (s) * ratio;
+    bs->windows = bs->windows * (1.0 - ratio) + bs->frameWindows * ratio;
+    bs->overdraw = bs->overdraw * (1.0 - ratio) + benchOverdraw (bs) * ratio;
+    benchCostAddDamage (&bs->cost, bs);
+    benchCostAddDamage (&bs->stepCost, bs);
+}
+
+static void
+benchGpuOutputBegin (CompScreen *s,
+		     CompOutput *output)
+{
+    BenchGpuFrame *f;
+
+    BENCH_SCREEN (s);
+    BENCH_DISPLAY (s->display);
+
+    f = &bs->gpuFrame[bs->gpuSlot];
+
+    if (!bs->timerQuery || !bd->active || f->nOutput == BENCH_MAX_OUTPUTS)
+	return;
+
+    f->output[f->nOutput] = output == &s->fullscreenOutput ? -1 :
+			    output - s->outputDev;
+    (*bs->queryCounter) (f->query[f->nOutput * 2], GL_TIMESTAMP);
+}
+
+static void
+benchGpuOutputEnd (CompScreen *s)
+{
+    BenchGpuFrame *f;
+
+    BENCH_SCREEN (s);
+    BENCH_DISPLAY (s->display);
+
+    f = &bs->gpuFrame[bs->gpuSlot];
+
+    if (!bs->timerQuery || !bd->active || f->nOutput == BENCH_MAX_OUTPUTS)
+	return;
+
+    (*bs->queryCounter) (f->query[f->nOutput * 2 + 1], GL_TIMESTAMP);
+    f->nOutput++;
+}
+
+/* Switch to the other set of queries, taking in the results of the
+ * frame that used it if they are there. If not, that frame is lost. */
+static void
+benchGpuFrameDone (CompScreen *s)
+{
+    BenchGpuFrame *f;
+    GLuint64      begin, end;
+    GLint         available;
+    long long     ns = 0;
+    float         ratio = 0.05;
+    int           i, out;
+
+    BENCH_SCREEN (s);
+
+    if (!bs->timerQuery || !bs->gpuFrame[bs->gpuSlot].nOutput)
+	return;
+
+    bs->gpuSlot = (bs->gpuSlot + 1) % BENCH_GPU_SLOTS;
+    f = &bs->gpuFrame[bs->gpuSlot];
+
+    if (!f->nOutput)
+	return;
+
+    (*bs->getQueryObjectiv) (f->query[f->nOutput * 2 - 1],
+			     GL_QUERY_RESULT_AVAILABLE, &available);
+
+    for (i = 0; available && i < f->nOutput; i++)
+    {
+	(*bs->getQueryObjectui64v) (f->query[i * 2], GL_QUERY_RESULT, &begin);
+	(*bs->getQueryObjectui64v) (f->query[i * 2 + 1], GL_QUERY_RESULT,
+				    &end);
+
+	out = MAX (0, f->output[i]);
+	bs->cost.outputNs[out] += end - begin;
+	ns += end - begin;
+    }
+
+    if (available)
+    {
+	bs->gpuMs = bs->gpuMs * (1.0 - ratio) + ns / 1e6 * ratio;
+	benchCostAddGpu (&bs->cost, ns);
+	benchCostAddGpu (&bs->stepCost, ns);
+    }
+
+    f->nOutput = 0;
+}
+
+static BenchTexture *
+benchFindTexture (BenchScreen *bs,
+		  const void  *key)
+{
+    int i;
+
+    for (i = 0; i < bs->nTexture; i++)
+	if (bs->textures[i].key == key)
+	    return &bs->textures[i];
+
+    return NULL;
+}
+
+static void
+benchAddTexture (CompScreen    *s,
+		 const void    *key,
+		 const char    *owner,
+		 const char    *label,
+		 unsigned long bytes)
+{
+    BenchTexture *t;
+
+    BENCH_SCREEN (s);
+
+    t = benchFindTexture (bs, key);
+    if (!t)
+    {
+	if (bs->nTexture == bs->textureSize)
+	{
+	    t = realloc (bs->textures,
+			 (bs->textureSize + 16) * sizeof (BenchTexture));
+	    if (!t)
+		return;
+
+	    bs->textures = t;
+	    bs->textureSize += 16;
+	}
+
+	t = &bs->textures[bs->nTexture++];
+	t->key = key;
+	t->bytes = 0;
+    }
+
+    bs->textureBytes += bytes - t->bytes;
+    t->bytes = bytes;
+
+    snprintf (t->owner, sizeof (t->owner), "%s", owner);
+    snprintf (t->label, sizeof (t->label), "%s", label ? label : "");
+}
+
+static void
+benchRemoveTexture (CompScreen *s,
+		    const void *key)
+{
+    BenchTexture *t;
+
+    BENCH_SCREEN (s);
+
+    t = benchFindTexture (bs, key);
+    if (!t)
+	return;
+
+    bs->textureBytes -= t->bytes;
+    *t = bs->textures[--bs->nTexture];
+}
+
+static BenchFunc benchFunctions = {
+    .addTexture    = benchAddTexture,
+    .removeTexture = benchRemoveTexture
+};
+
+/* Totals per plugin, in the order they first reported */
+static void
+benchPrintTextures (CompScreen *s)
+{
+    unsigned long bytes;
+    int           i, j;
+
+    BENCH_SCREEN (s);
+
+    printf ("[BENCH] : textures %.1f MiB in %d", bs->textureBytes / 1048576.0,
+	    bs->nTexture);
+
+    for (i = 0; i < bs->nTexture; i++)
+    {
+	for (j = 0; j < i; j++)
+	    if (!strcmp (bs->textures[j].owner, bs->textures[i].owner))
+		break;
+
+	if (j < i)
+	    continue;
+
+	for (bytes = 0, j = i; j < bs->nTexture; j++)
+	    if (!strcmp (bs->textures[j].owner, bs->textures[i].owner))
+		bytes += bs->textures[j].bytes;
+
+	printf (", %s %.1f MiB", bs->textures[i].owner, bytes / 1048576.0);
+    }
+
+    printf ("\n");
+}
+
+static void
+benchPrintFrameCost (CompScreen *s)
+{
+    BenchFrameCost *c;
+    int            i;
+
+    BENCH_SCREEN (s);
+
+    c = &bs->cost;
+
+    if (c->cpuFrames)
+	printf ("[BENCH] : cpu %.2f ms per frame, max %.2f ms\n",
+		c->cpuNs / 1e6 / c->cpuFrames, c->cpuMaxNs / 1e6);
+
+    if (!c->gpuFrames)
+	return;
+
+    printf ("[BENCH] : gpu %.2f ms per frame, max %.2f ms",
+	    c->gpuNs / 1e6 / c->gpuFrames, c->gpuMaxNs / 1e6);
+
+    if (s->nOutputDev > 1)
+	for (i = 0; i < MIN (s->nOutputDev, BENCH_MAX_OUTPUTS); i++)
+	    printf (", output %d %.2f ms", i,
+		    c->outputNs[i] / 1e6 / c->gpuFrames);
+
+    printf ("\n");
+}
+
+static void
+benchPrintDamage (CompScreen *s)
+{
+    BenchFrameCost *c;
+    unsigned int   area = benchScreenArea (s);
+    int            i, n = MIN (s->nOutputDev, BENCH_MAX_OUTPUTS);
+
+    BENCH_SCREEN (s);
+
+    c = &bs->cost;
+
+    if (!c->damageFrames)
+	return;
+
+    printf ("[BENCH] : damage %.1f%% per frame, %.1f windows painted",
+	    area ? c->damagePx * 100.0 / area / c->damageFrames : 0.0,
+	    (double) c->windows / c->damageFrames);
+
+    if (benchGetOverdrawEstimate (s->display) && c->damagePx)
+	printf (", overdraw %.2f", (double) c->overdrawPx / c->damagePx);
+
+    if (n > 1)
+	for (i = 0; i < n; i++)
+	    printf (", output %d %.1f%%", i, c->outputDamagePx[i] * 100.0 /
+		    MAX (1, benchOutputArea (s, i)) / c->damageFrames);
+
+    printf ("\n");
+}
+
+static void
+benchGpuInit (CompScreen *s)
+{
+    const char *glExtensions;
+    int        i;
+
+    BENCH_SCREEN (s);
+
+    bs->timerQuery = FALSE;
+
+    glExtensions = (const char *) glGetString (GL_EXTENSIONS);
+    if (!glExtensions || !strstr (glExtensions, "GL_ARB_timer_query"))
+    {
+	compLogMessage ("bench", CompLogLevelInfo,
+			"GL_ARB_timer_query not supported, "
+			"GPU time is not measured");
+	return;
+    }
+
+    bs->genQueries = (PFNGLGENQUERIESPROC)
+	(*s->getProcAddress) ((GLubyte *) "glGenQueries");
+    bs->deleteQueries = (PFNGLDELETEQUERIESPROC)
+	(*s->getProcAddress) ((GLubyte *) "glDeleteQueries");
+    bs->queryCounter = (PFNGLQUERYCOUNTERPROC)
+	(*s->getProcAddress) ((GLubyte *) "glQueryCounter");
+    bs->getQueryObjectiv = (PFNGLGETQUERYOBJECTIVPROC)
+	(*s->getProcAddress) ((GLubyte *) "glGetQueryObjectiv");
+    bs->getQueryObjectui64v = (PFNGLGETQUERYOBJECTUI64VPROC)
+	(*s->getProcAddress) ((GLubyte *) "glGetQueryObjectui64v");
+
+    if (!bs->genQueries || !bs->deleteQueries || !bs->queryCounter ||
+	!bs->getQueryObjectiv || !bs->getQueryObjectui64v)
+	return;
+
+    for (i = 0; i < BENCH_GPU_SLOTS; i++)
+    {
+	(*bs->genQueries) (BENCH_MAX_OUTPUTS * 2, bs->gpuFrame[i].query);
+	bs->gpuFrame[i].nOutput = 0;
+    }
+
+    bs->gpuSlot = 0;
+    bs->timerQuery = TRUE;
+}
+
+static void
+benchGpuFini (CompScreen *s)
+{
+    int i;
+
+    BENCH_SCREEN (s);
+
+    if (!bs->timerQuery)
+	return;
+
+    for (i = 0; i < BENCH_GPU_SLOTS; i++)
+	(*bs->deleteQueries) (BENCH_MAX_OUTPUTS * 2, bs->gpuFrame[i].query);
+}
+
+static FuncPtr *
+benchHookSlot (CompScreen *s,
+	       int        hook)
+{
+    switch (hook) {
+    case BENCH_HOOK_PREPARE_PAINT_SCREEN:
+	return (FuncPtr *) &s->preparePaintScreen;
+    case BENCH_HOOK_PAINT_OUTPUT:
+	return (FuncPtr *) &s->paintOutput;
+    case BENCH_HOOK_PAINT_WINDOW:
+	return (FuncPtr *) &s->paintWindow;
+    case BENCH_HOOK_DRAW_WINDOW:
+	return (FuncPtr *) &s->drawWindow;
+    default:
+	return (FuncPtr *) &s->donePaintScreen;
+    }
+}
+
+static FuncPtr benchTrampoline[BENCH_HOOK_NUM];
+
+/* Leaves the real function of the level in the screen while it runs,
+ * just like without the trampoline, and returns it */
+static FuncPtr
+benchProfileEnter (CompScreen       *s,
+		   int              hook,
+		   BenchProfileCall *call)
+{
+    BenchHook *h;
+
+    BENCH_SCREEN (s);
+    BENCH_DISPLAY (s->display);
+
+    h = &bs->hooks[hook];
+
+    call->prevActive = h->active;
+    call->level = h->active < 0 ? h->nLevel - 1 : MAX (0, h->active - 1);
+    h->active = call->level;
+
+    call->childNs = h->childNs;
+    h->childNs = 0;
+
+    call->timed = bd->active && benchGetProfilePlugins (s->display);
+    if (call->timed)
+	call->start = benchNowNs ();
+
+    *benchHookSlot (s, hook) = h->level[call->level].real;
+
+    return h->level[call->level].real;
+}
+
+/* Time spent in the levels below is theirs, the rest is this one's */
+static void
+benchProfileLeave (CompScreen       *s,
+		   int              hook,
+		   BenchProfileCall *call)
+{
+    BenchHook  *h;
+    BenchLevel *level;
+    long long  elapsed;
+
+    BENCH_SCREEN (s);
+
+    h = &bs->hooks[hook];
+    level = &h->level[call->level];
+
+    if (call->timed)
+    {
+	elapsed = benchNowNs () - call->start;
+	level->selfNs += MAX (0, elapsed - h->childNs);
+	level->calls++;
+	h->childNs = call->childNs + elapsed;
+    }
+    else
+    {
+	h->childNs = call->childNs;
+    }
+
+    h->active = call->prevActive;
+
+    *benchHookSlot (s, hook) = benchTrampoline[hook];
+}
+
+static void
+benchProfilePreparePaintScreen (CompScreen *s,
+				int        ms)
+{
+    BenchProfileCall       call;
+    PreparePaintScreenProc real;
+
+    BENCH_SCREEN (s);
+
+    if (bs->hooks[BENCH_HOOK_PREPARE_PAINT_SCREEN].active < 0)
+	benchFrameBegin (s);
+
+    real = (PreparePaintScreenProc)
+	benchProfileEnter (s, BENCH_HOOK_PREPARE_PAINT_SCREEN, &call);
+    (*real) (s, ms);
+    benchProfileLeave (s, BENCH_HOOK_PREPARE_PAINT_SCREEN, &call);
+}
+
+static Bool
+benchProfilePaintOutput (CompScreen              *s,
+			 const ScreenPaintAttrib *sa,
+			 const CompTransform     *transform,
+			 Region                  region,
+			 CompOutput              *output,
+			 unsigned int            mask)
+{
+    BenchProfileCall call;
+    PaintOutputProc  real;
+    Bool             status;
+
+    real = (PaintOutputProc)
+	benchProfileEnter (s, BENCH_HOOK_PAINT_OUTPUT, &call);
+
+    /* GPU time covers the whole output, as painted from the top */
+    if (call.prevActive < 0)
+    {
+	benchFrameOutput (s, output, region);
+	benchGpuOutputBegin (s, output);
+    }
+    status = (*real) (s, sa, transform, region, output, mask);
+    if (call.prevActive < 0)
+	benchGpuOutputEnd (s);
+    benchProfileLeave (s, BENCH_HOOK_PAINT_OUTPUT, &call);
+
+    return status;
+}
+
+static Bool
+benchProfilePaintWindow (CompWindow              *w,
+			 const WindowPaintAttrib *attrib,
+			 const CompTransform     *transform,
+			 Region                  region,
+			 unsigned int            mask)
+{
+    BenchProfileCall call;
+    PaintWindowProc  real;
+    Bool             status;
+
+    real = (PaintWindowProc)
+	benchProfileEnter (w->screen, BENCH_HOOK_PAINT_WINDOW, &call);
+    status = (*real) (w, attrib, transform, region, mask);
+    benchProfileLeave (w->screen, BENCH_HOOK_PAINT_WINDOW, &call);
+
+    return status;
+}
+
+static Bool
+benchProfileDrawWindow (CompWindow           *w,
+			const CompTransform  *transform,
+			const FragmentAttrib *fragment,
+			Region               region,
+			unsigned int         mask)
+{
+    BenchProfileCall call;
+    DrawWindowProc   real;
+    Bool             status;
+
+    real = (DrawWindowProc)
+	benchProfileEnter (w->screen, BENCH_HOOK_DRAW_WINDOW, &call);
+    if (call.prevActive < 0)
+	benchFrameWindow (w, region);
+    status = (*real) (w, transform, fragment, region, mask);
+    benchProfileLeave (w->screen, BENCH_HOOK_DRAW_WINDOW, &call);
+
+    return status;
+}
+
+static void
+benchProfileDonePaintScreen (CompScreen *s)
+{
+    BenchProfileCall    call;
+    DonePaintScreenProc real;
+
+    BENCH_SCREEN (s);
+
+    if (bs->hooks[BENCH_HOOK_DONE_PAINT_SCREEN].active < 0)
+	benchFrameEnd (s);
+
+    real = (DonePaintScreenProc)
+	benchProfileEnter (s, BENCH_HOOK_DONE_PAINT_SCREEN, &call);
+    (*real) (s);
+    benchProfileLeave (s, BENCH_HOOK_DONE_PAINT_SCREEN, &call);
+}
+
+static FuncPtr benchTrampoline[BENCH_HOOK_NUM] = {
+    (FuncPtr) benchProfilePreparePaintScreen,
+    (FuncPtr) benchProfilePaintOutput,
+    (FuncPtr) benchProfilePaintWindow,
+    (FuncPtr) benchProfileDrawWindow,
+    (FuncPtr) benchProfileDonePaintScreen
+};
+
+static void
+benchProfileReset (BenchScreen *bs)
+{
+    int i, j;
+
+    for (i = 0; i < BENCH_HOOK_NUM; i++)
+    {
+	for (j = 0; j < bs->hooks[i].nLevel; j++)
+	{
+	    bs->hooks[i].level[j].selfNs = 0;
+	    bs->hooks[i].level[j].calls = 0;
+	}
+    }
+}
+
+/* Called after a plugin has been initialized for the screen, with the
+ * functions it wrapped itself around in the screen */
+static void
+benchProfilePush (CompScreen *s,
+		  CompPlugin *p)
+{
+    BenchHook *h;
+    FuncPtr   *slot;
+    int       i;
+
+    BENCH_SCREEN (s);
+
+    for (i = 0; i < BENCH_HOOK_NUM; i++)
+    {
+	h = &bs->hooks[i];
+	slot = benchHookSlot (s, i);
+
+	if (*slot == benchTrampoline[i] || h->nLevel == BENCH_MAX_LEVELS)
+	    continue;
+
+	memset (&h->level[h->nLevel], 0, sizeof (BenchLevel));
+	h->level[h->nLevel].plugin = p;
+	h->level[h->nLevel].real = *slot;
+	h->nLevel++;
+
+	*slot = benchTrampoline[i];
+    }
+}
+
+/* Without plugin profiling, plugins get no level of their own: the
+ * trampolines come off while one wraps the hooks, so that it wraps the
+ * function of the top level, and go back on over it, leaving one
+ * trampoline per hook for the frame statistics */
+static void
+benchProfileUncover (CompScreen *s)
+{
+    BenchHook *h;
+    int       i;
+
+    BENCH_SCREEN (s);
+
+    for (i = 0; i < BENCH_HOOK_NUM; i++)
+    {
+	h = &bs->hooks[i];
+	*benchHookSlot (s, i) = h->level[h->nLevel - 1].real;
+    }
+}
+
+/* The plugin that wrapped or unwrapped a hook becomes the function of
+ * the top level */
+static void
+benchProfileCover (CompScreen *s)
+{
+    BenchHook *h;
+    FuncPtr   *slot;
+    int       i;
+
+    BENCH_SCREEN (s);
+
+    for (i = 0; i < BENCH_HOOK_NUM; i++)
+    {
+	h = &bs->hooks[i];
+	slot = benchHookSlot (s, i);
+
+	if (*slot == benchTrampoline[i])
+	    continue;
+
+	h->level[h->nLevel - 1].real = *slot;
+	*slot = benchTrampoline[i];
+    }
+}
+
+/* Plugins are unloaded in reverse order, so p is on top of the chains
+ * it is in, and has just unwrapped itself */
+static void
+benchProfilePop (CompScreen *s,
+		 CompPlugin *p)
+{
+    BenchHook *h;
+    int       i;
+
+    BENCH_SCREEN (s);
+
+    for (i = 0; i < BENCH_HOOK_NUM; i++)
+    {
+	h = &bs->hooks[i];
+	if (h->nLevel > 1 && h->level[h->nLevel - 1].plugin == p)
+	    h->nLevel--;
+    }
+}
+
+static void
+benchProfileInit (CompScreen *s)
+{
+    FuncPtr *slot;
+    int     i;
+
+    BENCH_SCREEN (s);
+
+    for (i = 0; i < BENCH_HOOK_NUM; i++)
+    {
+	slot = benchHookSlot (s, i);
+
+	bs->hooks[i].level[0].plugin = NULL;
+	bs->hooks[i].level[0].real = *slot;
+	bs->hooks[i].nLevel = 1;
+	bs->hooks[i].active = -1;
+
+	*slot = benchTrampoline[i];
+    }
+}
+
+static void
+benchProfileFini (CompScreen *s)
+{
+    int i;
+
+    BENCH_SCREEN (s);
+
+    for (i = 0; i < BENCH_HOOK_NUM; i++)
+	*benchHookSlot (s, i) = bs->hooks[i].level[0].real;
+}
+
+typedef struct _BenchPluginCost
+{
+    CompPlugin *plugin;
+    long long  ns[BENCH_HOOK_NUM];
+    long long  total;
+}
+BenchPluginCost;
+
+static int
+benchCompareCost (const void *a,
+		  const void *b)
+{
+    const BenchPluginCost *ca = a, *cb = b;
+
+    return (ca->total < cb->total) - (ca->total > cb->total);
+}
+
+/* Most expensive plugin first, with its time per frame in each hook */
+static void
+benchPrintProfile (CompScreen *s,
+		   float      frames)
+{
+    BenchPluginCost cost[BENCH_MAX_LEVELS * BENCH_HOOK_NUM];
+    BenchLevel      *level;
+    int             i, j, k, n = 0;
+
+    BENCH_SCREEN (s);
+
+    if (frames < 1)
+	return;
+
+    for (i = 0; i < BENCH_HOOK_NUM; i++)
+    {
+	for (j = 0; j < bs->hooks[i].nLevel; j++)
+	{
+	    level = &bs->hooks[i].level[j];
+
+	    for (k = 0; k < n; k++)
+		if (cost[k].plugin == level->plugin)
+		    break;
+
+	    if (k == n)
+	    {
+		memset (&cost[n], 0, sizeof (BenchPluginCost));
+		cost[n++].plugin = level->plugin;
+	    }
+
+	    cost[k].ns[i] += level->selfNs;
+	    cost[k].total += level->selfNs;
+	}
+    }
+
+    qsort (cost, n, sizeof (BenchPluginCost), benchCompareCost);
+
+    printf ("[BENCH] : ms per frame   total prepare  output  window"
+	    "    draw    done\n");
+
+    for (k = 0; k < n; k++)
+    {
+	printf ("[BENCH] : %-12s %7.3f",
+		cost[k].plugin ? cost[k].plugin->vTable->name : "core",
+		cost[k].total / frames / 1e6);
+	for (i = 0; i < BENCH_HOOK_NUM; i++)
+	    printf (" %7.3f", cost[k].ns[i] / frames / 1e6);
+	printf ("\n");
+    }
+}
+
+static void
+benchPreparePaintScreen (CompScreen *s,
+			 int        ms)
+{
+    BENCH_SCREEN (s);
+    BENCH_DISPLAY (s->display);
+
+    float nRrVal;
+    float ratio = 0.05;
+    int   timediff;
+
+    struct timeval now;
+
+    gettimeofday (&now, 0);
+
+    timediff = TIMEVALDIFF (&now, &bs->lastRedraw);
+
+    nRrVal = MIN (1.1, (float) s->optimalRedrawTime / (float) timediff);
+
+    bs->rrVal = (bs->rrVal * (1.0 - ratio) ) + (nRrVal * ratio);
+
+    bs->fps = (bs->fps * (1.0 - ratio) ) +
+	      (1000000.0 / TIMEVALDIFFU (&now, &bs->lastRedraw) * ratio);
+
+    bs->frameInterval = TIMEVALDIFFU (&now, &bs->lastRedraw) / 1000.0f;
+    if (bd->active && !bs->skipFrame)
+	benchAddFrame (s, TIMEVALDIFFU (&now, &bs->lastRedraw));
+    bs->skipFrame = FALSE;
+
+    bs->lastRedraw = now;
+    bs->nVertex = -1;
+
+    if (benchGetOutputConsole (s->display) && bd->active)
+    {
+	bs->frames++;
+	bs->ctime += timediff;
+
+	if (bs->ctime >
+	    benchGetConsoleUpdateTime (s->display) * 1000)
+	{
+	    BenchFrameSummary sum;
+
+	    benchSummarize (&bs->period, &sum);
+
+	    printf ("[BENCH] : %.0f frames in %.1f seconds = %.3f FPS\n",
+		    bs->frames, bs->ctime / 1000.0,
+		    bs->frames / (bs->ctime / 1000.0) );
+	    printf ("[BENCH] : frame time p50 %.1f ms, p90 %.1f ms, "
+		    "p99 %.1f ms, max %.1f ms, %u of %u frames over "
+		    "%d ms budget\n", sum.p50, sum.p90, sum.p99, sum.max,
+		    sum.over, sum.count, s->optimalRedrawTime);
+	    benchPrintFrameCost (s);
+	    benchPrintDamage (s);
+	    benchPrintTextures (s);
+	    if (benchGetProfilePlugins (s->display))
+		benchPrintProfile (s, bs->frames);
+
+	    bs->frames = 0;
+	    bs->ctime = 0;
+	    memset (&bs->period, 0, sizeof (BenchHistogram));
+	    memset (&bs->cost, 0, sizeof (BenchFrameCost));
+	    benchProfileReset (bs);
+	}
+    }
+
+    UNWRAP (bs, s, preparePaintScreen);
+    (*s->preparePaintScreen) (s, (bs->alpha > 0.0) ? timediff : ms);
+    WRAP (bs, s, preparePaintScreen, benchPreparePaintScreen);
+
+    if (bd->active)
+	bs->alpha += timediff / 1000.0;
+    else
+	bs->alpha -= timediff / 1000.0;
+
+    bs->alpha = MIN (1.0, MAX (0.0, bs->alpha) );
+}
+
+/* Keeps the screen repainting. With full repaint off only the overlay
+ * is damaged, and left out of the damage counted, so that what the
+ * desktop and the plugins repaint by themselves shows. */
+static void
+benchDamage (CompScreen *s)
+{
+    BENCH_SCREEN (s);
+
+    EMPTY_REGION (bs->overlayRegion);
+
+    if (benchGetFullRepaint (s->display))
+    {
+	damageScreen (s);
+	return;
+    }
+
+    if (benchGetOutputScreen (s->display))
+    {
+	XRectangle rect;
+
+	rect.x = benchGetPositionX (s->display);
+	rect.y = benchGetPositionY (s->display);
+	rect.width = 512;
+	rect.height = BENCH_GRAPH_Y + BENCH_GRAPH_HEIGHT + 4;
+
+	XUnionRectWithRegion (&rect, bs->overlayRegion, bs->overlayRegion);
+	damageScreenRegion (s, bs->overlayRegion);
+    }
+}
+
+static void
+benchDonePaintScreen (CompScreen *s)
+{
+    BENCH_SCREEN (s);
+    BENCH_DISPLAY (s->display);
+
+    benchGpuFrameDone (s);
+
+    if (bs->alpha > 0.0)
+    {
+	benchDamage (s);
+	glFlush();
+	XSync (s->display->display, FALSE);
+
+	if (benchGetDisableLimiter (s->display) )
+	{
+	    s->lastRedraw = bs->initTime;
+	    s->timeMult = 0;
+	}
+
+	if (!bd->active)
+	    s->timeMult = 0;
+    }
+
+    UNWRAP (bs, s, donePaintScreen);
+    (*s->donePaintScreen) (s);
+    WRAP (bs, s, donePaintScreen, benchDonePaintScreen);
+}
+
+static void
+benchColor (GLubyte *c,
+	    float   r,
+	    float   g,
+	    float   b,
+	    float   a)
+{
+    c[0] = r * 255.0f;
+    c[1] = g * 255.0f;
+    c[2] = b * 255.0f;
+    c[3] = a * 255.0f;
+}
+
+/* Queues a quad from the atlas, the left and right edges colored
+ * separately for the gradient of the redraw bar */
+static void
+benchAddQuad (BenchScreen   *bs,
+	      float         x1,
+	      float         y1,
+	      float         x2,
+	      float         y2,
+	      float         s1,
+	      float         t1,
+	      float         s2,
+	      float         t2,
+	      const GLubyte *left,
+	      const GLubyte *right)
+{
+    BenchVertex *v;
+    int         i;
+
+    if (bs->nVertex + 4 > BENCH_MAX_QUADS * 4)
+	return;
+
+    v = &bs->vertices[bs->nVertex];
+    bs->nVertex += 4;
+
+    v[0].s = s1; v[0].t = t1; v[0].x = x1; v[0].y = y1;
+    v[1].s = s1; v[1].t = t2; v[1].x = x1; v[1].y = y2;
+    v[2].s = s2; v[2].t = t2; v[2].x = x2; v[2].y = y2;
+    v[3].s = s2; v[3].t = t1; v[3].x = x2; v[3].y = y1;
+
+    for (i = 0; i < 4; i++)
+    {
+	memcpy (v[i].color, (i < 2) ? left : right, 4);
+	v[i].z = 0.0f;
+    }
+}
+
+/* Untextured quads sample the white block of the atlas */
+static void
+benchAddGradient (BenchScreen   *bs,
+		  float         x1,
+		  float         y1,
+		  float         x2,
+		  float         y2,
+		  const GLubyte *left,
+		  const GLubyte *right)
+{
+    float s = (BENCH_ATLAS_WHITE_X + 4.0f) / BENCH_ATLAS_SIZE;
+    float t = (BENCH_ATLAS_DIGIT_Y + 4.0f) / BENCH_ATLAS_SIZE;
+
+    benchAddQuad (bs, x1, y1, x2, y2, s, t, s, t, left, right);
+}
+
+static void
+benchAddRect (BenchScreen   *bs,
+	      float         x1,
+	      float         y1,
+	      float         x2,
+	      float         y2,
+	      const GLubyte *color)
+{
+    benchAddGradient (bs, x1, y1, x2, y2, color, color);
+}
+
+static void
+benchAddDigit (BenchScreen   *bs,
+	       float         x,
+	       float         y,
+	       int           digit,
+	       const GLubyte *color)
+{
+    float s = digit * BENCH_ATLAS_DIGIT_PITCH;
+    float t = BENCH_ATLAS_DIGIT_Y;
+
+    benchAddQuad (bs, x, y, x + 16, y + 32,
+		  s / BENCH_ATLAS_SIZE, t / BENCH_ATLAS_SIZE,
+		  (s + 16) / BENCH_ATLAS_SIZE, (t + 32) / BENCH_ATLAS_SIZE,
+		  color, color);
+}
+
+/* Queues value / 10 with one decimal, or value as is. The decimal
+ * point is left as a gap like in the FPS display. */
+static void
+benchAddNumber (BenchScreen   *bs,
+		float         x,
+		float         y,
+		unsigned int  value,
+		Bool          decimal,
+		const GLubyte *color)
+{
+    char digits[16];
+    int  i, n;
+
+    n = snprintf (digits, sizeof (digits), decimal ? "%02u" : "%u",
+		  MIN (value, 99999));
+
+    for (i = 0; i < n; i++)
+    {
+	if (decimal && i == n - 1)
+	    x += 7;
+
+	benchAddDigit (bs, x, y, digits[i] - '0', color);
+	x += 12;
+    }
+}
+
+/* The redraw bar, its scale and the FPS, on the background image */
+static void
+benchAddFps (BenchScreen *bs)
+{
+    GLubyte      red[4], yellow[4], end[4], black[4];
+    float        rrVal = MIN (1.0, MAX (0.0, bs->rrVal));
+    float        r, x;
+    unsigned int fps, div;
+    int          i, digit;
+    Bool         isSet = FALSE;
+
+    benchColor (red, 1.0, 0.0, 0.0, bs->alpha);
+    benchColor (yellow, 1.0, 1.0, 0.0, bs->alpha);
+    benchColor (black, 0.0, 0.0, 0.0, bs->alpha);
+
+    if (rrVal < 0.5)
+    {
+	benchColor (end, 1.0, rrVal * 2.0, 0.0, bs->alpha);
+	benchAddGradient (bs, 53, 83, 53 + 330.0 * rrVal, 108, red, end);
+    }
+    else
+    {
+	benchColor (end, 1.0 - ((rrVal - 0.5) * 2.0), 1.0, 0.0, bs->alpha);
+	benchAddGradient (bs, 53, 83, 218, 108, red, yellow);
+	benchAddGradient (bs, 218, 83, 218 + 330.0 * (rrVal - 0.5), 108,
+			  yellow, end);
+    }
+
+    benchAddRect (bs, 52, 82, 54, 109, black);
+    benchAddRect (bs, 382, 82, 384, 109, black);
+    benchAddRect (bs, 54, 82, 382, 84, black);
+    benchAddRect (bs, 54, 107, 382, 109, black);
+
+    for (i = 33; i < 330; i += 33)
+	benchAddRect (bs, 53 + i - 0.5, 98, 53 + i + 0.5, 108, black);
+
+    for (i = 16; i < 330; i += 33)
+	benchAddRect (bs, 53 + i - 0.5, 103, 53 + i + 0.5, 108, black);
+
+    if (bs->fps > 30.0)
+	r = 0.0;
+    else
+	r = 1.0;
+
+    if (bs->fps <= 30.0 && bs->fps > 20.0)
+	r = 1.0 - ((bs->fps - 20.0) / 10.0);
+
+    benchColor (end, r, 0.0, 0.0, bs->alpha);
+
+    /* Right aligned, leading zeros left out down to the units */
+    fps = MIN (999999, bs->fps * 100.0);
+    x = 125;
+
+    for (i = 0, div = 100000; i < 6; i++, div /= 10)
+    {
+	digit = (fps / div) % 10;
+	isSet |= digit || i >= 3;
+
+	if (isSet)
+	    benchAddDigit (bs, x, 128, digit, end);
+
+	x += (i == 3) ? 19 : 12;
+    }
+}
+
+/* Below the FPS display, from left to right: p50, p90 and p99 frame
+ * time of the recent frames, their longest frame time, all in ms, and
+ * how many of them were over budget. Below that CPU and, where timer
+ * queries are supported, GPU time per frame in ms, the damaged share
+ * of the screen in percent, the windows painted and the overdraw.
+ * Last the reported texture memory in MiB and number of textures. */
+static void
+benchAddFrameTimes (CompScreen *s)
+{
+    BenchFrameSummary sum;
+    GLubyte           color[4];
+    float             values[4];
+    int               i;
+
+    BENCH_SCREEN (s);
+
+    benchSummarizeRecent (s, &sum);
+    values[0] = sum.p50;
+    values[1] = sum.p90;
+    values[2] = sum.p99;
+    values[3] = sum.max;
+
+    benchColor (color, 1.0, 1.0, 1.0, bs->alpha * 0.75);
+    benchAddRect (bs, 0, 256, 512, 384, color);
+
+    for (i = 0; i < 4; i++)
+    {
+	if (BENCH_OVER_BUDGET (values[i] * 1000.0f, s))
+	    benchColor (color, 1.0, 0.0, 0.0, bs->alpha);
+	else
+	    benchColor (color, 0.0, 0.0, 0.0, bs->alpha);
+
+	benchAddNumber (bs, 16 + i * 96, 264, values[i] * 10.0f + 0.5f,
+			TRUE, color);
+    }
+
+    benchColor (color, sum.over ? 1.0 : 0.0, 0.0, 0.0, bs->alpha);
+    benchAddNumber (bs, 16 + 4 * 96, 264, sum.over, FALSE, color);
+
+    benchColor (color, 0.0, 0.0, 0.0, bs->alpha);
+    benchAddNumber (bs, 16, 304, bs->cpuMs * 10.0f + 0.5f, TRUE, color);
+
+    if (bs->timerQuery)
+	benchAddNumber (bs, 112, 304, bs->gpuMs * 10.0f + 0.5f, TRUE, color);
+
+    benchAddNumber (bs, 208, 304, bs->damagePct * 10.0f + 0.5f, TRUE, color);
+    benchAddNumber (bs, 304, 304, bs->windows + 0.5f, FALSE, color);
+
+    if (benchGetOverdrawEstimate (s->display))
+	benchAddNumber (bs, 400, 304, bs->overdraw * 10.0f + 0.5f, TRUE,
+			color);
+
+    benchAddNumber (bs, 16, 344, bs->textureBytes / 104857.6f + 0.5f, TRUE,
+		    color);
+    benchAddNumber (bs, 112, 344, bs->nTexture, FALSE, color);
+}
+
+/* One bar per frame in the ring, newest on the right, scaled so that
+ * the graph is four optimal redraw times high, with a line at each
+ * of them. Bars over budget are red. */
+static void
+benchAddGraph (CompScreen *s)
+{
+    GLubyte color[4], over[4], line[4];
+    float   bottom = BENCH_GRAPH_Y + BENCH_GRAPH_HEIGHT;
+    float   scale;
+    int     i, first, us;
+
+    BENCH_SCREEN (s);
+
+    scale = BENCH_GRAPH_HEIGHT / (4000.0f * MAX (1, s->optimalRedrawTime));
+
+    benchColor (color, 1.0, 1.0, 1.0, bs->alpha * 0.75);
+    benchAddRect (bs, 0, BENCH_GRAPH_Y - 4, 512, bottom + 4, color);
+
+    benchColor (color, 0.0, 0.5, 0.0, bs->alpha);
+    benchColor (over, 1.0, 0.0, 0.0, bs->alpha);
+    benchColor (line, 0.0, 0.0, 0.0, bs->alpha * 0.5);
+
+    first = (bs->recent.count == BENCH_RING_SIZE) ? bs->ringPos : 0;
+
+    for (i = 0; i < bs->recent.count; i++)
+    {
+	us = bs->ring[(first + i) % BENCH_RING_SIZE];
+
+	benchAddRect (bs, BENCH_RING_SIZE - bs->recent.count + i,
+		      bottom - MIN (BENCH_GRAPH_HEIGHT, us * scale),
+		      BENCH_RING_SIZE - bs->recent.count + i + 1, bottom,
+		      BENCH_OVER_BUDGET (us, s) ? over : color);
+    }
+
+    for (i = 1; i < 4; i++)
+	benchAddRect (bs, 0, bottom - i * BENCH_GRAPH_HEIGHT / 4.0f,
+		      512, bottom - i * BENCH_GRAPH_HEIGHT / 4.0f + 1, line);
+}
+
+static Bool
+benchPaintOutput (CompScreen              *s,
+		  const ScreenPaintAttrib *sa,
+		  const CompTransform     *transform,
+		  Region                  region,
+		  CompOutput              *output,
+		  unsigned int            mask)
+{
+    Bool          status;
+    GLubyte       white[4];
+    CompTransform sTransform = *transform;
+
+    BENCH_SCREEN (s);
+
+    UNWRAP (bs, s, paintOutput);
+    status = (*s->paintOutput) (s, sa, transform, region, output, mask);
+    WRAP (bs, s, paintOutput, benchPaintOutput);
+
+    if (bs->alpha <= 0.0
+	|| !benchGetOutputScreen (s->display) )
+	return status;
+
+    /* Everything is queued once per frame and drawn again as is on
+     * the other outputs */
+    if (bs->nVertex < 0)
+    {
+	bs->nVertex = 0;
+
+	benchColor (white, 1.0, 1.0, 1.0, bs->alpha);
+	benchAddQuad (bs, 0, 0, 512, 256, 0, 0, 1,
+		      256.0f / BENCH_ATLAS_SIZE, white, white);
+
+	benchAddFps (bs);
+	benchAddFrameTimes (s);
+	benchAddGraph (s);
+    }
+
+    glGetError();
+    glPushAttrib (GL_COLOR_BUFFER_BIT | GL_TEXTURE_BIT);
+    glPushClientAttrib (GL_CLIENT_VERTEX_ARRAY_BIT);
+    GLERR;
+
+    transformToScreenSpace (s, output, -DEFAULT_Z_CAMERA, &sTransform);
+
+    glPushMatrix ();
+    glLoadMatrixf (sTransform.m);
+    glTranslatef (benchGetPositionX (s->display),
+		  benchGetPositionY (s->display), 0);
+
+    glEnable (GL_BLEND);
+    glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glTexEnvf (GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+
+    glEnable (GL_TEXTURE_2D);
+    glBindTexture (GL_TEXTURE_2D, bs->atlasTex);
+
+    glInterleavedArrays (GL_T2F_C4UB_V3F, 0, bs->vertices);
+    glDrawArrays (GL_QUADS, 0, bs->nVertex);
+
+    glBindTexture (GL_TEXTURE_2D, 0);
+    glDisable (GL_TEXTURE_2D);
+
+    glPopMatrix();
+
+    glTexEnvf (GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+
+    glColor4f (1.0, 1.0, 1.0, 1.0);
+
+    glPopClientAttrib ();
+    glPopAttrib();
+    glGetError();
+
+    return status;
+}
+
+static void
+benchResetStats (CompScreen *s)
+{
+    int i;
+
+    BENCH_SCREEN (s);
+
+    bs->ctime = 0;
+    bs->frames = 0;
+    benchResetFrames (bs);
+    benchProfileReset (bs);
+    memset (&bs->cost, 0, sizeof (BenchFrameCost));
+    memset (&bs->stepCost, 0, sizeof (BenchFrameCost));
+
+    /* Queries left from the last run are stale */
+    for (i = 0; i < BENCH_GPU_SLOTS; i++)
+	bs->gpuFrame[i].nOutput = 0;
+}
+
+/* Steps are separated by semicolons or commas, each a name and an
+ * optional length in seconds, one second by default */
+static int
+benchScenarioParse (const char *script,
+		    BenchStep  *step)
+{
+    char  *copy, *token, *save;
+    char  name[16];
+    float seconds;
+    int   n = 0, type;
+
+    copy = strdup (script);
+    if (!copy)
+	return 0;
+
+    for (token = strtok_r (copy, ";,", &save); token && n < BENCH_MAX_STEPS;
+	 token = strtok_r (NULL, ";,", &save))
+    {
+	seconds = 1.0f;
+	if (sscanf (token, " %15s %f", name, &seconds) < 1)
+	    continue;
+
+	for (type = 0; type < BENCH_STEP_NUM; type++)
+	    if (!strcmp (name, benchStepName[type]))
+		break;
+
+	if (type == BENCH_STEP_NUM || seconds <= 0.0f)
+	{
+	    compLogMessage ("bench", CompLogLevelWarn,
+			    "Ignoring scenario step \"%s\"", token);
+	    continue;
+	}
+
+	memset (&step[n], 0, sizeof (BenchStep));
+	step[n].type = type;
+	step[n].ms = seconds * 1000;
+	n++;
+    }
+
+    free (copy);
+
+    return n;
+}
+
+/* Test windows are laid out in a grid, each taking half of its cell
+ * so that moving and resizing them keeps them apart */
+static void
+benchScenarioLayout (BenchScenario *sc)
+{
+    CompScreen *s = sc->screen;
+    int        i, cols, rows, cellW, cellH;
+
+    cols = ceilf (sqrtf (sc->nWindow));
+    rows = (sc->nWindow + cols - 1) / cols;
+    cellW = s->width / cols;
+    cellH = s->height / rows;
+
+    for (i = 0; i < sc->nWindow; i++)
+    {
+	sc->window[i].id = None;
+	sc->window[i].width = cellW / 2;
+	sc->window[i].height = cellH / 2;
+	sc->window[i].x = (i % cols) * cellW + cellW / 4;
+	sc->window[i].y = (i / cols) * cellH + cellH / 4;
+    }
+
+    sc->radius = MIN (cellW, cellH) / 8;
+}
+
+static void
+benchScenarioOpenWindow (BenchScenario   *sc,
+			 BenchTestWindow *tw,
+			 int             i)
+{
+    Display    *dpy = sc->dpy;
+    int        screen = sc->screen->screenNum;
+    XSizeHints hints;
+    XColor     color;
+    char       name[32];
+
+    if (tw->id)
+	return;
+
+    /* Fixed colours, so that every run paints the same */
+    color.red   = (i * 0x3500 + 0x4000) & 0xffff;
+    color.green = (i * 0x7300 + 0x8000) & 0xffff;
+    color.blue  = (i * 0xb900 + 0xc000) & 0xffff;
+    if (!XAllocColor (dpy, DefaultColormap (dpy, screen), &color))
+	color.pixel = WhitePixel (dpy, screen);
+
+    tw->id = XCreateSimpleWindow (dpy, RootWindow (dpy, screen),
+				  tw->x, tw->y, tw->width, tw->height, 0,
+				  0, color.pixel);
+    tw->iconic = FALSE;
+
+    /* Keep placement out of it */
+    hints.flags = USPosition | USSize;
+    hints.x = tw->x;
+    hints.y = tw->y;
+    hints.width = tw->width;
+    hints.height = tw->height;
+    XSetWMNormalHints (dpy, tw->id, &hints);
+
+    snprintf (name, sizeof (name), "bench %d", i + 1);
+    XStoreName (dpy, tw->id, name);
+
+    XMapWindow (dpy, tw->id);
+}
+
+static void
+benchScenarioSetViewport (BenchScenario *sc,
+			  int           x)
+{
+    CompScreen *s = sc->screen;
+    XEvent     ev;
+
+    memset (&ev, 0, sizeof (XEvent));
+    ev.xclient.type = ClientMessage;
+    ev.xclient.window = RootWindow (sc->dpy, s->screenNum);
+    ev.xclient.message_type = sc->viewportAtom;
+    ev.xclient.format = 32;
+    ev.xclient.data.l[0] = x * s->width;
+    ev.xclient.data.l[1] = s->y * s->height;
+
+    XSendEvent (sc->dpy, ev.xclient.window, FALSE,
+		SubstructureRedirectMask | SubstructureNotifyMask, &ev);
+}
+
+/* Does what the current step has to do by the given fraction of it.
+ * One-off actions are spread evenly over the step and counted in
+ * actions, the first one is done at its start. */
+static void
+benchScenarioRun (BenchScenario *sc,
+		  float         progress)
+{
+    BenchStep       *step = &sc->step[sc->current];
+    BenchTestWindow *tw;
+    float           a = 2.0f * M_PI * progress;
+    int             i, n = sc->nWindow, due;
+
+    switch (step->type) {
+    case BENCH_STEP_OPEN:
+    case BENCH_STEP_CLOSE:
+	due = MIN (n, (int) (progress * n) + 1);
+	for (; sc->actions < due; sc->actions++)
+	{
+	    tw = &sc->window[sc->actions];
+	    if (step->type == BENCH_STEP_OPEN)
+		benchScenarioOpenWindow (sc, tw, sc->actions);
+	    else if (tw->id)
+	    {
+		XDestroyWindow (sc->dpy, tw->id);
+		tw->id = None;
+	    }
+	}
+	break;
+    case BENCH_STEP_MOVE:
+	for (i = 0; i < n; i++)
+	{
+	    tw = &sc->window[i];
+	    if (!tw->id || tw->iconic)
+		continue;
+
+	    /* Once round a circle, odd windows the other way */
+	    XMoveWindow (sc->dpy, tw->id,
+			 tw->x + sc->radius * (1.0f - cosf (a)),
+			 tw->y + sc->radius * sinf (a) * (i % 2 ? -1 : 1));
+	}
+	break;
+    case BENCH_STEP_RESIZE:
+	for (i = 0; i < n; i++)
+	{
+	    tw = &sc->window[i];
+	    if (!tw->id || tw->iconic)
+		continue;
+
+	    XResizeWindow (sc->dpy, tw->id,
+			   tw->width * (1.0f + 0.5f * sinf (a) *
+					(i % 2 ? -1 : 1)),
+			   tw->height * (1.0f + 0.5f * sinf (a) *
+					 (i % 2 ? 1 : -1)));
+	}
+	break;
+    case BENCH_STEP_MINIMIZE:
+	due = MIN (n * 2, (int) (progress * n * 2) + 1);
+	for (; sc->actions < due; sc->actions++)
+	{
+	    tw = &sc->window[sc->actions % n];
+	    if (!tw->id)
+		continue;
+
+	    if (sc->actions < n)
+		XIconifyWindow (sc->dpy, tw->id, sc->screen->screenNum);
+	    else
+		XMapWindow (sc->dpy, tw->id);
+
+	    tw->iconic = sc->actions < n;
+	}
+	break;
+    case BENCH_STEP_VIEWPORT:
+	if (sc->screen->hsize < 2)
+	    break;
+
+	due = MIN (2, (int) (progress * 2) + 1);
+	for (; sc->actions < due; sc->actions++)
+	{
+	    if (!sc->actions)
+		sc->viewportX = sc->screen->x;
+
+	    benchScenarioSetViewport (sc, sc->actions ? sc->viewportX :
+				      (sc->viewportX + 1) % sc->screen->hsize);
+	}
+	break;
+    default:
+	break;
+    }
+
+    XFlush (sc->dpy);
+}
+
+static void
+benchScenarioBeginStep (BenchScenario *sc)
+{
+    BENCH_SCREEN (sc->screen);
+
+    sc->stepStart = benchNowNs ();
+    sc->actions = 0;
 
-    gettimeofday (&now, 0);
+    memset (&bs->step, 0, sizeof (BenchHistogram));
+    memset (&bs->stepCost, 0, sizeof (BenchFrameCost));
 
-    timediff = TIMEVALDIFF (&now, &bs->lastRedraw);
+    benchScenarioRun (sc, 0.0f);
+}
 
-    nRrVal = MIN (1.1, (float) s->optimalRedrawTime / (float) timediff);
+static float
+benchScenarioDamagePct (BenchScenario  *sc,
+			BenchFrameCost *c)
+{
+    unsigned int area = benchScreenArea (sc->screen);
 
-    bs->rrVal = (bs->rrVal * (1.0 - ratio) ) + (nRrVal * ratio);
+    if (!area || !c->damageFrames)
+	return 0.0f;
 
-    bs->fps = (bs->fps * (1.0 - ratio) ) +
-	      (1000000.0 / TIMEVALDIFFU (&now, &bs->lastRedraw) * ratio);
+    return c->damagePx * 100.0 / area / c->damageFrames;
+}
 
-    bs->lastRedraw = now;
+static void
+benchScenarioEndStep (BenchScenario *sc)
+{
+    BenchStep      *step = &sc->step[sc->current];
+    BenchFrameCost *c;
+    int            i;
+
+    BENCH_SCREEN (sc->screen);
+
+    c = &bs->stepCost;
+
+    step->done = TRUE;
+    step->seconds = (benchNowNs () - sc->stepStart) / 1e9;
+    benchSummarize (&bs->step, &step->frames);
+    step->cpuMs = c->cpuFrames ? c->cpuNs / 1e6 / c->cpuFrames : 0.0f;
+    step->gpuMs = c->gpuFrames ? c->gpuNs / 1e6 / c->gpuFrames : -1.0f;
+    step->damagePct = benchScenarioDamagePct (sc, c);
+
+    for (i = 0; i < BENCH_HIST_BUCKETS; i++)
+	sc->total.bucket[i] += bs->step.bucket[i];
+    sc->total.count += bs->step.count;
+    sc->total.over += bs->step.over;
+    sc->total.max = MAX (sc->total.max, bs->step.max);
+
+    sc->totalCost.cpuNs += c->cpuNs;
+    sc->totalCost.cpuFrames += c->cpuFrames;
+    sc->totalCost.gpuNs += c->gpuNs;
+    sc->totalCost.gpuFrames += c->gpuFrames;
+    sc->totalCost.damagePx += c->damagePx;
+    sc->totalCost.damageFrames += c->damageFrames;
+
+    sc->seconds += step->seconds;
+}
 
-    if (benchGetOutputConsole (s->display) && bd->active)
-    {
-	bs->frames++;
-	bs->ctime += timediff;
+static void
+benchScenarioPrintRow (FILE              *f,
+		       const char        *prefix,
+		       const char        *name,
+		       float             seconds,
+		       BenchFrameSummary *sum,
+		       float             cpuMs,
+		       float             gpuMs,
+		       float             damagePct)
+{
+    char gpu[16] = "-";
 
-	if (bs->ctime >
-	    benchGetConsoleUpdateTime (s->display) * 1000)
-	{
-	    printf ("[BENCH] : %.0f frames in %.1f seconds = %.3f FPS\n",
-		    bs->frames, bs->ctime / 1000.0,
-		    bs->frames / (bs->ctime / 1000.0) );
-	    bs->frames = 0;
-	    bs->ctime = 0;
-	}
-    }
+    if (gpuMs >= 0.0f)
+	snprintf (gpu, sizeof (gpu), "%.2f", gpuMs);
 
-    UNWRAP (bs, s, preparePaintScreen);
-    (*s->preparePaintScreen) (s, (bs->alpha > 0.0) ? timediff : ms);
-    WRAP (bs, s, preparePaintScreen, benchPreparePaintScreen);
+    fprintf (f, "%s%-9s %7.2f %6u %7.2f %6.1f %6.1f %6.1f %6.1f %5u "
+	     "%6.2f %6s %6.1f\n", prefix, name, seconds, sum->count,
+	     seconds > 0.0f ? sum->count / seconds : 0.0f,
+	     sum->p50, sum->p90, sum->p99, sum->max, sum->over, cpuMs, gpu,
+	     damagePct);
+}
 
-    if (bd->active)
-	bs->alpha += timediff / 1000.0;
-    else
-	bs->alpha -= timediff / 1000.0;
+/* One line per step that was run, and one for all of them. Frame
+ * times are in ms, cpu and gpu are the mean time per frame, damage
+ * the mean damaged share of the screen in percent. */
+static void
+benchScenarioPrint (CompDisplay   *d,
+		    BenchScenario *sc,
+		    FILE          *f,
+		    const char    *prefix)
+{
+    BenchFrameSummary sum;
+    BenchFrameCost    *c = &sc->totalCost;
+    BenchStep         *step;
+    int               i;
+
+    fprintf (f, "%sscenario \"%s\", %d windows, %dx%d, %d ms refresh\n",
+	     prefix, benchGetScenarioScript (d), sc->nWindow,
+	     sc->screen->width, sc->screen->height,
+	     sc->screen->optimalRedrawTime);
+    fprintf (f, "%s%-9s %7s %6s %7s %6s %6s %6s %6s %5s %6s %6s %6s\n",
+	     prefix, "step", "seconds", "frames", "fps", "p50", "p90", "p99",
+	     "max", "over", "cpu", "gpu", "damage");
+
+    for (i = 0; i < sc->nStep; i++)
+    {
+	step = &sc->step[i];
+	if (step->done)
+	    benchScenarioPrintRow (f, prefix, benchStepName[step->type],
+				   step->seconds, &step->frames,
+				   step->cpuMs, step->gpuMs, step->damagePct);
+    }
 
-    bs->alpha = MIN (1.0, MAX (0.0, bs->alpha) );
+    benchSummarize (&sc->total, &sum);
+    benchScenarioPrintRow (f, prefix, "total", sc->seconds, &sum,
+			   c->cpuFrames ? c->cpuNs / 1e6 / c->cpuFrames : 0.0f,
+			   c->gpuFrames ? c->gpuNs / 1e6 / c->gpuFrames : -1.0f,
+			   benchScenarioDamagePct (sc, c));
 }
 
 static void
-benchDonePaintScreen (CompScreen *s)
+benchScenarioReport (CompDisplay   *d,
+		     BenchScenario *sc)
 {
-    BENCH_SCREEN (s);
-    BENCH_DISPLAY (s->display);
+    const char *path = benchGetScenarioReport (d);
+    FILE       *f;
 
-    if (bs->alpha > 0.0)
-    {
-	damageScreen (s);
-	glFlush();
-	XSync (s->display->display, FALSE);
+    benchScenarioPrint (d, sc, stdout, "[BENCH] : ");
+    fflush (stdout);
 
-	if (benchGetDisableLimiter (s->display) )
-	{
-	    s->lastRedraw = bs->initTime;
-	    s->timeMult = 0;
-	}
+    if (!*path)
+	return;
 
-	if (!bd->active)
-	    s->timeMult = 0;
+    f = fopen (path, "w");
+    if (!f)
+    {
+	compLogMessage ("bench", CompLogLevelWarn,
+			"Could not open report file %s", path);
+	return;
     }
 
-    UNWRAP (bs, s, donePaintScreen);
-    (*s->donePaintScreen) (s);
-    WRAP (bs, s, donePaintScreen, benchDonePaintScreen);
+    benchScenarioPrint (d, sc, f, "");
+    fclose (f);
 }
 
-static Bool
-benchPaintOutput (CompScreen              *s,
-		  const ScreenPaintAttrib *sa,
-		  const CompTransform     *transform,
-		  Region                  region,
-		  CompOutput              *output,
-		  unsigned int            mask)
+/* Removes the test windows and forgets the scenario, without a report */
+static void
+benchScenarioFree (CompDisplay *d)
 {
+    BenchScenario *sc;
+    int           i;
 
-    Bool status,  isSet;
-    unsigned int  fps;
-    CompTransform sTransform = *transform;
-
-    BENCH_SCREEN (s);
-
-    UNWRAP (bs, s, paintOutput);
-    status = (*s->paintOutput) (s, sa, transform, region, output, mask);
-    WRAP (bs, s, paintOutput, benchPaintOutput);
+    BENCH_DISPLAY (d);
 
-    if (bs->alpha <= 0.0
-	|| !benchGetOutputScreen (s->display) )
-	return status;
+    sc = bd->scenario;
+    if (!sc)
+	return;
 
-    glGetError();
-    glPushAttrib (GL_COLOR_BUFFER_BIT | GL_TEXTURE_BIT);
-    GLERR;
+    if (sc->timer)
+	compRemoveTimeout (sc->timer);
 
-    transformToScreenSpace (s, output, -DEFAULT_Z_CAMERA, &sTransform);
+    for (i = 0; i < sc->nWindow; i++)
+	if (sc->window[i].id)
+	    XDestroyWindow (sc->dpy, sc->window[i].id);
 
-    glPushMatrix ();
-    glLoadMatrixf (sTransform.m);
+    XCloseDisplay (sc->dpy);
+    free (sc);
 
-    glEnable (GL_BLEND);
-    glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glColor4f (1.0, 1.0, 1.0, bs->alpha);
-    glTexEnvf (GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+    bd->scenario = NULL;
+}
 
-    glTranslatef (benchGetPositionX (s->display),
-		  benchGetPositionY (s->display), 0);
+static void
+benchScenarioFinish (CompDisplay *d,
+		     Bool        aborted)
+{
+    BenchScenario *sc;
 
-    glEnable (GL_TEXTURE_2D);
-    glBindTexture (GL_TEXTURE_2D, bs->backTex);
-
-    glBegin (GL_QUADS);
-    glTexCoord2f (0, 0);
-    glVertex2f (0, 0);
-    glTexCoord2f (0, 1);
-    glVertex2f (0, 256);
-    glTexCoord2f (1, 1);
-    glVertex2f (512, 256);
-    glTexCoord2f (1, 0);
-    glVertex2f (512, 0);
-    glEnd();
+    BENCH_DISPLAY (d);
 
-    glBindTexture (GL_TEXTURE_2D, 0);
-    glDisable (GL_TEXTURE_2D);
+    sc = bd->scenario;
+    if (!sc)
+	return;
 
-    glTranslatef (53, 83, 0);
+    if (aborted && sc->current < sc->nStep)
+	benchScenarioEndStep (sc);
 
-    float rrVal = MIN (1.0, MAX (0.0, bs->rrVal) );
+    benchScenarioReport (d, sc);
 
-    if (rrVal < 0.5)
+    if (!sc->wasActive)
     {
-	glBegin (GL_QUADS);
-	glColor4f (1.0, 0.0, 0.0, bs->alpha);
-	glVertex2f (0.0, 0.0);
-	glVertex2f (0.0, 25.0);
-	glColor4f (1.0, rrVal * 2.0, 0.0, bs->alpha);
-	glVertex2f (330.0 * rrVal, 25.0);
-	glVertex2f (330.0 * rrVal, 0.0);
-	glEnd();
+	bd->active = FALSE;
+	benchTraceStop (d);
+	damageScreen (sc->screen);
     }
-    else
-    {
-	glBegin (GL_QUADS);
-	glColor4f (1.0, 0.0, 0.0, bs->alpha);
-	glVertex2f (0.0, 0.0);
-	glVertex2f (0.0, 25.0);
-	glColor4f (1.0, 1.0, 0.0, bs->alpha);
-	glVertex2f (165.0, 25.0);
-	glVertex2f (165.0, 0.0);
-	glEnd();
 
-	glBegin (GL_QUADS);
-	glColor4f (1.0, 1.0, 0.0, bs->alpha);
-	glVertex2f (165.0, 0.0);
-	glVertex2f (165.0, 25.0);
-	glColor4f (1.0 - ( (rrVal - 0.5) * 2.0), 1.0, 0.0, bs->alpha);
-	glVertex2f (165.0 + 330.0 * (rrVal - 0.5), 25.0);
-	glVertex2f (165.0 + 330.0 * (rrVal - 0.5), 0.0);
-	glEnd();
-    }
+    benchScenarioFree (d);
 
-    glColor4f (0.0, 0.0, 0.0, bs->alpha);
-    glCallList (bs->dList);
-    glTranslatef (72, 45, 0);
+    if (!aborted && benchGetScenarioQuit (d))
+	kill (getpid (), SIGTERM);
+}
 
-    float red;
+static Bool
+benchScenarioTick (void *closure)
+{
+    CompDisplay   *d = closure;
+    BenchScenario *sc;
+    float         ms;
 
-    if (bs->fps > 30.0)
-	red = 0.0;
-    else
-	red = 1.0;
+    BENCH_DISPLAY (d);
 
-    if (bs->fps <= 30.0 && bs->fps > 20.0)
-	red = 1.0 - ( (bs->fps - 20.0) / 10.0);
+    sc = bd->scenario;
+    ms = (benchNowNs () - sc->stepStart) / 1e6;
 
-    glColor4f (red, 0.0, 0.0, bs->alpha);
-    glEnable (GL_TEXTURE_2D);
+    benchScenarioRun (sc, MIN (1.0f, ms / sc->step[sc->current].ms));
 
-    isSet = FALSE;
+    if (ms < sc->step[sc->current].ms)
+	return TRUE;
 
-    fps = (bs->fps * 100.0);
-    fps = MIN (999999, fps);
+    benchScenarioEndStep (sc);
 
-    if (fps >= 100000)
+    if (++sc->current < sc->nStep)
     {
-	glBindTexture (GL_TEXTURE_2D, bs->numTex[fps / 100000]);
-	glCallList (bs->dList + 1);
-	isSet = TRUE;
+	benchScenarioBeginStep (sc);
+	return TRUE;
     }
 
-    fps %= 100000;
+    sc->timer = 0;
+    benchScenarioFinish (d, FALSE);
+
+    return FALSE;
+}
 
-    glTranslatef (12, 0, 0);
+static void
+benchScenarioStart (CompDisplay *d,
+		    CompScreen  *s)
+{
+    BenchScenario *sc;
 
-    if (fps >= 10000 || isSet)
-    {
-	glBindTexture (GL_TEXTURE_2D, bs->numTex[fps / 10000]);
-	glCallList (bs->dList + 1);
-	isSet = TRUE;
-    }
+    BENCH_DISPLAY (d);
 
-    fps %= 10000;
+    if (bd->scenario)
+	return;
 
-    glTranslatef (12, 0, 0);
+    sc = calloc (1, sizeof (BenchScenario));
+    if (!sc)
+	return;
 
-    if (fps >= 1000 || isSet)
+    sc->nStep = benchScenarioParse (benchGetScenarioScript (d), sc->step);
+    if (!sc->nStep)
     {
-	glBindTexture (GL_TEXTURE_2D, bs->numTex[fps / 1000]);
-	glCallList (bs->dList + 1);
+	compLogMessage ("bench", CompLogLevelWarn,
+			"The scenario script has no steps");
+	free (sc);
+	return;
     }
 
-    fps %= 1000;
-
-    glTranslatef (12, 0, 0);
-
-    glBindTexture (GL_TEXTURE_2D, bs->numTex[fps / 100]);
-    glCallList (bs->dList + 1);
-    fps %= 100;
+    sc->dpy = XOpenDisplay (DisplayString (d->display));
+    if (!sc->dpy)
+    {
+	compLogMessage ("bench", CompLogLevelWarn,
+			"Could not open a connection for the test windows");
+	free (sc);
+	return;
+    }
 
-    glTranslatef (19, 0, 0);
+    sc->screen = s;
+    sc->viewportAtom = XInternAtom (sc->dpy, "_NET_DESKTOP_VIEWPORT", FALSE);
+    sc->nWindow = benchGetScenarioWindows (d);
+    benchScenarioLayout (sc);
 
-    glBindTexture (GL_TEXTURE_2D, bs->numTex[fps / 10]);
-    glCallList (bs->dList + 1);
-    fps %= 10;
+    bd->scenario = sc;
 
-    glTranslatef (12, 0, 0);
+    sc->wasActive = bd->active;
+    if (!bd->active)
+    {
+	bd->active = TRUE;
+	benchTraceStart (d);
+    }
 
-    glBindTexture (GL_TEXTURE_2D, bs->numTex[fps]);
-    glCallList (bs->dList + 1);
+    benchResetStats (s);
+    damageScreen (s);
 
-    glBindTexture (GL_TEXTURE_2D, 0);
-    glDisable (GL_TEXTURE_2D);
+    benchScenarioBeginStep (sc);
+    sc->timer = compAddTimeout (BENCH_SCENARIO_TICK, BENCH_SCENARIO_TICK,
+				benchScenarioTick, d);
+}
 
-    glPopMatrix();
+static Bool
+benchScenarioInitiate (CompDisplay     *d,
+		       CompAction      *ac,
+		       CompActionState state,
+		       CompOption      *option,
+		       int             nOption)
+{
+    CompScreen *s;
 
-    glTexEnvf (GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+    BENCH_DISPLAY (d);
 
-    glColor4f (1.0, 1.0, 1.0, 1.0);
+    if (bd->scenario)
+    {
+	benchScenarioFinish (d, TRUE);
+	return FALSE;
+    }
 
-    glPopAttrib();
-    glGetError();
+    s = findScreenAtDisplay (d, getIntOptionNamed (option, nOption, "root", 0));
+    if (s)
+	benchScenarioStart (d, s);
 
-    return status;
+    return FALSE;
 }
 
 static Bool
-benchInitScreen (CompPlugin *p,
-		 CompScreen *s)
+benchScenarioAutostart (void *closure)
 {
-    int i;
-
-    BENCH_DISPLAY (s->display);
+    CompDisplay *d = closure;
 
-    BenchScreen *bs = (BenchScreen *) calloc (1, sizeof (BenchScreen) );
-
-    s->base.privates[bd->screenPrivateIndex].ptr = bs;
+    BENCH_DISPLAY (d);
 
-    WRAP (bs, s, paintOutput, benchPaintOutput);
-    WRAP (bs, s, preparePaintScreen, benchPreparePaintScreen);
-    WRAP (bs, s, donePaintScreen, benchDonePaintScreen);
+    bd->autostartHandle = 0;
 
-    glGenTextures (10, bs->numTex);
-    glGenTextures (1, &bs->backTex);
+    if (d->screens)
+	benchScenarioStart (d, d->screens);
 
-    glGetError();
+    return FALSE;
+}
 
-    glEnable (GL_TEXTURE_2D);
+static void
+benchInitAtlas (BenchScreen *bs)
+{
+    GLubyte *atlas, *p;
+    int     d, x, y;
 
-    bs->alpha = 0;
-    bs->ctime = 0;
-    bs->frames = 0;
+    atlas = calloc (BENCH_ATLAS_SIZE * BENCH_ATLAS_SIZE, 4);
+    if (!atlas)
+	return;
 
-    for (i = 0; i < 10; i++)
-    {
-	//Bind the texture
-	glBindTexture (GL_TEXTURE_2D, bs->numTex[i]);
+    memcpy (atlas, image_data, 512 * 256 * 4);
 
-	//Load the parameters
-	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    /* The digits only have alpha, color comes from the vertices */
+    for (d = 0; d < 10; d++)
+	for (y = 0; y < 32; y++)
+	    for (x = 0; x < 16; x++)
+	    {
+		p = atlas + ((BENCH_ATLAS_DIGIT_Y + y) * BENCH_ATLAS_SIZE +
+			     d * BENCH_ATLAS_DIGIT_PITCH + x) * 4;
+		p[0] = p[1] = p[2] = 0xff;
+		p[3] = number_data[d][(y * 16 + x) * 4 + 3];
+	    }
 
-	glTexImage2D (GL_TEXTURE_2D, 0, GL_ALPHA, 16, 32, 0,
-		      GL_RGBA, GL_UNSIGNED_BYTE, number_data[i]);
-	GLERR;
-    }
+    for (y = 0; y < 8; y++)
+	memset (atlas + ((BENCH_ATLAS_DIGIT_Y + y) * BENCH_ATLAS_SIZE +
+			 BENCH_ATLAS_WHITE_X) * 4, 0xff, 8 * 4);
 
-    glBindTexture (GL_TEXTURE_2D, bs->backTex);
+    glGenTextures (1, &bs->atlasTex);
+    glBindTexture (GL_TEXTURE_2D, bs->atlasTex);
 
-    //Load the parameters
     glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-    glTexImage2D (GL_TEXTURE_2D, 0, 4, 512, 256, 0, GL_RGBA,
-		  GL_UNSIGNED_BYTE, image_data);
+    glTexImage2D (GL_TEXTURE_2D, 0, GL_RGBA, BENCH_ATLAS_SIZE,
+		  BENCH_ATLAS_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, atlas);
     GLERR;
 
     glBindTexture (GL_TEXTURE_2D, 0);
-    glDisable (GL_TEXTURE_2D);
 
-    bs->dList = glGenLists (2);
-    glNewList (bs->dList, GL_COMPILE);
+    free (atlas);
+}
 
-    glLineWidth (2.0);
+static Bool
+benchInitScreen (CompPlugin *p,
+		 CompScreen *s)
+{
+    CompOption o;
 
-    glBegin (GL_LINE_LOOP);
-    glVertex2f (0, 0);
-    glVertex2f (0, 25);
-    glVertex2f (330, 25);
-    glVertex2f (330, 0);
-    glEnd();
+    BENCH_DISPLAY (s->display);
 
-    glLineWidth (1.0);
+    BenchScreen *bs = (BenchScreen *) calloc (1, sizeof (BenchScreen) );
 
-    glBegin (GL_LINES);
+    s->base.privates[bd->screenPrivateIndex].ptr = bs;
 
-    for (i = 33; i < 330; i += 33)
-    {
-	glVertex2f (i, 15);
-	glVertex2f (i, 25);
-    }
+    WRAP (bs, s, paintOutput, benchPaintOutput);
+    WRAP (bs, s, preparePaintScreen, benchPreparePaintScreen);
+    WRAP (bs, s, donePaintScreen, benchDonePaintScreen);
 
-    for (i = 16; i < 330; i += 33)
-    {
-	glVertex2f (i, 20);
-	glVertex2f (i, 25);
-    }
+    benchProfileInit (s);
+    benchGpuInit (s);
 
-    glEnd();
+    benchInitAtlas (bs);
+    benchAddTexture (s, &bs->atlasTex, "bench", "overlay",
+		     BENCH_TEXTURE_BYTES (BENCH_ATLAS_SIZE, BENCH_ATLAS_SIZE));
 
-    glEndList();
+    bs->damageRegion = XCreateRegion ();
+    bs->tmpRegion = XCreateRegion ();
+    bs->overlayRegion = XCreateRegion ();
 
-    glNewList (bs->dList + 1, GL_COMPILE);
-    glBegin (GL_QUADS);
-    glTexCoord2f (0, 0);
-    glVertex2f (0, 0);
-    glTexCoord2f (0, 1);
-    glVertex2f (0, 32);
-    glTexCoord2f (1, 1);
-    glVertex2f (16, 32);
-    glTexCoord2f (1, 0);
-    glVertex2f (16, 0);
-    glEnd();
-    glEndList();
+    bs->alpha = 0;
+    bs->ctime = 0;
+    bs->frames = 0;
+    bs->nVertex = -1;
 
     gettimeofday (&bs->initTime, 0);
     gettimeofday (&bs->lastRedraw, 0);
 
+    /* Plugins loaded before bench report the textures they hold */
+    o.type    = CompOptionTypeInt;
+    o.name    = "root";
+    o.value.i = s->root;
+
+    (*s->display->handleCompizEvent) (s->display, "bench", "start", &o, 1);
+
     return TRUE;
 }
 
@@ -466,10 +2789,22 @@ benchFiniScreen (CompPlugin *p,
 {
 
     BENCH_SCREEN (s);
-    glDeleteLists (bs->dList, 2);
+    BENCH_DISPLAY (s->display);
+
+    if (bd->scenario && bd->scenario->screen == s)
+	benchScenarioFree (s->display);
+
+    benchProfileFini (s);
+    benchGpuFini (s);
 
-    glDeleteTextures (10, bs->numTex);
-    glDeleteTextures (1, &bs->backTex);
+    glDeleteTextures (1, &bs->atlasTex);
+
+    XDestroyRegion (bs->damageRegion);
+    XDestroyRegion (bs->tmpRegion);
+    XDestroyRegion (bs->overlayRegion);
+
+    if (bs->textures)
+	free (bs->textures);
 
     //Restore the original function
     UNWRAP (bs, s, paintOutput);
@@ -490,21 +2825,113 @@ benchInitiate (CompDisplay     *d,
     CompScreen *s;
 
     BENCH_DISPLAY (d);
+
+    /* The scenario keeps bench running until it is done */
+    if (bd->scenario)
+	return FALSE;
+
     bd->active = !bd->active;
-    bd->active &= benchGetOutputScreen (d) || benchGetOutputConsole (d);
+    bd->active &= benchGetOutputScreen (d) || benchGetOutputConsole (d) ||
+		  *benchGetTraceFile (d);
+
+    if (bd->active)
+	benchTraceStart (d);
+    else
+	benchTraceStop (d);
     s = findScreenAtDisplay (d, getIntOptionNamed (option, nOption, "root", 0));
 
     if (s)
     {
-	BENCH_SCREEN (s);
 	damageScreen (s);
-	bs->ctime = 0;
-	bs->frames = 0;
+	benchResetStats (s);
     }
 
     return FALSE;
 }
 
+/* Plugins loaded after bench while plugin profiling is on wrap the
+ * trampolines, see BenchHook; the others are counted with the plugin
+ * below them */
+static CompBool
+benchInitPluginForObject (CompPlugin *p,
+			  CompObject *o)
+{
+    CompScreen *s = NULL;
+    CompBool   status;
+    Bool       profile = FALSE;
+
+    BENCH_CORE (&core);
+
+    if (o->type == COMP_OBJECT_TYPE_SCREEN && strcmp (p->vTable->name, "bench"))
+    {
+	s = (CompScreen *) o;
+	profile = benchGetProfilePlugins (s->display);
+	if (!profile)
+	    benchProfileUncover (s);
+    }
+
+    UNWRAP (bc, &core, initPluginForObject);
+    status = (*core.initPluginForObject) (p, o);
+    WRAP (bc, &core, initPluginForObject, benchInitPluginForObject);
+
+    if (s && !profile)
+	benchProfileCover (s);
+    else if (s && status)
+	benchProfilePush (s, p);
+
+    return status;
+}
+
+static void
+benchFiniPluginForObject (CompPlugin *p,
+			  CompObject *o)
+{
+    BENCH_CORE (&core);
+
+    UNWRAP (bc, &core, finiPluginForObject);
+    (*core.finiPluginForObject) (p, o);
+    WRAP (bc, &core, finiPluginForObject, benchFiniPluginForObject);
+
+    if (o->type == COMP_OBJECT_TYPE_SCREEN && strcmp (p->vTable->name, "bench"))
+    {
+	benchProfilePop ((CompScreen *) o, p);
+	benchProfileCover ((CompScreen *) o);
+    }
+}
+
+static Bool
+benchInitCore (CompPlugin *p,
+	       CompCore   *c)
+{
+    BenchCore *bc;
+
+    if (!checkPluginABI ("core", CORE_ABIVERSION))
+	return FALSE;
+
+    bc = malloc (sizeof (BenchCore));
+    if (!bc)
+	return FALSE;
+
+    c->base.privates[corePrivateIndex].ptr = bc;
+
+    WRAP (bc, c, initPluginForObject, benchInitPluginForObject);
+    WRAP (bc, c, finiPluginForObject, benchFiniPluginForObject);
+
+    return TRUE;
+}
+
+static void
+benchFiniCore (CompPlugin *p,
+	       CompCore   *c)
+{
+    BENCH_CORE (c);
+
+    UNWRAP (bc, c, initPluginForObject);
+    UNWRAP (bc, c, finiPluginForObject);
+
+    free (bc);
+}
+
 static Bool
 benchInitDisplay (CompPlugin  *p,
 		  CompDisplay *d)
@@ -532,10 +2959,25 @@ benchInitDisplay (CompPlugin  *p,
     }
 
     benchSetInitiateKeyInitiate (d, benchInitiate);
+    benchSetScenarioKeyInitiate (d, benchScenarioInitiate);
+
+    benchGetDisplayOption (d, BenchDisplayOptionAbi)->value.i =
+	BENCH_ABIVERSION;
+    benchGetDisplayOption (d, BenchDisplayOptionIndex)->value.i =
+	functionsPrivateIndex;
 
     bd->active = FALSE;
+    bd->trace = NULL;
+    bd->scenario = NULL;
+    bd->autostartHandle = 0;
+
+    if (benchGetScenarioAutostart (d))
+	bd->autostartHandle = compAddTimeout (BENCH_SCENARIO_DELAY,
+					      BENCH_SCENARIO_DELAY + 500,
+					      benchScenarioAutostart, d);
     //Record the display
     d->base.privates[displayPrivateIndex].ptr = bd;
+    d->base.privates[functionsPrivateIndex].ptr = &benchFunctions;
     return TRUE;
 }
 
@@ -544,6 +2986,13 @@ benchFiniDisplay (CompPlugin  *p,
 		  CompDisplay *d)
 {
     BENCH_DISPLAY (d);
+
+    if (bd->autostartHandle)
+	compRemoveTimeout (bd->autostartHandle);
+
+    benchScenarioFree (d);
+    benchTraceStop (d);
+
     //Free the private index
     freeScreenPrivateIndex (d, bd->screenPrivateIndex);
     //Free the pointer
@@ -555,10 +3004,27 @@ benchFiniDisplay (CompPlugin  *p,
 static Bool
 benchInit (CompPlugin * p)
 {
+    corePrivateIndex = allocateCorePrivateIndex ();
+
+    if (corePrivateIndex < 0)
+	return FALSE;
+
     displayPrivateIndex = allocateDisplayPrivateIndex();
 
     if (displayPrivateIndex < 0)
+    {
+	freeCorePrivateIndex (corePrivateIndex);
+	return FALSE;
+    }
+
+    functionsPrivateIndex = allocateDisplayPrivateIndex ();
+
+    if (functionsPrivateIndex < 0)
+    {
+	freeDisplayPrivateIndex (displayPrivateIndex);
+	freeCorePrivateIndex (corePrivateIndex);
 	return FALSE;
+    }
 
     return TRUE;
 }
@@ -568,6 +3034,10 @@ benchFini (CompPlugin * p)
 {
     if (displayPrivateIndex >= 0)
 	freeDisplayPrivateIndex (displayPrivateIndex);
+
+    freeDisplayPrivateIndex (functionsPrivateIndex);
+
+    freeCorePrivateIndex (corePrivateIndex);
 }
 
 static CompBool
@@ -575,7 +3045,7 @@ benchInitObject (CompPlugin *p,
 		 CompObject *o)
 {
     static InitPluginObjectProc dispTab[] = {
-	(InitPluginObjectProc) 0, /* InitCore */
+	(InitPluginObjectProc) benchInitCore,
 	(InitPluginObjectProc) benchInitDisplay,
 	(InitPluginObjectProc) benchInitScreen
     };
@@ -588,7 +3058,7 @@ benchFiniObject (CompPlugin *p,
 		 CompObject *o)
 {
     static FiniPluginObjectProc dispTab[] = {
-	(FiniPluginObjectProc) 0, /* FiniCore */
+	(FiniPluginObjectProc) benchFiniCore,
 	(FiniPluginObjectProc) benchFiniDisplay,
 	(FiniPluginObjectProc) benchFiniScreen
     };
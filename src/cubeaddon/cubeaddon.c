@@ -32,6 +32,7 @@
 
 #include <compiz-core.h>
 #include <compiz-cube.h>
+#include <compiz-bench.h>
 
 #include "cubeaddon_options.h"
 
@@ -49,6 +50,8 @@ static int cubeDisplayPrivateIndex;
 typedef struct _CubeaddonDisplay
 {
     int screenPrivateIndex;
+
+    HandleCompizEventProc handleCompizEvent;
 } CubeaddonDisplay;
 
 typedef struct _CubeCap
@@ -59,6 +62,7 @@ typedef struct _CubeCap
     Bool            loaded;
 
     CompTexture	    texture;
+    unsigned int    width, height;
     CompTransform   texMat;
 } CubeCap;
 
@@ -113,6 +117,18 @@ typedef struct _CubeaddonScreen
 #define CUBEADDON_DISPLAY(d) PLUGIN_DISPLAY(d, Cubeaddon, ca)
 #define CUBEADDON_SCREEN(s) PLUGIN_SCREEN(s, Cubeaddon, ca)
 
+static BenchFunc *
+cubeaddonGetBenchFunc (CompDisplay *d)
+{
+    int index;
+
+    if (!checkPluginABI ("bench", BENCH_ABIVERSION) ||
+	!getPluginDisplayIndex (d, "bench", &index))
+	return NULL;
+
+    return d->base.privates[index].ptr;
+}
+
 /*
  * Initiate a CubeCap
  */
@@ -126,6 +142,34 @@ cubeaddonInitCap (CompScreen *s, CubeCap *cap)
     cap->loaded     = FALSE;
 }
 
+/*
+ * Report a loaded CubeCap's image to bench
+ */
+static void
+cubeaddonReportCap (CompScreen *s, CubeCap *cap)
+{
+    BenchFunc *bench = cubeaddonGetBenchFunc (s->display);
+
+    if (bench && cap->loaded)
+	(*bench->addTexture) (s, &cap->texture, "cubeaddon",
+			      cap->files->value[cap->current].s,
+			      BENCH_TEXTURE_BYTES (cap->width, cap->height));
+}
+
+/*
+ * Free a CubeCap's image
+ */
+static void
+cubeaddonFiniCap (CompScreen *s, CubeCap *cap)
+{
+    BenchFunc *bench = cubeaddonGetBenchFunc (s->display);
+
+    if (bench)
+	(*bench->removeTexture) (s, &cap->texture);
+
+    finiTexture (s, &cap->texture);
+}
+
 /*
  * Attempt to load current cap image (if any)
  */
@@ -138,9 +182,13 @@ cubeaddonLoadCap (CompScreen *s,
 {
     unsigned int width, height;
     float        xScale, yScale;
+    BenchFunc    *bench = cubeaddonGetBenchFunc (s->display);
 
     CUBE_SCREEN (s);
 
+    if (bench)
+	(*bench->removeTexture) (s, &cap->texture);
+
     finiTexture (s, &cap->texture);
     initTexture (s, &cap->texture);
 
@@ -166,6 +214,10 @@ cubeaddonLoadCap (CompScreen *s,
     }
 
     cap->loaded = TRUE;
+    cap->width  = width;
+    cap->height = height;
+    cubeaddonReportCap (s, cap);
+
     matrixGetIdentity (&cap->texMat);
 
     cap->texMat.m[0] = cap->texture.matrix.xx;
@@ -1727,6 +1779,37 @@ cubeaddonDonePaintScreen (CompScreen * s)
 }
 
 
+/* Caps loaded before bench started are reported when it asks */
+static void
+cubeaddonHandleCompizEvent (CompDisplay *d,
+			    const char  *pluginName,
+			    const char  *eventName,
+			    CompOption  *option,
+			    int         nOption)
+{
+    CUBEADDON_DISPLAY (d);
+
+    UNWRAP (cad, d, handleCompizEvent);
+    (*d->handleCompizEvent) (d, pluginName, eventName, option, nOption);
+    WRAP (cad, d, handleCompizEvent, cubeaddonHandleCompizEvent);
+
+    if (strcmp (pluginName, "bench") == 0 &&
+	strcmp (eventName, "start") == 0)
+    {
+	CompScreen *s;
+
+	s = findScreenAtDisplay (d, getIntOptionNamed (option, nOption,
+						       "root", 0));
+	if (s)
+	{
+	    CUBEADDON_SCREEN (s);
+
+	    cubeaddonReportCap (s, &cas->topCap);
+	    cubeaddonReportCap (s, &cas->bottomCap);
+	}
+    }
+}
+
 static Bool
 cubeaddonInitDisplay (CompPlugin  *p,
 		      CompDisplay *d)
@@ -1755,6 +1838,8 @@ cubeaddonInitDisplay (CompPlugin  *p,
 
     d->base.privates[CubeaddonDisplayPrivateIndex].ptr = cad;
 
+    WRAP (cad, d, handleCompizEvent, cubeaddonHandleCompizEvent);
+
     cubeaddonSetTopNextKeyInitiate (d, cubeaddonTopNext);
     cubeaddonSetTopPrevKeyInitiate (d, cubeaddonTopPrev);
     cubeaddonSetBottomNextKeyInitiate (d, cubeaddonBottomNext);
@@ -1774,6 +1859,8 @@ cubeaddonFiniDisplay (CompPlugin  *p,
 {
     CUBEADDON_DISPLAY (d);
 
+    UNWRAP (cad, d, handleCompizEvent);
+
     freeScreenPrivateIndex (d, cad->screenPrivateIndex);
     free (cad);
 }
@@ -1877,6 +1964,9 @@ cubeaddonFiniScreen (CompPlugin *p,
 
     XDestroyRegion (cas->tmpRegion);
 
+    cubeaddonFiniCap (s, &cas->topCap);
+    cubeaddonFiniCap (s, &cas->bottomCap);
+
     UNWRAP (cas, s, paintTransformedOutput);
     UNWRAP (cas, s, paintOutput);
     UNWRAP (cas, s, donePaintScreen);
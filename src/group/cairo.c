@@ -24,6 +24,67 @@
 
 #include "group-internal.h"
 
+/*
+ * groupGetBenchFunc
+ *
+ */
+static BenchFunc *
+groupGetBenchFunc (CompDisplay *d)
+{
+    int index;
+
+    if (!checkPluginABI ("bench", BENCH_ABIVERSION) ||
+	!getPluginDisplayIndex (d, "bench", &index))
+	return NULL;
+
+    return d->base.privates[index].ptr;
+}
+
+/*
+ * groupReportCairoLayer
+ *
+ */
+static void
+groupReportCairoLayer (CompScreen      *s,
+		       GroupCairoLayer *layer)
+{
+    BenchFunc *bench;
+
+    if (!layer)
+	return;
+
+    bench = groupGetBenchFunc (s->display);
+    if (bench)
+	(*bench->addTexture) (s, &layer->texture, "group",
+			      layer->pixmap ? "tab bar title" : "tab bar layer",
+			      BENCH_TEXTURE_BYTES (layer->texWidth,
+						   layer->texHeight));
+}
+
+/*
+ * groupReportCairoLayers
+ *
+ * Report the layers of all tab bars, for a bench started after
+ * they were created.
+ */
+void
+groupReportCairoLayers (CompScreen *s)
+{
+    GroupSelection *group;
+
+    GROUP_SCREEN (s);
+
+    for (group = gs->groups; group; group = group->next)
+    {
+	if (!group->tabBar)
+	    continue;
+
+	groupReportCairoLayer (s, group->tabBar->textLayer);
+	groupReportCairoLayer (s, group->tabBar->bgLayer);
+	groupReportCairoLayer (s, group->tabBar->selectionLayer);
+    }
+}
+
 /*
  * groupRebuildCairoLayer
  *
@@ -71,9 +132,15 @@ void
 groupDestroyCairoLayer (CompScreen      *s,
 			GroupCairoLayer *layer)
 {
+    BenchFunc *bench;
+
     if (!layer)
 	return;
 
+    bench = groupGetBenchFunc (s->display);
+    if (bench)
+	(*bench->removeTexture) (s, &layer->texture);
+
     if (layer->cairo)
 	cairo_destroy (layer->cairo);
 
@@ -151,6 +218,7 @@ groupCreateCairoLayer (CompScreen *s,
     }
 
     groupClearCairoLayer (layer);
+    groupReportCairoLayer (s, layer);
 
     return layer;
 }
@@ -719,6 +787,7 @@ groupRenderWindowTitle (GroupSelection *group)
 	layer->pixmap = pixmap;
 	bindPixmapToTexture (s, &layer->texture, layer->pixmap,
 			     layer->texWidth, layer->texHeight, 32);
+	groupReportCairoLayer (s, layer);
     }
 }
 
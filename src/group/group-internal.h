@@ -34,6 +34,7 @@
 #include <cairo/cairo-xlib-xrender.h>
 #include <compiz-core.h>
 #include <compiz-text.h>
+#include <compiz-bench.h>
 #include <X11/Xatom.h>
 #include <X11/extensions/shape.h>
 
@@ -386,7 +387,8 @@ typedef struct _GroupResizeInfo {
 typedef struct _GroupDisplay {
     int screenPrivateIndex;
 
-    HandleEventProc handleEvent;
+    HandleEventProc       handleEvent;
+    HandleCompizEventProc handleCompizEvent;
 
     Bool ignoreMode;
 
@@ -519,6 +521,13 @@ void
 groupHandleEvent (CompDisplay *d,
 		  XEvent      *event);
 
+void
+groupHandleCompizEvent (CompDisplay *d,
+			const char  *pluginName,
+			const char  *eventName,
+			CompOption  *option,
+			int         nOption);
+
 void
 groupDeleteGroupWindow (CompWindow *w);
 
@@ -652,6 +661,9 @@ groupRenderTabBarBackground (GroupSelection *group);
 void
 groupRenderWindowTitle (GroupSelection *group);
 
+void
+groupReportCairoLayers (CompScreen *s);
+
 
 /*
  * tab.c
@@ -1651,6 +1651,36 @@ groupHandleEvent (CompDisplay *d,
     }
 }
 
+/*
+ * groupHandleCompizEvent
+ *
+ * Tab bars created before bench started are reported when it asks.
+ */
+void
+groupHandleCompizEvent (CompDisplay *d,
+			const char  *pluginName,
+			const char  *eventName,
+			CompOption  *option,
+			int         nOption)
+{
+    GROUP_DISPLAY (d);
+
+    UNWRAP (gd, d, handleCompizEvent);
+    (*d->handleCompizEvent) (d, pluginName, eventName, option, nOption);
+    WRAP (gd, d, handleCompizEvent, groupHandleCompizEvent);
+
+    if (strcmp (pluginName, "bench") == 0 &&
+	strcmp (eventName, "start") == 0)
+    {
+	CompScreen *s;
+
+	s = findScreenAtDisplay (d, getIntOptionNamed (option, nOption,
+						       "root", 0));
+	if (s)
+	    groupReportCairoLayers (s);
+    }
+}
+
 /*
  * groupGetOutputExtentsForWindow
  *
@@ -236,6 +236,7 @@ groupInitDisplay (CompPlugin  *p,
 					    "_COMPIZ_RESIZE_NOTIFY", 0);
 
     WRAP (gd, d, handleEvent, groupHandleEvent);
+    WRAP (gd, d, handleCompizEvent, groupHandleCompizEvent);
 
     groupSetSelectButtonInitiate (d, groupSelect);
     groupSetSelectButtonTerminate (d, groupSelectTerminate);
@@ -271,6 +272,7 @@ groupFiniDisplay (CompPlugin  *p,
     freeScreenPrivateIndex (d, gd->screenPrivateIndex);
 
     UNWRAP (gd, d, handleEvent);
+    UNWRAP (gd, d, handleCompizEvent);
 
     free (gd);
 }
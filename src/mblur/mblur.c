@@ -21,8 +21,10 @@
 
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <compiz-core.h>
+#include <compiz-bench.h>
 
 #include "mblur_options.h"
 
@@ -43,6 +45,8 @@ static int displayPrivateIndex = 0;
 typedef struct _MblurDisplay
 {
     int screenPrivateIndex;
+
+    HandleCompizEventProc handleCompizEvent;
 }
 MblurDisplay;
 
@@ -64,6 +68,30 @@ typedef struct _MblurScreen
 }
 MblurScreen;
 
+static BenchFunc *
+mblurGetBenchFunc (CompDisplay *d)
+{
+    int index;
+
+    if (!checkPluginABI ("bench", BENCH_ABIVERSION) ||
+	!getPluginDisplayIndex (d, "bench", &index))
+	return NULL;
+
+    return d->base.privates[index].ptr;
+}
+
+static void
+mblurReportTexture (CompScreen *s)
+{
+    BenchFunc *bench = mblurGetBenchFunc (s->display);
+
+    MBLUR_SCREEN (s);
+
+    if (bench && ms->texture)
+	(*bench->addTexture) (s, &ms->texture, "mblur", "screen copy",
+			      BENCH_TEXTURE_BYTES (s->width, s->height));
+}
+
 /* activate/deactivate motion blur */
 
 static Bool
@@ -180,6 +208,8 @@ mblurPaintScreen (CompScreen   *s,
 	if (!ms->texture)
 	{
 	    glGenTextures (1, &ms->texture);
+	    mblurReportTexture (s);
+
 	    glBindTexture (target, ms->texture);
 
 	    glTexParameteri (target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -321,6 +351,32 @@ mblurFini (CompPlugin *p)
 	freeDisplayPrivateIndex (displayPrivateIndex);
 }
 
+/* The screen copy made before bench started is reported when it asks */
+static void
+mblurHandleCompizEvent (CompDisplay *d,
+			const char  *pluginName,
+			const char  *eventName,
+			CompOption  *option,
+			int         nOption)
+{
+    CompScreen *s;
+
+    MBLUR_DISPLAY (d);
+
+    UNWRAP (md, d, handleCompizEvent);
+    (*d->handleCompizEvent) (d, pluginName, eventName, option, nOption);
+    WRAP (md, d, handleCompizEvent, mblurHandleCompizEvent);
+
+    if (strcmp (pluginName, "bench") == 0 &&
+	strcmp (eventName, "start") == 0)
+    {
+	s = findScreenAtDisplay (d, getIntOptionNamed (option, nOption,
+						       "root", 0));
+	if (s)
+	    mblurReportTexture (s);
+    }
+}
+
 static Bool
 mblurInitDisplay (CompPlugin  *p,
 		  CompDisplay *d)
@@ -350,6 +406,8 @@ mblurInitDisplay (CompPlugin  *p,
     /* Record the display */
     d->base.privates[displayPrivateIndex].ptr = md;
 
+    WRAP (md, d, handleCompizEvent, mblurHandleCompizEvent);
+
     mblurSetInitiateKeyInitiate (d, mblurToggle);
 
     return TRUE;
@@ -361,6 +419,8 @@ mblurFiniDisplay (CompPlugin  *p,
 {
     MBLUR_DISPLAY (d);
 
+    UNWRAP (md, d, handleCompizEvent);
+
     /*Free the private index */
     freeScreenPrivateIndex (d, md->screenPrivateIndex);
 
@@ -397,8 +457,13 @@ static void
 mblurFiniScreen (CompPlugin *p,
 		 CompScreen *s)
 {
+    BenchFunc *bench = mblurGetBenchFunc (s->display);
+
     MBLUR_SCREEN (s);
 
+    if (bench)
+	(*bench->removeTexture) (s, &ms->texture);
+
     if (ms->texture)
 	glDeleteTextures (1, &ms->texture);
 
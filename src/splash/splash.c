@@ -21,8 +21,10 @@
 
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <compiz-core.h>
+#include <compiz-bench.h>
 #include <X11/Xatom.h>
 
 #include "splash_options.h"
@@ -49,6 +51,8 @@ typedef struct _SplashDisplay
 {
     Atom splashAtom;
     int screenPrivateIndex;
+
+    HandleCompizEventProc handleCompizEvent;
 }
 SplashDisplay;
 
@@ -82,6 +86,34 @@ typedef struct _SplashScreen
 }
 SplashScreen;
 
+static BenchFunc *
+splashGetBenchFunc (CompDisplay *d)
+{
+    int index;
+
+    if (!checkPluginABI ("bench", BENCH_ABIVERSION) ||
+	!getPluginDisplayIndex (d, "bench", &index))
+	return NULL;
+
+    return d->base.privates[index].ptr;
+}
+
+static void
+splashReportTextures (CompScreen *s)
+{
+    BenchFunc *bench = splashGetBenchFunc (s->display);
+
+    SPLASH_SCREEN (s);
+
+    if (bench && ss->hasBack)
+	(*bench->addTexture) (s, &ss->back_img, "splash", "background",
+			      BENCH_TEXTURE_BYTES (ss->backSize[0],
+						   ss->backSize[1]));
+    if (bench && ss->hasLogo)
+	(*bench->addTexture) (s, &ss->logo_img, "splash", "logo",
+			      BENCH_TEXTURE_BYTES (ss->logoSize[0],
+						   ss->logoSize[1]));
+}
 
 static void
 splashPreparePaintScreen (CompScreen *s,
@@ -89,6 +121,7 @@ splashPreparePaintScreen (CompScreen *s,
 {
     SPLASH_SCREEN (s);
     CompDisplay *d = s->display;
+    BenchFunc   *bench;
 
     Bool lastShot = FALSE;
 
@@ -178,6 +211,8 @@ splashPreparePaintScreen (CompScreen *s,
 		compLogMessage ("splash", CompLogLevelWarn,
 				"Could not load splash logo image \"%s\" !",
 				splashGetLogo (d) );
+
+	    splashReportTextures (s);
 	}
     }
     else
@@ -187,9 +222,12 @@ splashPreparePaintScreen (CompScreen *s,
 	if (ss->hasInit)
 	{
 	    ss->hasInit = FALSE;
+	    bench = splashGetBenchFunc (d);
 
 	    if (ss->hasBack)
 	    {
+		if (bench)
+		    (*bench->removeTexture) (s, &ss->back_img);
 		finiTexture (s, &ss->back_img);
 		initTexture (s, &ss->back_img);
 		ss->hasBack = FALSE;
@@ -197,6 +235,8 @@ splashPreparePaintScreen (CompScreen *s,
 
 	    if (ss->hasLogo)
 	    {
+		if (bench)
+		    (*bench->removeTexture) (s, &ss->logo_img);
 		finiTexture (s, &ss->logo_img);
 		initTexture (s, &ss->logo_img);
 		ss->hasLogo = FALSE;
@@ -540,6 +580,7 @@ static void
 splashFiniScreen (CompPlugin *p,
 		  CompScreen *s)
 {
+    BenchFunc *bench = splashGetBenchFunc (s->display);
 
     SPLASH_SCREEN (s);
 
@@ -549,6 +590,12 @@ splashFiniScreen (CompPlugin *p,
     UNWRAP (ss, s, donePaintScreen);
     UNWRAP (ss, s, paintWindow);
 
+    if (bench)
+    {
+	(*bench->removeTexture) (s, &ss->back_img);
+	(*bench->removeTexture) (s, &ss->logo_img);
+    }
+
     finiTexture (s, &ss->back_img);
     finiTexture (s, &ss->logo_img);
 
@@ -580,6 +627,32 @@ splashInitiate (CompDisplay     *d,
 }
 
 
+/* Images loaded before bench started are reported when it asks */
+static void
+splashHandleCompizEvent (CompDisplay *d,
+			 const char  *pluginName,
+			 const char  *eventName,
+			 CompOption  *option,
+			 int         nOption)
+{
+    CompScreen *s;
+
+    SPLASH_DISPLAY (d);
+
+    UNWRAP (sd, d, handleCompizEvent);
+    (*d->handleCompizEvent) (d, pluginName, eventName, option, nOption);
+    WRAP (sd, d, handleCompizEvent, splashHandleCompizEvent);
+
+    if (strcmp (pluginName, "bench") == 0 &&
+	strcmp (eventName, "start") == 0)
+    {
+	s = findScreenAtDisplay (d, getIntOptionNamed (option, nOption,
+						       "root", 0));
+	if (s)
+	    splashReportTextures (s);
+    }
+}
+
 static Bool
 splashInitDisplay (CompPlugin  *p,
 		   CompDisplay *d)
@@ -610,6 +683,8 @@ splashInitDisplay (CompPlugin  *p,
 
     splashSetInitiateKeyInitiate (d, splashInitiate);
 
+    WRAP (sd, d, handleCompizEvent, splashHandleCompizEvent);
+
     d->base.privates[displayPrivateIndex].ptr = sd;
     return TRUE;
 }
@@ -620,6 +695,8 @@ splashFiniDisplay (CompPlugin  *p,
 {
     SPLASH_DISPLAY (d);
 
+    UNWRAP (sd, d, handleCompizEvent);
+
     /* Free the private index */
     freeScreenPrivateIndex (d, sd->screenPrivateIndex);
 
@@ -0,0 +1,395 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "vidcap-yuv.h"
+#include "wcap-yuv.h"
+
+/* Runs the GPU conversion of the recorder on a framebuffer object of a
+ * surfaceless EGL context, llvmpipe will do, for several areas and capture scales and compares
+ * the planes with wcap_convert_to_yv12_c() of the area halved on the
+ * CPU. Partial readbacks must match the planes of the whole frame.
+ * Skipped, with exit status 77, without a GL context that has the
+ * extensions the recorder needs. */
+
+#define SKIP 77
+
+/* Largest difference from the CPU result, in levels: the GPU rounds
+ * each halving and the chroma average to 8 bits */
+#define TOLERANCE 3
+
+#define WIDTH	320
+#define HEIGHT	200
+
+static uint32_t seed = 1;
+static int nchecks, failed;
+static GLuint screen;
+
+static uint32_t
+rnd(void)
+{
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+
+	return seed;
+}
+
+static int
+has_extension(const char *name)
+{
+	const char *ext = (const char *) glGetString(GL_EXTENSIONS);
+	size_t len = strlen(name);
+
+	while (ext && (ext = strstr(ext, name))) {
+		if (ext[len] == ' ' || ext[len] == '\0')
+			return 1;
+		ext += len;
+	}
+
+	return 0;
+}
+
+static int
+has_egl_extension(EGLDisplay dpy, const char *name)
+{
+	const char *ext = eglQueryString(dpy, EGL_EXTENSIONS);
+	size_t len = strlen(name);
+
+	while (ext && (ext = strstr(ext, name))) {
+		if (ext[len] == ' ' || ext[len] == '\0')
+			return 1;
+		ext += len;
+	}
+
+	return 0;
+}
+
+/* A context without any window system, on Mesa's surfaceless platform */
+static int
+setup_context(struct vidcap_gl *gl)
+{
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay;
+	EGLDisplay dpy;
+	EGLContext context;
+
+	if (!has_egl_extension(EGL_NO_DISPLAY, "EGL_MESA_platform_surfaceless"))
+		return 0;
+
+	getPlatformDisplay = (void *)
+		eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (!getPlatformDisplay)
+		return 0;
+
+	dpy = (*getPlatformDisplay) (EGL_PLATFORM_SURFACELESS_MESA,
+				     EGL_DEFAULT_DISPLAY, NULL);
+	if (dpy == EGL_NO_DISPLAY || !eglInitialize(dpy, NULL, NULL) ||
+	    !has_egl_extension(dpy, "EGL_KHR_no_config_context") ||
+	    !has_egl_extension(dpy, "EGL_KHR_surfaceless_context") ||
+	    !eglBindAPI(EGL_OPENGL_API))
+		return 0;
+
+	context = eglCreateContext(dpy, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT,
+				   NULL);
+	if (context == EGL_NO_CONTEXT ||
+	    !eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+		return 0;
+
+	if (!has_extension("GL_EXT_framebuffer_object") ||
+	    !has_extension("GL_ARB_fragment_program") ||
+	    !has_extension("GL_ARB_texture_rectangle"))
+		return 0;
+
+	gl->genPrograms = (void *) eglGetProcAddress("glGenProgramsARB");
+	gl->deletePrograms = (void *) eglGetProcAddress("glDeleteProgramsARB");
+	gl->bindProgram = (void *) eglGetProcAddress("glBindProgramARB");
+	gl->programString = (void *) eglGetProcAddress("glProgramStringARB");
+	gl->programLocalParameter4f = (void *)
+		eglGetProcAddress("glProgramLocalParameter4fARB");
+	gl->genFramebuffers = (void *)
+		eglGetProcAddress("glGenFramebuffersEXT");
+	gl->deleteFramebuffers = (void *)
+		eglGetProcAddress("glDeleteFramebuffersEXT");
+	gl->bindFramebuffer = (void *)
+		eglGetProcAddress("glBindFramebufferEXT");
+	gl->checkFramebufferStatus = (void *)
+		eglGetProcAddress("glCheckFramebufferStatusEXT");
+	gl->framebufferTexture2D = (void *)
+		eglGetProcAddress("glFramebufferTexture2DEXT");
+
+	if (!gl->genPrograms || !gl->deletePrograms || !gl->bindProgram ||
+	    !gl->programString || !gl->programLocalParameter4f ||
+	    !gl->genFramebuffers || !gl->deleteFramebuffers ||
+	    !gl->bindFramebuffer || !gl->checkFramebufferStatus ||
+	    !gl->framebufferTexture2D)
+		return 0;
+
+	printf("%s\n", (const char *) glGetString(GL_RENDERER));
+
+	return 1;
+}
+
+/* Random pixels in R, G, B, X byte order, top row first, in a
+ * framebuffer that stands in for the screen, bottom row first */
+static GLuint
+setup_screen(struct vidcap_gl *gl, uint32_t *frame)
+{
+	uint32_t *flipped;
+	GLuint tex, fbo;
+	int i;
+
+	flipped = malloc(WIDTH * HEIGHT * 4);
+	if (!flipped) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < WIDTH * HEIGHT; i++)
+		frame[i] = rnd() | 0xff000000;
+	for (i = 0; i < HEIGHT; i++)
+		memcpy(flipped + (HEIGHT - 1 - i) * WIDTH, frame + i * WIDTH,
+		       WIDTH * 4);
+
+	glGenTextures(1, &tex);
+	glBindTexture(GL_TEXTURE_2D, tex);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, WIDTH, HEIGHT, 0,
+		     GL_RGBA, GL_UNSIGNED_BYTE, flipped);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	free(flipped);
+
+	(*gl->genFramebuffers) (1, &fbo);
+	(*gl->bindFramebuffer) (GL_FRAMEBUFFER_EXT, fbo);
+	(*gl->framebufferTexture2D) (GL_FRAMEBUFFER_EXT,
+				     GL_COLOR_ATTACHMENT0_EXT,
+				     GL_TEXTURE_2D, tex, 0);
+	if ((*gl->checkFramebufferStatus) (GL_FRAMEBUFFER_EXT) !=
+	    GL_FRAMEBUFFER_COMPLETE_EXT) {
+		fprintf(stderr, "could not set up the screen framebuffer\n");
+		exit(EXIT_FAILURE);
+	}
+
+	return fbo;
+}
+
+/* The area halved levels times by averaging 2x2 blocks, and cropped to
+ * width x height */
+static void
+halve_area(const uint32_t *frame, int x, int y, int levels,
+	   int width, int height, uint32_t *out)
+{
+	int i, j, k, c, scale = 1 << levels, sum;
+	const unsigned char *p;
+
+	for (j = 0; j < height; j++) {
+		for (i = 0; i < width; i++) {
+			out[j * width + i] = 0;
+			for (c = 0; c < 4; c++) {
+				sum = 0;
+				for (k = 0; k < scale * scale; k++) {
+					p = (const unsigned char *)
+						&frame[(y + j * scale + k / scale) *
+						       WIDTH + x + i * scale +
+						       k % scale];
+					sum += p[c];
+				}
+				out[j * width + i] |= (uint32_t)
+					((sum + scale * scale / 2) /
+					 (scale * scale)) << (c * 8);
+			}
+		}
+	}
+}
+
+static int
+max_diff(const unsigned char *a, const unsigned char *b, size_t len)
+{
+	int d, max = 0;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		d = abs(a[i] - b[i]);
+		if (d > max)
+			max = d;
+	}
+
+	return max;
+}
+
+/* Compare the planes of one rectangle, read back to p, with those of
+ * the whole frame. Returns where the next rectangle starts, or NULL
+ * when they differ. */
+static unsigned char *
+compare_rect(unsigned char *planes, int width, int height,
+	     const struct wcap_rectangle *r, unsigned char *p)
+{
+	unsigned char *plane = planes;
+	int i, row, shift, len;
+
+	for (i = 0; i < 3; i++) {
+		shift = i ? 1 : 0;
+		len = (r->x2 - r->x1) >> shift;
+		for (row = r->y1 >> shift; row < r->y2 >> shift; row++) {
+			if (memcmp(plane + row * (width >> shift) +
+				   (r->x1 >> shift), p, len))
+				return NULL;
+			p += len;
+		}
+		plane += (size_t) (width >> shift) * (height >> shift);
+	}
+
+	return p;
+}
+
+static void
+check_area(struct vidcap_gl *gl, const uint32_t *frame,
+	   int x, int y, int width, int height, int levels)
+{
+	struct vidcap_yuv yuv;
+	struct wcap_rectangle rects[2];
+	unsigned char *ref, *planes, *part, *p;
+	uint32_t *halved;
+	size_t luma;
+	int i, n, w, h, d[3];
+
+	memset(&yuv, 0, sizeof yuv);
+	yuv.gl = *gl;
+	if (!vidcap_yuv_init(&yuv, width, height, levels)) {
+		fprintf(stderr, "could not set up %dx%d, scale %d\n",
+			width, height, levels);
+		failed = 1;
+		return;
+	}
+
+	w = yuv.width;
+	h = yuv.height;
+	luma = (size_t) w * h;
+	halved = malloc(luma * 4);
+	ref = malloc(luma * 3 / 2);
+	planes = malloc(luma * 3 / 2);
+	part = malloc(luma * 3 / 2 * 2);
+	if (!halved || !ref || !planes || !part) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	halve_area(frame, x, y, levels, w, h, halved);
+	wcap_convert_to_yv12_c(halved, w, h, ref);
+
+	/* The conversion leaves the default framebuffer bound */
+	(*gl->bindFramebuffer) (GL_FRAMEBUFFER_EXT, screen);
+	vidcap_yuv_convert(&yuv, x, HEIGHT - y - height);
+
+	rects[0].x1 = rects[0].y1 = 0;
+	rects[0].x2 = width;
+	rects[0].y2 = height;
+	n = vidcap_yuv_rects(&yuv, rects, 1);
+	vidcap_yuv_read_planes(&yuv, rects, n, (uint32_t *) planes);
+
+	d[0] = max_diff(planes, ref, luma);
+	d[1] = max_diff(planes + luma, ref + luma, luma / 4);
+	d[2] = max_diff(planes + luma + luma / 4, ref + luma + luma / 4,
+			luma / 4);
+
+	nchecks++;
+	if (n != 1 || d[0] > TOLERANCE || d[1] > TOLERANCE ||
+	    d[2] > TOLERANCE || glGetError() != GL_NO_ERROR) {
+		fprintf(stderr, "%dx%d at %d,%d, scale %d: Y, Cb, Cr "
+			"differ by %d, %d, %d\n", width, height, x, y, levels,
+			d[0], d[1], d[2]);
+		failed = 1;
+	}
+
+	/* Two damaged rectangles, read back plane by plane */
+	rects[0].x1 = width / 7;
+	rects[0].y1 = height / 5 + 1;
+	rects[0].x2 = width / 2;
+	rects[0].y2 = height / 2 + 3;
+	rects[1].x1 = width * 2 / 3 + 1;
+	rects[1].y1 = height / 3;
+	rects[1].x2 = width;
+	rects[1].y2 = height * 3 / 4;
+	n = vidcap_yuv_rects(&yuv, rects, 2);
+	vidcap_yuv_read_planes(&yuv, rects, n, (uint32_t *) part);
+
+	nchecks++;
+	p = part;
+	for (i = 0; i < n && p; i++)
+		p = compare_rect(planes, w, h, &rects[i], p);
+	if (!p) {
+		fprintf(stderr, "%dx%d, scale %d: rectangle %d differs\n",
+			width, height, levels, i - 1);
+		failed = 1;
+	}
+
+	vidcap_yuv_fini(&yuv);
+	free(halved);
+	free(ref);
+	free(planes);
+	free(part);
+}
+
+int
+main(void)
+{
+	static const int areas[][4] = {
+		{ 0, 0, WIDTH, HEIGHT },
+		{ 13, 7, 203, 151 },
+		{ 101, 50, 64, 34 },
+	};
+	struct vidcap_gl gl;
+	uint32_t *frame;
+	int i, levels;
+
+	if (!setup_context(&gl)) {
+		printf("no GL context with framebuffer objects, fragment "
+		       "programs and rectangle textures, skipped\n");
+		return SKIP;
+	}
+
+	frame = malloc(WIDTH * HEIGHT * 4);
+	if (!frame) {
+		fprintf(stderr, "out of memory\n");
+		return EXIT_FAILURE;
+	}
+	screen = setup_screen(&gl, frame);
+
+	for (levels = 0; levels <= 2; levels++)
+		for (i = 0; i < (int) (sizeof areas / sizeof areas[0]); i++)
+			check_area(&gl, frame, areas[i][0], areas[i][1],
+				   areas[i][2], areas[i][3], levels);
+
+	printf("gpu   %d checks against c\n", nchecks);
+	printf("%s\n", failed ? "FAILED" : "ok");
+
+	free(frame);
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
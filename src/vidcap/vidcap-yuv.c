@@ -0,0 +1,357 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "vidcap-yuv.h"
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+/* Each fragment of a plane target packs four horizontally adjacent
+ * samples, so the planes read back at one byte per sample. Sample
+ * positions come from fragment.position * scale + offset, advancing by
+ * step; rows are flipped so the planes read back top row first. Chroma
+ * samples fall between four source pixels and the bilinear filter
+ * averages them. */
+static const char *yuvProgram =
+	"!!ARBfp1.0\n"
+	"PARAM scale = program.local[0];\n"
+	"PARAM offset = program.local[1];\n"
+	"PARAM coeff = program.local[2];\n"
+	"PARAM step = program.local[3];\n"
+	"TEMP pos, c, out;\n"
+	"MAD pos, fragment.position, scale, offset;\n"
+	"TEX c, pos, texture[0], RECT;\n"
+	"DP3 out.x, c, coeff;\n"
+	"ADD pos, pos, step;\n"
+	"TEX c, pos, texture[0], RECT;\n"
+	"DP3 out.y, c, coeff;\n"
+	"ADD pos, pos, step;\n"
+	"TEX c, pos, texture[0], RECT;\n"
+	"DP3 out.z, c, coeff;\n"
+	"ADD pos, pos, step;\n"
+	"TEX c, pos, texture[0], RECT;\n"
+	"DP3 out.w, c, coeff;\n"
+	"ADD result.color, out, coeff.w;\n"
+	"END\n";
+
+/* Y, Cb and Cr weights of r, g, b and the offset, matching wcap-yuv.c */
+static const GLfloat yuvCoeff[3][4] = {
+	{  0.29900f,  0.58699f,  0.11401f, 0.0f },
+	{ -0.16863f, -0.33106f,  0.49969f, 128.0f / 255.0f },
+	{  0.49981f, -0.41852f, -0.08129f, 128.0f / 255.0f }
+};
+
+static GLuint
+vidcap_yuv_target(struct vidcap_yuv *yuv, int width, int height, GLuint *fbo)
+{
+	struct vidcap_gl *gl = &yuv->gl;
+	GLuint tex;
+	GLenum status;
+
+	glGenTextures(1, &tex);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB, tex);
+	glTexParameteri(GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_RECTANGLE_ARB, 0, GL_RGBA8, width, height, 0,
+		     GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB, 0);
+
+	if (!fbo)
+		return tex;
+
+	(*gl->genFramebuffers) (1, fbo);
+	(*gl->bindFramebuffer) (GL_FRAMEBUFFER_EXT, *fbo);
+	(*gl->framebufferTexture2D) (GL_FRAMEBUFFER_EXT,
+				     GL_COLOR_ATTACHMENT0_EXT,
+				     GL_TEXTURE_RECTANGLE_ARB, tex, 0);
+	status = (*gl->checkFramebufferStatus) (GL_FRAMEBUFFER_EXT);
+	(*gl->bindFramebuffer) (GL_FRAMEBUFFER_EXT, 0);
+
+	if (status != GL_FRAMEBUFFER_COMPLETE_EXT) {
+		(*gl->deleteFramebuffers) (1, fbo);
+		glDeleteTextures(1, &tex);
+		*fbo = 0;
+		return 0;
+	}
+
+	return tex;
+}
+
+void
+vidcap_yuv_fini(struct vidcap_yuv *yuv)
+{
+	struct vidcap_gl *gl = &yuv->gl;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (yuv->level_fbo[i])
+			(*gl->deleteFramebuffers) (1, &yuv->level_fbo[i]);
+		if (yuv->level[i])
+			glDeleteTextures(1, &yuv->level[i]);
+		yuv->level_fbo[i] = yuv->level[i] = 0;
+	}
+
+	for (i = 0; i < 3; i++) {
+		if (yuv->plane_fbo[i])
+			(*gl->deleteFramebuffers) (1, &yuv->plane_fbo[i]);
+		if (yuv->plane[i])
+			glDeleteTextures(1, &yuv->plane[i]);
+		yuv->plane_fbo[i] = yuv->plane[i] = 0;
+	}
+
+	if (yuv->source)
+		glDeleteTextures(1, &yuv->source);
+	if (yuv->program)
+		(*gl->deletePrograms) (1, &yuv->program);
+	yuv->source = yuv->program = 0;
+}
+
+/* The frame is cropped to a multiple of 8 x 2 luma samples so the
+ * packed planes line up */
+int
+vidcap_yuv_init(struct vidcap_yuv *yuv, int area_width, int area_height,
+		int levels)
+{
+	struct vidcap_gl *gl = &yuv->gl;
+	GLint errorPos;
+	int i, width, height, ok;
+
+	yuv->area_width = area_width;
+	yuv->area_height = area_height;
+	yuv->levels = levels;
+	yuv->scale = 1 << levels;
+	yuv->width = (area_width / yuv->scale) & ~7;
+	yuv->height = (area_height / yuv->scale) & ~1;
+	if (yuv->width <= 0 || yuv->height <= 0)
+		return 0;
+
+	glGetError();
+
+	(*gl->genPrograms) (1, &yuv->program);
+	(*gl->bindProgram) (GL_FRAGMENT_PROGRAM_ARB, yuv->program);
+	(*gl->programString) (GL_FRAGMENT_PROGRAM_ARB,
+			      GL_PROGRAM_FORMAT_ASCII_ARB,
+			      strlen(yuvProgram), yuvProgram);
+	glGetIntegerv(GL_PROGRAM_ERROR_POSITION_ARB, &errorPos);
+	(*gl->bindProgram) (GL_FRAGMENT_PROGRAM_ARB, 0);
+
+	ok = glGetError() == GL_NO_ERROR && errorPos == -1;
+
+	width = area_width;
+	height = area_height;
+	yuv->source = vidcap_yuv_target(yuv, width, height, NULL);
+	ok = ok && yuv->source;
+
+	for (i = 0; i < levels; i++) {
+		width /= 2;
+		height /= 2;
+		yuv->level[i] = vidcap_yuv_target(yuv, width, height,
+						  &yuv->level_fbo[i]);
+		ok = ok && yuv->level[i];
+	}
+
+	yuv->plane[0] = vidcap_yuv_target(yuv, yuv->width / 4, yuv->height,
+					  &yuv->plane_fbo[0]);
+	for (i = 1; i < 3; i++)
+		yuv->plane[i] = vidcap_yuv_target(yuv, yuv->width / 8,
+						  yuv->height / 2,
+						  &yuv->plane_fbo[i]);
+	ok = ok && yuv->plane[0] && yuv->plane[1] && yuv->plane[2];
+
+	if (!ok) {
+		vidcap_yuv_fini(yuv);
+		return 0;
+	}
+
+	return 1;
+}
+
+static void
+vidcap_yuv_pass(struct vidcap_yuv *yuv, GLuint fbo, int width, int height,
+		float tx1, float ty1, float tx2, float ty2)
+{
+	(*yuv->gl.bindFramebuffer) (GL_FRAMEBUFFER_EXT, fbo);
+	glViewport(0, 0, width, height);
+
+	glBegin(GL_QUADS);
+	glTexCoord2f(tx1, ty1);
+	glVertex2f(-1, -1);
+	glTexCoord2f(tx2, ty1);
+	glVertex2f(1, -1);
+	glTexCoord2f(tx2, ty2);
+	glVertex2f(1, 1);
+	glTexCoord2f(tx1, ty2);
+	glVertex2f(-1, 1);
+	glEnd();
+}
+
+/* Run the area through the conversion passes */
+void
+vidcap_yuv_convert(struct vidcap_yuv *yuv, int x, int y)
+{
+	struct vidcap_gl *gl = &yuv->gl;
+	int i, width, height, chroma;
+
+	glPushAttrib(GL_VIEWPORT_BIT | GL_ENABLE_BIT | GL_TEXTURE_BIT);
+	glDisable(GL_BLEND);
+	glDisable(GL_SCISSOR_TEST);
+	glDisable(GL_STENCIL_TEST);
+	glDisable(GL_DEPTH_TEST);
+
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	glLoadIdentity();
+
+	glEnable(GL_TEXTURE_RECTANGLE_ARB);
+	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+
+	width = yuv->area_width;
+	height = yuv->area_height;
+
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB, yuv->source);
+	glCopyTexSubImage2D(GL_TEXTURE_RECTANGLE_ARB, 0, 0, 0, x, y,
+			    width, height);
+
+	/* Sampling the middle of each 2x2 block halves exactly. An odd
+	 * row or column is dropped at the bottom or right edge of the
+	 * area, like the final crop does. */
+	for (i = 0; i < yuv->levels; i++) {
+		vidcap_yuv_pass(yuv, yuv->level_fbo[i], width / 2, height / 2,
+				0, height & 1, width & ~1, height);
+		width /= 2;
+		height /= 2;
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB, yuv->level[i]);
+	}
+
+	glEnable(GL_FRAGMENT_PROGRAM_ARB);
+	(*gl->bindProgram) (GL_FRAGMENT_PROGRAM_ARB, yuv->program);
+
+	for (i = 0; i < 3; i++) {
+		chroma = i > 0;
+		(*gl->programLocalParameter4f) (GL_FRAGMENT_PROGRAM_ARB, 0,
+						chroma ? 8 : 4,
+						chroma ? -2 : -1, 0, 0);
+		(*gl->programLocalParameter4f) (GL_FRAGMENT_PROGRAM_ARB, 1,
+						chroma ? -3 : -1.5,
+						height, 0, 0);
+		(*gl->programLocalParameter4f) (GL_FRAGMENT_PROGRAM_ARB, 2,
+						yuvCoeff[i][0], yuvCoeff[i][1],
+						yuvCoeff[i][2], yuvCoeff[i][3]);
+		(*gl->programLocalParameter4f) (GL_FRAGMENT_PROGRAM_ARB, 3,
+						chroma ? 2 : 1, 0, 0, 0);
+		vidcap_yuv_pass(yuv, yuv->plane_fbo[i],
+				yuv->width / (chroma ? 8 : 4),
+				yuv->height / (chroma ? 2 : 1),
+				0, 0, 0, 0);
+	}
+
+	(*gl->bindProgram) (GL_FRAGMENT_PROGRAM_ARB, 0);
+	(*gl->bindFramebuffer) (GL_FRAMEBUFFER_EXT, 0);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB, 0);
+
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+	glPopMatrix();
+
+	glPopAttrib();
+}
+
+/* Rectangles are widened to cover whole packed texels of all three
+ * planes. Alignment can make them overlap, so fall back to their
+ * extents when they would add up to more than a frame. */
+int
+vidcap_yuv_rects(struct vidcap_yuv *yuv, struct wcap_rectangle *rects, int n)
+{
+	struct wcap_rectangle *r, u;
+	int i, j, scale = yuv->scale, total = 0;
+
+	for (i = j = 0; i < n; i++) {
+		r = &rects[j];
+		*r = rects[i];
+
+		r->x1 = (r->x1 / scale) & ~7;
+		r->y1 = (r->y1 / scale) & ~1;
+		r->x2 = MIN (((r->x2 + scale - 1) / scale + 7) & ~7,
+			     yuv->width);
+		r->y2 = MIN (((r->y2 + scale - 1) / scale + 1) & ~1,
+			     yuv->height);
+
+		/* Damage in the cropped margin */
+		if (r->x1 >= r->x2 || r->y1 >= r->y2)
+			continue;
+
+		if (j) {
+			u.x1 = MIN (u.x1, r->x1);
+			u.y1 = MIN (u.y1, r->y1);
+			u.x2 = u.x2 > r->x2 ? u.x2 : r->x2;
+			u.y2 = u.y2 > r->y2 ? u.y2 : r->y2;
+		} else {
+			u = *r;
+		}
+		total += (r->x2 - r->x1) * (r->y2 - r->y1);
+		j++;
+	}
+
+	if (total > yuv->width * yuv->height) {
+		rects[0] = u;
+		j = 1;
+	}
+
+	return j;
+}
+
+int
+vidcap_yuv_read_planes(struct vidcap_yuv *yuv,
+		       const struct wcap_rectangle *rects, int nrects,
+		       uint32_t *data)
+{
+	int i, plane, shift, width, height, n = 0;
+
+	for (i = 0; i < nrects; i++) {
+		for (plane = 0; plane < 3; plane++) {
+			shift = plane ? 1 : 0;
+			width = ((rects[i].x2 - rects[i].x1) >> shift) / 4;
+			height = (rects[i].y2 - rects[i].y1) >> shift;
+
+			(*yuv->gl.bindFramebuffer) (GL_FRAMEBUFFER_EXT,
+						    yuv->plane_fbo[plane]);
+			glReadPixels((rects[i].x1 >> shift) / 4,
+				     rects[i].y1 >> shift, width, height,
+				     GL_RGBA, GL_UNSIGNED_BYTE,
+				     (GLvoid *) (data + n));
+			n += width * height;
+		}
+	}
+	(*yuv->gl.bindFramebuffer) (GL_FRAMEBUFFER_EXT, 0);
+
+	return n;
+}
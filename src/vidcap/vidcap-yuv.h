@@ -0,0 +1,93 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _VIDCAP_YUV_
+#define _VIDCAP_YUV_
+
+#include <stdint.h>
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#include "wcap-decode.h"
+
+/* Conversion of the recorded area to YUV 4:2:0 on the GPU, kept free of
+ * compiz so that vidcap-yuv-test can run it on any GL context. */
+
+/* Entry points beyond GL 1.1, which compiz looks up for each screen */
+struct vidcap_gl {
+	void (*genPrograms) (GLsizei n, GLuint *programs);
+	void (*deletePrograms) (GLsizei n, GLuint *programs);
+	void (*bindProgram) (GLenum target, GLuint program);
+	void (*programString) (GLenum target, GLenum format, GLsizei len,
+			       const GLvoid *string);
+	void (*programLocalParameter4f) (GLenum target, GLuint index,
+					 GLfloat x, GLfloat y,
+					 GLfloat z, GLfloat w);
+	void (*genFramebuffers) (GLsizei n, GLuint *framebuffers);
+	void (*deleteFramebuffers) (GLsizei n, GLuint *framebuffers);
+	void (*bindFramebuffer) (GLenum target, GLuint framebuffer);
+	GLenum (*checkFramebufferStatus) (GLenum target);
+	void (*framebufferTexture2D) (GLenum target, GLenum attachment,
+				      GLenum textarget, GLuint texture,
+				      GLint level);
+};
+
+/* The area of area_width x area_height pixels is copied to source,
+ * halved levels times into level[] and converted into packed plane
+ * targets of width x height luma samples, width x height being the
+ * halved area cropped to a multiple of 8 x 2. */
+struct vidcap_yuv {
+	struct vidcap_gl gl;
+	int area_width, area_height;
+	int levels, scale, width, height;
+	GLuint program;
+	GLuint source;
+	GLuint level[2], level_fbo[2];
+	GLuint plane[3], plane_fbo[3];
+};
+
+/* Returns 0, with nothing left allocated, when the GL objects cannot
+ * be set up or the area is too small */
+int vidcap_yuv_init(struct vidcap_yuv *yuv, int area_width, int area_height,
+		    int levels);
+void vidcap_yuv_fini(struct vidcap_yuv *yuv);
+
+/* Convert the area with its bottom left corner at x, y of the read
+ * framebuffer, in GL window coordinates */
+void vidcap_yuv_convert(struct vidcap_yuv *yuv, int x, int y);
+
+/* Map rectangles of the area, top row first, to the aligned rectangles
+ * of the planes that cover them. Returns how many there are. */
+int vidcap_yuv_rects(struct vidcap_yuv *yuv, struct wcap_rectangle *rects,
+		     int n);
+
+/* Read the Y, Cb and Cr planes of each rectangle back, one after the
+ * other, into data or the bound pack buffer at that offset. Returns
+ * the size in 32 bit words. */
+int vidcap_yuv_read_planes(struct vidcap_yuv *yuv,
+			   const struct wcap_rectangle *rects, int nrects,
+			   uint32_t *data);
+
+#endif
@@ -34,248 +34,1342 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
+#include <pthread.h>
 #include <dirent.h>
 #include <sys/stat.h>
 #include <math.h>
+#include <signal.h>
+#include <limits.h>
 
 #include <compiz-core.h>
+#include <GL/glext.h>
+#include <X11/cursorfont.h>
 
 #include "vidcap_options.h"
 #include "wcap-decode.h"
+#include "wcap-encode.h"
+#include "wcap-compress.h"
+#include "wcap-y4m.h"
+#include "vidcap-yuv.h"
 
 #define WCAPFILE "/tmp/vidcap.wcap"
-#define RAWFILE "/tmp/vidcap.raw"
+
+#define READBACK_BUFFERS 3
+#define MAX_RECTS 16
+
+#define INDICATOR_OFFSET 50
+#define INDICATOR_RADIUS 25
 
 #define DONE_MS 1500
 #define SPIN_MS 1000
 #define BLINK_MS 500
 
-static int VidcapDisplayPrivateIndex;
+/* Capture statistics drawn left of the indicator, one row each */
+#define STATS_ROWS 5
+#define STATS_ROW_HEIGHT 16
+#define STATS_NUMBER_WIDTH 48
+#define STATS_BAR_WIDTH 64
+#define STATS_WIDTH (STATS_NUMBER_WIDTH + STATS_BAR_WIDTH)
+#define STATS_DIGIT_WIDTH 6
+#define STATS_DIGIT_HEIGHT 10
+
+static int VidcapDisplayPrivateIndex;
+
+/* One captured frame waiting to be encoded. The pixel buffer is
+ * large enough for a full screen and the encoder compresses into
+ * it in place, so nothing is allocated per frame. */
+typedef struct _VidcapFrame
+{
+    uint32_t msecs;
+    Bool keyframe;
+    int nrects;
+    struct wcap_rectangle *rects;
+    uint32_t *pixels;
+} VidcapFrame;
+
+/* Per frame measurements of one kind, kept for the summary logged
+ * when recording stops */
+typedef struct _VidcapSamples
+{
+    uint32_t *v;
+    uint32_t count, size, max;
+    uint64_t sum;
+} VidcapSamples;
+
+/* Moving averages over the last frames, for the on-screen stats */
+typedef struct _VidcapAverages
+{
+    float readback_ms, encode_ms, depth, drop_rate;
+    uint64_t bytes;
+    unsigned int dropped;
+} VidcapAverages;
+
+typedef struct _VidcapDisplay
+{
+    int screenPrivateIndex;
+    int fd;
+    uint32_t ms;
+    uint32_t *frame;
+    Bool yuv;
+
+    /* Size of the recording as written into the header, which the
+     * shadow frame and the encoder thread go by */
+    int width, height;
+
+    /* Compression of each frame's run data, when built with a codec */
+    struct wcap_compressor *compressor;
+    void *packed;
+    size_t packed_size;
+
+    /* Frame ring shared between the paint path (producer)
+     * and the encoder thread (consumer). */
+    VidcapFrame *ring;
+    int ring_size, ring_head, ring_tail, ring_count;
+    pthread_mutex_t ring_mutex;
+    pthread_cond_t ring_cond;
+    pthread_t encoder;
+    Bool encoder_stop, encoder_error, encoder_done;
+    unsigned int frames, dropped;
+
+    /* Readback time and queue depth are sampled on the paint path,
+     * encode time and frame size by the encoder. The averages are
+     * shared and updated under ring_mutex. */
+    VidcapSamples readback_us, depth, encode_us, frame_bytes;
+    VidcapAverages avg;
+
+    /* Keyframe schedule (paint path) and frame index (encoder) */
+    uint32_t wcap_flags;
+    uint32_t keyframe_interval, last_keyframe;
+    Bool keyframe_pending;
+    struct wcap_index_entry *index;
+    uint32_t index_count, index_size;
+
+    /* Bytes of the capture file holding complete frames, followed
+     * by the live transcoder while recording. */
+    Bool live;
+    size_t committed;
+    pthread_cond_t live_cond;
+
+	int dot_timer;
+    pthread_t thread;
+    Bool thread_running, recording, show_dot, done;
+
+    HandleEventProc handleEvent;
+    Cursor cursor;
+} VidcapDisplay;
+
+/* A readback issued into a pixel pack buffer that has not been
+ * collected yet. */
+typedef struct _VidcapReadback
+{
+    GLuint pbo;
+    Bool pending, keyframe;
+    uint32_t msecs;
+    int nrects, npixels;
+    struct wcap_rectangle *rects;
+} VidcapReadback;
+
+typedef struct _VidcapScreen
+{
+    PaintScreenProc	paintScreen;
+    PreparePaintScreenProc	preparePaintScreen;
+    DonePaintScreenProc	donePaintScreen;
+    PaintOutputProc	paintOutput;
+
+    /* Area repainted since the last captured frame */
+    Region damage;
+
+    /* Part of the screen being recorded, following window when set.
+     * Its size is fixed for the whole recording. */
+    BoxRec area;
+    Window window;
+
+    /* Rubber band selection of the area to record */
+    int grabIndex;
+    int x1, y1, x2, y2;
+
+    Bool pbo;
+    PFNGLGENBUFFERSARBPROC genBuffers;
+    PFNGLDELETEBUFFERSARBPROC deleteBuffers;
+    PFNGLBINDBUFFERARBPROC bindBuffer;
+    PFNGLBUFFERDATAARBPROC bufferData;
+    PFNGLMAPBUFFERARBPROC mapBuffer;
+    PFNGLUNMAPBUFFERARBPROC unmapBuffer;
+
+    VidcapReadback readback[READBACK_BUFFERS];
+    int readback_index;
+    Bool readback_active;
+
+    /* Conversion of the area to YUV 4:2:0 on the GPU */
+    Bool yuv_supported, yuv_active;
+    struct vidcap_yuv yuv;
+} VidcapScreen;
+
+#define VIDCAP_DISPLAY(d) PLUGIN_DISPLAY(d, Vidcap, v)
+#define VIDCAP_SCREEN(s) PLUGIN_SCREEN(s, Vidcap, v)
+
+static void
+vidcapPreparePaintScreen (CompScreen *s, int ms)
+{
+	int delay_ms;
+
+	VIDCAP_SCREEN (s);
+	VIDCAP_DISPLAY (s->display);
+
+	if (vd->recording)
+		vd->ms += ms;
+
+	if (vidcapGetDrawIndicator (s->display) &&
+		(vd->recording || vd->thread_running || vd->done)) {
+		vd->dot_timer += ms;
+		delay_ms = (vd->thread_running ? SPIN_MS : BLINK_MS);
+		if (!vd->done && vd->dot_timer > delay_ms)	{
+			if (vd->thread_running)
+				vd->dot_timer -= SPIN_MS;
+			else
+				vd->dot_timer -= BLINK_MS;
+			vd->show_dot = !vd->show_dot;
+		}
+		if (vd->done && vd->dot_timer > DONE_MS)
+			vd->done = FALSE;
+	}
+
+	UNWRAP (vs, s, preparePaintScreen);
+	(*s->preparePaintScreen) (s, ms); 
+	WRAP (vs, s, preparePaintScreen, vidcapPreparePaintScreen);
+}
+
+/* Where the capture statistics go on an output */
+static void
+vidcap_stats_box(const BoxRec *output, BoxPtr box)
+{
+	box->x2 = output->x2 - INDICATOR_OFFSET - INDICATOR_RADIUS - 8;
+	box->x1 = box->x2 - STATS_WIDTH;
+	box->y1 = output->y2 - INDICATOR_OFFSET -
+		  STATS_ROWS * STATS_ROW_HEIGHT / 2;
+	box->y2 = box->y1 + STATS_ROWS * STATS_ROW_HEIGHT;
+}
+
+static void
+vidcapDonePaintScreen (CompScreen *s)
+{
+	VIDCAP_SCREEN (s);
+	VIDCAP_DISPLAY (s->display);
+
+	if (vidcapGetDrawIndicator (s->display) &&
+		(vd->recording || vd->thread_running || vd->done)) {
+		REGION indicator;
+		int i;
+
+		/* Only the indicator changes, keep the rest of the
+		 * screen out of the damage (and out of the capture) */
+		indicator.rects = &indicator.extents;
+		indicator.numRects = 1;
+
+		for (i = 0; i < s->nOutputDev; i++) {
+			BoxPtr box = &s->outputDev[i].region.extents;
+
+			indicator.extents.x1 = box->x2 - INDICATOR_OFFSET -
+					       INDICATOR_RADIUS - 1;
+			indicator.extents.y1 = box->y2 - INDICATOR_OFFSET -
+					       INDICATOR_RADIUS - 1;
+			indicator.extents.x2 = box->x2 - INDICATOR_OFFSET +
+					       INDICATOR_RADIUS + 1;
+			indicator.extents.y2 = box->y2 - INDICATOR_OFFSET +
+					       INDICATOR_RADIUS + 1;
+
+			damageScreenRegion(s, &indicator);
+		}
+	}
+
+	if (vidcapGetDrawStats (s->display) && vd->recording) {
+		REGION stats;
+		int i;
+
+		stats.rects = &stats.extents;
+		stats.numRects = 1;
+
+		for (i = 0; i < s->nOutputDev; i++) {
+			vidcap_stats_box(&s->outputDev[i].region.extents,
+					 &stats.extents);
+			damageScreenRegion(s, &stats);
+		}
+	}
+
+	UNWRAP (vs, s, donePaintScreen);
+	(*s->donePaintScreen) (s); 
+	WRAP (vs, s, donePaintScreen, vidcapDonePaintScreen);
+		
+}
+
+static int
+rect_area(const struct wcap_rectangle *r)
+{
+	return (r->x2 - r->x1) * (r->y2 - r->y1);
+}
+
+static void
+rect_union(struct wcap_rectangle *r, const struct wcap_rectangle *a,
+	   const struct wcap_rectangle *b)
+{
+	r->x1 = MIN (a->x1, b->x1);
+	r->y1 = MIN (a->y1, b->y1);
+	r->x2 = MAX (a->x2, b->x2);
+	r->y2 = MAX (a->y2, b->y2);
+}
+
+static uint32_t
+vidcap_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void
+vidcap_sample(VidcapSamples *samples, uint32_t v)
+{
+	uint32_t *tmp;
+
+	/* Keep counting when out of memory, only the p95 suffers */
+	if (samples->count == samples->size) {
+		tmp = realloc(samples->v, (samples->size ?
+					   samples->size * 2 : 4096) * sizeof v);
+		if (tmp) {
+			samples->v = tmp;
+			samples->size = samples->size ? samples->size * 2 : 4096;
+		}
+	}
+	if (samples->count < samples->size)
+		samples->v[samples->count] = v;
+
+	samples->count++;
+	samples->sum += v;
+	if (v > samples->max)
+		samples->max = v;
+}
+
+static void
+vidcap_samples_reset(VidcapSamples *samples)
+{
+	free(samples->v);
+	memset(samples, 0, sizeof (*samples));
+}
+
+static int
+compare_sample(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Sorts the samples */
+static void
+vidcap_log_samples(VidcapSamples *samples, const char *what,
+		   double scale, const char *unit)
+{
+	uint32_t n = MIN (samples->count, samples->size);
+
+	if (!n)
+		return;
+
+	qsort(samples->v, n, sizeof (uint32_t), compare_sample);
+
+	compLogMessage("vidcap", CompLogLevelInfo,
+		"%s: mean %.2f %s, p95 %.2f %s, max %.2f %s", what,
+		(double) samples->sum / samples->count * scale, unit,
+		samples->v[(n - 1) * 95 / 100] * scale, unit,
+		samples->max * scale, unit);
+}
+
+/* Summary of the recording, once the encoder has finished */
+static void
+vidcap_log_stats(VidcapDisplay *vd)
+{
+	double secs = vd->ms / 1000.0;
+
+	compLogMessage("vidcap", CompLogLevelInfo,
+		"%u frames in %.1f s, %u dropped, %.1f MB written, "
+		"%.1f fps effective", vd->frames, secs, vd->dropped,
+		vd->avg.bytes / 1e6,
+		secs > 0 ? (vd->frames - vd->dropped) / secs : 0.0);
+
+	vidcap_log_samples(&vd->readback_us, "Readback", 0.001, "ms");
+	vidcap_log_samples(&vd->encode_us, "Encode", 0.001, "ms");
+	vidcap_log_samples(&vd->frame_bytes, "Frame size", 0.001, "KB");
+	vidcap_log_samples(&vd->depth, "Queue depth", 1.0, "frames");
+
+	vidcap_samples_reset(&vd->readback_us);
+	vidcap_samples_reset(&vd->encode_us);
+	vidcap_samples_reset(&vd->frame_bytes);
+	vidcap_samples_reset(&vd->depth);
+}
+
+/* Weight of the newest frame in the on-screen averages */
+#define AVG(avg, v) ((avg) += ((v) - (avg)) / 8.0f)
+
+static void
+vidcap_free_ring(VidcapDisplay *vd)
+{
+	int i;
+
+	for (i = 0; i < vd->ring_size; i++) {
+		free(vd->ring[i].rects);
+		free(vd->ring[i].pixels);
+	}
+	free(vd->ring);
+	vd->ring = NULL;
+	vd->ring_size = 0;
+}
+
+static Bool
+vidcap_alloc_ring(VidcapDisplay *vd, int size, int max_rects, int max_pixels)
+{
+	int i;
+
+	vd->ring = calloc(size, sizeof (VidcapFrame));
+	if (!vd->ring)
+		return FALSE;
+
+	vd->ring_size = size;
+	vd->ring_head = vd->ring_tail = vd->ring_count = 0;
+
+	for (i = 0; i < size; i++) {
+		vd->ring[i].rects = malloc(max_rects *
+					   sizeof (struct wcap_rectangle));
+		vd->ring[i].pixels = malloc(max_pixels * 4);
+		if (!vd->ring[i].rects || !vd->ring[i].pixels) {
+			vidcap_free_ring(vd);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static Bool
+vidcap_index_frame(VidcapDisplay *vd, VidcapFrame *f)
+{
+	struct wcap_index_entry *index;
+
+	if (vd->index_count == vd->index_size) {
+		vd->index_size = vd->index_size ? vd->index_size * 2 : 1024;
+		index = realloc(vd->index, vd->index_size * sizeof (*index));
+		if (!index)
+			return FALSE;
+		vd->index = index;
+	}
+
+	index = &vd->index[vd->index_count++];
+	index->msecs = f->msecs;
+	index->flags = f->keyframe ? WCAP_FRAME_KEYFRAME : 0;
+	index->offset = vd->committed;
+
+	return TRUE;
+}
+
+/* Only written once recording stops cleanly; the decoder rebuilds the
+ * index of a file that lacks it from the frame headers. */
+static void
+vidcap_write_index(VidcapDisplay *vd)
+{
+	struct wcap_index_trailer trailer;
+	struct iovec v[2];
+	size_t len;
+
+	trailer.offset = vd->committed;
+	trailer.count = vd->index_count;
+	trailer.magic = WCAP_INDEX_MAGIC;
+
+	v[0].iov_base = vd->index;
+	v[0].iov_len = vd->index_count * sizeof (struct wcap_index_entry);
+	v[1].iov_base = &trailer;
+	v[1].iov_len = sizeof (trailer);
+
+	len = v[0].iov_len + v[1].iov_len;
+	if (writev(vd->fd, v, 2) != len)
+		compLogMessage("vidcap", CompLogLevelWarn,
+			"Could not write the frame index to %s", WCAPFILE);
+}
+
+/* Delta-RLE encode one frame against the shadow frame and append it to
+ * the capture file. The run output never overtakes the pixel being read,
+ * so all rectangles are compressed in place into one contiguous block,
+ * which then goes through the compressor when there is one. */
+static size_t
+vidcap_encode_frame(VidcapDisplay *vd, VidcapFrame *f, int width, int height)
+{
+	uint32_t *p, flags;
+	int i;
+	size_t len, size, packed = 0;
+	ssize_t ret;
+	struct wcap_frame_header header;
+	struct wcap_frame_header_ext ext;
+	struct iovec v[3];
+
+	p = f->pixels;
+
+	if (vd->yuv) {
+		/* Planes go out as they were read back,
+		 * 12 bits per pixel */
+		for (i = 0; i < f->nrects; i++)
+			p += rect_area(&f->rects[i]) * 3 / 8;
+	} else {
+		/* Keyframes cover the whole area */
+		p = wcap_encode_frame(p, vd->frame, width, height,
+				      f->rects, f->nrects, f->keyframe);
+	}
+
+	size = (p - f->pixels) * 4;
+	flags = f->keyframe ? WCAP_FRAME_KEYFRAME : 0;
+
+	if (vd->compressor) {
+		packed = wcap_compress(vd->compressor, vd->packed,
+				       vd->packed_size, f->pixels, size);
+		if (packed) {
+			size = packed;
+			flags |= wcap_compress_codec();
+		}
+	}
+
+	if (vd->wcap_flags & WCAP_HEADER_KEYFRAMES) {
+		ext.msecs = f->msecs;
+		ext.flags = flags;
+		ext.nrects = f->nrects;
+		ext.size = size;
+
+		v[0].iov_base = &ext;
+		v[0].iov_len = sizeof (ext);
+	} else {
+		header.msecs = f->msecs;
+		header.nrects = f->nrects;
+
+		v[0].iov_base = &header;
+		v[0].iov_len = sizeof (header);
+	}
+	v[1].iov_base = f->rects;
+	v[1].iov_len = f->nrects * sizeof (struct wcap_rectangle);
+	v[2].iov_base = packed ? vd->packed : (void *) f->pixels;
+	v[2].iov_len = size;
+
+	len = v[0].iov_len + v[1].iov_len + v[2].iov_len;
+	ret = writev(vd->fd, v, 3);
+	if (ret != len)
+		return 0;
+
+	if ((vd->wcap_flags & WCAP_HEADER_KEYFRAMES) &&
+	    !vidcap_index_frame(vd, f))
+		return 0;
+
+	return len;
+}
+
+static void *
+encoder_func(void *data)
+{
+	CompDisplay *d = (CompDisplay *) data;
+	VidcapFrame *f;
+	size_t len = 0;
+	uint32_t start, us = 0;
+
+	VIDCAP_DISPLAY (d);
+
+	pthread_mutex_lock(&vd->ring_mutex);
+	for (;;) {
+		while (!vd->ring_count && !vd->encoder_stop)
+			pthread_cond_wait(&vd->ring_cond, &vd->ring_mutex);
+
+		if (!vd->ring_count)
+			break;
+
+		f = &vd->ring[vd->ring_tail];
+		pthread_mutex_unlock(&vd->ring_mutex);
+
+		/* Keep draining after an error so the paint
+		 * path never waits on a full ring. */
+		if (!vd->encoder_error) {
+			start = vidcap_now_us();
+			len = vidcap_encode_frame(vd, f, vd->width, vd->height);
+			us = vidcap_now_us() - start;
+			if (!len)
+				vd->encoder_error = TRUE;
+		}
+
+		pthread_mutex_lock(&vd->ring_mutex);
+		vd->ring_tail = (vd->ring_tail + 1) % vd->ring_size;
+		vd->ring_count--;
+
+		if (len) {
+			vidcap_sample(&vd->encode_us, us);
+			vidcap_sample(&vd->frame_bytes, len);
+			AVG (vd->avg.encode_ms, us / 1000.0f);
+			vd->avg.bytes += len;
+			vd->committed += len;
+			pthread_cond_signal(&vd->live_cond);
+			len = 0;
+		}
+	}
+	pthread_mutex_unlock(&vd->ring_mutex);
+
+	if ((vd->wcap_flags & WCAP_HEADER_KEYFRAMES) && !vd->encoder_error)
+		vidcap_write_index(vd);
+
+	/* The index is not part of the committed frame data */
+	pthread_mutex_lock(&vd->ring_mutex);
+	vd->encoder_done = TRUE;
+	pthread_cond_signal(&vd->live_cond);
+	pthread_mutex_unlock(&vd->ring_mutex);
+
+	return NULL;
+}
+
+/* Ask the encoder to finish the queued frames and exit */
+static void
+vidcap_signal_encoder(VidcapDisplay *vd)
+{
+	pthread_mutex_lock(&vd->ring_mutex);
+	vd->encoder_stop = TRUE;
+	pthread_cond_signal(&vd->ring_cond);
+	pthread_mutex_unlock(&vd->ring_mutex);
+}
+
+/* Stop the encoder and wait for it to drain the ring */
+static void
+vidcap_stop_encoder(VidcapDisplay *vd)
+{
+	vidcap_signal_encoder(vd);
+
+	pthread_join(vd->encoder, NULL);
+
+	vidcap_free_ring(vd);
+	free(vd->frame);
+	free(vd->index);
+	vd->index = NULL;
+	wcap_compressor_destroy(vd->compressor);
+	vd->compressor = NULL;
+	free(vd->packed);
+	vd->packed = NULL;
+	close(vd->fd);
+
+	if (vd->dropped)
+		compLogMessage("vidcap", CompLogLevelWarn,
+			"Dropped %u of %u frames, encoder could not keep up",
+			vd->dropped, vd->frames);
+
+	vidcap_log_stats(vd);
+}
+
+/* Claim the next free ring slot. When the ring is full the frame is
+ * dropped: the encoder deltas against its own shadow copy, so the next
+ * frame picks up the changes as long as their damage is kept, see
+ * vidcap_restore_damage. */
+static VidcapFrame *
+vidcap_get_slot(VidcapDisplay *vd)
+{
+	VidcapFrame *f = NULL;
+
+	pthread_mutex_lock(&vd->ring_mutex);
+	vd->frames++;
+	vidcap_sample(&vd->depth, vd->ring_count);
+	AVG (vd->avg.depth, vd->ring_count);
+	if (vd->ring_count == vd->ring_size) {
+		vd->dropped++;
+		vd->avg.dropped = vd->dropped;
+		AVG (vd->avg.drop_rate, 1.0f);
+	} else {
+		f = &vd->ring[vd->ring_head];
+		AVG (vd->avg.drop_rate, 0.0f);
+	}
+	pthread_mutex_unlock(&vd->ring_mutex);
+
+	return f;
+}
+
+static void
+vidcap_queue_slot(VidcapDisplay *vd)
+{
+	pthread_mutex_lock(&vd->ring_mutex);
+	vd->ring_head = (vd->ring_head + 1) % vd->ring_size;
+	vd->ring_count++;
+	pthread_cond_signal(&vd->ring_cond);
+	pthread_mutex_unlock(&vd->ring_mutex);
+}
+
+/* Turn the damage accumulated since the last capture into at most
+ * MAX_RECTS rectangles and reset it. Region rectangles are sorted in
+ * y-x bands, so neighbours in the list are first collapsed into
+ * groups, then the pair whose bounding box wastes the fewest pixels is
+ * merged until the count is low enough. Merged boxes may overlap, which
+ * the format handles, but the pixel total must still fit a ring slot,
+ * so fall back to the extents when it does not. */
+static int
+vidcap_damage_rects(CompScreen *screen, struct wcap_rectangle *rects)
+{
+	struct wcap_rectangle tmp[MAX_RECTS * 4], u;
+	Region damage;
+	REGION area;
+	int i, j, n, group, best_i, best_j, waste, best_waste, total;
+	int x, y;
+
+	VIDCAP_SCREEN (screen);
+
+	area.rects = &area.extents;
+	area.numRects = 1;
+	area.extents = vs->area;
+
+	damage = vs->damage;
+	XIntersectRegion (damage, &area, damage);
+
+	if (!damage->numRects)
+		return 0;
+
+	/* Rectangles are relative to the recorded area */
+	x = vs->area.x1;
+	y = vs->area.y1;
+
+	group = (damage->numRects + MAX_RECTS * 4 - 1) / (MAX_RECTS * 4);
+	for (i = n = 0; i < damage->numRects; i++) {
+		struct wcap_rectangle r = {
+			damage->rects[i].x1 - x, damage->rects[i].y1 - y,
+			damage->rects[i].x2 - x, damage->rects[i].y2 - y
+		};
+
+		if (i % group)
+			rect_union(&tmp[n - 1], &tmp[n - 1], &r);
+		else
+			tmp[n++] = r;
+	}
+
+	while (n > MAX_RECTS) {
+		best_i = 0;
+		best_j = 1;
+		best_waste = INT_MAX;
+		for (i = 0; i < n; i++) {
+			for (j = i + 1; j < n; j++) {
+				rect_union(&u, &tmp[i], &tmp[j]);
+				waste = rect_area(&u) - rect_area(&tmp[i]) -
+					rect_area(&tmp[j]);
+				if (waste < 0)
+					waste = 0;
+				if (waste < best_waste) {
+					best_waste = waste;
+					best_i = i;
+					best_j = j;
+				}
+			}
+		}
+		rect_union(&tmp[best_i], &tmp[best_i], &tmp[best_j]);
+		tmp[best_j] = tmp[--n];
+	}
+
+	for (i = total = 0; i < n; i++)
+		total += rect_area(&tmp[i]);
+
+	if (total > (area.extents.x2 - x) * (area.extents.y2 - y)) {
+		rects[0].x1 = damage->extents.x1 - x;
+		rects[0].y1 = damage->extents.y1 - y;
+		rects[0].x2 = damage->extents.x2 - x;
+		rects[0].y2 = damage->extents.y2 - y;
+		n = 1;
+	} else {
+		memcpy(rects, tmp, n * sizeof (struct wcap_rectangle));
+	}
+
+	EMPTY_REGION (damage);
+
+	return n;
+}
+
+/* Mark the whole recorded area for the next captured frame */
+static void
+vidcap_damage_area(CompScreen *screen)
+{
+	REGION area;
+
+	VIDCAP_SCREEN (screen);
+
+	area.rects = &area.extents;
+	area.numRects = 1;
+	area.extents = vs->area;
+
+	XUnionRegion (vs->damage, &area, vs->damage);
+}
+
+/* Turn this frame into a keyframe when one is due by extending the
+ * damage to the whole recorded area. A dropped keyframe is retried
+ * with the next frame. */
+static Bool
+vidcap_keyframe_due(CompScreen *screen)
+{
+	VIDCAP_DISPLAY (screen->display);
+
+	if (!vd->keyframe_pending &&
+	    (!vd->keyframe_interval ||
+	     vd->ms - vd->last_keyframe < vd->keyframe_interval))
+		return FALSE;
+
+	vidcap_damage_area(screen);
+	vd->keyframe_pending = FALSE;
+	vd->last_keyframe = vd->ms;
+
+	return TRUE;
+}
+
+/* Set up the conversion passes when the recording is to be made in
+ * YUV */
+static Bool
+vidcap_start_yuv(CompScreen *s)
+{
+	VIDCAP_SCREEN (s);
+
+	vs->yuv_active = FALSE;
+
+	if (vidcapGetCaptureFormat (s->display) != CaptureFormatSubsampled)
+		return FALSE;
+
+	if (!vs->yuv_supported) {
+		compLogMessage("vidcap", CompLogLevelWarn,
+			"Converting on the GPU needs framebuffer objects, "
+			"fragment programs and rectangle textures, "
+			"recording full color instead");
+		return FALSE;
+	}
+
+	if (!vidcap_yuv_init(&vs->yuv, vs->area.x2 - vs->area.x1,
+			     vs->area.y2 - vs->area.y1,
+			     vidcapGetCaptureScale (s->display))) {
+		/* Nothing to warn about for an area smaller than 8 x 2 */
+		if (vs->yuv.width > 0 && vs->yuv.height > 0)
+			compLogMessage("vidcap", CompLogLevelWarn,
+				"Could not set up the GPU conversion, "
+				"recording full color instead");
+		return FALSE;
+	}
+
+	vs->yuv_active = TRUE;
+
+	return TRUE;
+}
+
+static void
+vidcap_stop_yuv(CompScreen *s)
+{
+	VIDCAP_SCREEN (s);
+
+	vidcap_yuv_fini(&vs->yuv);
+	vs->yuv_active = FALSE;
+}
 
-typedef struct _VidcapDisplay
+/* Read the rectangles back one after the other into pixel_data, or into
+ * the bound pack buffer at that offset. Returns the number of pixels. */
+static int
+vidcap_read_rects(CompScreen *screen, struct wcap_rectangle *rects,
+		  int nrects, uint32_t *pixel_data)
 {
-    int screenPrivateIndex;
-    int fd;
-    uint32_t ms;
-    uint32_t *frame;
+	int i, width, height, npixels = 0;
 
-	int dot_timer;
-    pthread_t thread;
-    Bool thread_running, recording, show_dot, done;
-} VidcapDisplay;
+	VIDCAP_SCREEN (screen);
 
-typedef struct _VidcapScreen
+	for (i = 0; i < nrects; i++) {
+		width = rects[i].x2 - rects[i].x1;
+		height = rects[i].y2 - rects[i].y1;
+
+		glReadPixels(vs->area.x1 + rects[i].x1,
+				screen->height - vs->area.y1 - rects[i].y2,
+				width, height, GL_RGBA, GL_UNSIGNED_BYTE,
+				(GLvoid *) (pixel_data + npixels));
+
+		npixels += width * height;
+	}
+
+	return npixels;
+}
+
+/* The rectangles of the recorded frame that changed, and their
+ * readback in either capture format */
+static int
+vidcap_frame_rects(CompScreen *screen, struct wcap_rectangle *rects)
 {
-    PaintScreenProc	paintScreen;
-    PreparePaintScreenProc	preparePaintScreen;
-    DonePaintScreenProc	donePaintScreen;
-} VidcapScreen;
+	int n;
 
-#define VIDCAP_DISPLAY(d) PLUGIN_DISPLAY(d, Vidcap, v)
-#define VIDCAP_SCREEN(s) PLUGIN_SCREEN(s, Vidcap, v)
+	VIDCAP_SCREEN (screen);
+
+	n = vidcap_damage_rects(screen, rects);
+	if (vs->yuv_active)
+		n = vidcap_yuv_rects(&vs->yuv, rects, n);
+
+	return n;
+}
 
+static int
+vidcap_read_frame(CompScreen *screen, struct wcap_rectangle *rects,
+		  int nrects, uint32_t *data)
+{
+	VIDCAP_SCREEN (screen);
+
+	if (!vs->yuv_active)
+		return vidcap_read_rects(screen, rects, nrects, data);
+
+	if (!nrects)
+		return 0;
+
+	vidcap_yuv_convert(&vs->yuv, vs->area.x1,
+			   screen->height - vs->area.y2);
+
+	return vidcap_yuv_read_planes(&vs->yuv, rects, nrects, data);
+}
+
+/* Synchronous path, stalls until the GPU has finished the frame. */
 static void
-wcap_decoder_decode_rectangle(struct wcap_decoder *decoder,
-			      struct wcap_rectangle *rect)
+vidcap_capture_frame(CompScreen *screen)
 {
-	uint32_t v, *p = decoder->p, *d;
-	int width = rect->x2 - rect->x1, height = rect->y2 - rect->y1;
-	int x, i, j, k, l, count = width * height;
-	unsigned char r, g, b, dr, dg, db;
+	VidcapFrame *f;
 
-	d = decoder->frame + (rect->y2 - 1) * decoder->width;
-	x = rect->x1;
-	i = 0;
-	while (i < count) {
-		v = *p++;
-		l = v >> 24;
-		if (l < 0xe0) {
-			j = l + 1;
-		} else {
-			j = 1 << (l - 0xe0 + 7);
-		}
-
-		dr = (v >> 16);
-		dg = (v >>  8);
-		db = (v >>  0);
-		for (k = 0; k < j; k++) {
-			r = (d[x] >> 16) + dr;
-			g = (d[x] >>  8) + dg;
-			b = (d[x] >>  0) + db;
-			d[x] = 0xff000000 | (r << 16) | (g << 8) | b;
-			x++;
-			if (x == rect->x2) {
-				x = rect->x1;
-				d -= decoder->width;
-			}
-		}
-		i += j;
-	}
+	VIDCAP_DISPLAY (screen->display);
 
-	if (i != count)
-		printf("rle encoding longer than expected (%d expected %d)\n",
-		       i, count);
+	f = vidcap_get_slot(vd);
+	if (!f)
+		return;
 
-	decoder->p = p;
+	f->msecs = vd->ms;
+	f->keyframe = vidcap_keyframe_due(screen);
+	f->nrects = vidcap_frame_rects(screen, f->rects);
+	vidcap_read_frame(screen, f->rects, f->nrects, f->pixels);
+
+	vidcap_queue_slot(vd);
 }
 
-int
-wcap_decoder_get_frame(struct wcap_decoder *decoder)
+/* The damage of a readback that never reached the encoder was already
+ * taken off the screen's region, add it back so the next frame records
+ * those areas again. */
+static void
+vidcap_restore_damage(CompScreen *screen, VidcapReadback *rb)
 {
-	struct wcap_rectangle *rects;
-	struct wcap_frame_header *header;
-	uint32_t i;
+	int i, scale;
 
-	if (decoder->p == decoder->end)
-		return 0;
+	VIDCAP_SCREEN (screen);
+	VIDCAP_DISPLAY (screen->display);
+
+	/* YUV rectangles are in scaled frame coordinates */
+	scale = vs->yuv_active ? vs->yuv.scale : 1;
 
-	header = decoder->p;
-	decoder->msecs = header->msecs;
-	decoder->count++;
+	for (i = 0; i < rb->nrects; i++) {
+		XRectangle r;
 
-	rects = (void *) (header + 1);
-	decoder->p = (uint32_t *) (rects + header->nrects);
-	for (i = 0; i < header->nrects; i++)
-		wcap_decoder_decode_rectangle(decoder, &rects[i]);
+		r.x = vs->area.x1 + rb->rects[i].x1 * scale;
+		r.y = vs->area.y1 + rb->rects[i].y1 * scale;
+		r.width = (rb->rects[i].x2 - rb->rects[i].x1) * scale;
+		r.height = (rb->rects[i].y2 - rb->rects[i].y1) * scale;
+		XUnionRectWithRegion (&r, vs->damage, vs->damage);
+	}
 
-	return 1;
+	if (rb->keyframe)
+		vd->keyframe_pending = TRUE;
 }
 
-struct wcap_decoder *
-wcap_decoder_create(const char *filename)
+/* Map a finished pack buffer and hand its contents to the encoder. */
+static void
+vidcap_collect_readback(CompScreen *screen, VidcapReadback *rb)
 {
-	struct wcap_decoder *decoder;
-	struct wcap_header *header;
-	int frame_size;
-	struct stat buf;
+	VidcapFrame *f;
+	void *data;
 
-	decoder = malloc(sizeof *decoder);
-	if (decoder == NULL)
-		return NULL;
+	VIDCAP_SCREEN (screen);
+	VIDCAP_DISPLAY (screen->display);
 
-	decoder->fd = open(filename, O_RDONLY);
-	if (decoder->fd == -1) {
-		free(decoder);
-		return NULL;
+	if (!rb->pending)
+		return;
+
+	rb->pending = FALSE;
+
+	f = vidcap_get_slot(vd);
+	if (!f) {
+		vidcap_restore_damage(screen, rb);
+		return;
 	}
 
-	fstat(decoder->fd, &buf);
-	decoder->size = buf.st_size;
-	decoder->map = mmap(NULL, decoder->size,
-			    PROT_READ, MAP_PRIVATE, decoder->fd, 0);
-	if (decoder->map == MAP_FAILED) {
-		fprintf(stderr, "mmap failed\n");
-		close(decoder->fd);
-		free(decoder);
-		return NULL;
+	(*vs->bindBuffer) (GL_PIXEL_PACK_BUFFER_ARB, rb->pbo);
+	data = (*vs->mapBuffer) (GL_PIXEL_PACK_BUFFER_ARB, GL_READ_ONLY_ARB);
+	if (data) {
+		f->msecs = rb->msecs;
+		f->keyframe = rb->keyframe;
+		f->nrects = rb->nrects;
+		memcpy(f->rects, rb->rects,
+		       rb->nrects * sizeof (struct wcap_rectangle));
+		memcpy(f->pixels, data, rb->npixels * 4);
+		(*vs->unmapBuffer) (GL_PIXEL_PACK_BUFFER_ARB);
 	}
+	(*vs->bindBuffer) (GL_PIXEL_PACK_BUFFER_ARB, 0);
+
+	if (data)
+		vidcap_queue_slot(vd);
+	else
+		vidcap_restore_damage(screen, rb);
+}
 
-	header = decoder->map;
-	decoder->format = header->format;
-	decoder->count = 0;
-	decoder->width = header->width;
-	decoder->height = header->height;
-	decoder->p = header + 1;
-	decoder->end = (char *) decoder->map + decoder->size;
+/* Asynchronous path: start the readback of this frame into the next
+ * pack buffer, then collect the oldest one, which the GPU has had
+ * READBACK_BUFFERS - 1 frames to complete. */
+static void
+vidcap_capture_frame_async(CompScreen *screen)
+{
+	VidcapReadback *rb;
 
-	frame_size = header->width * header->height * 4;
-	decoder->frame = malloc(frame_size);
-	if (decoder->frame == NULL) {
-		close(decoder->fd);
-		free(decoder);
-		return NULL;
-	}
-	memset(decoder->frame, 0, frame_size);
+	VIDCAP_SCREEN (screen);
+	VIDCAP_DISPLAY (screen->display);
 
-	return decoder;
+	rb = &vs->readback[vs->readback_index];
+
+	rb->msecs = vd->ms;
+	rb->keyframe = vidcap_keyframe_due(screen);
+	rb->nrects = vidcap_frame_rects(screen, rb->rects);
+
+	(*vs->bindBuffer) (GL_PIXEL_PACK_BUFFER_ARB, rb->pbo);
+	rb->npixels = vidcap_read_frame(screen, rb->rects, rb->nrects, NULL);
+	(*vs->bindBuffer) (GL_PIXEL_PACK_BUFFER_ARB, 0);
+	rb->pending = TRUE;
+
+	vs->readback_index = (vs->readback_index + 1) % READBACK_BUFFERS;
+
+	vidcap_collect_readback(screen, &vs->readback[vs->readback_index]);
 }
 
-void
-wcap_decoder_destroy(struct wcap_decoder *decoder)
+static void
+vidcap_readback_fini(CompScreen *s, Bool flush)
 {
-	munmap(decoder->map, decoder->size);
-	close(decoder->fd);
-	free(decoder->frame);
-	free(decoder);
+	int i;
+
+	VIDCAP_SCREEN (s);
+
+	if (!vs->readback_active)
+		return;
+
+	for (i = 0; i < READBACK_BUFFERS; i++) {
+		VidcapReadback *rb;
+
+		rb = &vs->readback[(vs->readback_index + i) % READBACK_BUFFERS];
+		if (flush)
+			vidcap_collect_readback(s, rb);
+		(*vs->deleteBuffers) (1, &rb->pbo);
+		free(rb->rects);
+		rb->rects = NULL;
+	}
+
+	vs->readback_active = FALSE;
 }
 
-static uint32_t *
-output_run(uint32_t *p, uint32_t delta, int run)
+static Bool
+vidcap_readback_init(CompScreen *s)
 {
 	int i;
 
-	while (run > 0) {
-		if (run <= 0xe0) {
-			*p++ = delta | ((run - 1) << 24);
-			break;
+	VIDCAP_SCREEN (s);
+
+	vs->readback_active = FALSE;
+
+	if (!vs->pbo || !vidcapGetAsyncReadback (s->display))
+		return FALSE;
+
+	for (i = 0; i < READBACK_BUFFERS; i++) {
+		VidcapReadback *rb = &vs->readback[i];
+
+		rb->pending = FALSE;
+		rb->rects = malloc(MAX_RECTS * sizeof (struct wcap_rectangle));
+		(*vs->genBuffers) (1, &rb->pbo);
+		(*vs->bindBuffer) (GL_PIXEL_PACK_BUFFER_ARB, rb->pbo);
+		(*vs->bufferData) (GL_PIXEL_PACK_BUFFER_ARB,
+				   (vs->area.x2 - vs->area.x1) *
+				   (vs->area.y2 - vs->area.y1) * 4, NULL,
+				   GL_STREAM_READ_ARB);
+	}
+	(*vs->bindBuffer) (GL_PIXEL_PACK_BUFFER_ARB, 0);
+
+	vs->readback_index = 0;
+	vs->readback_active = TRUE;
+
+	for (i = 0; i < READBACK_BUFFERS; i++) {
+		if (!vs->readback[i].rects) {
+			vidcap_readback_fini(s, FALSE);
+			return FALSE;
 		}
+	}
 
-		i = 24 - __builtin_clz(run);
-		*p++ = delta | ((i + 0xe0) << 24);
-		run -= 1 << (7 + i);
+	return TRUE;
+}
+
+/* The outer rectangle of a window, moved inside the screen and
+ * limited to width x height when those are set */
+static void
+vidcap_window_area(CompWindow *w, int width, int height, BoxPtr box)
+{
+	CompScreen *s = w->screen;
+	int x, y;
+
+	x = w->attrib.x - w->input.left;
+	y = w->attrib.y - w->input.top;
+	if (!width)
+		width = MIN (w->width + w->input.left + w->input.right,
+			     s->width);
+	if (!height)
+		height = MIN (w->height + w->input.top + w->input.bottom,
+			      s->height);
+
+	box->x1 = MAX (0, MIN (x, s->width - width));
+	box->y1 = MAX (0, MIN (y, s->height - height));
+	box->x2 = box->x1 + width;
+	box->y2 = box->y1 + height;
+}
+
+/* Move the recorded area along with the window. The frame size stays
+ * what it was when the recording started, so a resized window is
+ * cropped or shows what is next to it. */
+static void
+vidcap_follow_window(CompScreen *s)
+{
+	CompWindow *w;
+	BoxRec box;
+
+	VIDCAP_SCREEN (s);
+
+	if (!vs->window)
+		return;
+
+	w = findWindowAtScreen (s, vs->window);
+	if (!w) {
+		compLogMessage("vidcap", CompLogLevelInfo,
+			"Recorded window is gone, recording where it was");
+		vs->window = None;
+		return;
 	}
 
-	return p;
+	vidcap_window_area(w, vs->area.x2 - vs->area.x1,
+			   vs->area.y2 - vs->area.y1, &box);
+
+	if (box.x1 != vs->area.x1 || box.y1 != vs->area.y1) {
+		vs->area = box;
+		vidcap_damage_area(s);
+	}
 }
 
-static uint32_t
-component_delta(uint32_t next, uint32_t prev)
+static void
+vidcap_start_capture(CompScreen *s)
+{
+	/* The first frame has to cover the whole area */
+	vidcap_damage_area(s);
+	damageScreen (s);
+
+	vidcap_readback_init(s);
+}
+
+/* Seven segment digits, bit 0 is the top segment, going clockwise,
+ * then the middle one */
+static const unsigned char digitSegments[10] = {
+	0x3f, 0x06, 0x5b, 0x4f, 0x66, 0x6d, 0x7d, 0x07, 0x7f, 0x6f
+};
+
+static int
+vidcap_number_width(const char *text)
 {
-	unsigned char dr, dg, db;
+	int width = 0;
 
-	dr = (next >> 16) - (prev >> 16);
-	dg = (next >>  8) - (prev >>  8);
-	db = (next >>  0) - (prev >>  0);
+	for (; *text; text++)
+		width += *text == '.' ? 3 : STATS_DIGIT_WIDTH + 3;
 
-	return (dr << 16) | (dg << 8) | (db << 0);
+	return width;
 }
 
 static void
-vidcapPreparePaintScreen (CompScreen *s, int ms)
+vidcap_draw_number(const char *text, int x, int y)
 {
-	int delay_ms;
+	int w = STATS_DIGIT_WIDTH, h = STATS_DIGIT_HEIGHT, m = h / 2;
+	int segs;
+
+	glBegin(GL_LINES);
+	for (; *text; text++) {
+		if (*text == '.') {
+			glVertex2i(x, y + h);
+			glVertex2i(x + 1, y + h);
+			x += 3;
+			continue;
+		}
 
-	VIDCAP_SCREEN (s);
-	VIDCAP_DISPLAY (s->display);
+		segs = *text >= '0' && *text <= '9' ?
+		       digitSegments[*text - '0'] : 0;
 
-	if (vd->recording)
-		vd->ms += ms;
+		if (segs & 0x01) {
+			glVertex2i(x, y);
+			glVertex2i(x + w, y);
+		}
+		if (segs & 0x02) {
+			glVertex2i(x + w, y);
+			glVertex2i(x + w, y + m);
+		}
+		if (segs & 0x04) {
+			glVertex2i(x + w, y + m);
+			glVertex2i(x + w, y + h);
+		}
+		if (segs & 0x08) {
+			glVertex2i(x, y + h);
+			glVertex2i(x + w, y + h);
+		}
+		if (segs & 0x10) {
+			glVertex2i(x, y + m);
+			glVertex2i(x, y + h);
+		}
+		if (segs & 0x20) {
+			glVertex2i(x, y);
+			glVertex2i(x, y + m);
+		}
+		if (segs & 0x40) {
+			glVertex2i(x, y + m);
+			glVertex2i(x + w, y + m);
+		}
+		x += w + 3;
+	}
+	glEnd();
+}
 
-	if (vidcapGetDrawIndicator (s->display) &&
-		(vd->recording || vd->thread_running || vd->done)) {
-		vd->dot_timer += ms;
-		delay_ms = (vd->thread_running ? SPIN_MS : BLINK_MS);
-		if (!vd->done && vd->dot_timer > delay_ms)	{
-			if (vd->thread_running)
-				vd->dot_timer -= SPIN_MS;
+/* Rows of readback and encode time in ms against the frame budget,
+ * queue depth against the ring size, dropped frames with the recent
+ * drop rate, and MB written */
+static void
+vidcap_draw_stats(CompScreen *screen, CompOutput *outputs, int numOutput)
+{
+	VidcapAverages avg;
+	float fill[STATS_ROWS];
+	char text[STATS_ROWS][16];
+	float budget = 1000.0f / vidcapGetFrameRate (screen->display);
+	int i, row, x, y;
+	BoxRec box;
+
+	VIDCAP_DISPLAY (screen->display);
+
+	pthread_mutex_lock(&vd->ring_mutex);
+	avg = vd->avg;
+	pthread_mutex_unlock(&vd->ring_mutex);
+
+	snprintf(text[0], sizeof (text[0]), "%.1f", avg.readback_ms);
+	fill[0] = avg.readback_ms / budget;
+	snprintf(text[1], sizeof (text[1]), "%.1f", avg.encode_ms);
+	fill[1] = avg.encode_ms / budget;
+	snprintf(text[2], sizeof (text[2]), "%.1f", avg.depth);
+	fill[2] = avg.depth / vd->ring_size;
+	snprintf(text[3], sizeof (text[3]), "%u", avg.dropped);
+	fill[3] = avg.drop_rate;
+	snprintf(text[4], sizeof (text[4]), "%.1f", avg.bytes / 1e6);
+	fill[4] = -1.0f;
+
+	glViewport(0, 0, screen->width, screen->height);
+
+	glPushMatrix();
+
+	glTranslatef(-0.5f, -0.5f, -DEFAULT_Z_CAMERA);
+	glScalef(1.0f  / screen->width, -1.0f / screen->height, 1.0f);
+	glTranslatef(0, -screen->height, 0.0f);
+
+	glEnable(GL_BLEND);
+
+	for (i = 0; i < numOutput; i++) {
+		vidcap_stats_box(&outputs[i].region.extents, &box);
+
+		glColor4f(0.0, 0.0, 0.0, 0.5);
+		glRecti(box.x1, box.y1, box.x2, box.y2);
+
+		for (row = 0; row < STATS_ROWS; row++) {
+			y = box.y1 + row * STATS_ROW_HEIGHT;
+
+			glColor4f(1.0, 1.0, 1.0, 0.9);
+			x = box.x1 + STATS_NUMBER_WIDTH - 6 -
+			    vidcap_number_width(text[row]);
+			vidcap_draw_number(text[row], x,
+				y + (STATS_ROW_HEIGHT - STATS_DIGIT_HEIGHT) / 2);
+
+			if (fill[row] < 0)
+				continue;
+
+			/* Green, turning yellow past half, red when full */
+			if (fill[row] >= 1.0f)
+				glColor4f(1.0, 0.0, 0.0, 0.8);
+			else if (fill[row] >= 0.5f)
+				glColor4f(1.0, 0.8, 0.0, 0.8);
 			else
-				vd->dot_timer -= BLINK_MS;
-			vd->show_dot = !vd->show_dot;
+				glColor4f(0.0, 0.8, 0.0, 0.8);
+
+			x = box.x1 + STATS_NUMBER_WIDTH;
+			glRecti(x, y + 4, x + STATS_BAR_WIDTH *
+				MIN (MAX (fill[row], 0.02f), 1.0f),
+				y + STATS_ROW_HEIGHT - 4);
 		}
-		if (vd->done && vd->dot_timer > DONE_MS)
-			vd->done = FALSE;
 	}
 
-	UNWRAP (vs, s, preparePaintScreen);
-	(*s->preparePaintScreen) (s, ms); 
-	WRAP (vs, s, preparePaintScreen, vidcapPreparePaintScreen);
+	glDisable(GL_BLEND);
+
+	glColor4usv(defaultColor);
+
+	glPopMatrix();
 }
 
-static void
-vidcapDonePaintScreen (CompScreen *s)
+static Bool
+vidcapPaintOutput (CompScreen              *s,
+				   const ScreenPaintAttrib *sAttrib,
+				   const CompTransform     *transform,
+				   Region                  region,
+				   CompOutput              *output,
+				   unsigned int            mask)
 {
+	Bool status;
+
 	VIDCAP_SCREEN (s);
 	VIDCAP_DISPLAY (s->display);
 
-	if (vidcapGetDrawIndicator (s->display) &&
-		(vd->recording || vd->thread_running || vd->done))
-		damageScreen(s);
+	if (vd->recording)
+		XUnionRegion (vs->damage, region, vs->damage);
 
-	UNWRAP (vs, s, donePaintScreen);
-	(*s->donePaintScreen) (s); 
-	WRAP (vs, s, donePaintScreen, vidcapDonePaintScreen);
-		
+	UNWRAP (vs, s, paintOutput);
+	status = (*s->paintOutput) (s, sAttrib, transform, region, output, mask);
+	WRAP (vs, s, paintOutput, vidcapPaintOutput);
+
+	if (vs->grabIndex) {
+		CompTransform sTransform = *transform;
+		int x1, y1, x2, y2;
+
+		x1 = MIN (vs->x1, vs->x2);
+		y1 = MIN (vs->y1, vs->y2);
+		x2 = MAX (vs->x1, vs->x2);
+		y2 = MAX (vs->y1, vs->y2);
+
+		transformToScreenSpace (s, output, -DEFAULT_Z_CAMERA, &sTransform);
+
+		glPushMatrix ();
+		glLoadMatrixf (sTransform.m);
+
+		glDisableClientState (GL_TEXTURE_COORD_ARRAY);
+		glEnable (GL_BLEND);
+
+		glColor4f (1.0, 0.0, 0.0, 0.15);
+		glRecti (x1, y2, x2, y1);
+
+		glColor4f (1.0, 0.0, 0.0, 0.5);
+		glBegin (GL_LINE_LOOP);
+		glVertex2i (x1, y1);
+		glVertex2i (x2, y1);
+		glVertex2i (x2, y2);
+		glVertex2i (x1, y2);
+		glEnd ();
+
+		glColor4usv (defaultColor);
+		glDisable (GL_BLEND);
+		glEnableClientState (GL_TEXTURE_COORD_ARRAY);
+		glPopMatrix ();
+	}
+
+	return status;
 }
 
 static void
@@ -284,9 +1378,18 @@ vidcap_stop_recording(CompScreen *s)
 	VIDCAP_DISPLAY (s->display);
 
 	vd->recording = FALSE;
-	close(vd->fd);
-	free(vd->frame);
-	remove(WCAPFILE);
+	vidcap_readback_fini(s, FALSE);
+	vidcap_stop_yuv(s);
+
+	if (vd->live) {
+		/* The live transcoder finishes with what made it to disk */
+		vidcap_signal_encoder(vd);
+		vd->dot_timer = 0;
+		vd->thread_running = TRUE;
+	} else {
+		vidcap_stop_encoder(vd);
+		remove(WCAPFILE);
+	}
 }
 
 static void
@@ -295,19 +1398,7 @@ vidcapPaintScreen (CompScreen   *screen,
 					int          numOutput,
 					unsigned int mask)
 {
-	struct {
-		uint32_t msecs;
-		uint32_t nrects;
-	} header;
-	struct box {
-		uint32_t x1;
-		uint32_t y1;
-		uint32_t x2;
-		uint32_t y2;
-	};
-	uint32_t delta, prev, *d, *s, *p, next, *pixel_data;
-	int i, j, k, ret, width, height, run, stride, y_orig, size;
-	struct iovec v[2];
+	int i;
 
 	VIDCAP_SCREEN (screen);
 	VIDCAP_DISPLAY (screen->display);
@@ -317,93 +1408,31 @@ vidcapPaintScreen (CompScreen   *screen,
 	WRAP (vs, screen, paintScreen, vidcapPaintScreen);
 
 	if (vd->recording) {
-		struct box *b = malloc (screen->nOutputDev * sizeof (struct box));
-		if (!b) {
-			vidcap_stop_recording(screen);
-			return;
-		}
-
-		for (i = 0; i < screen->nOutputDev; i++) {
-			b[i].x1 = outputs[i].region.extents.x1;
-			b[i].y1 = outputs[i].region.extents.y1;
-			b[i].x2 = outputs[i].region.extents.x2;
-			b[i].y2 = outputs[i].region.extents.y2;
-		}
-
-		header.msecs = vd->ms;
-		header.nrects = screen->nOutputDev;
+		uint32_t start = vidcap_now_us(), us;
 
-		v[0].iov_base = &header;
-		v[0].iov_len = sizeof (header);
-		v[1].iov_base = b;
-		v[1].iov_len = screen->nOutputDev * sizeof (struct box);
-
-		ret = writev(vd->fd, v, 2);
+		vidcap_follow_window(screen);
 
-		if (ret != (v[0].iov_len + v[1].iov_len)) {
+		if (vd->encoder_error) {
 			compLogMessage("vidcap", CompLogLevelError,
 									"Could not write to %s", WCAPFILE);
 			vidcap_stop_recording(screen);
-			free(b);
-			return;
-		}
-
-		stride = screen->width;
-
-		for (i = 0; i < screen->nOutputDev; i++) {
-			width = outputs[i].width;
-			height = outputs[i].height;
-
-			size = width * height * 4;
-
-			pixel_data = malloc(size);
-			if (!pixel_data)
-				return;
-
-			y_orig = screen->height - b[i].y2;
-
-			glReadPixels(b[i].x1, y_orig, width, height,
-					GL_RGBA, GL_UNSIGNED_BYTE, (GLvoid *) pixel_data);
-
-			p = pixel_data;
-			run = prev = 0;
-			for (j = 0; j < height; j++) {
-				s = pixel_data + width * j;
-				y_orig = b[i].y2 - j - 1;
-				d = vd->frame + stride * y_orig + b[i].x1;
-
-				for (k = 0; k < width; k++) {
-					next = *s++;
-					delta = component_delta(next, *d);
-					*d++ = next;
-					if (run == 0 || delta == prev) {
-						run++;
-					} else {
-						p = output_run(p, prev, run);
-						run = 1;
-					}
-					prev = delta;
-				}
-			}
-
-			p = output_run(p, prev, run);
-
-			ret = write(vd->fd, pixel_data, (p - pixel_data) * 4);
-
-			free(pixel_data);
+		} else {
+			if (vs->readback_active)
+				vidcap_capture_frame_async(screen);
+			else
+				vidcap_capture_frame(screen);
 
-			if (ret != (p - pixel_data) * 4) {
-				compLogMessage("vidcap", CompLogLevelError,
-										"Could not write to %s", WCAPFILE);
-				vidcap_stop_recording(screen);
-				free(b);
-				return;
-			}
+			us = vidcap_now_us() - start;
+			vidcap_sample(&vd->readback_us, us);
+			pthread_mutex_lock(&vd->ring_mutex);
+			AVG (vd->avg.readback_ms, us / 1000.0f);
+			pthread_mutex_unlock(&vd->ring_mutex);
 		}
-
-		free(b);
 	}
 
+	if (vidcapGetDrawStats (screen->display) && vd->recording)
+		vidcap_draw_stats(screen, outputs, numOutput);
+
 	if (vidcapGetDrawIndicator (screen->display) &&
 		((vd->recording && vd->show_dot) ||
 			vd->thread_running || vd->done)) {
@@ -418,8 +1447,8 @@ vidcapPaintScreen (CompScreen   *screen,
 		for (i = 0; i < screen->nOutputDev; i++) {
 			int angle;
 			double vectorX, vectorY;
-			int centerX = outputs[i].region.extents.x2 - 50;
-			int centerY = outputs[i].region.extents.y2 - 50;
+			int centerX = outputs[i].region.extents.x2 - INDICATOR_OFFSET;
+			int centerY = outputs[i].region.extents.y2 - INDICATOR_OFFSET;
 
 			if (vd->recording)
 				glColor4f(1.0, 0.0, 0.0, 0.5);
@@ -437,9 +1466,9 @@ vidcapPaintScreen (CompScreen   *screen,
 				for (angle = 0; angle <= 360; angle++)
 				{
 					vectorX = centerX +
-							 (25 * sinf(angle * DEG2RAD));
+							 (INDICATOR_RADIUS * sinf(angle * DEG2RAD));
 					vectorY = centerY +
-							 (25 * cosf(angle * DEG2RAD));
+							 (INDICATOR_RADIUS * cosf(angle * DEG2RAD));
 					glVertex2d (vectorX, vectorY);
 				}
 			}
@@ -451,189 +1480,89 @@ vidcapPaintScreen (CompScreen   *screen,
 				if (vd->show_dot) {
 					for (angle = target_angle; angle >= 0; angle--) {
 						vectorX = centerX +
-								 (25 * sinf(angle * DEG2RAD));
+								 (INDICATOR_RADIUS * sinf(angle * DEG2RAD));
 						vectorY = centerY -
-								 (25 * cosf(angle * DEG2RAD));
+								 (INDICATOR_RADIUS * cosf(angle * DEG2RAD));
 						glVertex2d (vectorX, vectorY);
 					}
 				} else {
 					for (angle = 360; angle >= target_angle; angle--) {
 						vectorX = centerX +
-								 (25 * sinf(angle * DEG2RAD));
+								 (INDICATOR_RADIUS * sinf(angle * DEG2RAD));
 						vectorY = centerY -
-								 (25 * cosf(angle * DEG2RAD));
+								 (INDICATOR_RADIUS * cosf(angle * DEG2RAD));
 						glVertex2d (vectorX, vectorY);
 					}
 				}
-			}
-			glEnd();
-
-			glDisable(GL_BLEND);
-
-			glColor4usv(defaultColor);
-		}
-
-		glPopMatrix ();
-	}
-}
-
-static inline int
-rgb_to_yuv(uint32_t format, uint32_t p, int *u, int *v)
-{
-	int r, g, b, y;
-
-	r = (p >> 0) & 0xff;
-	g = (p >> 8) & 0xff;
-	b = (p >> 16) & 0xff;
-
-	y = (19595 * r + 38469 * g + 7472 * b) >> 16;
-	if (y > 255)
-		y = 255;
-
-	*u += 46727 * (r - y);
-	*v += 36962 * (b - y);
-
-	return y;
-}
-
-static inline
-int clamp_uv(int u)
-{
-	int clamp = (u >> 18) + 128;
-
-	if (clamp < 0)
-		return 0;
-	else if (clamp > 255)
-		return 255;
-	else
-		return clamp;
-}
-
-static void
-convert_to_yv12(struct wcap_decoder *decoder, unsigned char *out)
-{
-	unsigned char *y1, *y2, *u, *v;
-	uint32_t *p1, *p2, *end;
-	int i, u_accum, v_accum, stride0, stride1;
-	uint32_t format = decoder->format;
-
-	stride0 = decoder->width;
-	stride1 = decoder->width / 2;
-	for (i = 0; i < decoder->height; i += 2) {
-		y1 = out + stride0 * i;
-		y2 = y1 + stride0;
-		v = out + stride0 * decoder->height + stride1 * i / 2;
-		u = v + stride1 * decoder->height / 2;
-		p1 = decoder->frame + decoder->width * i;
-		p2 = p1 + decoder->width;
-		end = p1 + decoder->width;
+			}
+			glEnd();
 
-		while (p1 < end) {
-			u_accum = 0;
-			v_accum = 0;
-			y1[0] = rgb_to_yuv(format, p1[0], &u_accum, &v_accum);
-			y1[1] = rgb_to_yuv(format, p1[1], &u_accum, &v_accum);
-			y2[0] = rgb_to_yuv(format, p2[0], &u_accum, &v_accum);
-			y2[1] = rgb_to_yuv(format, p2[1], &u_accum, &v_accum);
-			u[0] = clamp_uv(u_accum);
-			v[0] = clamp_uv(v_accum);
+			glDisable(GL_BLEND);
 
-			y1 += 2;
-			p1 += 2;
-			y2 += 2;
-			p2 += 2;
-			u++;
-			v++;
+			glColor4usv(defaultColor);
 		}
+
+		glPopMatrix ();
 	}
 }
 
+/* Constant rate Y4M, or Matroska with the frames that changed */
 static int
-output_yuv_frame(struct wcap_decoder *decoder, FILE *f)
+vidcap_output_rate(CompDisplay *d)
 {
-	unsigned char *out;
-	int size, ret;
-
-	size = decoder->width * decoder->height * 3 / 2;
-
-	out = malloc(size);
+	if (vidcapGetVariableFrameRate (d))
+		return WCAP_RATE_VARIABLE;
 
-	convert_to_yv12(decoder, out);
-
-	ret = fwrite("FRAME\n", 1, 6, f);
-
-	if (ret == 6)
-		ret = fwrite(out, 1, size, f);
-
-	free (out);
-
-	return (ret == size);
+	return vidcapGetFrameRate (d);
 }
 
 static int
-write_file(int fd)
+write_file(CompDisplay *d, FILE *f)
 {
 	struct wcap_decoder *decoder = wcap_decoder_create(WCAPFILE);
-	int i, has_frame;
-	int num = 30, denom = 1;
-	uint32_t msecs, frame_time;
-	FILE *f;
-	char *header;
-	int size, ret;
+	struct timeval start, end;
+	int frames;
+	long nthreads;
+	double secs;
+
+	if (!decoder)
+		return -1;
 
 	compLogMessage("vidcap", CompLogLevelInfo, "Decoding");
 
-	size = asprintf(&header, "YUV4MPEG2 C420jpeg W%d H%d F%d:%d Ip A0:0\n",
-							decoder->width, decoder->height, num, denom);
-	f = fdopen(fd, "w");
-	ret = fwrite(header, 1, size, f);
-	free(header);
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads < 1)
+		nthreads = 1;
 
-	if (ret != size) {
-		compLogMessage("vidcap", CompLogLevelError,
-			"Failed to write header to '%s'", RAWFILE);
-		fclose(f);
-		return -1;
-	}
+	gettimeofday(&start, NULL);
 
-	i = 0;
-	has_frame = wcap_decoder_get_frame(decoder);
-	msecs = decoder->msecs;
-	frame_time = 1000 * denom / num;
-	while (has_frame) {
-		if (!output_yuv_frame(decoder, f)) {
-			compLogMessage("vidcap", CompLogLevelError,
-				"Failed to write frame to '%s'", RAWFILE);
-			fclose(f);
-			return -1;
-		}
-		if ((i % 5) == 0) {
-			printf(" .");
-			fflush (stdout);
-		}
-		i++;
-		msecs += frame_time;
-		while (decoder->msecs < msecs && has_frame)
-			has_frame = wcap_decoder_get_frame(decoder);
-	}
+	frames = wcap_y4m_transcode(decoder, WCAPFILE, f,
+				    vidcap_output_rate(d), nthreads, stdout);
 	printf("\n");
 
-	fclose(f);
+	gettimeofday(&end, NULL);
+	secs = (end.tv_sec - start.tv_sec) +
+	       (end.tv_usec - start.tv_usec) / 1000000.0;
 
-	compLogMessage("vidcap", CompLogLevelInfo,
-		"wcap file: size %dx%d, %d frames\n",
-		decoder->width, decoder->height, i);
+	if (frames >= 0)
+		compLogMessage("vidcap", CompLogLevelInfo,
+			"wcap file: size %dx%d, %d frames, %.1f fps with %ld threads\n",
+			decoder->width, decoder->height, frames,
+			secs > 0 ? frames / secs : 0.0, nthreads);
+	else
+		compLogMessage("vidcap", CompLogLevelError,
+			"Failed to write frames to the encoder");
 
 	wcap_decoder_destroy(decoder);
 
-	return 0;
+	return frames < 0 ? -1 : 0;
 }
 
-static void *
-thread_func(void *data)
+/* Build the configured encoder command, with the output file name
+ * substituted for %f.ext, reading the video stream from its stdin. */
+static char *
+vidcap_encoder_command(CompDisplay *d, char **path)
 {
-	CompDisplay *d = (CompDisplay *) data;
-	int fd;
 	DIR *dir;
 	struct dirent *file;
 	struct stat st;
@@ -641,21 +1570,6 @@ thread_func(void *data)
 	char filename[256], ext[32];
 	int i, j, ret, found;
 
-	fd = open(RAWFILE, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
-
-	if (!fd) {
-		compLogMessage("vidcap", CompLogLevelError,
-			"Could not open '%s' for writing", RAWFILE);
-		goto out;
-	}
-
-	ret = write_file(fd);
-
-	close(fd);
-
-	if (ret < 0)
-		goto out;
-
 	if (stat(vidcapGetDirectory (d), &st) == 0 && S_ISDIR(st.st_mode) &&
 			access(vidcapGetDirectory (d), W_OK) == 0) {
 		directory = strdup(vidcapGetDirectory (d));
@@ -709,6 +1623,7 @@ thread_func(void *data)
 	}
 	if (asprintf(&fullpath, "%s/%s", directory, filename) <= 0)
 		fullpath = strdup ("/tmp/vidcap.mp4");
+	free(directory);
 
 	tmpcmd = strdup(vidcapGetCommand (d));
 	ret = found = 0;
@@ -720,34 +1635,203 @@ thread_func(void *data)
 							strncmp(&tmpcmd[j], "\0", 1); j++);
 			j = j - (i + 3);
 			tmpcmd[i] = '\0';
-			ret = asprintf(&command, "cat %s | %s%s%s",
-						RAWFILE, tmpcmd, fullpath, &tmpcmd[i+3+j]);
+			ret = asprintf(&command, "%s%s%s",
+						tmpcmd, fullpath, &tmpcmd[i+3+j]);
 			break;
 		}
 	}
 
 	if (!found)
-		ret = asprintf(&command, "cat %s | avconv -i - %s", RAWFILE, fullpath);
+		ret = asprintf(&command, "avconv -i - %s", fullpath);
+
+	free(tmpcmd);
+
+	if (ret <= 0) {
+		free(fullpath);
+		return NULL;
+	}
+
+	*path = fullpath;
+
+	return command;
+}
 
-	if (ret > 0)
-		ret = system(command);
+/* Start the encoder with the video stream going straight into its stdin */
+static FILE *
+vidcap_open_encoder(const char *command)
+{
+	sigset_t mask;
+	FILE *f;
+
+	f = popen(command, "w");
+
+	/* A dying encoder must fail our writes with EPIPE rather than
+	 * take the compositor down. SIGPIPE is delivered to the writing
+	 * thread, so blocking it in this one is enough; the converter
+	 * threads it starts later inherit the mask, and all of them exit
+	 * with the recording. Only block it once the encoder has been
+	 * started, so that it does not inherit the mask. */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+	return f;
+}
+
+static void
+vidcap_close_encoder(FILE *f, const char *fullpath, int ret)
+{
+	int status;
+
+	status = pclose(f);
 
-	if (access(fullpath, F_OK) != -1)
+	if (ret == 0 && status == 0 && access(fullpath, F_OK) != -1)
 		compLogMessage("vidcap", CompLogLevelInfo, "Created: %s\n", fullpath);
 	else
 		compLogMessage("vidcap", CompLogLevelWarn,
 					"There was a problem creating the video file\n");
+}
+
+static void *
+thread_func(void *data)
+{
+	CompDisplay *d = (CompDisplay *) data;
+	FILE *f;
+	char *command, *fullpath;
+	int ret;
+
+	VIDCAP_DISPLAY (d);
+
+	vidcap_stop_encoder(vd);
+
+	command = vidcap_encoder_command(d, &fullpath);
+	if (!command)
+		goto out;
+
+	f = vidcap_open_encoder(command);
+	if (!f) {
+		compLogMessage("vidcap", CompLogLevelError,
+			"Could not run '%s'", command);
+	} else {
+		ret = write_file(d, f);
+		vidcap_close_encoder(f, fullpath, ret);
+	}
 
-	free(tmpcmd);
 	free(command);
 	free(fullpath);
-	free(directory);
 out:
-	remove(RAWFILE);
 	remove(WCAPFILE);
 
+	vd->thread_running = FALSE;
+	vd->done = TRUE;
+	vd->dot_timer = 0;
+
+	return NULL;
+}
+
+#define LIVE_MAP_STEP (64 << 20)
+
+/* Transcode while recording: follow the capture file as the encoder
+ * thread appends to it and feed every complete frame to the encoder
+ * process right away, so stopping only has to flush the tail. */
+static void *
+live_func(void *data)
+{
+	CompDisplay *d = (CompDisplay *) data;
+	struct wcap_header header;
+	struct wcap_decoder *decoder = NULL;
+	struct wcap_y4m_writer y4m;
+	FILE *f = NULL;
+	char *command, *fullpath = NULL;
+	char *map = MAP_FAILED;
+	size_t map_len = 0, offset = sizeof (header), committed;
+	Bool done = FALSE, ok = FALSE, y4m_ok = FALSE;
+	int fd;
+
 	VIDCAP_DISPLAY (d);
 
+	fd = open(WCAPFILE, O_RDONLY | O_CLOEXEC);
+	if (fd != -1 && pread(fd, &header, sizeof (header), 0) == sizeof (header))
+		decoder = wcap_decoder_create_stream(&header, vd->wcap_flags);
+	if (vd->wcap_flags)
+		offset += sizeof (struct wcap_header_ext);
+
+	command = vidcap_encoder_command(d, &fullpath);
+	if (command && decoder) {
+		f = vidcap_open_encoder(command);
+		if (!f)
+			compLogMessage("vidcap", CompLogLevelError,
+				"Could not run '%s'", command);
+		else
+			ok = y4m_ok = wcap_y4m_writer_init(&y4m, f,
+					header.width, header.height,
+					vidcap_output_rate(d),
+					sysconf(_SC_NPROCESSORS_ONLN));
+		if (y4m_ok)
+			y4m.progress = stdout;
+	}
+
+	/* Keep following the file on failure, the encoder
+	 * thread still has to be drained and joined. */
+	while (!done) {
+		pthread_mutex_lock(&vd->ring_mutex);
+		while (vd->committed == offset && !vd->encoder_done)
+			pthread_cond_wait(&vd->live_cond, &vd->ring_mutex);
+		committed = vd->committed;
+		done = vd->encoder_done;
+		pthread_mutex_unlock(&vd->ring_mutex);
+
+		if (committed == offset)
+			continue;
+
+		/* Mapping past the end of the file is fine as long
+		 * as only the committed bytes are touched. */
+		if (ok && committed > map_len) {
+			if (map != MAP_FAILED)
+				munmap(map, map_len);
+			map_len = (committed + LIVE_MAP_STEP - 1) &
+				  ~((size_t) LIVE_MAP_STEP - 1);
+			map = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fd, 0);
+			if (map == MAP_FAILED)
+				ok = FALSE;
+		}
+
+		if (ok) {
+			wcap_decoder_set_data(decoder, map + offset,
+					      committed - offset);
+			while (ok && wcap_decoder_get_frame(decoder))
+				ok = wcap_y4m_writer_push(&y4m, decoder);
+		}
+
+		/* Also after a failure, or the wait above stops
+		 * blocking and the loop spins on the ring lock. */
+		offset = committed;
+	}
+	if (ok)
+		ok = wcap_y4m_writer_finish(&y4m, decoder);
+	printf("\n");
+
+	if (y4m_ok && !ok)
+		compLogMessage("vidcap", CompLogLevelError,
+			"Failed to write frames to the encoder");
+
+	vidcap_stop_encoder(vd);
+
+	if (map != MAP_FAILED)
+		munmap(map, map_len);
+	if (y4m_ok)
+		wcap_y4m_writer_fini(&y4m);
+	if (f)
+		vidcap_close_encoder(f, fullpath, ok ? 0 : -1);
+	if (decoder)
+		wcap_decoder_destroy(decoder);
+	if (fd != -1)
+		close(fd);
+	free(command);
+	free(fullpath);
+
+	remove(WCAPFILE);
+
 	vd->thread_running = FALSE;
 	vd->done = TRUE;
 	vd->dot_timer = 0;
@@ -755,39 +1839,89 @@ out:
 	return NULL;
 }
 
-static Bool
-vidcapToggle(CompDisplay     *d,
-				CompAction      *action,
-				CompActionState state,
-				CompOption      *option,
-				int             nOption)
+/* Start recording the area set up on the first screen, or stop */
+static void
+vidcap_toggle_recording(CompDisplay *d)
 {
 	VIDCAP_DISPLAY (d);
+	VIDCAP_SCREEN (d->screens);
 	struct wcap_header header;
-	int ret;
+	struct wcap_header_ext ext;
+	struct iovec v[2];
+	int ret, len, width, height;
+	Bool compress;
 
 	if (vd->thread_running) {
 		vd->recording = FALSE;
 		compLogMessage("vidcap", CompLogLevelInfo, "Processing, please wait");
-		return TRUE;
+		return;
 	}
 
 	vd->recording = !vd->recording;
 
 	if (vd->recording) {
 		compLogMessage("vidcap", CompLogLevelInfo, "Recording started");
-		vd->frame = malloc (d->screens->width * d->screens->height * 4);
+		width = vs->area.x2 - vs->area.x1;
+		height = vs->area.y2 - vs->area.y1;
+		vd->frame = malloc (width * height * 4);
 		if (!vd->frame) {
 			vd->recording = FALSE;
-			return TRUE;
+			return;
+		}
+		if (!vidcap_alloc_ring(vd, vidcapGetBufferFrames (d), MAX_RECTS,
+				       width * height)) {
+			compLogMessage("vidcap", CompLogLevelError,
+				"Could not allocate %d frame buffers",
+				vidcapGetBufferFrames (d));
+			vd->recording = FALSE;
+			free(vd->frame);
+			return;
 		}
-		memset(vd->frame, 0, d->screens->width * d->screens->height * 4);
+		memset(vd->frame, 0, width * height * 4);
 		vd->ms = 0;
 
-		header.magic = WCAP_HEADER_MAGIC;
-		header.format = WCAP_FORMAT_XBGR8888;
-		header.width = d->screens->width;
-		header.height = d->screens->height;
+		compress = vidcapGetCompressFrames (d);
+		if (compress && !wcap_compress_codec()) {
+			compLogMessage("vidcap", CompLogLevelWarn,
+				"Built without LZ4 or zstd, "
+				"not compressing frames");
+			compress = FALSE;
+		}
+
+		/* Compressed frames are flagged in the
+		 * extended frame headers */
+		vd->keyframe_interval = vidcapGetKeyframeInterval (d) * 1000;
+		vd->wcap_flags = vd->keyframe_interval || compress ?
+				 WCAP_HEADER_KEYFRAMES : 0;
+		vd->keyframe_pending = vd->wcap_flags != 0;
+		vd->last_keyframe = 0;
+		vd->index = NULL;
+		vd->index_count = vd->index_size = 0;
+
+		/* Without keyframes or compression
+		 * stick to the original format */
+		header.magic = vd->wcap_flags ? WCAP_HEADER_MAGIC_EXT :
+						WCAP_HEADER_MAGIC;
+		vd->yuv = vidcap_start_yuv(d->screens);
+		if (vd->yuv) {
+			header.format = WCAP_FORMAT_I420;
+			header.width = vs->yuv.width;
+			header.height = vs->yuv.height;
+		} else {
+			header.format = WCAP_FORMAT_XBGR8888;
+			header.width = width;
+			header.height = height;
+		}
+		vd->width = header.width;
+		vd->height = header.height;
+		ext.flags = vd->wcap_flags;
+		ext.reserved = 0;
+
+		v[0].iov_base = &header;
+		v[0].iov_len = sizeof (header);
+		v[1].iov_base = &ext;
+		v[1].iov_len = vd->wcap_flags ? sizeof (ext) : 0;
+		len = v[0].iov_len + v[1].iov_len;
 
 		vd->fd = open(WCAPFILE, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
 
@@ -795,36 +1929,249 @@ vidcapToggle(CompDisplay     *d,
 			compLogMessage("vidcap", CompLogLevelError,
 									"Could not open %s for writing", WCAPFILE);
 			vd->recording = FALSE;
+			vidcap_stop_yuv(d->screens);
+			vidcap_free_ring(vd);
 			free(vd->frame);
-			return TRUE;
+			return;
 		}
 
-		ret = write(vd->fd, &header, sizeof (header));
+		ret = writev(vd->fd, v, 2);
 
 		vd->dot_timer = 0;
 		vd->done = FALSE;
 
-		if (ret != sizeof (header)) {
+		if (ret != len) {
 			compLogMessage("vidcap", CompLogLevelError,
 									"Could not write to %s", WCAPFILE);
 			vd->recording = FALSE;
+			vidcap_stop_yuv(d->screens);
+			vidcap_free_ring(vd);
 			free(vd->frame);
 			close(vd->fd);
 			remove(WCAPFILE);
-			return TRUE;
+			return;
+		}
+
+		vd->compressor = NULL;
+		vd->packed = NULL;
+		if (compress) {
+			vd->packed_size = wcap_compress_bound(width * height * 4);
+			vd->packed = malloc(vd->packed_size);
+			vd->compressor = wcap_compressor_create();
+			if (!vd->packed || !vd->compressor) {
+				compLogMessage("vidcap", CompLogLevelWarn,
+					"Could not set up compression, "
+					"storing frames as they are");
+				wcap_compressor_destroy(vd->compressor);
+				vd->compressor = NULL;
+			}
 		}
+
+		vd->frames = vd->dropped = 0;
+		memset(&vd->avg, 0, sizeof (vd->avg));
+		vd->encoder_stop = vd->encoder_error = vd->encoder_done = FALSE;
+		vd->committed = len;
+		pthread_create(&vd->encoder, NULL, encoder_func, d);
+
+		vd->live = vidcapGetLiveTranscode (d);
+		if (vd->live)
+			pthread_create(&vd->thread, NULL, live_func, d);
+
+		vidcap_start_capture(d->screens);
 	} else {
-		free(vd->frame);
-		close(vd->fd);
+		/* thread_func and live_func wait for the
+		 * encoder to drain the ring */
+		vidcap_readback_fini(d->screens, TRUE);
+		vidcap_stop_yuv(d->screens);
 		vd->dot_timer = 0;
 		vd->thread_running = TRUE;
-		pthread_create(&vd->thread, NULL, thread_func, d);
+		if (vd->live)
+			vidcap_signal_encoder(vd);
+		else
+			pthread_create(&vd->thread, NULL, thread_func, d);
 		compLogMessage("vidcap", CompLogLevelInfo, "Recording stopped");
 	}
+}
+
+static Bool
+vidcapToggle(CompDisplay     *d,
+				CompAction      *action,
+				CompActionState state,
+				CompOption      *option,
+				int             nOption)
+{
+	VIDCAP_DISPLAY (d);
+	VIDCAP_SCREEN (d->screens);
+
+	if (!vd->recording && !vd->thread_running) {
+		vs->area.x1 = vs->area.y1 = 0;
+		vs->area.x2 = d->screens->width;
+		vs->area.y2 = d->screens->height;
+		vs->window = None;
+	}
+
+	vidcap_toggle_recording(d);
+
+	return TRUE;
+}
+
+/* Record the active window, following it around. Stops like the
+ * toggle when already recording. */
+static Bool
+vidcapRecordWindow(CompDisplay     *d,
+				CompAction      *action,
+				CompActionState state,
+				CompOption      *option,
+				int             nOption)
+{
+	CompWindow *w;
+	Window xid;
+
+	VIDCAP_DISPLAY (d);
+	VIDCAP_SCREEN (d->screens);
+
+	if (vd->recording || vd->thread_running) {
+		vidcap_toggle_recording(d);
+		return TRUE;
+	}
+
+	xid = getIntOptionNamed (option, nOption, "window", d->activeWindow);
+	w = findWindowAtDisplay (d, xid);
+	if (!w || w->screen != d->screens)
+		return FALSE;
+
+	vidcap_window_area(w, 0, 0, &vs->area);
+	if (vs->area.x2 <= vs->area.x1 || vs->area.y2 <= vs->area.y1)
+		return FALSE;
+	vs->window = w->id;
+
+	vidcap_toggle_recording(d);
+
+	return TRUE;
+}
+
+static void
+vidcap_damage_selection(CompScreen *s)
+{
+	REGION reg;
+
+	VIDCAP_SCREEN (s);
+
+	reg.rects = &reg.extents;
+	reg.numRects = 1;
+	reg.extents.x1 = MIN (vs->x1, vs->x2) - 1;
+	reg.extents.y1 = MIN (vs->y1, vs->y2) - 1;
+	reg.extents.x2 = MAX (vs->x1, vs->x2) + 1;
+	reg.extents.y2 = MAX (vs->y1, vs->y2) + 1;
+
+	damageScreenRegion (s, &reg);
+}
+
+/* Drag out the rectangle to record. Stops like the toggle when
+ * already recording. */
+static Bool
+vidcapSelectRegion(CompDisplay     *d,
+				CompAction      *action,
+				CompActionState state,
+				CompOption      *option,
+				int             nOption)
+{
+	CompScreen *s;
+	Window xid;
+
+	VIDCAP_DISPLAY (d);
+
+	if (vd->recording || vd->thread_running) {
+		vidcap_toggle_recording(d);
+		return TRUE;
+	}
+
+	xid = getIntOptionNamed (option, nOption, "root", 0);
+	s = findScreenAtDisplay (d, xid);
+	if (!s || s != d->screens)
+		return FALSE;
+
+	VIDCAP_SCREEN (s);
+
+	if (otherScreenGrabExist (s, "vidcap", NULL))
+		return FALSE;
+
+	if (!vs->grabIndex)
+		vs->grabIndex = pushScreenGrab (s, vd->cursor, "vidcap");
+
+	if (state & CompActionStateInitKey)
+		action->state |= CompActionStateTermKey;
+
+	if (state & CompActionStateInitButton)
+		action->state |= CompActionStateTermButton;
+
+	vs->x1 = vs->x2 = pointerX;
+	vs->y1 = vs->y2 = pointerY;
 
 	return TRUE;
 }
 
+static Bool
+vidcapSelectRegionTerminate(CompDisplay     *d,
+				CompAction      *action,
+				CompActionState state,
+				CompOption      *option,
+				int             nOption)
+{
+	CompScreen *s = d->screens;
+
+	VIDCAP_SCREEN (s);
+
+	action->state &= ~(CompActionStateTermKey | CompActionStateTermButton);
+
+	if (!vs->grabIndex)
+		return FALSE;
+
+	removeScreenGrab (s, vs->grabIndex, NULL);
+	vs->grabIndex = 0;
+	vidcap_damage_selection(s);
+
+	vs->area.x1 = MAX (0, MIN (vs->x1, vs->x2));
+	vs->area.y1 = MAX (0, MIN (vs->y1, vs->y2));
+	vs->area.x2 = MIN (s->width, MAX (vs->x1, vs->x2));
+	vs->area.y2 = MIN (s->height, MAX (vs->y1, vs->y2));
+	vs->window = None;
+
+	if (vs->area.x2 <= vs->area.x1 || vs->area.y2 <= vs->area.y1)
+		return FALSE;
+
+	vidcap_toggle_recording(d);
+
+	return FALSE;
+}
+
+static void
+vidcapHandleEvent(CompDisplay *d,
+				XEvent      *event)
+{
+	CompScreen *s;
+
+	VIDCAP_DISPLAY (d);
+
+	if (event->type == MotionNotify) {
+		s = findScreenAtDisplay (d, event->xmotion.root);
+		if (s) {
+			VIDCAP_SCREEN (s);
+
+			if (vs->grabIndex) {
+				vidcap_damage_selection(s);
+				vs->x2 = pointerX;
+				vs->y2 = pointerY;
+				vidcap_damage_selection(s);
+			}
+		}
+	}
+
+	UNWRAP (vd, d, handleEvent);
+	(*d->handleEvent) (d, event);
+	WRAP (vd, d, handleEvent, vidcapHandleEvent);
+}
+
 static Bool
 vidcapInitDisplay(CompPlugin *p,
 					CompDisplay *d)
@@ -848,8 +2195,27 @@ vidcapInitDisplay(CompPlugin *p,
 	vd->done = FALSE;
 	vd->recording = FALSE;
 	vd->thread_running = FALSE;
+	vd->ring = NULL;
+	vd->ring_size = 0;
+	vd->live = FALSE;
+	vd->compressor = NULL;
+	vd->packed = NULL;
+	memset(&vd->readback_us, 0, sizeof (vd->readback_us));
+	memset(&vd->depth, 0, sizeof (vd->depth));
+	memset(&vd->encode_us, 0, sizeof (vd->encode_us));
+	memset(&vd->frame_bytes, 0, sizeof (vd->frame_bytes));
+	memset(&vd->avg, 0, sizeof (vd->avg));
+	pthread_mutex_init(&vd->ring_mutex, NULL);
+	pthread_cond_init(&vd->ring_cond, NULL);
+	pthread_cond_init(&vd->live_cond, NULL);
 
     vidcapSetToggleRecordInitiate(d, vidcapToggle);
+    vidcapSetRecordWindowInitiate(d, vidcapRecordWindow);
+    vidcapSetRecordRegionInitiate(d, vidcapSelectRegion);
+    vidcapSetRecordRegionTerminate(d, vidcapSelectRegionTerminate);
+
+	vd->cursor = XCreateFontCursor (d->display, XC_crosshair);
+	WRAP (vd, d, handleEvent, vidcapHandleEvent);
 
     d->base.privates[VidcapDisplayPrivateIndex].ptr = vd;
 
@@ -863,6 +2229,24 @@ vidcapFiniDisplay(CompPlugin *p,
 {
 	VIDCAP_DISPLAY (d);
 
+	if (vd->recording) {
+		vd->recording = FALSE;
+		if (vd->live) {
+			vidcap_signal_encoder(vd);
+			pthread_join(vd->thread, NULL);
+		} else {
+			vidcap_stop_encoder(vd);
+			remove(WCAPFILE);
+		}
+	}
+
+	pthread_mutex_destroy(&vd->ring_mutex);
+	pthread_cond_destroy(&vd->ring_cond);
+	pthread_cond_destroy(&vd->live_cond);
+
+	UNWRAP (vd, d, handleEvent);
+	XFreeCursor (d->display, vd->cursor);
+
 	freeScreenPrivateIndex(d, vd->screenPrivateIndex);
 
 	free(vd);
@@ -873,6 +2257,7 @@ vidcapInitScreen(CompPlugin *p,
 				 CompScreen *s)
 {
 	VidcapScreen *vs;
+	const char *glExtensions;
 
     VIDCAP_DISPLAY (s->display);
 
@@ -880,11 +2265,67 @@ vidcapInitScreen(CompPlugin *p,
 	if (!vs)
 		return FALSE;
 
+	vs->damage = XCreateRegion ();
+	if (!vs->damage) {
+		free(vs);
+		return FALSE;
+	}
+
+	vs->readback_active = FALSE;
+	vs->pbo = FALSE;
+
+	vs->area.x1 = vs->area.y1 = 0;
+	vs->area.x2 = s->width;
+	vs->area.y2 = s->height;
+	vs->window = None;
+	vs->grabIndex = 0;
+
+	vs->yuv_active = FALSE;
+	memset(&vs->yuv, 0, sizeof (vs->yuv));
+	vs->yuv.gl.genPrograms = s->genPrograms;
+	vs->yuv.gl.deletePrograms = s->deletePrograms;
+	vs->yuv.gl.bindProgram = s->bindProgram;
+	vs->yuv.gl.programString = s->programString;
+	vs->yuv.gl.programLocalParameter4f = s->programLocalParameter4f;
+	vs->yuv.gl.genFramebuffers = s->genFramebuffers;
+	vs->yuv.gl.deleteFramebuffers = s->deleteFramebuffers;
+	vs->yuv.gl.bindFramebuffer = s->bindFramebuffer;
+	vs->yuv.gl.checkFramebufferStatus = s->checkFramebufferStatus;
+	vs->yuv.gl.framebufferTexture2D = s->framebufferTexture2D;
+	vs->yuv_supported = s->fbo && s->fragmentProgram &&
+			    s->textureRectangle;
+
+	glExtensions = (const char *) glGetString (GL_EXTENSIONS);
+	if (glExtensions && strstr (glExtensions, "GL_ARB_pixel_buffer_object")) {
+		vs->genBuffers = (PFNGLGENBUFFERSARBPROC)
+			(*s->getProcAddress) ((GLubyte *) "glGenBuffersARB");
+		vs->deleteBuffers = (PFNGLDELETEBUFFERSARBPROC)
+			(*s->getProcAddress) ((GLubyte *) "glDeleteBuffersARB");
+		vs->bindBuffer = (PFNGLBINDBUFFERARBPROC)
+			(*s->getProcAddress) ((GLubyte *) "glBindBufferARB");
+		vs->bufferData = (PFNGLBUFFERDATAARBPROC)
+			(*s->getProcAddress) ((GLubyte *) "glBufferDataARB");
+		vs->mapBuffer = (PFNGLMAPBUFFERARBPROC)
+			(*s->getProcAddress) ((GLubyte *) "glMapBufferARB");
+		vs->unmapBuffer = (PFNGLUNMAPBUFFERARBPROC)
+			(*s->getProcAddress) ((GLubyte *) "glUnmapBufferARB");
+
+		vs->pbo = vs->genBuffers && vs->deleteBuffers &&
+			  vs->bindBuffer && vs->bufferData &&
+			  vs->mapBuffer && vs->unmapBuffer;
+	}
+
+	if (!vs->pbo)
+		compLogMessage("vidcap", CompLogLevelInfo,
+			"GL_ARB_pixel_buffer_object not supported, "
+			"using synchronous readback");
+
     s->base.privates[vd->screenPrivateIndex].ptr = vs;
 
 	WRAP (vs, s, preparePaintScreen, vidcapPreparePaintScreen);
 	WRAP (vs, s, donePaintScreen, vidcapDonePaintScreen);
 	WRAP (vs, s, paintScreen, vidcapPaintScreen);
+	WRAP (vs, s, paintOutput, vidcapPaintOutput);
 
 	return TRUE;
 
@@ -896,9 +2337,18 @@ vidcapFiniScreen(CompPlugin *p,
 {
 	VIDCAP_SCREEN (s);
 
+	vidcap_readback_fini(s, FALSE);
+	vidcap_stop_yuv(s);
+
+	if (vs->grabIndex)
+		removeScreenGrab (s, vs->grabIndex, NULL);
+
 	UNWRAP (vs, s, preparePaintScreen);
 	UNWRAP (vs, s, donePaintScreen);
 	UNWRAP (vs, s, paintScreen);
+	UNWRAP (vs, s, paintOutput);
+
+	XDestroyRegion (vs->damage);
 
 	free(vs);
 }
@@ -0,0 +1,208 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(HAVE_LZ4)
+#include <lz4.h>
+#elif defined(HAVE_ZSTD)
+#include <zstd.h>
+#endif
+
+#include "wcap-decode.h"
+#include "wcap-compress.h"
+
+/* Fast rather than small: frames are compressed at paint rate */
+#define WCAP_ZSTD_LEVEL 1
+
+struct wcap_compressor {
+#ifdef HAVE_ZSTD
+	ZSTD_CCtx *cctx;
+#else
+	int unused;
+#endif
+};
+
+uint32_t
+wcap_compress_codec(void)
+{
+#if defined(HAVE_LZ4)
+	return WCAP_FRAME_LZ4;
+#elif defined(HAVE_ZSTD)
+	return WCAP_FRAME_ZSTD;
+#else
+	return 0;
+#endif
+}
+
+const char *
+wcap_compress_name(uint32_t codec)
+{
+	switch (codec & WCAP_FRAME_COMPRESSED) {
+	case WCAP_FRAME_LZ4:
+		return "lz4";
+	case WCAP_FRAME_ZSTD:
+		return "zstd";
+	default:
+		return "none";
+	}
+}
+
+struct wcap_compressor *
+wcap_compressor_create(void)
+{
+	struct wcap_compressor *c;
+
+	if (!wcap_compress_codec())
+		return NULL;
+
+	c = calloc(1, sizeof *c);
+	if (!c)
+		return NULL;
+
+#ifdef HAVE_ZSTD
+	c->cctx = ZSTD_createCCtx();
+	if (!c->cctx) {
+		free(c);
+		return NULL;
+	}
+#endif
+
+	return c;
+}
+
+void
+wcap_compressor_destroy(struct wcap_compressor *c)
+{
+	if (!c)
+		return;
+
+#ifdef HAVE_ZSTD
+	ZSTD_freeCCtx(c->cctx);
+#endif
+	free(c);
+}
+
+size_t
+wcap_compress_bound(size_t size)
+{
+	size_t bound = size;
+
+#if defined(HAVE_LZ4)
+	bound = LZ4_compressBound(size);
+#elif defined(HAVE_ZSTD)
+	bound = ZSTD_compressBound(size);
+#endif
+
+	return sizeof (struct wcap_compressed) + bound + 3;
+}
+
+size_t
+wcap_compress(struct wcap_compressor *c, void *dst, size_t dst_size,
+	      const void *src, size_t size)
+{
+	struct wcap_compressed header;
+	char *out = (char *) dst + sizeof header;
+	size_t len = 0;
+
+	if (!c || dst_size < wcap_compress_bound(size))
+		return 0;
+
+#if defined(HAVE_LZ4)
+	{
+		int ret = LZ4_compress_default(src, out, size,
+					       dst_size - sizeof header);
+
+		len = ret > 0 ? ret : 0;
+	}
+#elif defined(HAVE_ZSTD)
+	len = ZSTD_compressCCtx(c->cctx, out, dst_size - sizeof header,
+				src, size, WCAP_ZSTD_LEVEL);
+	if (ZSTD_isError(len))
+		len = 0;
+#endif
+
+	if (!len)
+		return 0;
+
+	header.size = size;
+	header.compressed = len;
+	memcpy(dst, &header, sizeof header);
+
+	while (len & 3)
+		out[len++] = 0;
+
+	len += sizeof header;
+
+	return len < size ? len : 0;
+}
+
+size_t
+wcap_decompress(uint32_t codec, void *dst, size_t dst_size,
+		const void *src, size_t size)
+{
+	struct wcap_compressed header;
+	size_t len = 0;
+
+	if (size < sizeof header)
+		return 0;
+
+	memcpy(&header, src, sizeof header);
+	if (header.size > dst_size ||
+	    header.compressed > size - sizeof header)
+		return 0;
+
+	switch (codec & WCAP_FRAME_COMPRESSED) {
+#ifdef HAVE_LZ4
+	case WCAP_FRAME_LZ4:
+	{
+		int ret = LZ4_decompress_safe((const char *) src + sizeof header,
+					      dst, header.compressed,
+					      header.size);
+
+		len = ret > 0 ? ret : 0;
+		break;
+	}
+#endif
+#ifdef HAVE_ZSTD
+	case WCAP_FRAME_ZSTD:
+		len = ZSTD_decompress(dst, header.size,
+				      (const char *) src + sizeof header,
+				      header.compressed);
+		if (ZSTD_isError(len))
+			len = 0;
+		break;
+#endif
+	default:
+		break;
+	}
+
+	return len == header.size ? len : 0;
+}
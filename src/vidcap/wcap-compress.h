@@ -0,0 +1,62 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _WCAP_COMPRESS_
+#define _WCAP_COMPRESS_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Optional compression of the run data of a frame, with LZ4 or zstd
+ * as chosen at build time. Compressed frames are flagged with the
+ * codec in their header and start with struct wcap_compressed. */
+
+struct wcap_compressor;
+
+/* The frame flag of the codec this build compresses with, or 0 */
+uint32_t wcap_compress_codec(void);
+
+const char *wcap_compress_name(uint32_t codec);
+
+/* NULL when built without a codec */
+struct wcap_compressor *wcap_compressor_create(void);
+void wcap_compressor_destroy(struct wcap_compressor *c);
+
+/* Space wcap_compress() needs for size bytes of run data */
+size_t wcap_compress_bound(size_t size);
+
+/* Compress size bytes of run data into dst, padded to 4 bytes. Returns
+ * the bytes written, or 0 when that would save nothing and the frame
+ * is better stored as it is. */
+size_t wcap_compress(struct wcap_compressor *c, void *dst, size_t dst_size,
+		     const void *src, size_t size);
+
+/* Undo wcap_compress() for a frame flagged with codec. Returns the
+ * bytes of run data written to dst, or 0 for corrupt data or a codec
+ * this build does not have. */
+size_t wcap_decompress(uint32_t codec, void *dst, size_t dst_size,
+		       const void *src, size_t size);
+
+#endif
@@ -0,0 +1,132 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wcap-corpus.h"
+
+void
+wcap_corpus_pack_rectangle(uint32_t *dst, const uint32_t *frame, int stride,
+			   const struct wcap_rectangle *rect)
+{
+	int y, width = rect->x2 - rect->x1;
+
+	for (y = rect->y2 - 1; y >= rect->y1; y--) {
+		memcpy(dst, frame + y * stride + rect->x1, width * 4);
+		dst += width;
+	}
+}
+
+/* A desktop-like corpus: a static gradient, a window of text-like
+ * content moving across it and a blinking cursor. */
+void
+wcap_corpus_synth_frame(uint32_t *frame, int width, int height, int n)
+{
+	int x, y, wx, wy, ww = width / 3, wh = height / 3;
+	uint32_t h;
+
+	for (y = 0; y < height; y++)
+		for (x = 0; x < width; x++)
+			frame[y * width + x] = 0xff000000 |
+				(0x40 << 16) | ((y * 255 / height) << 8) |
+				(x * 255 / width);
+
+	wx = (n * 7) % (width - ww);
+	wy = (n * 3) % (height - wh);
+	for (y = 0; y < wh; y++) {
+		for (x = 0; x < ww; x++) {
+			h = (x / 2) * 73856093u ^ (y / 3) * 19349663u;
+			frame[(wy + y) * width + wx + x] =
+				(y % 12) < 9 && (h % 5) == 0 ?
+				0xff202020 : 0xfff0f0f0;
+		}
+	}
+
+	if ((n / 15) % 2)
+		for (y = 0; y < 16 && y < wh; y++)
+			frame[(wy + y + 2) * width + wx + 4] = 0xff000000;
+}
+
+uint32_t **
+wcap_corpus_load(const char *filename, int *width, int *height,
+		 int *nframes)
+{
+	struct wcap_decoder *decoder = NULL;
+	uint32_t **frames;
+	size_t npixels;
+	int n;
+
+	if (filename) {
+		decoder = wcap_decoder_create(filename);
+		if (!decoder) {
+			fprintf(stderr, "could not open %s\n", filename);
+			return NULL;
+		}
+		if (decoder->format == WCAP_FORMAT_I420) {
+			fprintf(stderr, "%s was recorded as YUV, the corpus "
+				"needs an RGB recording\n", filename);
+			wcap_decoder_destroy(decoder);
+			return NULL;
+		}
+		*width = decoder->width;
+		*height = decoder->height;
+	}
+
+	npixels = (size_t) *width * *height;
+	frames = calloc(*nframes, sizeof *frames);
+	if (!frames)
+		return NULL;
+
+	for (n = 0; n < *nframes; n++) {
+		if (decoder && !wcap_decoder_get_frame(decoder))
+			break;
+		frames[n] = malloc(npixels * 4);
+		if (!frames[n])
+			break;
+		if (decoder)
+			memcpy(frames[n], decoder->frame, npixels * 4);
+		else
+			wcap_corpus_synth_frame(frames[n], *width, *height,
+						n);
+	}
+	*nframes = n;
+
+	if (decoder)
+		wcap_decoder_destroy(decoder);
+
+	return frames;
+}
+
+void
+wcap_corpus_free(uint32_t **frames, int nframes)
+{
+	int n;
+
+	for (n = 0; n < nframes; n++)
+		free(frames[n]);
+	free(frames);
+}
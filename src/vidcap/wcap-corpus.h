@@ -0,0 +1,50 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _WCAP_CORPUS_
+#define _WCAP_CORPUS_
+
+#include <stdint.h>
+
+#include "wcap-decode.h"
+
+/* Test frames shared by wcap-tool bench and wcap-test */
+
+/* Pack a rectangle of a top-down frame bottom row first, the order the
+ * recorder gets it in from glReadPixels. */
+void wcap_corpus_pack_rectangle(uint32_t *dst, const uint32_t *frame,
+				int stride, const struct wcap_rectangle *rect);
+
+/* Frame n of a desktop-like sequence */
+void wcap_corpus_synth_frame(uint32_t *frame, int width, int height, int n);
+
+/* Load up to *nframes frames of an RGB recording, or synthesize them at
+ * *width x *height when filename is NULL. Updates *nframes to the
+ * number of frames loaded. */
+uint32_t **wcap_corpus_load(const char *filename, int *width, int *height,
+			    int *nframes);
+void wcap_corpus_free(uint32_t **frames, int nframes);
+
+#endif
@@ -0,0 +1,513 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "wcap-decode.h"
+#include "wcap-compress.h"
+
+static void
+wcap_decoder_decode_rectangle(struct wcap_decoder *decoder,
+			      struct wcap_rectangle *rect, uint32_t *end)
+{
+	uint32_t v, any = 0, *p = decoder->p, *d;
+	int width = rect->x2 - rect->x1, height = rect->y2 - rect->y1;
+	int x, i, j, k, l, count = width * height;
+	unsigned char r, g, b, dr, dg, db;
+
+	d = decoder->frame + (rect->y2 - 1) * decoder->width;
+	x = rect->x1;
+	i = 0;
+	while (i < count && p < end) {
+		v = *p++;
+		l = v >> 24;
+		if (l < 0xe0) {
+			j = l + 1;
+		} else {
+			j = 1 << (l - 0xe0 + 7);
+		}
+
+		if (j > count - i) {
+			printf("rle encoding longer than expected (%d expected %d)\n",
+			       i + j, count);
+			j = count - i;
+		}
+
+		any |= v & 0xffffff;
+		dr = (v >> 16);
+		dg = (v >>  8);
+		db = (v >>  0);
+		for (k = 0; k < j; k++) {
+			r = (d[x] >> 16) + dr;
+			g = (d[x] >>  8) + dg;
+			b = (d[x] >>  0) + db;
+			d[x] = 0xff000000 | (r << 16) | (g << 8) | b;
+			x++;
+			if (x == rect->x2) {
+				x = rect->x1;
+				d -= decoder->width;
+			}
+		}
+		i += j;
+	}
+
+	if (i != count)
+		printf("rle encoding shorter than expected (%d expected %d)\n",
+		       i, count);
+
+	/* Damage that was repainted with the same pixels is all zero runs */
+	if (any)
+		decoder->changed = 1;
+	decoder->p = p;
+}
+
+/* Copy the three planes of a rectangle of a WCAP_FORMAT_I420 frame */
+static void
+wcap_decoder_copy_planes(struct wcap_decoder *decoder,
+			 struct wcap_rectangle *rect)
+{
+	unsigned char *src = decoder->p, *dst = (unsigned char *) decoder->frame;
+	int width = rect->x2 - rect->x1, stride = decoder->width;
+	int x = rect->x1, y1 = rect->y1, y2 = rect->y2;
+	int plane, y;
+
+	for (plane = 0; plane < 3; plane++) {
+		for (y = y1; y < y2; y++) {
+			memcpy(dst + y * stride + x, src, width);
+			src += width;
+		}
+
+		/* Then the two chroma planes at half resolution */
+		dst += stride * (plane ? decoder->height / 2 : decoder->height);
+		if (plane == 0) {
+			width /= 2;
+			stride /= 2;
+			x /= 2;
+			y1 /= 2;
+			y2 /= 2;
+		}
+	}
+
+	decoder->p = src;
+}
+
+static size_t
+wcap_rectangle_size(struct wcap_decoder *decoder, struct wcap_rectangle *r)
+{
+	size_t area = (size_t) (r->x2 - r->x1) * (r->y2 - r->y1);
+
+	return decoder->format == WCAP_FORMAT_I420 ? area * 3 / 2 : 0;
+}
+
+static int
+wcap_rectangle_valid(struct wcap_decoder *decoder, struct wcap_rectangle *r)
+{
+	if (decoder->format == WCAP_FORMAT_I420 &&
+	    ((r->x1 | r->y1 | r->x2 | r->y2) & 1))
+		return 0;
+
+	return r->x1 >= 0 && r->y1 >= 0 && r->x1 < r->x2 && r->y1 < r->y2 &&
+	       r->x2 <= decoder->width && r->y2 <= decoder->height;
+}
+
+/* Black, which is where the first frame and keyframes start from */
+static void
+wcap_decoder_clear(struct wcap_decoder *decoder)
+{
+	size_t luma = (size_t) decoder->width * decoder->height;
+
+	if (decoder->format == WCAP_FORMAT_I420) {
+		memset(decoder->frame, 0, luma);
+		memset((char *) decoder->frame + luma, 128, luma / 2);
+	} else {
+		memset(decoder->frame, 0, luma * 4);
+	}
+}
+
+/* Returns 0 at the end of the data, and for a frame that is cut short
+ * or corrupt, so a damaged file decodes up to the damage. */
+int
+wcap_decoder_get_frame(struct wcap_decoder *decoder)
+{
+	struct wcap_rectangle *rects;
+	uint32_t i, msecs, flags = 0, nrects, *data, *end, *next = NULL;
+	size_t avail, size, max, len;
+
+	avail = (char *) decoder->end - (char *) decoder->p;
+
+	if (decoder->flags & WCAP_HEADER_KEYFRAMES) {
+		struct wcap_frame_header_ext *header = decoder->p;
+
+		if (avail < sizeof *header)
+			return 0;
+		avail -= sizeof *header;
+		if (header->nrects > avail / sizeof *rects ||
+		    header->size > avail - header->nrects * sizeof *rects)
+			return 0;
+
+		msecs = header->msecs;
+		flags = header->flags;
+		nrects = header->nrects;
+		rects = (void *) (header + 1);
+		end = (uint32_t *) ((char *) (rects + nrects) + header->size);
+		next = end;
+	} else {
+		struct wcap_frame_header *header = decoder->p;
+
+		if (avail < sizeof *header)
+			return 0;
+		avail -= sizeof *header;
+		if (header->nrects > avail / sizeof *rects)
+			return 0;
+
+		msecs = header->msecs;
+		nrects = header->nrects;
+		rects = (void *) (header + 1);
+		end = decoder->end;
+	}
+
+	for (i = 0, size = 0; i < nrects; i++) {
+		if (!wcap_rectangle_valid(decoder, &rects[i]))
+			return 0;
+		size += wcap_rectangle_size(decoder, &rects[i]);
+	}
+
+	data = (uint32_t *) (rects + nrects);
+
+	/* Run data takes at most a word per pixel, planes less */
+	if (flags & WCAP_FRAME_COMPRESSED) {
+		max = (size_t) decoder->width * decoder->height * 4;
+		if (!decoder->scratch) {
+			decoder->scratch = malloc(max);
+			if (!decoder->scratch)
+				return 0;
+		}
+
+		len = wcap_decompress(flags, decoder->scratch, max, data,
+				      (char *) end - (char *) data);
+		if (!len || len & 3)
+			return 0;
+
+		data = decoder->scratch;
+		end = (uint32_t *) ((char *) data + len);
+	}
+
+	/* Planes are stored as is, so their size is known up front */
+	if (size > (size_t) ((char *) end - (char *) data))
+		return 0;
+
+	if (flags & WCAP_FRAME_KEYFRAME)
+		wcap_decoder_clear(decoder);
+
+	decoder->msecs = msecs;
+	decoder->frame_flags = flags;
+	decoder->count++;
+
+	/* Planes are not compared with what they replace */
+	decoder->changed = (flags & WCAP_FRAME_KEYFRAME) ||
+			   (nrects && decoder->format == WCAP_FORMAT_I420);
+
+	decoder->p = data;
+	for (i = 0; i < nrects; i++) {
+		if (decoder->format == WCAP_FORMAT_I420)
+			wcap_decoder_copy_planes(decoder, &rects[i]);
+		else
+			wcap_decoder_decode_rectangle(decoder, &rects[i], end);
+	}
+
+	if (next)
+		decoder->p = next;
+
+	return 1;
+}
+
+#define WCAP_FRAME_FLAGS	(WCAP_FRAME_KEYFRAME | WCAP_FRAME_COMPRESSED)
+
+/* Whether a header found walking the file starts a frame that follows
+ * the one at msecs, rather than bytes of a partly written index. Only
+ * checks what the walk relies on, the run data is checked on decode. */
+static int
+wcap_frame_header_valid(struct wcap_decoder *decoder,
+			struct wcap_frame_header_ext *header, size_t len,
+			uint32_t msecs)
+{
+	struct wcap_rectangle *rects = (void *) (header + 1);
+	uint32_t i;
+
+	if (header->nrects > len / sizeof *rects ||
+	    header->size > len - header->nrects * sizeof *rects ||
+	    header->size & 3 || header->flags & ~WCAP_FRAME_FLAGS ||
+	    header->msecs < msecs)
+		return 0;
+
+	for (i = 0; i < header->nrects; i++)
+		if (!wcap_rectangle_valid(decoder, &rects[i]))
+			return 0;
+
+	return 1;
+}
+
+/* Use the index at the end of the file, or rebuild it by walking the
+ * frame headers when the recording was cut short before it was
+ * written. A partially written last frame is dropped either way, and
+ * the walk stops at the first header that cannot start a frame. */
+static void
+wcap_decoder_load_index(struct wcap_decoder *decoder)
+{
+	struct wcap_index_trailer trailer;
+	struct wcap_frame_header_ext *header;
+	struct wcap_index_entry *index = NULL, *tmp;
+	char *map = decoder->map, *p, *end;
+	size_t first, len;
+	uint32_t n = 0, size = 0;
+
+	first = (char *) decoder->start - map;
+
+	if (decoder->size >= first + sizeof trailer) {
+		memcpy(&trailer, map + decoder->size - sizeof trailer,
+		       sizeof trailer);
+		len = decoder->size - sizeof trailer;
+
+		if (trailer.magic == WCAP_INDEX_MAGIC &&
+		    trailer.offset >= first && trailer.offset <= len &&
+		    len - trailer.offset ==
+		    (uint64_t) trailer.count * sizeof *index) {
+			index = malloc(trailer.count * sizeof *index + 1);
+			if (!index)
+				return;
+			memcpy(index, map + trailer.offset,
+			       trailer.count * sizeof *index);
+			decoder->index = index;
+			decoder->index_count = trailer.count;
+			decoder->end = map + trailer.offset;
+			return;
+		}
+	}
+
+	p = decoder->start;
+	end = decoder->end;
+	while ((size_t) (end - p) >= sizeof *header) {
+		header = (void *) p;
+		len = end - p - sizeof *header;
+		if (!wcap_frame_header_valid(decoder, header, len,
+					     n ? index[n - 1].msecs : 0))
+			break;
+
+		if (n == size) {
+			size = size ? size * 2 : 256;
+			tmp = realloc(index, size * sizeof *index);
+			if (!tmp) {
+				free(index);
+				return;
+			}
+			index = tmp;
+		}
+
+		index[n].msecs = header->msecs;
+		index[n].flags = header->flags;
+		index[n].offset = p - map;
+		n++;
+
+		p += sizeof *header +
+		     header->nrects * sizeof (struct wcap_rectangle) +
+		     header->size;
+	}
+
+	decoder->index = index;
+	decoder->index_count = n;
+	decoder->end = p;
+}
+
+struct wcap_decoder *
+wcap_decoder_create(const char *filename)
+{
+	struct wcap_decoder *decoder;
+	struct wcap_header *header;
+	struct wcap_header_ext *ext;
+	int frame_size;
+	struct stat buf;
+
+	decoder = malloc(sizeof *decoder);
+	if (decoder == NULL)
+		return NULL;
+
+	decoder->fd = open(filename, O_RDONLY);
+	if (decoder->fd == -1) {
+		free(decoder);
+		return NULL;
+	}
+
+	fstat(decoder->fd, &buf);
+	decoder->size = buf.st_size;
+	if (decoder->size < sizeof *header) {
+		close(decoder->fd);
+		free(decoder);
+		return NULL;
+	}
+
+	decoder->map = mmap(NULL, decoder->size,
+			    PROT_READ, MAP_PRIVATE, decoder->fd, 0);
+	if (decoder->map == MAP_FAILED) {
+		fprintf(stderr, "mmap failed\n");
+		close(decoder->fd);
+		free(decoder);
+		return NULL;
+	}
+
+	header = decoder->map;
+	decoder->format = header->format;
+	decoder->flags = 0;
+	decoder->count = 0;
+	decoder->changed = 0;
+	decoder->width = header->width;
+	decoder->height = header->height;
+	decoder->start = header + 1;
+	decoder->end = (char *) decoder->map + decoder->size;
+	decoder->index = NULL;
+	decoder->index_count = 0;
+	decoder->scratch = NULL;
+
+	if (header->magic == WCAP_HEADER_MAGIC_EXT &&
+	    decoder->size >= sizeof *header + sizeof *ext) {
+		ext = decoder->start;
+		decoder->flags = ext->flags;
+		decoder->start = ext + 1;
+	} else if (header->magic != WCAP_HEADER_MAGIC) {
+		fprintf(stderr, "not a wcap file\n");
+		goto err;
+	}
+
+	decoder->p = decoder->start;
+
+	if (decoder->flags & WCAP_HEADER_KEYFRAMES)
+		wcap_decoder_load_index(decoder);
+
+	frame_size = header->width * header->height * 4;
+	decoder->frame = malloc(frame_size);
+	if (decoder->frame == NULL)
+		goto err;
+	wcap_decoder_clear(decoder);
+
+	return decoder;
+
+err:
+	free(decoder->index);
+	munmap(decoder->map, decoder->size);
+	close(decoder->fd);
+	free(decoder);
+	return NULL;
+}
+
+/* A decoder without a file of its own, fed with complete frames
+ * through wcap_decoder_set_data() as they become available. */
+struct wcap_decoder *
+wcap_decoder_create_stream(const struct wcap_header *header, uint32_t flags)
+{
+	struct wcap_decoder *decoder;
+	int frame_size;
+
+	decoder = malloc(sizeof *decoder);
+	if (decoder == NULL)
+		return NULL;
+
+	decoder->fd = -1;
+	decoder->size = 0;
+	decoder->map = NULL;
+	decoder->start = decoder->p = decoder->end = NULL;
+	decoder->format = header->format;
+	decoder->flags = flags;
+	decoder->count = 0;
+	decoder->changed = 0;
+	decoder->width = header->width;
+	decoder->height = header->height;
+	decoder->index = NULL;
+	decoder->index_count = 0;
+	decoder->scratch = NULL;
+
+	frame_size = header->width * header->height * 4;
+	decoder->frame = malloc(frame_size);
+	if (decoder->frame == NULL) {
+		free(decoder);
+		return NULL;
+	}
+	wcap_decoder_clear(decoder);
+
+	return decoder;
+}
+
+void
+wcap_decoder_set_data(struct wcap_decoder *decoder, void *data, size_t size)
+{
+	decoder->p = data;
+	decoder->end = (char *) data + size;
+}
+
+/* Position the decoder on the last keyframe at or before msecs, or the
+ * first one, so the next frame decoded is that keyframe. Returns 0 when
+ * the file has no keyframes to seek to. */
+int
+wcap_decoder_seek(struct wcap_decoder *decoder, uint32_t msecs)
+{
+	struct wcap_index_entry *e;
+	uint32_t i, key = UINT32_MAX;
+
+	for (i = 0; i < decoder->index_count; i++) {
+		e = &decoder->index[i];
+		if (e->msecs > msecs && key != UINT32_MAX)
+			break;
+		if ((e->flags & WCAP_FRAME_KEYFRAME) &&
+		    e->offset < (size_t) ((char *) decoder->end -
+					  (char *) decoder->map))
+			key = i;
+	}
+
+	if (key == UINT32_MAX)
+		return 0;
+
+	decoder->p = (char *) decoder->map + decoder->index[key].offset;
+	decoder->count = key;
+
+	return 1;
+}
+
+void
+wcap_decoder_destroy(struct wcap_decoder *decoder)
+{
+	if (decoder->map) {
+		munmap(decoder->map, decoder->size);
+		close(decoder->fd);
+	}
+	free(decoder->index);
+	free(decoder->frame);
+	free(decoder->scratch);
+	free(decoder);
+}
@@ -26,26 +26,75 @@
 #ifndef _WCAP_DECODE_
 #define _WCAP_DECODE_
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define WCAP_HEADER_MAGIC	0x57434150
+#define WCAP_HEADER_MAGIC_EXT	0x57434158
+#define WCAP_INDEX_MAGIC	0x57434149
 
 #define WCAP_FORMAT_XRGB8888	0x34325258
 #define WCAP_FORMAT_XBGR8888	0x34324258
 #define WCAP_FORMAT_RGBX8888	0x34325852
 #define WCAP_FORMAT_BGRX8888	0x34325842
 
+/* Planar Y, Cb, Cr 4:2:0 frames, converted on the GPU. Rectangles are in
+ * luma pixels with even corners and carry their three planes as is. */
+#define WCAP_FORMAT_I420	0x30323449
+
 struct wcap_header {
 	uint32_t magic;
 	uint32_t format;
 	uint32_t width, height;
 };
 
+/* Follows struct wcap_header when magic is WCAP_HEADER_MAGIC_EXT */
+struct wcap_header_ext {
+	uint32_t flags;
+	uint32_t reserved;
+};
+
+/* Frames use struct wcap_frame_header_ext, start over from black when
+ * flagged as keyframes, and a complete file ends with an index. */
+#define WCAP_HEADER_KEYFRAMES	(1 << 0)
+
 struct wcap_frame_header {
 	uint32_t msecs;
 	uint32_t nrects;
 };
 
+#define WCAP_FRAME_KEYFRAME	(1 << 0)
+#define WCAP_FRAME_LZ4		(1 << 1)
+#define WCAP_FRAME_ZSTD		(1 << 2)
+#define WCAP_FRAME_COMPRESSED	(WCAP_FRAME_LZ4 | WCAP_FRAME_ZSTD)
+
+struct wcap_frame_header_ext {
+	uint32_t msecs;
+	uint32_t flags;
+	uint32_t nrects;
+	uint32_t size;		/* bytes of run data after the rectangles */
+};
+
+/* Starts the data of a compressed frame, followed by the compressed
+ * run data and padding to a multiple of 4 bytes */
+struct wcap_compressed {
+	uint32_t size;		/* bytes of run data */
+	uint32_t compressed;	/* bytes of compressed data */
+};
+
+/* One entry per frame, then the trailer as the last bytes of the file */
+struct wcap_index_entry {
+	uint32_t msecs;
+	uint32_t flags;
+	uint64_t offset;
+};
+
+struct wcap_index_trailer {
+	uint64_t offset;
+	uint32_t count;
+	uint32_t magic;
+};
+
 struct wcap_rectangle {
 	int32_t x1, y1, x2, y2;
 };
@@ -53,16 +102,31 @@ struct wcap_rectangle {
 struct wcap_decoder {
 	int fd;
 	size_t size;
-	void *map, *p, *end;
-	uint32_t *frame;
+	void *map, *start, *p, *end;
+	uint32_t *frame;	/* the planes for WCAP_FORMAT_I420 */
 	uint32_t format;
+	uint32_t flags;
 	uint32_t msecs;
+	uint32_t frame_flags;
 	uint32_t count;
+	int changed;		/* the last frame changed any pixel */
 	int width, height;
+
+	/* Run data of compressed frames */
+	void *scratch;
+
+	/* Frame offsets relative to map, read from the file or
+	 * rebuilt from the frame headers when it was cut short */
+	struct wcap_index_entry *index;
+	uint32_t index_count;
 };
 
 int wcap_decoder_get_frame(struct wcap_decoder *decoder);
 struct wcap_decoder *wcap_decoder_create(const char *filename);
+struct wcap_decoder *wcap_decoder_create_stream(const struct wcap_header *header,
+						uint32_t flags);
+void wcap_decoder_set_data(struct wcap_decoder *decoder, void *data, size_t size);
+int wcap_decoder_seek(struct wcap_decoder *decoder, uint32_t msecs);
 void wcap_decoder_destroy(struct wcap_decoder *decoder);
 
 #endif
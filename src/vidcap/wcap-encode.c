@@ -0,0 +1,323 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "wcap-encode.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WCAP_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+struct wcap_run_state {
+	uint32_t *p;
+	uint32_t prev;
+	int run;
+};
+
+typedef void (*wcap_encode_row_func)(struct wcap_run_state *st,
+				     const uint32_t *s, uint32_t *d,
+				     int width);
+
+static uint32_t *
+output_run(uint32_t *p, uint32_t delta, int run)
+{
+	int i;
+
+	while (run > 0) {
+		if (run <= 0xe0) {
+			*p++ = delta | ((run - 1) << 24);
+			break;
+		}
+
+		i = 24 - __builtin_clz(run);
+		*p++ = delta | ((i + 0xe0) << 24);
+		run -= 1 << (7 + i);
+	}
+
+	return p;
+}
+
+static inline uint32_t
+component_delta(uint32_t next, uint32_t prev)
+{
+	unsigned char dr, dg, db;
+
+	dr = (next >> 16) - (prev >> 16);
+	dg = (next >>  8) - (prev >>  8);
+	db = (next >>  0) - (prev >>  0);
+
+	return (dr << 16) | (dg << 8) | (db << 0);
+}
+
+static inline void
+encode_pixel(struct wcap_run_state *st, uint32_t delta)
+{
+	if (st->run == 0 || delta == st->prev) {
+		st->run++;
+	} else {
+		st->p = output_run(st->p, st->prev, st->run);
+		st->run = 1;
+	}
+	st->prev = delta;
+}
+
+static void
+encode_row_c(struct wcap_run_state *st, const uint32_t *s, uint32_t *d,
+	     int width)
+{
+	uint32_t next;
+	int k;
+
+	for (k = 0; k < width; k++) {
+		next = *s++;
+		encode_pixel(st, component_delta(next, *d));
+		*d++ = next;
+	}
+}
+
+#ifdef WCAP_X86_KERNELS
+
+/* The vector kernels compute the deltas of a whole block with one byte
+ * subtraction (the alpha byte is masked off, matching component_delta)
+ * and only fall back to per-pixel run tracking for blocks that neither
+ * continue the current run nor form a run of their own. The block is
+ * loaded before any run is emitted, so in place output stays safe. */
+
+__attribute__((target("sse2")))
+static void
+encode_row_sse2(struct wcap_run_state *st, const uint32_t *s, uint32_t *d,
+		int width)
+{
+	const __m128i mask = _mm_set1_epi32(0x00ffffff);
+	__m128i next, delta;
+	uint32_t lanes[4], first;
+	int k, l;
+
+	for (k = 0; k + 4 <= width; k += 4) {
+		next = _mm_loadu_si128((const __m128i *) (s + k));
+		delta = _mm_sub_epi8(next,
+				     _mm_loadu_si128((const __m128i *) (d + k)));
+		delta = _mm_and_si128(delta, mask);
+		_mm_storeu_si128((__m128i *) (d + k), next);
+
+		if (st->run &&
+		    _mm_movemask_epi8(_mm_cmpeq_epi32(delta,
+				_mm_set1_epi32(st->prev))) == 0xffff) {
+			st->run += 4;
+			continue;
+		}
+
+		first = _mm_cvtsi128_si32(delta);
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(delta,
+				_mm_set1_epi32(first))) == 0xffff) {
+			if (st->run)
+				st->p = output_run(st->p, st->prev, st->run);
+			st->run = 4;
+			st->prev = first;
+			continue;
+		}
+
+		_mm_storeu_si128((__m128i *) lanes, delta);
+		for (l = 0; l < 4; l++)
+			encode_pixel(st, lanes[l]);
+	}
+
+	encode_row_c(st, s + k, d + k, width - k);
+}
+
+__attribute__((target("avx2")))
+static void
+encode_row_avx2(struct wcap_run_state *st, const uint32_t *s, uint32_t *d,
+		int width)
+{
+	const __m256i mask = _mm256_set1_epi32(0x00ffffff);
+	__m256i next, delta;
+	uint32_t lanes[8], first;
+	int k, l;
+
+	for (k = 0; k + 8 <= width; k += 8) {
+		next = _mm256_loadu_si256((const __m256i *) (s + k));
+		delta = _mm256_sub_epi8(next,
+				_mm256_loadu_si256((const __m256i *) (d + k)));
+		delta = _mm256_and_si256(delta, mask);
+		_mm256_storeu_si256((__m256i *) (d + k), next);
+
+		if (st->run &&
+		    _mm256_movemask_epi8(_mm256_cmpeq_epi32(delta,
+				_mm256_set1_epi32(st->prev))) == -1) {
+			st->run += 8;
+			continue;
+		}
+
+		first = _mm_cvtsi128_si32(_mm256_castsi256_si128(delta));
+		if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(delta,
+				_mm256_set1_epi32(first))) == -1) {
+			if (st->run)
+				st->p = output_run(st->p, st->prev, st->run);
+			st->run = 8;
+			st->prev = first;
+			continue;
+		}
+
+		_mm256_storeu_si256((__m256i *) lanes, delta);
+		for (l = 0; l < 8; l++)
+			encode_pixel(st, lanes[l]);
+	}
+
+	encode_row_sse2(st, s + k, d + k, width - k);
+}
+
+#endif
+
+/* The kernels this CPU runs, scalar reference first and the one
+ * wcap_encode_rectangle dispatches to last */
+static struct {
+	const char *name;
+	wcap_encode_row_func row;
+} kernels[3];
+static int nkernels;
+static wcap_encode_row_func encode_row;
+
+static void
+add_kernel(const char *name, wcap_encode_row_func row)
+{
+	kernels[nkernels].name = name;
+	kernels[nkernels].row = row;
+	nkernels++;
+}
+
+static void
+select_kernel(void)
+{
+	nkernels = 0;
+	add_kernel("c", encode_row_c);
+
+#ifdef WCAP_X86_KERNELS
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+		add_kernel("sse2", encode_row_sse2);
+	if (__builtin_cpu_supports("avx2"))
+		add_kernel("avx2", encode_row_avx2);
+#endif
+
+	encode_row = kernels[nkernels - 1].row;
+}
+
+static uint32_t *
+encode_rectangle(wcap_encode_row_func row, uint32_t *p, const uint32_t *src,
+		 uint32_t *frame, int stride,
+		 const struct wcap_rectangle *rect)
+{
+	struct wcap_run_state st = { p, 0, 0 };
+	int j, width, height;
+
+	width = rect->x2 - rect->x1;
+	height = rect->y2 - rect->y1;
+
+	for (j = 0; j < height; j++) {
+		(*row)(&st, src, frame + stride * (rect->y2 - j - 1) + rect->x1,
+		       width);
+		src += width;
+	}
+
+	return output_run(st.p, st.prev, st.run);
+}
+
+uint32_t *
+wcap_encode_rectangle_c(uint32_t *p, const uint32_t *src, uint32_t *frame,
+			int stride, const struct wcap_rectangle *rect)
+{
+	return encode_rectangle(encode_row_c, p, src, frame, stride, rect);
+}
+
+uint32_t *
+wcap_encode_rectangle(uint32_t *p, const uint32_t *src, uint32_t *frame,
+		      int stride, const struct wcap_rectangle *rect)
+{
+	if (!encode_row)
+		select_kernel();
+
+	return encode_rectangle(encode_row, p, src, frame, stride, rect);
+}
+
+uint32_t *
+wcap_encode_frame(uint32_t *p, uint32_t *frame, int width, int height,
+		  const struct wcap_rectangle *rects, int nrects, int keyframe)
+{
+	const uint32_t *s = p;
+	int i;
+
+	if (keyframe)
+		memset(frame, 0, (size_t) width * height * 4);
+
+	for (i = 0; i < nrects; i++) {
+		p = wcap_encode_rectangle(p, s, frame, width, &rects[i]);
+		s += (rects[i].x2 - rects[i].x1) * (rects[i].y2 - rects[i].y1);
+	}
+
+	return p;
+}
+
+const char *
+wcap_encode_kernel(void)
+{
+	if (!encode_row)
+		select_kernel();
+
+	return kernels[nkernels - 1].name;
+}
+
+int
+wcap_encode_kernel_count(void)
+{
+	if (!encode_row)
+		select_kernel();
+
+	return nkernels;
+}
+
+const char *
+wcap_encode_kernel_name(int kernel)
+{
+	if (kernel < 0 || kernel >= wcap_encode_kernel_count())
+		return NULL;
+
+	return kernels[kernel].name;
+}
+
+uint32_t *
+wcap_encode_rectangle_kernel(int kernel, uint32_t *p, const uint32_t *src,
+			     uint32_t *frame, int stride,
+			     const struct wcap_rectangle *rect)
+{
+	if (kernel < 0 || kernel >= wcap_encode_kernel_count())
+		return NULL;
+
+	return encode_rectangle(kernels[kernel].row, p, src, frame, stride,
+				rect);
+}
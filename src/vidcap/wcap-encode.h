@@ -0,0 +1,68 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _WCAP_ENCODE_
+#define _WCAP_ENCODE_
+
+#include <stdint.h>
+
+#include "wcap-decode.h"
+
+/* Delta-RLE encode the pixels of rect, read back bottom row first as
+ * glReadPixels returns them, against the shadow frame and update the
+ * shadow. Runs are written to p, which may point into src since the
+ * output never overtakes the pixel being read. Returns the new end of
+ * the run data. */
+uint32_t *wcap_encode_rectangle(uint32_t *p, const uint32_t *src,
+				uint32_t *frame, int stride,
+				const struct wcap_rectangle *rect);
+
+/* Scalar reference the vector kernels must match byte for byte */
+uint32_t *wcap_encode_rectangle_c(uint32_t *p, const uint32_t *src,
+				  uint32_t *frame, int stride,
+				  const struct wcap_rectangle *rect);
+
+/* Encode the rectangles of a frame, packed one after the other from p,
+ * in place against the shadow frame of width x height pixels, the size
+ * of the recording rather than of the screen. Keyframes start over
+ * from a black shadow. Returns the end of the run data. */
+uint32_t *wcap_encode_frame(uint32_t *p, uint32_t *frame,
+			    int width, int height,
+			    const struct wcap_rectangle *rects, int nrects,
+			    int keyframe);
+
+const char *wcap_encode_kernel(void);
+
+/* The kernels the CPU supports, numbered from 0 for the scalar
+ * reference, so tests and benchmarks can run each of them. The kernel
+ * wcap_encode_rectangle uses is the last one. */
+int wcap_encode_kernel_count(void);
+const char *wcap_encode_kernel_name(int kernel);
+uint32_t *wcap_encode_rectangle_kernel(int kernel, uint32_t *p,
+				       const uint32_t *src, uint32_t *frame,
+				       int stride,
+				       const struct wcap_rectangle *rect);
+
+#endif
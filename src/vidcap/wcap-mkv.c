@@ -0,0 +1,218 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "wcap-mkv.h"
+
+#define EBML_HEADER		0x1a45dfa3
+#define EBML_VERSION		0x4286
+#define EBML_READ_VERSION	0x42f7
+#define EBML_MAX_ID_LENGTH	0x42f2
+#define EBML_MAX_SIZE_LENGTH	0x42f3
+#define EBML_DOC_TYPE		0x4282
+#define EBML_DOC_TYPE_VERSION	0x4287
+#define EBML_DOC_TYPE_READ	0x4285
+
+#define MKV_SEGMENT		0x18538067
+#define MKV_INFO		0x1549a966
+#define MKV_TIMECODE_SCALE	0x2ad7b1
+#define MKV_MUXING_APP		0x4d80
+#define MKV_WRITING_APP		0x5741
+#define MKV_TRACKS		0x1654ae6b
+#define MKV_TRACK_ENTRY		0xae
+#define MKV_TRACK_NUMBER	0xd7
+#define MKV_TRACK_UID		0x73c5
+#define MKV_TRACK_TYPE		0x83
+#define MKV_CODEC_ID		0x86
+#define MKV_VIDEO		0xe0
+#define MKV_PIXEL_WIDTH		0xb0
+#define MKV_PIXEL_HEIGHT	0xba
+#define MKV_COLOUR_SPACE	0x2eb524
+#define MKV_CLUSTER		0x1f43b675
+#define MKV_TIMECODE		0xe7
+#define MKV_SIMPLE_BLOCK	0xa3
+
+/* Elements are built in a small buffer, frame data goes out as is */
+struct ebml {
+	unsigned char data[256];
+	int len;
+};
+
+static void
+ebml_bytes(struct ebml *e, const void *data, int len)
+{
+	memcpy(e->data + e->len, data, len);
+	e->len += len;
+}
+
+/* IDs carry their length marker already */
+static void
+ebml_id(struct ebml *e, uint32_t id)
+{
+	int shift;
+
+	for (shift = 24; shift > 0 && !(id >> shift); shift -= 8)
+		;
+	for (; shift >= 0; shift -= 8)
+		e->data[e->len++] = id >> shift;
+}
+
+/* Sizes always take 8 bytes, so they can be written before the
+ * element content is known. All ones means unknown. */
+static void
+ebml_size(struct ebml *e, uint64_t size)
+{
+	int shift;
+
+	e->data[e->len++] = 0x01;
+	for (shift = 48; shift >= 0; shift -= 8)
+		e->data[e->len++] = size >> shift;
+}
+
+static void
+ebml_uint(struct ebml *e, uint32_t id, uint64_t value)
+{
+	int shift;
+
+	for (shift = 56; shift > 0 && !(value >> shift); shift -= 8)
+		;
+	ebml_id(e, id);
+	e->data[e->len++] = 0x80 | (shift / 8 + 1);
+	for (; shift >= 0; shift -= 8)
+		e->data[e->len++] = value >> shift;
+}
+
+static void
+ebml_string(struct ebml *e, uint32_t id, const char *s)
+{
+	int len = strlen(s);
+
+	ebml_id(e, id);
+	e->data[e->len++] = 0x80 | len;
+	ebml_bytes(e, s, len);
+}
+
+/* Start a master element, returns where its size goes */
+static int
+ebml_start(struct ebml *e, uint32_t id)
+{
+	int pos;
+
+	ebml_id(e, id);
+	pos = e->len;
+	ebml_size(e, 0);
+
+	return pos;
+}
+
+static void
+ebml_end(struct ebml *e, int pos, uint64_t extra)
+{
+	int len = e->len;
+
+	e->len = pos;
+	ebml_size(e, len - pos - 8 + extra);
+	e->len = len;
+}
+
+static int
+ebml_write(struct ebml *e, FILE *f)
+{
+	return fwrite(e->data, 1, e->len, f) == e->len;
+}
+
+int
+wcap_mkv_write_header(FILE *f, int width, int height)
+{
+	struct ebml e;
+	int header, info, tracks, track, video;
+
+	e.len = 0;
+
+	header = ebml_start(&e, EBML_HEADER);
+	ebml_uint(&e, EBML_VERSION, 1);
+	ebml_uint(&e, EBML_READ_VERSION, 1);
+	ebml_uint(&e, EBML_MAX_ID_LENGTH, 4);
+	ebml_uint(&e, EBML_MAX_SIZE_LENGTH, 8);
+	ebml_string(&e, EBML_DOC_TYPE, "matroska");
+	ebml_uint(&e, EBML_DOC_TYPE_VERSION, 2);
+	ebml_uint(&e, EBML_DOC_TYPE_READ, 2);
+	ebml_end(&e, header, 0);
+
+	/* Streamed to a pipe, so the segment size is never known */
+	ebml_id(&e, MKV_SEGMENT);
+	ebml_size(&e, 0xffffffffffffffULL);
+
+	/* Timestamps in milliseconds, as recorded */
+	info = ebml_start(&e, MKV_INFO);
+	ebml_uint(&e, MKV_TIMECODE_SCALE, 1000000);
+	ebml_string(&e, MKV_MUXING_APP, "wcap");
+	ebml_string(&e, MKV_WRITING_APP, "wcap");
+	ebml_end(&e, info, 0);
+
+	tracks = ebml_start(&e, MKV_TRACKS);
+	track = ebml_start(&e, MKV_TRACK_ENTRY);
+	ebml_uint(&e, MKV_TRACK_NUMBER, 1);
+	ebml_uint(&e, MKV_TRACK_UID, 1);
+	ebml_uint(&e, MKV_TRACK_TYPE, 1);
+	ebml_string(&e, MKV_CODEC_ID, "V_UNCOMPRESSED");
+	video = ebml_start(&e, MKV_VIDEO);
+	ebml_uint(&e, MKV_PIXEL_WIDTH, width);
+	ebml_uint(&e, MKV_PIXEL_HEIGHT, height);
+	ebml_id(&e, MKV_COLOUR_SPACE);
+	e.data[e.len++] = 0x84;
+	ebml_bytes(&e, "I420", 4);
+	ebml_end(&e, video, 0);
+	ebml_end(&e, track, 0);
+	ebml_end(&e, tracks, 0);
+
+	return ebml_write(&e, f);
+}
+
+int
+wcap_mkv_write_frame(FILE *f, const unsigned char *yuv, int size,
+		     uint32_t msecs)
+{
+	/* Track 1, no offset from the cluster time, keyframe */
+	static const unsigned char block[] = { 0x81, 0x00, 0x00, 0x80 };
+	struct ebml e;
+	int cluster;
+
+	e.len = 0;
+
+	cluster = ebml_start(&e, MKV_CLUSTER);
+	ebml_uint(&e, MKV_TIMECODE, msecs);
+	ebml_id(&e, MKV_SIMPLE_BLOCK);
+	ebml_size(&e, sizeof (block) + size);
+	ebml_bytes(&e, block, sizeof (block));
+
+	/* The cluster also covers the frame data that follows */
+	ebml_end(&e, cluster, size);
+
+	return ebml_write(&e, f) && fwrite(yuv, 1, size, f) == size;
+}
@@ -0,0 +1,1133 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "wcap-compress.h"
+#include "wcap-corpus.h"
+#include "wcap-decode.h"
+#include "wcap-encode.h"
+#include "wcap-yuv.h"
+
+/* Checks every encode kernel the CPU supports against the scalar
+ * reference, byte for byte, on random frames, desktop-like and
+ * recorded frames, odd widths and several rectangles encoded in place
+ * the way the recorder does, then decodes what each kernel wrote.
+ * Recordings with keyframes are decoded in order and after seeking,
+ * with the index, without it and with damaged frame headers, and
+ * recordings of an area smaller than the screen. Compressed frames
+ * are checked when built with a codec, I420 planes either way. The
+ * threaded YUV conversion is checked against its scalar reference.
+ * Run by make check; set WCAP=file.wcap to add the frames of a
+ * recording. */
+
+#define MAX_RECTS 16
+
+struct test {
+	int width, height;
+	uint32_t *prev, *frame;
+
+	/* Packed rectangles, reference output and the two shadows */
+	uint32_t *src, *out, *buf, *shadow, *ref_shadow;
+};
+
+static uint32_t seed = 1;
+static int nchecks, failed;
+
+static uint32_t
+rnd(void)
+{
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+
+	return seed;
+}
+
+static int
+test_init(struct test *t, int width, int height)
+{
+	size_t npixels = (size_t) width * height;
+
+	t->width = width;
+	t->height = height;
+	t->prev = malloc(npixels * 4);
+	t->frame = malloc(npixels * 4);
+	t->src = malloc(npixels * MAX_RECTS * 4);
+	t->out = malloc((npixels + 1) * MAX_RECTS * 4);
+	t->buf = malloc(npixels * MAX_RECTS * 4);
+	t->shadow = malloc(npixels * 4);
+	t->ref_shadow = malloc(npixels * 4);
+
+	return t->prev && t->frame && t->src && t->out && t->buf &&
+	       t->shadow && t->ref_shadow;
+}
+
+static void
+test_fini(struct test *t)
+{
+	free(t->prev);
+	free(t->frame);
+	free(t->src);
+	free(t->out);
+	free(t->buf);
+	free(t->shadow);
+	free(t->ref_shadow);
+}
+
+/* Runs of a few colours with single channel changes, so the deltas
+ * form runs of every length. Where keep is set, pixels of prev are
+ * kept to give long runs of zero deltas. */
+static void
+random_frame(uint32_t *frame, const uint32_t *prev, int npixels, int keep)
+{
+	uint32_t v = rnd();
+	int i;
+
+	for (i = 0; i < npixels; i++) {
+		switch (rnd() % 16) {
+		case 0:
+			v = rnd();
+			break;
+		case 1:
+			v ^= rnd() & 0x00010101;
+			break;
+		case 2:
+			v ^= 0xff000000;
+			break;
+		}
+		frame[i] = keep && prev && (i / 97) % 3 ? prev[i] : v;
+	}
+}
+
+static void
+random_rect(struct wcap_rectangle *r, int width, int height)
+{
+	r->x1 = rnd() % width;
+	r->y1 = rnd() % height;
+	r->x2 = r->x1 + 1 + rnd() % (width - r->x1);
+	r->y2 = r->y1 + 1 + rnd() % (height - r->y1);
+}
+
+/* Encode the rectangles of t->frame against a shadow holding t->prev,
+ * with the reference from a separate buffer and with kernel in place,
+ * and compare the runs and the updated shadows. */
+static void
+check(struct test *t, int kernel, const char *what,
+      const struct wcap_rectangle *rects, int nrects)
+{
+	size_t npixels = (size_t) t->width * t->height, len;
+	uint32_t *s, *p, *q;
+	int i;
+
+	s = t->src;
+	for (i = 0; i < nrects; i++) {
+		wcap_corpus_pack_rectangle(s, t->frame, t->width, &rects[i]);
+		s += (rects[i].x2 - rects[i].x1) * (rects[i].y2 - rects[i].y1);
+	}
+	memcpy(t->buf, t->src, (s - t->src) * 4);
+	memcpy(t->shadow, t->prev, npixels * 4);
+	memcpy(t->ref_shadow, t->prev, npixels * 4);
+
+	s = t->src;
+	q = t->out;
+	for (i = 0; i < nrects; i++) {
+		q = wcap_encode_rectangle_c(q, s, t->ref_shadow, t->width,
+					    &rects[i]);
+		s += (rects[i].x2 - rects[i].x1) * (rects[i].y2 - rects[i].y1);
+	}
+
+	s = p = t->buf;
+	for (i = 0; i < nrects; i++) {
+		p = wcap_encode_rectangle_kernel(kernel, p, s, t->shadow,
+						 t->width, &rects[i]);
+		s += (rects[i].x2 - rects[i].x1) * (rects[i].y2 - rects[i].y1);
+	}
+
+	len = q - t->out;
+	nchecks++;
+	if (p - t->buf != len || memcmp(t->buf, t->out, len * 4) ||
+	    memcmp(t->shadow, t->ref_shadow, npixels * 4)) {
+		fprintf(stderr, "%s: %s mismatch at %dx%d, %d rectangles\n",
+			wcap_encode_kernel_name(kernel), what,
+			t->width, t->height, nrects);
+		failed = 1;
+	}
+}
+
+static void
+check_full(struct test *t, int kernel, const char *what)
+{
+	struct wcap_rectangle rect = { 0, 0, t->width, t->height };
+
+	check(t, kernel, what, &rect, 1);
+}
+
+static void
+check_random(int kernel, int width, int height)
+{
+	struct wcap_rectangle rects[MAX_RECTS];
+	struct test t;
+	size_t npixels = (size_t) width * height;
+	int i, j, n;
+
+	if (!test_init(&t, width, height)) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	random_frame(t.prev, NULL, npixels, 0);
+	random_frame(t.frame, t.prev, npixels, 0);
+	check_full(&t, kernel, "random");
+
+	random_frame(t.frame, t.prev, npixels, 1);
+	check_full(&t, kernel, "random partly unchanged");
+
+	memcpy(t.frame, t.prev, npixels * 4);
+	check_full(&t, kernel, "unchanged");
+
+	/* Several rectangles, overlapping at times, encoded in place */
+	for (i = 0; i < 8; i++) {
+		random_frame(t.frame, t.prev, npixels, i & 1);
+		n = 1 + rnd() % MAX_RECTS;
+		for (j = 0; j < n; j++)
+			random_rect(&rects[j], width, height);
+		check(&t, kernel, "multiple rectangles", rects, n);
+	}
+
+	test_fini(&t);
+}
+
+/* Consecutive frames of the corpus, in full and as the damage of the
+ * moving window */
+static void
+check_corpus(int kernel, const char *what, uint32_t **frames,
+	     int width, int height, int nframes)
+{
+	struct wcap_rectangle rects[4];
+	struct test t;
+	size_t npixels = (size_t) width * height;
+	int n;
+
+	if (!test_init(&t, width, height)) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	memset(t.prev, 0, npixels * 4);
+	for (n = 0; n < nframes; n++) {
+		memcpy(t.frame, frames[n], npixels * 4);
+		check_full(&t, kernel, what);
+
+		rects[0].x1 = 0;
+		rects[0].y1 = 0;
+		rects[0].x2 = width / 2 + 1;
+		rects[0].y2 = height / 3;
+		rects[1].x1 = width / 3;
+		rects[1].y1 = height / 3;
+		rects[1].x2 = width;
+		rects[1].y2 = height;
+		check(&t, kernel, what, rects, 2);
+
+		memcpy(t.prev, frames[n], npixels * 4);
+	}
+
+	test_fini(&t);
+}
+
+/* Pack the rectangles of t->frame to p and encode them in place
+ * against t->shadow, the way the recorder writes a frame. Returns the
+ * end of the runs. */
+static uint32_t *
+encode_rects(struct test *t, int kernel, uint32_t *p,
+	     const struct wcap_rectangle *rects, int nrects)
+{
+	uint32_t *s = p;
+	int i;
+
+	for (i = 0; i < nrects; i++) {
+		wcap_corpus_pack_rectangle(s, t->frame, t->width, &rects[i]);
+		s += (rects[i].x2 - rects[i].x1) * (rects[i].y2 - rects[i].y1);
+	}
+
+	s = p;
+	for (i = 0; i < nrects; i++) {
+		p = wcap_encode_rectangle_kernel(kernel, p, s, t->shadow,
+						 t->width, &rects[i]);
+		s += (rects[i].x2 - rects[i].x1) * (rects[i].y2 - rects[i].y1);
+	}
+
+	return p;
+}
+
+/* Encode a run of random frames, damaged in random rectangles, into a
+ * stream and check the decoder reproduces the encoder's shadow frame */
+static void
+check_decode(int kernel, int width, int height)
+{
+	struct wcap_rectangle *rects;
+	struct wcap_frame_header *fh;
+	struct wcap_header header;
+	struct wcap_decoder *decoder;
+	struct test t;
+	size_t npixels = (size_t) width * height, len = 0, alloc;
+	uint32_t *stream, *shadows, *p, *s;
+	int i, n, nframes = 12;
+
+	alloc = nframes * (sizeof *fh + MAX_RECTS * sizeof *rects +
+			   npixels * MAX_RECTS * 4);
+	stream = malloc(alloc);
+	shadows = malloc(nframes * npixels * 4);
+	if (!test_init(&t, width, height) || !stream || !shadows) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	memset(t.shadow, 0, npixels * 4);
+	memset(t.frame, 0, npixels * 4);
+	for (n = 0; n < nframes; n++) {
+		memcpy(t.prev, t.frame, npixels * 4);
+		random_frame(t.frame, t.prev, npixels, n & 1);
+
+		fh = (void *) ((char *) stream + len);
+		fh->msecs = n * 1000 / 30;
+		fh->nrects = n ? 1 + rnd() % MAX_RECTS : 1;
+		rects = (void *) (fh + 1);
+		for (i = 0; i < fh->nrects; i++)
+			random_rect(&rects[i], width, height);
+		if (!n) {
+			rects[0].x1 = rects[0].y1 = 0;
+			rects[0].x2 = width;
+			rects[0].y2 = height;
+		}
+
+		p = encode_rects(&t, kernel, (uint32_t *) (rects + fh->nrects),
+				 rects, fh->nrects);
+		len = (char *) p - (char *) stream;
+
+		/* Keep the shadow of each frame to compare with */
+		memcpy(shadows + npixels * n, t.shadow, npixels * 4);
+	}
+
+	header.magic = WCAP_HEADER_MAGIC;
+	header.format = WCAP_FORMAT_XBGR8888;
+	header.width = width;
+	header.height = height;
+	decoder = wcap_decoder_create_stream(&header, 0);
+	if (!decoder) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	wcap_decoder_set_data(decoder, stream, len);
+
+	nchecks++;
+	for (n = 0; wcap_decoder_get_frame(decoder); n++) {
+		s = shadows + npixels * n;
+		for (i = 0; i < npixels && n < nframes; i++)
+			if ((decoder->frame[i] ^ s[i]) & 0xffffff)
+				break;
+		if (i < npixels) {
+			fprintf(stderr, "%s: decode mismatch at %dx%d, "
+				"frame %d\n", wcap_encode_kernel_name(kernel),
+				width, height, n);
+			failed = 1;
+			break;
+		}
+	}
+	if (!failed && n != nframes) {
+		fprintf(stderr, "%s: decoded %d of %d frames at %dx%d\n",
+			wcap_encode_kernel_name(kernel), n, nframes,
+			width, height);
+		failed = 1;
+	}
+
+	wcap_decoder_destroy(decoder);
+	free(stream);
+	free(shadows);
+	test_fini(&t);
+}
+
+/* Damage the way the recorder reports it: up to MAX_RECTS rectangles,
+ * aligned to align_x x align_y, or their extents when they add up to
+ * more than the frame, so the data of a frame never outgrows it */
+static int
+random_damage(struct wcap_rectangle *rects, int width, int height,
+	      int align_x, int align_y)
+{
+	struct wcap_rectangle *r, e;
+	size_t total = 0;
+	int i, n = 1 + rnd() % MAX_RECTS;
+
+	for (i = 0; i < n; i++) {
+		r = &rects[i];
+		random_rect(r, width, height);
+		r->x1 -= r->x1 % align_x;
+		r->y1 -= r->y1 % align_y;
+		r->x2 += (align_x - r->x2 % align_x) % align_x;
+		r->y2 += (align_y - r->y2 % align_y) % align_y;
+		total += (size_t) (r->x2 - r->x1) * (r->y2 - r->y1);
+	}
+
+	if (total <= (size_t) width * height)
+		return n;
+
+	e = rects[0];
+	for (i = 1; i < n; i++) {
+		e.x1 = rects[i].x1 < e.x1 ? rects[i].x1 : e.x1;
+		e.y1 = rects[i].y1 < e.y1 ? rects[i].y1 : e.y1;
+		e.x2 = rects[i].x2 > e.x2 ? rects[i].x2 : e.x2;
+		e.y2 = rects[i].y2 > e.y2 ? rects[i].y2 : e.y2;
+	}
+	rects[0] = e;
+
+	return 1;
+}
+
+/* A recording in the keyframe container, the way the recorder writes
+ * it: frames of random damage, a keyframe every KEY_INTERVAL frames and
+ * the index after the last frame */
+
+#define KEY_INTERVAL 5
+
+struct stream {
+	int width, height, nframes;
+	char *data;
+	size_t len;		/* up to the end of the last frame */
+	size_t size;		/* with the index, when there is one */
+	struct wcap_index_entry *index;
+	uint32_t *shadows;	/* the frame after each frame */
+};
+
+/* Record the area of width x height pixels at x, y of a screen of
+ * screen_width x screen_height, whose shadow frame is the size of the
+ * area, and encode each frame through wcap_encode_frame(). With a
+ * compressor, frames that shrink are stored compressed. */
+static void
+stream_write_area(struct stream *st, int screen_width, int screen_height,
+		  int x, int y, int width, int height, int nframes,
+		  struct wcap_compressor *c)
+{
+	struct wcap_header *header;
+	struct wcap_header_ext *ext;
+	struct wcap_frame_header_ext *fh;
+	struct wcap_rectangle *rects;
+	struct wcap_index_trailer trailer;
+	struct test t;
+	size_t npixels = (size_t) width * height, alloc;
+	size_t nscreen = (size_t) screen_width * screen_height;
+	size_t packed_size = wcap_compress_bound(npixels * MAX_RECTS * 4), len;
+	uint32_t *screen, *prev, *p, *s;
+	void *packed;
+	int i, n;
+
+	alloc = sizeof *header + sizeof *ext +
+		nframes * (sizeof *fh + MAX_RECTS * sizeof *rects +
+			   npixels * MAX_RECTS * 4 + sizeof *st->index) +
+		sizeof trailer;
+	st->data = malloc(alloc);
+	st->index = malloc(nframes * sizeof *st->index);
+	st->shadows = malloc(nframes * npixels * 4);
+	screen = malloc(nscreen * 4);
+	prev = malloc(nscreen * 4);
+	packed = malloc(packed_size);
+	if (!test_init(&t, width, height) || !st->data || !st->index ||
+	    !st->shadows || !screen || !prev || !packed) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	st->width = width;
+	st->height = height;
+	st->nframes = nframes;
+
+	header = (void *) st->data;
+	header->magic = WCAP_HEADER_MAGIC_EXT;
+	header->format = WCAP_FORMAT_XBGR8888;
+	header->width = width;
+	header->height = height;
+	ext = (void *) (header + 1);
+	ext->flags = WCAP_HEADER_KEYFRAMES;
+	ext->reserved = 0;
+	st->len = sizeof *header + sizeof *ext;
+
+	memset(screen, 0, nscreen * 4);
+	for (n = 0; n < nframes; n++) {
+		memcpy(prev, screen, nscreen * 4);
+		random_frame(screen, prev, nscreen, n & 1);
+		for (i = 0; i < height; i++)
+			memcpy(t.frame + width * i,
+			       screen + screen_width * (y + i) + x, width * 4);
+
+		fh = (void *) (st->data + st->len);
+		fh->msecs = n * 1000 / 30;
+		fh->flags = n % KEY_INTERVAL ? 0 : WCAP_FRAME_KEYFRAME;
+		rects = (void *) (fh + 1);
+
+		/* Keyframes cover the whole area */
+		if (fh->flags & WCAP_FRAME_KEYFRAME) {
+			fh->nrects = 1;
+			rects[0].x1 = rects[0].y1 = 0;
+			rects[0].x2 = width;
+			rects[0].y2 = height;
+		} else {
+			fh->nrects = random_damage(rects, width, height, 1, 1);
+		}
+
+		p = s = (uint32_t *) (rects + fh->nrects);
+		for (i = 0; i < fh->nrects; i++) {
+			wcap_corpus_pack_rectangle(s, t.frame, width,
+						   &rects[i]);
+			s += (rects[i].x2 - rects[i].x1) *
+			     (rects[i].y2 - rects[i].y1);
+		}
+		p = wcap_encode_frame(p, t.shadow, width, height,
+				      rects, fh->nrects,
+				      fh->flags & WCAP_FRAME_KEYFRAME);
+		fh->size = (char *) p - (char *) (rects + fh->nrects);
+
+		st->index[n].msecs = fh->msecs;
+		st->index[n].flags = fh->flags;
+		st->index[n].offset = st->len;
+
+		s = (uint32_t *) (rects + fh->nrects);
+		len = wcap_compress(c, packed, packed_size, s, fh->size);
+		if (len) {
+			memcpy(s, packed, len);
+			fh->size = len;
+			fh->flags |= wcap_compress_codec();
+			p = (uint32_t *) ((char *) s + len);
+		}
+		st->len = (char *) p - st->data;
+
+		memcpy(st->shadows + npixels * n, t.shadow, npixels * 4);
+	}
+
+	memcpy(st->data + st->len, st->index, nframes * sizeof *st->index);
+	trailer.offset = st->len;
+	trailer.count = nframes;
+	trailer.magic = WCAP_INDEX_MAGIC;
+	memcpy(st->data + st->len + nframes * sizeof *st->index,
+	       &trailer, sizeof trailer);
+	st->size = st->len + nframes * sizeof *st->index + sizeof trailer;
+
+	free(screen);
+	free(prev);
+	free(packed);
+	test_fini(&t);
+}
+
+static void
+stream_write(struct stream *st, int width, int height, int nframes)
+{
+	stream_write_area(st, width, height, 0, 0, width, height, nframes,
+			  NULL);
+}
+
+static void
+stream_fini(struct stream *st)
+{
+	free(st->data);
+	free(st->index);
+	free(st->shadows);
+}
+
+/* wcap_decoder_create() maps a file, so go through one */
+static struct wcap_decoder *
+stream_decoder(const void *data, size_t size)
+{
+	struct wcap_decoder *decoder;
+	char name[] = "wcap-test-XXXXXX";
+	int fd;
+
+	fd = mkstemp(name);
+	if (fd == -1 || write(fd, data, size) != (ssize_t) size) {
+		fprintf(stderr, "could not write %s\n", name);
+		exit(EXIT_FAILURE);
+	}
+	close(fd);
+
+	decoder = wcap_decoder_create(name);
+	unlink(name);
+	if (!decoder) {
+		fprintf(stderr, "could not decode %s\n", name);
+		exit(EXIT_FAILURE);
+	}
+
+	return decoder;
+}
+
+/* Decode frames first up to last and compare each with the frame the
+ * encoder had; stops at the first mismatch */
+static int
+stream_decode(struct stream *st, struct wcap_decoder *decoder,
+	      int first, int last, const char *what)
+{
+	size_t npixels = (size_t) st->width * st->height, i;
+	uint32_t *s;
+	int n;
+
+	for (n = first; n < last; n++) {
+		if (!wcap_decoder_get_frame(decoder)) {
+			fprintf(stderr, "%s: frame %d of %dx%d missing\n",
+				what, n, st->width, st->height);
+			return 0;
+		}
+
+		s = st->shadows + npixels * n;
+		for (i = 0; i < npixels; i++)
+			if ((decoder->frame[i] ^ s[i]) & 0xffffff)
+				break;
+		if (i < npixels || decoder->msecs != st->index[n].msecs) {
+			fprintf(stderr, "%s: frame %d of %dx%d differs\n",
+				what, n, st->width, st->height);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static void
+stream_check(int ok)
+{
+	nchecks++;
+	if (!ok)
+		failed = 1;
+}
+
+/* Decode the stream in order and from each keyframe after seeking to
+ * it, or to a time in the frames that follow it */
+static void
+check_seek(int width, int height)
+{
+	struct wcap_decoder *decoder;
+	struct stream st;
+	int n, next, nframes = 3 * KEY_INTERVAL + 2;
+
+	stream_write(&st, width, height, nframes);
+	decoder = stream_decoder(st.data, st.size);
+
+	stream_check(decoder->index_count == nframes);
+	stream_check(stream_decode(&st, decoder, 0, nframes, "decode"));
+	stream_check(!wcap_decoder_get_frame(decoder));
+
+	for (n = 0; n < nframes; n += KEY_INTERVAL) {
+		next = n + KEY_INTERVAL < nframes ? n + KEY_INTERVAL : nframes;
+
+		stream_check(wcap_decoder_seek(decoder, st.index[n].msecs) &&
+			     stream_decode(&st, decoder, n, next, "seek"));
+		stream_check(wcap_decoder_seek(decoder,
+					       st.index[next - 1].msecs) &&
+			     stream_decode(&st, decoder, n, nframes,
+					   "seek between keyframes"));
+	}
+
+	wcap_decoder_destroy(decoder);
+	stream_fini(&st);
+}
+
+/* A recording cut short has no index, one cut in the middle of a frame
+ * a partial last frame; the index is rebuilt from the whole frames */
+static void
+check_truncated(int width, int height)
+{
+	struct wcap_decoder *decoder;
+	struct stream st;
+	int nframes = 2 * KEY_INTERVAL + 3, cut = nframes - 1;
+
+	stream_write(&st, width, height, nframes);
+
+	decoder = stream_decoder(st.data, st.len);
+	stream_check(decoder->index_count == nframes &&
+		     stream_decode(&st, decoder, 0, nframes, "no index"));
+	wcap_decoder_destroy(decoder);
+
+	decoder = stream_decoder(st.data, st.index[cut].offset +
+				 sizeof (struct wcap_frame_header_ext) + 4);
+	stream_check(decoder->index_count == cut &&
+		     stream_decode(&st, decoder, 0, cut, "truncated") &&
+		     !wcap_decoder_get_frame(decoder));
+	stream_check(wcap_decoder_seek(decoder, UINT32_MAX) &&
+		     stream_decode(&st, decoder, 2 * KEY_INTERVAL, cut,
+				   "seek truncated"));
+	wcap_decoder_destroy(decoder);
+
+	stream_fini(&st);
+}
+
+/* Each header that cannot start a frame stops the rebuild of the
+ * index, and decoding, right before it */
+static void
+check_corrupt(int width, int height)
+{
+	static const char *what[] = {
+		"flags", "msecs", "size", "nrects", "rectangle"
+	};
+	struct wcap_frame_header_ext *fh;
+	struct wcap_rectangle *rect;
+	struct wcap_decoder *decoder;
+	struct stream st;
+	char *data;
+	int i, nframes = 2 * KEY_INTERVAL + 3, bad = KEY_INTERVAL + 2;
+
+	stream_write(&st, width, height, nframes);
+	data = malloc(st.len);
+	if (!data) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < sizeof what / sizeof what[0]; i++) {
+		memcpy(data, st.data, st.len);
+		fh = (void *) (data + st.index[bad].offset);
+		rect = (void *) (fh + 1);
+
+		switch (i) {
+		case 0:
+			fh->flags |= 1 << 7;
+			break;
+		case 1:
+			fh->msecs = st.index[bad - 1].msecs - 1;
+			break;
+		case 2:
+			fh->size -= 2;
+			break;
+		case 3:
+			fh->nrects = UINT32_MAX;
+			break;
+		case 4:
+			rect->x2 = width + 1;
+			break;
+		}
+
+		decoder = stream_decoder(data, st.len);
+		nchecks++;
+		if (decoder->index_count != bad ||
+		    !stream_decode(&st, decoder, 0, bad, what[i]) ||
+		    wcap_decoder_get_frame(decoder)) {
+			fprintf(stderr, "corrupt %s: rebuilt %u frames, "
+				"expected %d\n", what[i],
+				decoder->index_count, bad);
+			failed = 1;
+		}
+		wcap_decoder_destroy(decoder);
+	}
+
+	free(data);
+	stream_fini(&st);
+}
+
+/* The threaded conversion against the scalar reference, with and
+ * without workers. Frames have even sizes, chroma covers 2x2 pixels. */
+/* A window or region recording: the frames, keyframes included, are
+ * the size of the area, not of the screen it is cut from */
+static void
+check_area(int x, int y, int width, int height)
+{
+	struct wcap_decoder *decoder;
+	struct stream st;
+	int nframes = 2 * KEY_INTERVAL + 1;
+
+	stream_write_area(&st, 97, 61, x, y, width, height, nframes, NULL);
+	decoder = stream_decoder(st.data, st.size);
+
+	stream_check(decoder->width == width && decoder->height == height);
+	stream_check(stream_decode(&st, decoder, 0, nframes, "area"));
+	stream_check(wcap_decoder_seek(decoder, st.index[KEY_INTERVAL].msecs) &&
+		     stream_decode(&st, decoder, KEY_INTERVAL, nframes,
+				   "area seek"));
+
+	wcap_decoder_destroy(decoder);
+	stream_fini(&st);
+}
+
+/* wcap_compress() writes the header and the compressed data padded
+ * with zeroes to 4 bytes, and wcap_decompress() gives the run data
+ * back; short buffers, data cut short and the wrong codec are refused,
+ * and noise is left to be stored as it is */
+static void
+check_compress_data(struct wcap_compressor *c, size_t size)
+{
+	uint32_t codec = wcap_compress_codec();
+	struct wcap_compressed header;
+	size_t bound = wcap_compress_bound(size), len, i;
+	uint32_t *src, *out;
+	unsigned char *packed;
+	int ok;
+
+	src = malloc(size);
+	out = malloc(size);
+	packed = malloc(bound);
+	if (!src || !out || !packed) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* Short runs of a few values, like run data */
+	for (i = 0; i < size / 4; i++)
+		src[i] = (i / 3 + (rnd() & 1)) % 5 * 0x01010101;
+
+	len = wcap_compress(c, packed, bound, src, size);
+	memcpy(&header, packed, sizeof header);
+	ok = len && !(len & 3) && len < size && header.size == size &&
+	     header.compressed <= len - sizeof header &&
+	     len - sizeof header - header.compressed < 4;
+	for (i = sizeof header + header.compressed; ok && i < len; i++)
+		ok = !packed[i];
+	ok = ok && wcap_decompress(codec, out, size, packed, len) == size &&
+	     !memcmp(out, src, size);
+	if (!ok)
+		fprintf(stderr, "%s: %zu bytes do not come back\n",
+			wcap_compress_name(codec), size);
+	stream_check(ok);
+
+	stream_check(!wcap_compress(c, packed, bound - 1, src, size));
+	stream_check(!wcap_decompress(codec, out, size - 4, packed, len));
+	stream_check(!wcap_decompress(codec, out, size, packed,
+				      sizeof header + header.compressed - 1));
+	stream_check(!wcap_decompress(codec ^ WCAP_FRAME_COMPRESSED,
+				      out, size, packed, len));
+
+	for (i = 0; i < size / 4; i++)
+		src[i] = rnd();
+	stream_check(!wcap_compress(c, packed, bound, src, size));
+
+	free(src);
+	free(out);
+	free(packed);
+}
+
+/* A recording with compressed frames decodes in order and after a
+ * seek, like one without. Returns how many frames shrank, which tiny
+ * ones do not. */
+static int
+check_compress_stream(struct wcap_compressor *c, int width, int height)
+{
+	struct wcap_decoder *decoder;
+	struct wcap_frame_header_ext *fh;
+	struct stream st;
+	int n, compressed = 0, nframes = 2 * KEY_INTERVAL + 1;
+
+	stream_write_area(&st, width, height, 0, 0, width, height, nframes, c);
+	for (n = 0; n < nframes; n++) {
+		fh = (void *) (st.data + st.index[n].offset);
+		if (fh->flags & wcap_compress_codec())
+			compressed++;
+	}
+	decoder = stream_decoder(st.data, st.size);
+
+	stream_check(stream_decode(&st, decoder, 0, nframes, "compressed"));
+	stream_check(wcap_decoder_seek(decoder, st.index[KEY_INTERVAL].msecs) &&
+		     stream_decode(&st, decoder, KEY_INTERVAL, nframes,
+				   "compressed seek"));
+
+	wcap_decoder_destroy(decoder);
+	stream_fini(&st);
+
+	return compressed;
+}
+
+/* Write the Y, Cb and Cr rows of rect one plane after the other, the
+ * way the recorder reads them back, and into the decoded frame ref */
+static unsigned char *
+write_planes(unsigned char *p, unsigned char *ref, int width, int height,
+	     const struct wcap_rectangle *rect, int n)
+{
+	int plane, x, y, shift;
+
+	for (plane = 0; plane < 3; plane++) {
+		shift = plane ? 1 : 0;
+		for (y = rect->y1 >> shift; y < rect->y2 >> shift; y++)
+			for (x = rect->x1 >> shift; x < rect->x2 >> shift; x++) {
+				*p = (x / 4 * 3 + y + n * 5 + plane * 64 +
+				      (rnd() % 8 == 0)) & 0xff;
+				ref[(width >> shift) * y + x] = *p++;
+			}
+		ref += (size_t) (width >> shift) * (height >> shift);
+	}
+
+	return p;
+}
+
+/* A WCAP_FORMAT_I420 recording, its planes damaged in rectangles
+ * aligned to 8 x 2 like the recorder's, with keyframes and without an
+ * index. Frames that shrink are compressed when there is a compressor.
+ * Returns how many were. */
+static int
+check_planes(struct wcap_compressor *c, int width, int height)
+{
+	struct wcap_header *header;
+	struct wcap_header_ext *ext;
+	struct wcap_frame_header_ext *fh;
+	struct wcap_rectangle *rects;
+	struct wcap_decoder *decoder;
+	size_t fsize = (size_t) width * height * 3 / 2, len, size, alloc;
+	size_t packed_size = wcap_compress_bound(fsize * MAX_RECTS);
+	unsigned char *data, *refs, *ref, *planes, *packed, *p;
+	int i, n, compressed = 0, nframes = 2 * KEY_INTERVAL + 1;
+
+	alloc = sizeof *header + sizeof *ext +
+		nframes * (sizeof *fh + MAX_RECTS * sizeof *rects +
+			   fsize * MAX_RECTS);
+	data = malloc(alloc);
+	refs = malloc(nframes * fsize);
+	planes = malloc(fsize * MAX_RECTS);
+	packed = malloc(packed_size);
+	if (!data || !refs || !planes || !packed) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	header = (void *) data;
+	header->magic = WCAP_HEADER_MAGIC_EXT;
+	header->format = WCAP_FORMAT_I420;
+	header->width = width;
+	header->height = height;
+	ext = (void *) (header + 1);
+	ext->flags = WCAP_HEADER_KEYFRAMES;
+	ext->reserved = 0;
+	len = sizeof *header + sizeof *ext;
+
+	for (n = 0; n < nframes; n++) {
+		ref = refs + fsize * n;
+		if (n)
+			memcpy(ref, ref - fsize, fsize);
+
+		fh = (void *) (data + len);
+		fh->msecs = n * 1000 / 30;
+		fh->flags = n % KEY_INTERVAL ? 0 : WCAP_FRAME_KEYFRAME;
+		rects = (void *) (fh + 1);
+
+		if (fh->flags & WCAP_FRAME_KEYFRAME) {
+			fh->nrects = 1;
+			rects[0].x1 = rects[0].y1 = 0;
+			rects[0].x2 = width;
+			rects[0].y2 = height;
+		} else {
+			fh->nrects = random_damage(rects, width, height, 8, 2);
+		}
+
+		p = planes;
+		for (i = 0; i < fh->nrects; i++)
+			p = write_planes(p, ref, width, height, &rects[i], n);
+		size = p - planes;
+
+		p = (unsigned char *) (rects + fh->nrects);
+		fh->size = wcap_compress(c, packed, packed_size, planes, size);
+		if (fh->size) {
+			memcpy(p, packed, fh->size);
+			fh->flags |= wcap_compress_codec();
+		} else {
+			memcpy(p, planes, size);
+			fh->size = size;
+		}
+		len = p + fh->size - data;
+	}
+
+	decoder = stream_decoder(data, len);
+	for (n = 0; n < nframes; n++) {
+		if (!wcap_decoder_get_frame(decoder) ||
+		    memcmp(decoder->frame, refs + fsize * n, fsize)) {
+			fprintf(stderr, "i420: frame %d of %dx%d differs\n",
+				n, width, height);
+			break;
+		}
+		if (decoder->frame_flags & WCAP_FRAME_COMPRESSED)
+			compressed++;
+	}
+	stream_check(n == nframes);
+
+	wcap_decoder_destroy(decoder);
+	free(data);
+	free(refs);
+	free(planes);
+	free(packed);
+
+	return compressed;
+}
+
+static void
+check_yuv(struct wcap_yuv_pool **pools, int npools, int width, int height)
+{
+	size_t npixels = (size_t) width * height, size = npixels * 3 / 2;
+	unsigned char *out, *ref;
+	uint32_t *frame;
+	int i;
+
+	frame = malloc(npixels * 4);
+	out = malloc(size);
+	ref = malloc(size);
+	if (!frame || !out || !ref) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	random_frame(frame, NULL, npixels, 0);
+	wcap_convert_to_yv12_c(frame, width, height, ref);
+
+	for (i = 0; i < npools; i++) {
+		memset(out, 0, size);
+		wcap_convert_to_yv12(pools[i], frame, width, height, out);
+		nchecks++;
+		if (memcmp(out, ref, size)) {
+			fprintf(stderr, "yuv mismatch at %dx%d, pool %d\n",
+				width, height, i);
+			failed = 1;
+		}
+	}
+
+	free(frame);
+	free(out);
+	free(ref);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const int sizes[][2] = {
+		{ 1, 1 }, { 3, 5 }, { 17, 9 }, { 31, 31 }, { 641, 7 },
+		{ 1920, 4 }, { 250, 250 }
+	};
+	static const int yuv_sizes[][2] = {
+		{ 2, 40 }, { 6, 98 }, { 642, 6 }, { 1366, 768 }, { 1920, 1080 }
+	};
+	static const int plane_sizes[][2] = {
+		{ 8, 2 }, { 64, 48 }, { 648, 6 }, { 320, 200 }
+	};
+	struct wcap_compressor *compressor;
+	struct wcap_yuv_pool *pools[2];
+	const char *filename = getenv("WCAP");
+	uint32_t **synth, **recorded = NULL;
+	int k, i, width, height, nsynth = 12, nrecorded = 8, compressed;
+	int synth_width = 643, synth_height = 361;
+	int rec_width, rec_height;
+
+	synth = wcap_corpus_load(NULL, &synth_width, &synth_height, &nsynth);
+	if (!synth) {
+		fprintf(stderr, "out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	if (filename && *filename) {
+		recorded = wcap_corpus_load(filename, &rec_width, &rec_height,
+					    &nrecorded);
+		if (!recorded)
+			return EXIT_FAILURE;
+	}
+
+	for (k = 0; k < wcap_encode_kernel_count(); k++) {
+		nchecks = 0;
+
+		/* Every width up to a few blocks of the widest kernel, to
+		 * cover each tail length */
+		for (width = 1; width <= 70; width++)
+			check_random(k, width, 3);
+		for (height = 1; height <= 4; height++)
+			check_random(k, 1, height);
+
+		for (i = 0; i < sizeof sizes / sizeof sizes[0]; i++)
+			check_random(k, sizes[i][0], sizes[i][1]);
+
+		check_corpus(k, "desktop", synth,
+			     synth_width, synth_height, nsynth);
+		if (recorded)
+			check_corpus(k, filename, recorded,
+				     rec_width, rec_height, nrecorded);
+
+		for (i = 0; i < sizeof sizes / sizeof sizes[0]; i++)
+			check_decode(k, sizes[i][0], sizes[i][1]);
+
+		printf("%-5s %d checks against c\n",
+		       wcap_encode_kernel_name(k), nchecks);
+	}
+
+	/* Keyframes, the index and its rebuild */
+	nchecks = 0;
+	for (i = 0; i < sizeof sizes / sizeof sizes[0]; i++) {
+		check_seek(sizes[i][0], sizes[i][1]);
+		check_truncated(sizes[i][0], sizes[i][1]);
+		check_corrupt(sizes[i][0], sizes[i][1]);
+	}
+	check_area(13, 7, 65, 43);
+	check_area(0, 60, 97, 1);
+	check_area(96, 0, 1, 61);
+	printf("index %d checks\n", nchecks);
+
+	/* Compressed frames when there is a codec, I420 planes either way */
+	compressor = wcap_compressor_create();
+	nchecks = 0;
+	if (compressor) {
+		check_compress_data(compressor, 64);
+		check_compress_data(compressor, 4 * 1001);
+		check_compress_data(compressor, 1 << 20);
+		for (i = compressed = 0; i < sizeof sizes / sizeof sizes[0]; i++)
+			compressed += check_compress_stream(compressor,
+							    sizes[i][0],
+							    sizes[i][1]);
+		stream_check(compressed > 0);
+		printf("%-5s %d checks\n",
+		       wcap_compress_name(wcap_compress_codec()), nchecks);
+	} else {
+		printf("built without LZ4 or zstd, compression not checked\n");
+	}
+
+	nchecks = 0;
+	for (i = compressed = 0; i < sizeof plane_sizes / sizeof plane_sizes[0];
+	     i++)
+		compressed += check_planes(compressor, plane_sizes[i][0],
+					   plane_sizes[i][1]);
+	stream_check(compressor ? compressed > 0 : !compressed);
+	printf("i420  %d checks\n", nchecks);
+	wcap_compressor_destroy(compressor);
+
+	pools[0] = wcap_yuv_pool_create(0);
+	pools[1] = wcap_yuv_pool_create(3);
+	if (!pools[0] || !pools[1]) {
+		fprintf(stderr, "out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	/* Every even width up to a few SSE2 blocks */
+	nchecks = 0;
+	for (width = 2; width <= 40; width += 2)
+		check_yuv(pools, 2, width, 2);
+	for (i = 0; i < sizeof yuv_sizes / sizeof yuv_sizes[0]; i++)
+		check_yuv(pools, 2, yuv_sizes[i][0], yuv_sizes[i][1]);
+	printf("yuv   %d checks against c\n", nchecks);
+
+	wcap_yuv_pool_destroy(pools[0]);
+	wcap_yuv_pool_destroy(pools[1]);
+
+	wcap_corpus_free(synth, nsynth);
+	if (recorded)
+		wcap_corpus_free(recorded, nrecorded);
+
+	printf("%s\n", failed ? "FAILED" : "ok");
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
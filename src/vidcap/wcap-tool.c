@@ -0,0 +1,715 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "wcap-corpus.h"
+#include "wcap-decode.h"
+#include "wcap-encode.h"
+#include "wcap-compress.h"
+#include "wcap-yuv.h"
+#include "wcap-y4m.h"
+
+/* Command line front end to the wcap codec, so recordings can be
+ * converted and the codec measured without a running compositor. */
+
+static void
+usage(void)
+{
+	uint32_t codec = wcap_compress_codec();
+	char compress[64];
+
+	if (codec)
+		snprintf(compress, sizeof compress,
+			 "-z compresses frames with %s.",
+			 wcap_compress_name(codec));
+	else
+		snprintf(compress, sizeof compress,
+			 "-z is unavailable, built without LZ4 or zstd.");
+
+	fprintf(stderr,
+		"usage: wcap-tool encode [-k SECONDS] [-r RATE] [-z] WIDTHxHEIGHT RAW WCAP\n"
+		"       wcap-tool decode [-r RATE | -v] [-j THREADS] WCAP [OUT]\n"
+		"       wcap-tool stats WCAP\n"
+		"       wcap-tool bench [-s WIDTHxHEIGHT] [-n FRAMES] [WCAP]\n"
+		"\n"
+		"RAW holds packed 32 bit frames, bytes in R, G, B, X order and the\n"
+		"top row first (ffmpeg -pix_fmt rgb0). A file name of - reads\n"
+		"stdin or writes stdout. %s\n"
+		"decode writes Y4M at a constant RATE, or with -v Matroska with\n"
+		"the frames that changed at their recorded times.\n",
+		compress);
+	exit(EXIT_FAILURE);
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+parse_size(const char *s, int *width, int *height)
+{
+	return sscanf(s, "%dx%d", width, height) == 2 &&
+	       *width > 0 && *height > 0;
+}
+
+static int
+nprocs(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n > 1 ? n : 1;
+}
+
+static int
+encode(int argc, char **argv)
+{
+	struct wcap_header header;
+	struct wcap_header_ext ext;
+	struct wcap_frame_header_ext fh;
+	struct wcap_frame_header legacy;
+	struct wcap_rectangle rect;
+	struct wcap_index_entry *index = NULL;
+	struct wcap_index_trailer trailer;
+	struct wcap_compressor *compressor = NULL;
+	uint32_t *in, *prev, *tmp, *shadow, *buf, *p;
+	uint32_t n, msecs, last_key = 0, size = 0;
+	uint64_t offset, payload = 0;
+	int width, height, rate = 30, interval = 0, compress = 0, ext_frames;
+	int key, opt;
+	size_t npixels, len, packed_size = 0;
+	void *packed = NULL, *data;
+	FILE *raw, *out;
+	double start;
+
+	while ((opt = getopt(argc, argv, "k:r:z")) != -1) {
+		switch (opt) {
+		case 'k':
+			interval = atoi(optarg);
+			break;
+		case 'r':
+			rate = atoi(optarg);
+			break;
+		case 'z':
+			compress = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (argc - optind != 3 || rate <= 0 || interval < 0 ||
+	    !parse_size(argv[optind], &width, &height))
+		usage();
+
+	if (compress && !wcap_compress_codec()) {
+		fprintf(stderr, "no compression in this build\n");
+		return EXIT_FAILURE;
+	}
+
+	raw = strcmp(argv[optind + 1], "-") ? fopen(argv[optind + 1], "rb") : stdin;
+	out = strcmp(argv[optind + 2], "-") ? fopen(argv[optind + 2], "wb") : stdout;
+	if (!raw || !out) {
+		fprintf(stderr, "could not open input or output\n");
+		return EXIT_FAILURE;
+	}
+
+	npixels = (size_t) width * height;
+	in = calloc(npixels, 4);
+	prev = calloc(npixels, 4);
+	shadow = calloc(npixels, 4);
+	buf = malloc(npixels * 4);
+	if (compress) {
+		compressor = wcap_compressor_create();
+		packed_size = wcap_compress_bound(npixels * 4);
+		packed = malloc(packed_size);
+	}
+	if (!in || !prev || !shadow || !buf ||
+	    (compress && (!compressor || !packed))) {
+		fprintf(stderr, "out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	/* Compression needs the flags of the extended frame headers */
+	ext_frames = interval || compress;
+
+	header.magic = ext_frames ? WCAP_HEADER_MAGIC_EXT : WCAP_HEADER_MAGIC;
+	header.format = WCAP_FORMAT_XBGR8888;
+	header.width = width;
+	header.height = height;
+	ext.flags = WCAP_HEADER_KEYFRAMES;
+	ext.reserved = 0;
+
+	fwrite(&header, sizeof header, 1, out);
+	offset = sizeof header;
+	if (ext_frames) {
+		fwrite(&ext, sizeof ext, 1, out);
+		offset += sizeof ext;
+	}
+
+	start = now();
+
+	for (n = 0; fread(in, 4, npixels, raw) == npixels; n++) {
+		msecs = (uint64_t) n * 1000 / rate;
+		key = ext_frames &&
+		      (n == 0 || (interval && msecs - last_key >= interval * 1000));
+
+		/* Only the band of rows that changed, like the
+		 * damage the recorder reads back */
+		rect.x1 = 0;
+		rect.x2 = width;
+		rect.y1 = 0;
+		rect.y2 = height;
+		if (!key && n > 0) {
+			while (rect.y1 < height &&
+			       !memcmp(in + rect.y1 * width,
+				       prev + rect.y1 * width, width * 4))
+				rect.y1++;
+			while (rect.y2 > rect.y1 &&
+			       !memcmp(in + (rect.y2 - 1) * width,
+				       prev + (rect.y2 - 1) * width, width * 4))
+				rect.y2--;
+		}
+
+		if (key) {
+			memset(shadow, 0, npixels * 4);
+			last_key = msecs;
+		}
+
+		p = buf;
+		if (rect.y1 < rect.y2) {
+			wcap_corpus_pack_rectangle(buf, in, width, &rect);
+			p = wcap_encode_rectangle(buf, buf, shadow, width, &rect);
+		}
+
+		data = buf;
+		len = (p - buf) * 4;
+		if (compressor) {
+			size_t packed_len = wcap_compress(compressor, packed,
+							  packed_size, buf, len);
+
+			if (packed_len) {
+				data = packed;
+				len = packed_len;
+			}
+		}
+
+		if (ext_frames) {
+			if (n == size) {
+				size = size ? size * 2 : 1024;
+				index = realloc(index, size * sizeof *index);
+				if (!index) {
+					fprintf(stderr, "out of memory\n");
+					return EXIT_FAILURE;
+				}
+			}
+			index[n].msecs = msecs;
+			index[n].flags = key ? WCAP_FRAME_KEYFRAME : 0;
+			index[n].offset = offset;
+
+			fh.msecs = msecs;
+			fh.flags = index[n].flags;
+			if (data == packed)
+				fh.flags |= wcap_compress_codec();
+			fh.nrects = rect.y1 < rect.y2;
+			fh.size = len;
+			fwrite(&fh, sizeof fh, 1, out);
+			offset += sizeof fh;
+		} else {
+			legacy.msecs = msecs;
+			legacy.nrects = rect.y1 < rect.y2;
+			fwrite(&legacy, sizeof legacy, 1, out);
+			offset += sizeof legacy;
+		}
+
+		if (rect.y1 < rect.y2) {
+			fwrite(&rect, sizeof rect, 1, out);
+			offset += sizeof rect;
+		}
+		fwrite(data, 1, len, out);
+		offset += len;
+		payload += len;
+
+		tmp = prev;
+		prev = in;
+		in = tmp;
+	}
+
+	if (ext_frames) {
+		trailer.offset = offset;
+		trailer.count = n;
+		trailer.magic = WCAP_INDEX_MAGIC;
+		fwrite(index, sizeof *index, n, out);
+		fwrite(&trailer, sizeof trailer, 1, out);
+	}
+
+	if (fflush(out) || ferror(out)) {
+		fprintf(stderr, "write error\n");
+		return EXIT_FAILURE;
+	}
+
+	fprintf(stderr, "%u frames, %.1f MB of runs, %.1f MB/s (%s, %s)\n",
+		n, payload / 1e6,
+		(double) n * npixels * 4 / 1e6 / (now() - start),
+		wcap_encode_kernel(),
+		wcap_compress_name(compressor ? wcap_compress_codec() : 0));
+
+	if (raw != stdin)
+		fclose(raw);
+	if (out != stdout)
+		fclose(out);
+	free(index);
+	free(in);
+	free(prev);
+	free(shadow);
+	free(buf);
+	free(packed);
+	wcap_compressor_destroy(compressor);
+
+	return EXIT_SUCCESS;
+}
+
+static int
+decode(int argc, char **argv)
+{
+	struct wcap_decoder *decoder;
+	int rate = 30, threads = nprocs(), frames, opt;
+	FILE *out;
+	double start;
+
+	while ((opt = getopt(argc, argv, "r:vj:")) != -1) {
+		switch (opt) {
+		case 'r':
+			rate = atoi(optarg);
+			if (rate <= 0)
+				usage();
+			break;
+		case 'v':
+			rate = WCAP_RATE_VARIABLE;
+			break;
+		case 'j':
+			threads = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (argc - optind < 1 || argc - optind > 2 ||
+	    rate < 0 || rate > 1000 || threads <= 0)
+		usage();
+
+	decoder = wcap_decoder_create(argv[optind]);
+	if (!decoder) {
+		fprintf(stderr, "could not open %s\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+
+	out = argc - optind == 1 || !strcmp(argv[optind + 1], "-") ?
+	      stdout : fopen(argv[optind + 1], "wb");
+	if (!out) {
+		fprintf(stderr, "could not open %s\n", argv[optind + 1]);
+		return EXIT_FAILURE;
+	}
+
+	start = now();
+	frames = wcap_y4m_transcode(decoder, argv[optind], out, rate,
+				    threads, NULL);
+	if (fflush(out) || frames < 0) {
+		fprintf(stderr, "write error\n");
+		return EXIT_FAILURE;
+	}
+
+	fprintf(stderr, "%dx%d, %d frames, %.1f fps with %d threads\n",
+		decoder->width, decoder->height, frames,
+		frames / (now() - start), threads);
+
+	if (out != stdout)
+		fclose(out);
+	wcap_decoder_destroy(decoder);
+
+	return EXIT_SUCCESS;
+}
+
+static int
+stats(int argc, char **argv)
+{
+	struct wcap_decoder *decoder;
+	struct wcap_rectangle *rects;
+	uint32_t i, nrects, keyframes = 0, compressed = 0, codec = 0;
+	uint32_t first = 0, last = 0;
+	uint64_t pixels = 0, bytes = 0, total_rects = 0;
+	size_t header_size;
+	char *p;
+	double start, secs;
+
+	if (argc != 2)
+		usage();
+
+	decoder = wcap_decoder_create(argv[1]);
+	if (!decoder) {
+		fprintf(stderr, "could not open %s\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	header_size = decoder->flags & WCAP_HEADER_KEYFRAMES ?
+		      sizeof (struct wcap_frame_header_ext) :
+		      sizeof (struct wcap_frame_header);
+
+	start = now();
+	for (;;) {
+		p = decoder->p;
+		if (!wcap_decoder_get_frame(decoder))
+			break;
+
+		if (decoder->flags & WCAP_HEADER_KEYFRAMES)
+			nrects = ((struct wcap_frame_header_ext *) p)->nrects;
+		else
+			nrects = ((struct wcap_frame_header *) p)->nrects;
+		rects = (struct wcap_rectangle *) (p + header_size);
+
+		for (i = 0; i < nrects; i++)
+			pixels += (uint64_t) (rects[i].x2 - rects[i].x1) *
+				  (rects[i].y2 - rects[i].y1);
+		total_rects += nrects;
+		bytes += (char *) decoder->p - p - header_size -
+			 nrects * sizeof *rects;
+
+		if (decoder->frame_flags & WCAP_FRAME_KEYFRAME)
+			keyframes++;
+		if (decoder->frame_flags & WCAP_FRAME_COMPRESSED) {
+			codec = decoder->frame_flags & WCAP_FRAME_COMPRESSED;
+			compressed++;
+		}
+		if (decoder->count == 1)
+			first = decoder->msecs;
+		last = decoder->msecs;
+	}
+	secs = now() - start;
+
+	printf("size:        %dx%d\n", decoder->width, decoder->height);
+	printf("format:      %.4s\n", (char *) &decoder->format);
+	printf("container:   %s\n", decoder->flags & WCAP_HEADER_KEYFRAMES ?
+	       "keyframes and index" : "original");
+	printf("frames:      %u\n", decoder->count);
+	printf("keyframes:   %u\n", keyframes);
+	printf("compressed:  %u frames (%s)\n", compressed,
+	       wcap_compress_name(codec));
+	printf("duration:    %.2f s\n", (last - first) / 1000.0);
+	printf("rectangles:  %.1f per frame\n",
+	       decoder->count ? (double) total_rects / decoder->count : 0.0);
+	printf("damage:      %.1f%% of the screen per frame\n",
+	       decoder->count ? 100.0 * pixels / decoder->count /
+	       ((double) decoder->width * decoder->height) : 0.0);
+	printf("run data:    %.1f MB, %.1f:1\n", bytes / 1e6,
+	       bytes ? pixels * 4.0 / bytes : 0.0);
+	printf("decode:      %.1f MB/s of damaged pixels\n",
+	       secs > 0 ? pixels * 4 / 1e6 / secs : 0.0);
+
+	wcap_decoder_destroy(decoder);
+
+	return EXIT_SUCCESS;
+}
+
+/* Frames per second of the YV12 conversion at common output sizes,
+ * threaded against the scalar reference. Each conversion runs for a
+ * quarter of a second on a few frames of the synthetic corpus. */
+static int
+bench_yv12(struct wcap_yuv_pool *pool)
+{
+	static const int sizes[][2] = {
+		{ 1280, 720 }, { 1920, 1080 }, { 2560, 1440 }, { 3840, 2160 }
+	};
+	uint32_t **frames;
+	unsigned char *yuv, *ref_yuv;
+	int width, height, nframes, i, n, failed = 0;
+	size_t yuv_size;
+	double start, fps, fps_c;
+	char size[32];
+
+	for (i = 0; i < sizeof sizes / sizeof sizes[0]; i++) {
+		width = sizes[i][0];
+		height = sizes[i][1];
+		nframes = 4;
+		yuv_size = (size_t) width * height * 3 / 2;
+
+		frames = wcap_corpus_load(NULL, &width, &height, &nframes);
+		yuv = malloc(yuv_size);
+		ref_yuv = malloc(yuv_size);
+		if (!frames || nframes != 4 || !yuv || !ref_yuv) {
+			fprintf(stderr, "out of memory\n");
+			return 1;
+		}
+
+		for (n = 0; n < nframes; n++) {
+			wcap_convert_to_yv12(pool, frames[n], width, height, yuv);
+			wcap_convert_to_yv12_c(frames[n], width, height,
+					       ref_yuv);
+			if (!failed && memcmp(yuv, ref_yuv, yuv_size)) {
+				fprintf(stderr, "yuv mismatch at %dx%d\n",
+					width, height);
+				failed = 1;
+			}
+		}
+
+		start = now();
+		for (n = 0; n < nframes || now() - start < 0.25; n++)
+			wcap_convert_to_yv12(pool, frames[n % nframes],
+					     width, height, yuv);
+		fps = n / (now() - start);
+
+		start = now();
+		for (n = 0; n < nframes || now() - start < 0.25; n++)
+			wcap_convert_to_yv12_c(frames[n % nframes],
+					       width, height, ref_yuv);
+		fps_c = n / (now() - start);
+
+		snprintf(size, sizeof size, "%dx%d:", width, height);
+		printf("yv12 %-10s %6.1f fps (%d threads), %.1f fps scalar\n",
+		       size, fps, nprocs(), fps_c);
+
+		wcap_corpus_free(frames, nframes);
+		free(yuv);
+		free(ref_yuv);
+	}
+
+	return failed;
+}
+
+/* Measure every stage on the corpus, with every encode kernel the CPU
+ * supports, and check the results against the scalar references.
+ * Exits non-zero on any mismatch, make check runs the thorough tests
+ * in wcap-test. */
+static int
+bench(int argc, char **argv)
+{
+	struct wcap_header header;
+	struct wcap_frame_header fh;
+	struct wcap_rectangle rect;
+	struct wcap_decoder *decoder;
+	struct wcap_yuv_pool *pool;
+	uint32_t **frames, **shadows, *src, *stream;
+	uint32_t *p, *q, *r, *out, *end = NULL, *ref_end = NULL;
+	unsigned char *yuv, *ref_yuv;
+	int width = 1920, height = 1080, nframes = 60, n, i, k, opt, failed = 0;
+	int nkernels = wcap_encode_kernel_count();
+	size_t npixels, yuv_size, len = 0, alloc;
+	double start, *t_enc, t_dec, t_yuv = 0, t_yuv_c = 0;
+	double mb;
+
+	while ((opt = getopt(argc, argv, "s:n:")) != -1) {
+		switch (opt) {
+		case 's':
+			if (!parse_size(optarg, &width, &height))
+				usage();
+			break;
+		case 'n':
+			nframes = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (argc - optind > 1 || nframes <= 0)
+		usage();
+
+	frames = wcap_corpus_load(argc - optind ? argv[optind] : NULL,
+				  &width, &height, &nframes);
+	if (!frames || !nframes)
+		return EXIT_FAILURE;
+
+	npixels = (size_t) width * height;
+	yuv_size = npixels * 3 / 2;
+	mb = (double) nframes * npixels * 4 / 1e6;
+
+	shadows = calloc(nkernels, sizeof *shadows);
+	t_enc = calloc(nkernels, sizeof *t_enc);
+	for (k = 0; shadows && k < nkernels; k++)
+		if (!(shadows[k] = calloc(npixels, 4)))
+			break;
+	src = malloc(npixels * 4);
+	q = malloc(npixels * 4);
+	r = malloc(npixels * 4);
+	alloc = nframes * (sizeof fh + sizeof rect + npixels * 4);
+	stream = malloc(alloc);
+	yuv = malloc(yuv_size);
+	ref_yuv = malloc(yuv_size);
+	pool = wcap_yuv_pool_create(nprocs() - 1);
+	if (!shadows || k < nkernels || !t_enc || !src || !q || !r ||
+	    !stream || !yuv || !ref_yuv || !pool) {
+		fprintf(stderr, "out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	rect.x1 = 0;
+	rect.y1 = 0;
+	rect.x2 = width;
+	rect.y2 = height;
+
+	/* Encode with every kernel, each on a shadow of its own, checking
+	 * the output against the scalar kernel. The kernel in use writes
+	 * one stream of frames for the decoder. */
+	for (n = 0; n < nframes; n++) {
+		wcap_corpus_pack_rectangle(src, frames[n], width, &rect);
+
+		fh.msecs = n * 1000 / 30;
+		fh.nrects = 1;
+		memcpy((char *) stream + len, &fh, sizeof fh);
+		len += sizeof fh;
+		memcpy((char *) stream + len, &rect, sizeof rect);
+		len += sizeof rect;
+		p = (uint32_t *) ((char *) stream + len);
+
+		for (k = 0; k < nkernels; k++) {
+			out = k == nkernels - 1 ? p : k ? r : q;
+
+			start = now();
+			end = wcap_encode_rectangle_kernel(k, out, src,
+							   shadows[k], width,
+							   &rect);
+			t_enc[k] += now() - start;
+
+			if (!k)
+				ref_end = end;
+			else if (!failed && (end - out != ref_end - q ||
+					     memcmp(out, q, (end - out) * 4))) {
+				fprintf(stderr, "%s encoder mismatch in "
+					"frame %d\n",
+					wcap_encode_kernel_name(k), n);
+				failed = 1;
+			}
+		}
+
+		len = (char *) end - (char *) stream;
+	}
+
+	/* Decode the stream back and check it reproduces the corpus */
+	header.magic = WCAP_HEADER_MAGIC;
+	header.format = WCAP_FORMAT_XBGR8888;
+	header.width = width;
+	header.height = height;
+	decoder = wcap_decoder_create_stream(&header, 0);
+	if (!decoder) {
+		fprintf(stderr, "out of memory\n");
+		return EXIT_FAILURE;
+	}
+	wcap_decoder_set_data(decoder, stream, len);
+
+	start = now();
+	for (n = 0; wcap_decoder_get_frame(decoder); n++) {
+		for (i = 0; i < npixels && !failed; i++) {
+			if ((decoder->frame[i] ^ frames[n][i]) & 0xffffff) {
+				fprintf(stderr, "decoder mismatch in frame %d\n", n);
+				failed = 1;
+			}
+		}
+	}
+	t_dec = now() - start;
+	if (n != nframes) {
+		fprintf(stderr, "decoded %d of %d frames\n", n, nframes);
+		failed = 1;
+	}
+
+	for (n = 0; n < nframes; n++) {
+		start = now();
+		wcap_convert_to_yv12(pool, frames[n], width, height, yuv);
+		t_yuv += now() - start;
+
+		start = now();
+		wcap_convert_to_yv12_c(frames[n], width, height, ref_yuv);
+		t_yuv_c += now() - start;
+
+		if (!failed && memcmp(yuv, ref_yuv, yuv_size)) {
+			fprintf(stderr, "yuv mismatch in frame %d\n", n);
+			failed = 1;
+		}
+	}
+
+	printf("corpus:      %s, %dx%d, %d frames\n",
+	       argc - optind ? argv[optind] : "synthetic", width, height, nframes);
+	for (k = 0; k < nkernels; k++)
+		printf("encode %-5s %8.1f MB/s%s\n", wcap_encode_kernel_name(k),
+		       mb / t_enc[k], k == nkernels - 1 ? ", in use" : "");
+	printf("runs:        %.1f:1\n",
+	       mb * 1e6 / (len - nframes * (sizeof fh + sizeof rect)));
+	printf("decode:      %8.1f MB/s\n", mb / t_dec);
+	printf("yuv:         %8.1f MB/s (%d threads), %.1f MB/s scalar\n",
+	       mb / t_yuv, nprocs(), mb / t_yuv_c);
+
+	if (bench_yv12(pool))
+		failed = 1;
+
+	printf("%s\n", failed ? "FAILED" : "ok");
+
+	wcap_decoder_destroy(decoder);
+	wcap_yuv_pool_destroy(pool);
+	wcap_corpus_free(frames, nframes);
+	for (k = 0; k < nkernels; k++)
+		free(shadows[k]);
+	free(shadows);
+	free(t_enc);
+	free(src);
+	free(q);
+	free(r);
+	free(stream);
+	free(yuv);
+	free(ref_yuv);
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int
+main(int argc, char **argv)
+{
+	if (argc < 2)
+		usage();
+
+	/* Let getopt see the subcommand as argv[0] */
+	if (!strcmp(argv[1], "encode"))
+		return encode(argc - 1, argv + 1);
+	if (!strcmp(argv[1], "decode"))
+		return decode(argc - 1, argv + 1);
+	if (!strcmp(argv[1], "stats"))
+		return stats(argc - 1, argv + 1);
+	if (!strcmp(argv[1], "bench"))
+		return bench(argc - 1, argv + 1);
+
+	usage();
+	return EXIT_FAILURE;
+}
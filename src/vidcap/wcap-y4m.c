@@ -0,0 +1,620 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "wcap-y4m.h"
+
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+int
+wcap_y4m_write_header(FILE *f, int width, int height, int rate)
+{
+	char *header;
+	int size, ret;
+
+	size = asprintf(&header, "YUV4MPEG2 C420jpeg W%d H%d F%d:%d Ip A0:0\n",
+			width, height, rate, 1);
+	if (size < 0)
+		return 0;
+
+	ret = fwrite(header, 1, size, f);
+	free(header);
+
+	return ret == size;
+}
+
+int
+wcap_y4m_write_frame(FILE *f, const unsigned char *yuv, int size)
+{
+	return fwrite("FRAME\n", 1, 6, f) == 6 &&
+	       fwrite(yuv, 1, size, f) == size;
+}
+
+/* Frames recorded as YUV need no conversion */
+static const unsigned char *
+frame_planes(struct wcap_yuv_pool *pool, struct wcap_decoder *decoder,
+	     unsigned char *out)
+{
+	if (decoder->format == WCAP_FORMAT_I420)
+		return (const unsigned char *) decoder->frame;
+
+	wcap_convert_to_yv12(pool, decoder->frame,
+			     decoder->width, decoder->height, out);
+
+	return out;
+}
+
+static int
+write_header(FILE *f, int width, int height, int rate)
+{
+	if (rate == WCAP_RATE_VARIABLE)
+		return wcap_mkv_write_header(f, width, height);
+	else
+		return wcap_y4m_write_header(f, width, height, rate);
+}
+
+static int
+write_frame(FILE *f, const unsigned char *yuv, int size,
+	    int rate, uint32_t msecs)
+{
+	if (rate == WCAP_RATE_VARIABLE)
+		return wcap_mkv_write_frame(f, yuv, size, msecs);
+	else
+		return wcap_y4m_write_frame(f, yuv, size);
+}
+
+/* Output tick n of a constant rate, exact in the long run */
+static uint32_t
+tick_time(uint32_t t0, int rate, uint64_t n)
+{
+	return t0 + n * 1000 / rate;
+}
+
+static void
+progress(FILE *f, int frames)
+{
+	if (f && (frames % 5) == 0) {
+		fprintf(f, " .");
+		fflush(f);
+	}
+}
+
+int
+wcap_y4m_writer_init(struct wcap_y4m_writer *y, FILE *f,
+		     int width, int height, int rate, int nthreads)
+{
+	y->f = f;
+	y->progress = NULL;
+	y->width = width;
+	y->height = height;
+	y->rate = rate;
+	y->ticks = 0;
+	y->started = 0;
+	y->converted = 0;
+	y->pending = 0;
+	y->frames = 0;
+	y->pool = wcap_yuv_pool_create(nthreads > 1 ? nthreads - 1 : 0);
+	y->out = malloc(width * height * 3 / 2);
+	if (!y->pool || !y->out ||
+	    !write_header(f, width, height, rate)) {
+		if (y->pool)
+			wcap_yuv_pool_destroy(y->pool);
+		free(y->out);
+		return 0;
+	}
+
+	return 1;
+}
+
+void
+wcap_y4m_writer_fini(struct wcap_y4m_writer *y)
+{
+	wcap_yuv_pool_destroy(y->pool);
+	free(y->out);
+}
+
+/* Static stretches repeat the last conversion */
+static const unsigned char *
+writer_planes(struct wcap_y4m_writer *y, struct wcap_decoder *decoder)
+{
+	if (decoder->format == WCAP_FORMAT_I420)
+		return (const unsigned char *) decoder->frame;
+
+	if (!y->converted) {
+		frame_planes(y->pool, decoder, y->out);
+		y->converted = 1;
+	}
+
+	return y->out;
+}
+
+static int
+writer_write_vfr(struct wcap_y4m_writer *y, struct wcap_decoder *decoder,
+		 uint32_t msecs)
+{
+	if (!wcap_mkv_write_frame(y->f, writer_planes(y, decoder),
+				  y->width * y->height * 3 / 2, msecs - y->t0))
+		return 0;
+	progress(y->progress, y->frames++);
+	y->pending = 0;
+
+	return 1;
+}
+
+int
+wcap_y4m_writer_push(struct wcap_y4m_writer *y, struct wcap_decoder *decoder)
+{
+	if (!y->started) {
+		y->t0 = y->next = decoder->msecs;
+		y->started = 1;
+	}
+
+	if (decoder->changed)
+		y->converted = 0;
+
+	if (y->rate == WCAP_RATE_VARIABLE) {
+		if (y->frames && !decoder->changed) {
+			y->last = decoder->msecs;
+			y->pending = 1;
+			return 1;
+		}
+
+		return writer_write_vfr(y, decoder, decoder->msecs);
+	}
+
+	while (decoder->msecs >= y->next) {
+		if (!wcap_y4m_write_frame(y->f, writer_planes(y, decoder),
+					  y->width * y->height * 3 / 2))
+			return 0;
+		progress(y->progress, y->frames++);
+		y->next = tick_time(y->t0, y->rate, ++y->ticks);
+	}
+
+	return 1;
+}
+
+int
+wcap_y4m_writer_finish(struct wcap_y4m_writer *y,
+		       struct wcap_decoder *decoder)
+{
+	/* Repeat the last frame at the end time */
+	if (y->pending)
+		return writer_write_vfr(y, decoder, y->last);
+
+	return 1;
+}
+
+/* Parallel transcoding of a recording with keyframes. The file is split
+ * at its keyframes into segments that decode independently. Worker w
+ * decodes and converts segments w, w + n, w + 2n... into its own bounded
+ * queue of YUV frames, which the writer drains in segment order. The
+ * output ticks of a segment are those that fall after the last frame of
+ * the previous one, so the result matches the sequential resampler.
+ * At a variable rate, segments queue their changed frames instead, plus
+ * the first and last frame of the file. */
+struct segment_job;
+
+struct segment_worker {
+	struct segment_job *job;
+	pthread_t thread;
+	int first;
+	unsigned char **buf;
+	uint32_t *msecs;
+	int *end;
+	int head, count;
+};
+
+struct segment_job {
+	const char *filename;
+	struct wcap_index_entry *index;
+	uint32_t index_count;
+	uint32_t *bounds;
+	int nsegments, nworkers, depth;
+	int width, height, rate;
+	uint32_t t0;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int ready, abort;
+	struct segment_worker *workers;
+};
+
+/* write_segments could not start, nothing was written yet */
+#define SEGMENT_FALLBACK -2
+
+/* Queues stay small, the writer only needs to keep ahead of one worker */
+#define SEGMENT_QUEUE_BYTES (256 << 20)
+#define SEGMENT_QUEUE_MAX 16
+
+static int
+segment_get_slot(struct segment_worker *w)
+{
+	struct segment_job *job = w->job;
+	int slot = -1;
+
+	pthread_mutex_lock(&job->mutex);
+	while (w->count == job->depth && !job->abort)
+		pthread_cond_wait(&job->cond, &job->mutex);
+	if (!job->abort)
+		slot = (w->head + w->count) % job->depth;
+	pthread_mutex_unlock(&job->mutex);
+
+	return slot;
+}
+
+static void
+segment_queue_slot(struct segment_worker *w, int slot, int end,
+		   uint32_t msecs)
+{
+	struct segment_job *job = w->job;
+
+	pthread_mutex_lock(&job->mutex);
+	w->end[slot] = end;
+	w->msecs[slot] = msecs;
+	w->count++;
+	pthread_cond_broadcast(&job->cond);
+	pthread_mutex_unlock(&job->mutex);
+}
+
+static void
+segment_abort(struct segment_job *job)
+{
+	pthread_mutex_lock(&job->mutex);
+	job->abort = 1;
+	pthread_cond_broadcast(&job->cond);
+	pthread_mutex_unlock(&job->mutex);
+}
+
+/* Convert the current frame into a slot, or copy the previous slot
+ * when nothing changed since that was converted */
+static void
+segment_fill_slot(struct segment_worker *w, struct wcap_decoder *decoder,
+		  struct wcap_yuv_pool *pool, int slot, int prev)
+{
+	struct segment_job *job = w->job;
+	size_t size = (size_t) job->width * job->height * 3 / 2;
+
+	if (prev >= 0 && !decoder->changed)
+		memcpy(w->buf[slot], w->buf[prev], size);
+	else if (decoder->format == WCAP_FORMAT_I420)
+		memcpy(w->buf[slot], decoder->frame, size);
+	else
+		wcap_convert_to_yv12(pool, decoder->frame,
+				     job->width, job->height, w->buf[slot]);
+}
+
+static void *
+segment_func(void *data)
+{
+	struct segment_worker *w = data;
+	struct segment_job *job = w->job;
+	struct wcap_decoder *decoder;
+	struct wcap_yuv_pool *pool;
+	uint32_t first, last, next, i;
+	uint64_t tick;
+	int s, slot, prev;
+
+	/* Each worker maps the file and decodes into a frame of its own */
+	decoder = wcap_decoder_create(job->filename);
+	pool = wcap_yuv_pool_create(0);
+	if (!decoder || !pool) {
+		segment_abort(job);
+		goto out;
+	}
+
+	pthread_mutex_lock(&job->mutex);
+	job->ready++;
+	pthread_cond_broadcast(&job->cond);
+	pthread_mutex_unlock(&job->mutex);
+
+	for (s = w->first; s < job->nsegments; s += job->nworkers) {
+		first = job->bounds[s];
+		last = s + 1 < job->nsegments ?
+		       job->bounds[s + 1] : job->index_count;
+
+		/* The first tick after the previous segment */
+		if (first == 0) {
+			tick = 0;
+		} else {
+			tick = ((uint64_t) job->index[first - 1].msecs -
+				job->t0 + 1) * job->rate;
+			tick = (tick + 999) / 1000;
+			if (!wcap_decoder_seek(decoder, job->index[first].msecs) ||
+			    decoder->count != first) {
+				segment_abort(job);
+				goto out;
+			}
+		}
+
+		next = job->rate == WCAP_RATE_VARIABLE ? 0 :
+		       tick_time(job->t0, job->rate, tick);
+		for (i = first, prev = -1;
+		     i < last && wcap_decoder_get_frame(decoder); i++) {
+			if (job->rate == WCAP_RATE_VARIABLE) {
+				if (!decoder->changed && i > 0 &&
+				    i < job->index_count - 1)
+					continue;
+				next = decoder->msecs;
+			} else if (decoder->changed) {
+				prev = -1;
+			}
+
+			while (decoder->msecs >= next) {
+				slot = segment_get_slot(w);
+				if (slot < 0)
+					goto out;
+				segment_fill_slot(w, decoder, pool, slot, prev);
+				segment_queue_slot(w, slot, 0, decoder->msecs);
+				prev = slot;
+				if (job->rate == WCAP_RATE_VARIABLE)
+					break;
+				next = tick_time(job->t0, job->rate, ++tick);
+			}
+		}
+
+		slot = segment_get_slot(w);
+		if (slot < 0)
+			goto out;
+		segment_queue_slot(w, slot, 1, 0);
+	}
+
+out:
+	if (pool)
+		wcap_yuv_pool_destroy(pool);
+	if (decoder)
+		wcap_decoder_destroy(decoder);
+
+	return NULL;
+}
+
+/* Returns SEGMENT_FALLBACK when the workers could not be set up, the
+ * output is only written once all of them have opened the file. */
+static int
+write_segments(struct wcap_decoder *decoder, const char *filename,
+	       FILE *f, int rate, int nthreads, FILE *out)
+{
+	struct segment_job job;
+	struct segment_worker *w;
+	int i, j, s, size, slot, end, abort, frames = 0, started = 0;
+
+	size = decoder->width * decoder->height * 3 / 2;
+
+	memset(&job, 0, sizeof (job));
+	job.filename = filename;
+	job.index = decoder->index;
+	job.index_count = decoder->index_count;
+	job.width = decoder->width;
+	job.height = decoder->height;
+	job.rate = rate;
+	job.t0 = decoder->index[0].msecs;
+
+	/* Frames before the first keyframe decode from the start */
+	job.bounds = malloc((decoder->index_count + 1) * sizeof (uint32_t));
+	if (!job.bounds)
+		return SEGMENT_FALLBACK;
+	job.bounds[job.nsegments++] = 0;
+	for (i = 1; i < decoder->index_count; i++)
+		if (decoder->index[i].flags & WCAP_FRAME_KEYFRAME)
+			job.bounds[job.nsegments++] = i;
+
+	job.nworkers = MIN (nthreads, job.nsegments);
+	job.depth = SEGMENT_QUEUE_BYTES / (job.nworkers * size);
+	job.depth = MAX (2, MIN (job.depth, SEGMENT_QUEUE_MAX));
+	job.workers = calloc(job.nworkers, sizeof (struct segment_worker));
+	pthread_mutex_init(&job.mutex, NULL);
+	pthread_cond_init(&job.cond, NULL);
+
+	if (!job.workers) {
+		frames = SEGMENT_FALLBACK;
+		goto out;
+	}
+
+	for (i = 0; i < job.nworkers; i++) {
+		w = &job.workers[i];
+		w->job = &job;
+		w->first = i;
+		w->buf = calloc(job.depth, sizeof (unsigned char *));
+		w->end = calloc(job.depth, sizeof (int));
+		w->msecs = calloc(job.depth, sizeof (uint32_t));
+		for (j = 0; w->buf && j < job.depth; j++)
+			if (!(w->buf[j] = malloc(size)))
+				break;
+		if (!w->end || !w->msecs || !w->buf || j < job.depth) {
+			frames = SEGMENT_FALLBACK;
+			goto out;
+		}
+	}
+
+	for (started = 0; started < job.nworkers; started++)
+		if (pthread_create(&job.workers[started].thread, NULL,
+				   segment_func, &job.workers[started]))
+			break;
+
+	pthread_mutex_lock(&job.mutex);
+	while (started == job.nworkers && job.ready < job.nworkers &&
+	       !job.abort)
+		pthread_cond_wait(&job.cond, &job.mutex);
+	abort = job.abort;
+	pthread_mutex_unlock(&job.mutex);
+
+	if (started < job.nworkers || abort) {
+		frames = SEGMENT_FALLBACK;
+		goto out;
+	}
+
+	if (!write_header(f, job.width, job.height, rate)) {
+		frames = -1;
+		goto out;
+	}
+
+	for (s = 0; s < job.nsegments && frames >= 0; ) {
+		w = &job.workers[s % job.nworkers];
+
+		pthread_mutex_lock(&job.mutex);
+		while (!w->count && !job.abort)
+			pthread_cond_wait(&job.cond, &job.mutex);
+		slot = w->count ? w->head : -1;
+		pthread_mutex_unlock(&job.mutex);
+
+		if (slot < 0) {
+			frames = -1;
+			break;
+		}
+
+		end = w->end[slot];
+		if (!end) {
+			if (!write_frame(f, w->buf[slot], size, rate,
+					 w->msecs[slot] - job.t0)) {
+				frames = -1;
+				break;
+			}
+			progress(out, frames++);
+		}
+
+		pthread_mutex_lock(&job.mutex);
+		w->head = (w->head + 1) % job.depth;
+		w->count--;
+		pthread_cond_broadcast(&job.cond);
+		pthread_mutex_unlock(&job.mutex);
+
+		if (end)
+			s++;
+	}
+
+out:
+	segment_abort(&job);
+	for (i = 0; i < started; i++)
+		pthread_join(job.workers[i].thread, NULL);
+
+	for (i = 0; job.workers && i < job.nworkers; i++) {
+		w = &job.workers[i];
+		for (j = 0; w->buf && j < job.depth; j++)
+			free(w->buf[j]);
+		free(w->buf);
+		free(w->end);
+		free(w->msecs);
+	}
+	free(job.workers);
+	free(job.bounds);
+	pthread_mutex_destroy(&job.mutex);
+	pthread_cond_destroy(&job.cond);
+
+	return frames;
+}
+
+static int
+write_sequential(struct wcap_decoder *decoder, FILE *f, int rate,
+		 int nthreads, FILE *out)
+{
+	struct wcap_y4m_writer y4m;
+	int frames;
+
+	if (!wcap_y4m_writer_init(&y4m, f, decoder->width, decoder->height,
+				  rate, nthreads))
+		return -1;
+	y4m.progress = out;
+
+	while (wcap_decoder_get_frame(decoder)) {
+		if (!wcap_y4m_writer_push(&y4m, decoder)) {
+			wcap_y4m_writer_fini(&y4m);
+			return -1;
+		}
+	}
+
+	if (!wcap_y4m_writer_finish(&y4m, decoder)) {
+		wcap_y4m_writer_fini(&y4m);
+		return -1;
+	}
+
+	frames = y4m.frames;
+	wcap_y4m_writer_fini(&y4m);
+
+	return frames;
+}
+
+/* Segments seek to their keyframe by time, so only split a file whose
+ * index points at the frames it describes, in order, and gives each
+ * keyframe a time of its own. Returns the number of keyframes. */
+static uint32_t
+index_keyframes(struct wcap_decoder *decoder)
+{
+	struct wcap_index_entry *e, *prev = NULL, *key = NULL;
+	struct wcap_frame_header_ext *header;
+	size_t start, end;
+	uint32_t i, keyframes = 0;
+
+	start = (char *) decoder->start - (char *) decoder->map;
+	end = (char *) decoder->end - (char *) decoder->map;
+
+	for (i = 0; i < decoder->index_count; i++) {
+		e = &decoder->index[i];
+		if (e->offset & 3 || e->offset + sizeof *header > end ||
+		    (!prev && e->offset != start) ||
+		    (prev && (e->offset <= prev->offset ||
+			      e->msecs < prev->msecs)))
+			return 0;
+
+		if (e->flags & WCAP_FRAME_KEYFRAME) {
+			header = (void *) ((char *) decoder->map + e->offset);
+			if (header->msecs != e->msecs ||
+			    header->flags != e->flags ||
+			    (key && key->msecs == e->msecs))
+				return 0;
+			key = e;
+			keyframes++;
+		}
+		prev = e;
+	}
+
+	return keyframes;
+}
+
+int
+wcap_y4m_transcode(struct wcap_decoder *decoder, const char *filename,
+		   FILE *f, int rate, int nthreads, FILE *progress)
+{
+	int frames;
+
+	/* Anything the segments cannot handle decodes in one pass */
+	if (nthreads > 1 && index_keyframes(decoder) > 1) {
+		frames = write_segments(decoder, filename, f, rate,
+					nthreads, progress);
+		if (frames != SEGMENT_FALLBACK)
+			return frames;
+	}
+
+	return write_sequential(decoder, f, rate, nthreads, progress);
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _WCAP_Y4M_
+#define _WCAP_Y4M_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "wcap-decode.h"
+#include "wcap-mkv.h"
+#include "wcap-yuv.h"
+
+/* Instead of a constant output rate: only frames that changed pixels
+ * are written, with their own timestamps, to a Matroska stream */
+#define WCAP_RATE_VARIABLE 0
+
+int wcap_y4m_write_header(FILE *f, int width, int height, int rate);
+int wcap_y4m_write_frame(FILE *f, const unsigned char *yuv, int size);
+
+/* Resamples decoded frames to a constant rate Y4M stream: each output
+ * tick shows the first frame captured at or after it. A frame is only
+ * converted once however many ticks repeat it. At WCAP_RATE_VARIABLE,
+ * frames without changes are left out instead. Dots are printed to
+ * progress, when set, as frames go out. */
+struct wcap_y4m_writer {
+	FILE *f, *progress;
+	struct wcap_yuv_pool *pool;
+	unsigned char *out;
+	int width, height;
+	int rate;
+	uint64_t ticks;
+	uint32_t t0, next, last;
+	int started, converted, pending;
+	int frames;
+};
+
+int wcap_y4m_writer_init(struct wcap_y4m_writer *y, FILE *f,
+			 int width, int height, int rate, int nthreads);
+void wcap_y4m_writer_fini(struct wcap_y4m_writer *y);
+
+/* Call after every decoded frame. Returns 0 when writing fails. */
+int wcap_y4m_writer_push(struct wcap_y4m_writer *y,
+			 struct wcap_decoder *decoder);
+
+/* Call after the last frame, so a variable rate stream does not end
+ * early when its last frames were left out. Returns 0 when writing
+ * fails. */
+int wcap_y4m_writer_finish(struct wcap_y4m_writer *y,
+			   struct wcap_decoder *decoder);
+
+/* Transcode the whole file decoder was created from. Recordings with
+ * keyframes are decoded in parallel segments by nthreads workers that
+ * each open filename again. Returns the number of frames written, or
+ * -1 on failure. */
+int wcap_y4m_transcode(struct wcap_decoder *decoder, const char *filename,
+		       FILE *f, int rate, int nthreads, FILE *progress);
+
+#endif
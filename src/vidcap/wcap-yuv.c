@@ -0,0 +1,403 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "wcap-yuv.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WCAP_X86_KERNELS
+#include <emmintrin.h>
+#endif
+
+struct wcap_yuv_job {
+	const uint32_t *frame;
+	int width, height;
+	unsigned char *out;
+};
+
+struct wcap_yuv_pool {
+	pthread_mutex_t mutex;
+	pthread_cond_t start, done;
+	pthread_t *threads;
+	int nthreads, nbands;
+	unsigned int generation;
+	int pending;
+	int next_band;
+	int quit;
+	struct wcap_yuv_job job;
+};
+
+typedef void (*wcap_convert_rows_func)(const uint32_t *p1,
+				       const uint32_t *p2,
+				       unsigned char *y1, unsigned char *y2,
+				       unsigned char *u, unsigned char *v,
+				       int width);
+
+static inline int
+rgb_to_yuv(uint32_t p, int *u, int *v)
+{
+	int r, g, b, y;
+
+	r = (p >> 0) & 0xff;
+	g = (p >> 8) & 0xff;
+	b = (p >> 16) & 0xff;
+
+	y = (19595 * r + 38469 * g + 7472 * b) >> 16;
+	if (y > 255)
+		y = 255;
+
+	*u += 46727 * (r - y);
+	*v += 36962 * (b - y);
+
+	return y;
+}
+
+static inline
+int clamp_uv(int u)
+{
+	int clamp = (u >> 18) + 128;
+
+	if (clamp < 0)
+		return 0;
+	else if (clamp > 255)
+		return 255;
+	else
+		return clamp;
+}
+
+static void
+convert_rows_c(const uint32_t *p1, const uint32_t *p2,
+	       unsigned char *y1, unsigned char *y2,
+	       unsigned char *u, unsigned char *v, int width)
+{
+	const uint32_t *end = p1 + width;
+	int u_accum, v_accum;
+
+	while (p1 < end) {
+		u_accum = 0;
+		v_accum = 0;
+		y1[0] = rgb_to_yuv(p1[0], &u_accum, &v_accum);
+		y1[1] = rgb_to_yuv(p1[1], &u_accum, &v_accum);
+		y2[0] = rgb_to_yuv(p2[0], &u_accum, &v_accum);
+		y2[1] = rgb_to_yuv(p2[1], &u_accum, &v_accum);
+		u[0] = clamp_uv(u_accum);
+		v[0] = clamp_uv(v_accum);
+
+		y1 += 2;
+		p1 += 2;
+		y2 += 2;
+		p2 += 2;
+		u++;
+		v++;
+	}
+}
+
+#ifdef WCAP_X86_KERNELS
+
+/* Luma of four pixels. 38469 does not fit a signed 16 bit multiplier,
+ * so g is weighted by 32768 with a shift and by 5701 in the madd. */
+__attribute__((target("sse2")))
+static inline __m128i
+luma4(__m128i p)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i coeff = _mm_setr_epi16(19595, 5701, 7472, 0,
+					     19595, 5701, 7472, 0);
+	__m128i lo, hi, g;
+	__m128 even, odd;
+
+	lo = _mm_madd_epi16(_mm_unpacklo_epi8(p, zero), coeff);
+	hi = _mm_madd_epi16(_mm_unpackhi_epi8(p, zero), coeff);
+	even = _mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi),
+			      _MM_SHUFFLE(2, 0, 2, 0));
+	odd = _mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi),
+			     _MM_SHUFFLE(3, 1, 3, 1));
+
+	g = _mm_and_si128(_mm_srli_epi32(p, 8), _mm_set1_epi32(0xff));
+
+	return _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(
+				_mm_castps_si128(even), _mm_castps_si128(odd)),
+				_mm_slli_epi32(g, 15)), 16);
+}
+
+/* Sum horizontally adjacent lanes: [a0+a1, a2+a3, b0+b1, b2+b3] */
+__attribute__((target("sse2")))
+static inline __m128i
+pair_sum(__m128i a, __m128i b)
+{
+	__m128 even, odd;
+
+	even = _mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b),
+			      _MM_SHUFFLE(2, 0, 2, 0));
+	odd = _mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b),
+			     _MM_SHUFFLE(3, 1, 3, 1));
+
+	return _mm_add_epi32(_mm_castps_si128(even), _mm_castps_si128(odd));
+}
+
+/* k * d for |d| < 32768 and 32768 <= k < 65536, split the same way */
+__attribute__((target("sse2")))
+static inline __m128i
+scale_chroma(__m128i d, int k)
+{
+	return _mm_add_epi32(_mm_slli_epi32(d, 15),
+			     _mm_madd_epi16(d, _mm_set1_epi32(k - 32768)));
+}
+
+/* Eight columns of two rows per iteration, which yields four chroma
+ * samples. The chroma sums are the per-block sums of r - y and b - y,
+ * scaled once, which is exactly what the scalar accumulation computes. */
+__attribute__((target("sse2")))
+static void
+convert_rows_sse2(const uint32_t *p1, const uint32_t *p2,
+		  unsigned char *y1, unsigned char *y2,
+		  unsigned char *u, unsigned char *v, int width)
+{
+	const __m128i mask = _mm_set1_epi32(0xff);
+	const __m128i bias = _mm_set1_epi32(128);
+	__m128i a1, b1, a2, b2, ya1, yb1, ya2, yb2, ys, rs, bs, t;
+	int k, c;
+
+	for (k = 0; k + 8 <= width; k += 8) {
+		a1 = _mm_loadu_si128((const __m128i *) (p1 + k));
+		b1 = _mm_loadu_si128((const __m128i *) (p1 + k + 4));
+		a2 = _mm_loadu_si128((const __m128i *) (p2 + k));
+		b2 = _mm_loadu_si128((const __m128i *) (p2 + k + 4));
+
+		ya1 = luma4(a1);
+		yb1 = luma4(b1);
+		ya2 = luma4(a2);
+		yb2 = luma4(b2);
+
+		t = _mm_packs_epi32(ya1, yb1);
+		_mm_storel_epi64((__m128i *) (y1 + k), _mm_packus_epi16(t, t));
+		t = _mm_packs_epi32(ya2, yb2);
+		_mm_storel_epi64((__m128i *) (y2 + k), _mm_packus_epi16(t, t));
+
+		ys = pair_sum(_mm_add_epi32(ya1, ya2), _mm_add_epi32(yb1, yb2));
+		rs = pair_sum(_mm_add_epi32(_mm_and_si128(a1, mask),
+					    _mm_and_si128(a2, mask)),
+			      _mm_add_epi32(_mm_and_si128(b1, mask),
+					    _mm_and_si128(b2, mask)));
+		bs = pair_sum(_mm_add_epi32(
+				_mm_and_si128(_mm_srli_epi32(a1, 16), mask),
+				_mm_and_si128(_mm_srli_epi32(a2, 16), mask)),
+			      _mm_add_epi32(
+				_mm_and_si128(_mm_srli_epi32(b1, 16), mask),
+				_mm_and_si128(_mm_srli_epi32(b2, 16), mask)));
+
+		t = _mm_add_epi32(_mm_srai_epi32(
+			scale_chroma(_mm_sub_epi32(rs, ys), 46727), 18), bias);
+		t = _mm_packs_epi32(t, t);
+		c = _mm_cvtsi128_si32(_mm_packus_epi16(t, t));
+		memcpy(u + k / 2, &c, 4);
+
+		t = _mm_add_epi32(_mm_srai_epi32(
+			scale_chroma(_mm_sub_epi32(bs, ys), 36962), 18), bias);
+		t = _mm_packs_epi32(t, t);
+		c = _mm_cvtsi128_si32(_mm_packus_epi16(t, t));
+		memcpy(v + k / 2, &c, 4);
+	}
+
+	convert_rows_c(p1 + k, p2 + k, y1 + k, y2 + k, u + k / 2, v + k / 2,
+		       width - k);
+}
+
+#endif
+
+static wcap_convert_rows_func convert_rows;
+
+static void
+select_kernel(void)
+{
+	wcap_convert_rows_func func = convert_rows_c;
+
+#ifdef WCAP_X86_KERNELS
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+		func = convert_rows_sse2;
+#endif
+
+	convert_rows = func;
+}
+
+static void
+convert_band(wcap_convert_rows_func rows, const struct wcap_yuv_job *job,
+	     int first, int last)
+{
+	unsigned char *y1, *y2, *u, *v;
+	const uint32_t *p1, *p2;
+	int i, stride0, stride1, width = job->width, height = job->height;
+
+	stride0 = width;
+	stride1 = width / 2;
+	for (i = first; i < last; i += 2) {
+		y1 = job->out + stride0 * i;
+		y2 = y1 + stride0;
+		v = job->out + stride0 * height + stride1 * i / 2;
+		u = v + stride1 * height / 2;
+		p1 = job->frame + width * i;
+		p2 = p1 + width;
+
+		(*rows)(p1, p2, y1, y2, u, v, width);
+	}
+}
+
+/* Row pairs are split evenly, band n of nbands starts at an even row */
+static void
+convert_job_band(struct wcap_yuv_pool *pool, int band)
+{
+	int pairs = (pool->job.height + 1) / 2;
+
+	convert_band(convert_rows, &pool->job,
+		     2 * (pairs * band / pool->nbands),
+		     2 * (pairs * (band + 1) / pool->nbands));
+}
+
+static void *
+worker_func(void *data)
+{
+	struct wcap_yuv_pool *pool = data;
+	unsigned int generation = 0;
+	int band;
+
+	pthread_mutex_lock(&pool->mutex);
+	for (;;) {
+		while (pool->generation == generation && !pool->quit)
+			pthread_cond_wait(&pool->start, &pool->mutex);
+		if (pool->quit)
+			break;
+		generation = pool->generation;
+
+		while (pool->next_band < pool->nbands) {
+			band = pool->next_band++;
+			pthread_mutex_unlock(&pool->mutex);
+			convert_job_band(pool, band);
+			pthread_mutex_lock(&pool->mutex);
+			if (--pool->pending == 0)
+				pthread_cond_signal(&pool->done);
+		}
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+struct wcap_yuv_pool *
+wcap_yuv_pool_create(int nthreads)
+{
+	struct wcap_yuv_pool *pool;
+	int i;
+
+	if (!convert_rows)
+		select_kernel();
+
+	pool = calloc(1, sizeof *pool);
+	if (!pool)
+		return NULL;
+
+	pool->threads = calloc(nthreads ? nthreads : 1, sizeof (pthread_t));
+	if (!pool->threads) {
+		free(pool);
+		return NULL;
+	}
+
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&pool->threads[i], NULL, worker_func, pool))
+			break;
+	}
+	pool->nthreads = i;
+
+	/* A few bands per thread keep the cores busy when some
+	 * bands convert faster than others */
+	pool->nbands = (pool->nthreads + 1) * 4;
+
+	return pool;
+}
+
+void
+wcap_yuv_pool_destroy(struct wcap_yuv_pool *pool)
+{
+	int i;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < pool->nthreads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	pthread_mutex_destroy(&pool->mutex);
+	pthread_cond_destroy(&pool->start);
+	pthread_cond_destroy(&pool->done);
+	free(pool->threads);
+	free(pool);
+}
+
+void
+wcap_convert_to_yv12(struct wcap_yuv_pool *pool, const uint32_t *frame,
+		     int width, int height, unsigned char *out)
+{
+	int band;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->job.frame = frame;
+	pool->job.width = width;
+	pool->job.height = height;
+	pool->job.out = out;
+	pool->next_band = 0;
+	pool->pending = pool->nbands;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->start);
+
+	while (pool->next_band < pool->nbands) {
+		band = pool->next_band++;
+		pthread_mutex_unlock(&pool->mutex);
+		convert_job_band(pool, band);
+		pthread_mutex_lock(&pool->mutex);
+		pool->pending--;
+	}
+
+	while (pool->pending)
+		pthread_cond_wait(&pool->done, &pool->mutex);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+void
+wcap_convert_to_yv12_c(const uint32_t *frame, int width, int height,
+		       unsigned char *out)
+{
+	struct wcap_yuv_job job = { frame, width, height, out };
+
+	convert_band(convert_rows_c, &job, 0, height);
+}
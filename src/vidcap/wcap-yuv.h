@@ -0,0 +1,46 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _WCAP_YUV_
+#define _WCAP_YUV_
+
+#include <stdint.h>
+
+struct wcap_yuv_pool;
+
+/* Worker pool splitting the conversion into bands of rows. The calling
+ * thread converts one band itself, so nthreads may be 0. */
+struct wcap_yuv_pool *wcap_yuv_pool_create(int nthreads);
+void wcap_yuv_pool_destroy(struct wcap_yuv_pool *pool);
+
+/* Convert an XBGR frame to planar YUV 4:2:0 (Y, then V, then U) */
+void wcap_convert_to_yv12(struct wcap_yuv_pool *pool, const uint32_t *frame,
+			  int width, int height, unsigned char *out);
+
+/* Single threaded scalar reference */
+void wcap_convert_to_yv12_c(const uint32_t *frame, int width, int height,
+			    unsigned char *out);
+
+#endif
@@ -34,6 +34,7 @@
 #include <X11/extensions/shape.h>
 
 #include <compiz-core.h>
+#include <compiz-bench.h>
 
 #include "wallpaper_options.h"
 
@@ -60,6 +61,7 @@ typedef struct _WallpaperBackground
 typedef struct _WallpaperDisplay
 {
 	HandleEventProc handleEvent;
+	HandleCompizEventProc handleCompizEvent;
 
 	int screenPrivateIndex;
 
@@ -97,6 +99,30 @@ typedef struct _WallpaperScreen
 
 #define NUM_LIST_OPTIONS 5
 
+static BenchFunc *
+wallpaperGetBenchFunc (CompDisplay *d)
+{
+	int index;
+
+	if (!checkPluginABI ("bench", BENCH_ABIVERSION) ||
+	    !getPluginDisplayIndex (d, "bench", &index))
+		return NULL;
+
+	return d->base.privates[index].ptr;
+}
+
+static void
+reportBackground (CompScreen          *s,
+		  WallpaperBackground *back)
+{
+	BenchFunc *bench = wallpaperGetBenchFunc (s->display);
+
+	if (bench)
+		(*bench->addTexture) (s, &back->imgTex, "wallpaper", back->image,
+				      BENCH_TEXTURE_BYTES (back->width,
+							   back->height));
+}
+
 static Bool
 initBackground (void *object,
 		void *closure)
@@ -156,6 +182,8 @@ initBackground (void *object,
 		}
 		else
 		{
+			reportBackground (s, back);
+
 			back->loaded = TRUE;
 			return TRUE;
 		}
@@ -170,6 +198,10 @@ finiBackground (void *object,
 {
 	CompScreen          *s = (CompScreen *) closure;
 	WallpaperBackground *back = (WallpaperBackground *) object;
+	BenchFunc           *bench = wallpaperGetBenchFunc (s->display);
+
+	if (bench)
+		(*bench->removeTexture) (s, &back->imgTex);
 	
 	finiTexture (s, &back->imgTex);
 	finiTexture (s, &back->fillTex);
@@ -1226,6 +1258,39 @@ wallpaperDamageWindowRect (CompWindow *w,
 	return status;
 }
 
+/* Backgrounds loaded before bench started are reported when it asks */
+static void
+wallpaperHandleCompizEvent (CompDisplay *d,
+			    const char  *pluginName,
+			    const char  *eventName,
+			    CompOption  *option,
+			    int         nOption)
+{
+	WALLPAPER_DISPLAY (d);
+
+	UNWRAP (wd, d, handleCompizEvent);
+	(*d->handleCompizEvent) (d, pluginName, eventName, option, nOption);
+	WRAP (wd, d, handleCompizEvent, wallpaperHandleCompizEvent);
+
+	if (strcmp (pluginName, "bench") == 0 &&
+	    strcmp (eventName, "start") == 0)
+	{
+		CompScreen   *s;
+		unsigned int i;
+
+		s = findScreenAtDisplay (d, getIntOptionNamed (option, nOption,
+							       "root", 0));
+		if (s)
+		{
+			WALLPAPER_SCREEN (s);
+
+			for (i = 0; i < ws->nBackgrounds; i++)
+				if (ws->backgrounds[i].loaded)
+					reportBackground (s, &ws->backgrounds[i]);
+		}
+	}
+}
+
 static Bool
 wallpaperInitDisplay (CompPlugin  *p,
                       CompDisplay *d)
@@ -1251,6 +1316,8 @@ wallpaperInitDisplay (CompPlugin  *p,
 
 	d->base.privates[WallpaperDisplayPrivateIndex].ptr = wd;
 
+	WRAP (wd, d, handleCompizEvent, wallpaperHandleCompizEvent);
+
 	wallpaperSetRecursiveNotify (d, wallpaperRecursiveNotify);
 
 	return TRUE;
@@ -1261,6 +1328,8 @@ static void wallpaperFiniDisplay (CompPlugin  *p,
 {
 	WALLPAPER_DISPLAY (d);
 
+	UNWRAP (wd, d, handleCompizEvent);
+
 	freeScreenPrivateIndex (d, wd->screenPrivateIndex);
 
 	free (wd);